@@ -47,6 +47,7 @@ CREATE TABLE IF NOT EXISTS Characters (
     guild_rank TINYINT UNSIGNED DEFAULT NULL,
     alliance_rank TINYINT UNSIGNED DEFAULT NULL,
     gm TINYINT UNSIGNED NOT NULL DEFAULT 0,
+    version BIGINT UNSIGNED NOT NULL DEFAULT 0, -- Incremented by the triggers below so that cached copies of the character can be validated
     INDEX (account_id, world),
     INDEX (guild_id),
     FOREIGN KEY (account_id) REFERENCES Accounts (id) ON DELETE CASCADE
@@ -152,6 +153,17 @@ CREATE TABLE IF NOT EXISTS EquippedEquipment (
     FOREIGN KEY (equip) REFERENCES CharacterEquipment (id) ON DELETE CASCADE
 );
 
+-- Row IDs of Items, Equipment and CharacterEquipment are handed out from here instead of AUTO_INCREMENT
+-- so that the channel servers can lease them in blocks. `next_id` is the first ID that wasn't leased yet
+CREATE TABLE IF NOT EXISTS IdSequences (
+    name VARCHAR(32) PRIMARY KEY,
+    next_id BIGINT UNSIGNED NOT NULL
+);
+
+INSERT IGNORE INTO IdSequences SELECT 'Items', COALESCE(MAX(id), 0) + 1 FROM Items;
+INSERT IGNORE INTO IdSequences SELECT 'Equipment', COALESCE(MAX(id), 0) + 1 FROM Equipment;
+INSERT IGNORE INTO IdSequences SELECT 'CharacterEquipment', COALESCE(MAX(id), 0) + 1 FROM CharacterEquipment;
+
 CREATE TABLE IF NOT EXISTS Storages (
     id BIGINT UNSIGNED PRIMARY KEY AUTO_INCREMENT,
     account_id INT UNSIGNED,
@@ -27434,3 +27446,110 @@ CREATE TABLE IF NOT EXISTS Keymaps (
     FOREIGN KEY (character_id) REFERENCES Characters (id) ON DELETE CASCADE
 );
 
+-- Every write that changes what GetCharacter returns has to bump Characters.version.
+-- Writes to the row itself and to the storage that the account shares between its characters in a world are caught here.
+-- The per-character tables are only written by do_update_character() in database.c, which always updates the row too
+CREATE TRIGGER CharactersBumpVersion BEFORE UPDATE ON Characters
+    FOR EACH ROW SET NEW.version = OLD.version + 1;
+
+CREATE PROCEDURE BumpStorageVersion(IN storage_id BIGINT UNSIGNED)
+    UPDATE Characters JOIN Storages ON Characters.account_id = Storages.account_id AND Characters.world = Storages.world
+        SET Characters.version = Characters.version + 1 WHERE Storages.id = storage_id;
+
+CREATE TRIGGER StoragesBumpVersion AFTER UPDATE ON Storages
+    FOR EACH ROW UPDATE Characters SET version = version + 1 WHERE account_id = NEW.account_id AND world = NEW.world;
+
+-- Rows removed by ON DELETE CASCADE don't fire triggers, hence the one on StorageSlots
+CREATE TRIGGER StorageSlotsDeleteBumpVersion AFTER DELETE ON StorageSlots
+    FOR EACH ROW CALL BumpStorageVersion(OLD.storage);
+
+CREATE TRIGGER StorageItemsInsertBumpVersion AFTER INSERT ON StorageItems
+    FOR EACH ROW CALL BumpStorageVersion((SELECT storage FROM StorageSlots WHERE id = NEW.slot));
+
+CREATE TRIGGER StorageItemsUpdateBumpVersion AFTER UPDATE ON StorageItems
+    FOR EACH ROW CALL BumpStorageVersion((SELECT storage FROM StorageSlots WHERE id = NEW.slot));
+
+CREATE TRIGGER StorageItemsDeleteBumpVersion AFTER DELETE ON StorageItems
+    FOR EACH ROW CALL BumpStorageVersion((SELECT storage FROM StorageSlots WHERE id = OLD.slot));
+
+CREATE TRIGGER StorageEquipmentInsertBumpVersion AFTER INSERT ON StorageEquipment
+    FOR EACH ROW CALL BumpStorageVersion((SELECT storage FROM StorageSlots WHERE id = NEW.slot));
+
+CREATE TRIGGER StorageEquipmentUpdateBumpVersion AFTER UPDATE ON StorageEquipment
+    FOR EACH ROW CALL BumpStorageVersion((SELECT storage FROM StorageSlots WHERE id = NEW.slot));
+
+CREATE TRIGGER StorageEquipmentDeleteBumpVersion AFTER DELETE ON StorageEquipment
+    FOR EACH ROW CALL BumpStorageVersion((SELECT storage FROM StorageSlots WHERE id = OLD.slot));
+
+-- Returns every result set needed to load a character in a single round-trip.
+-- If the character's version equals `known_version` only the first result set is returned.
+-- The order of the result sets is relied upon by do_get_character() in database.c
+DELIMITER //
+CREATE PROCEDURE GetCharacter(IN chr_id INT UNSIGNED, IN known_version BIGINT UNSIGNED)
+proc: BEGIN
+    DECLARE storage_id BIGINT UNSIGNED DEFAULT NULL;
+    DECLARE current_version BIGINT UNSIGNED DEFAULT NULL;
+
+    -- Read once so that the version that is returned is also the one that the early exit is decided on
+    SELECT version INTO current_version FROM Characters WHERE id = chr_id;
+
+    SELECT account_id, world, name, map, spawn, job, level, exp, max_hp, hp, max_mp, mp,
+        str, dex, int_, luk, hpmp, ap, sp, fame, gender, skin, face, hair, mesos,
+        equip_slots, use_slots, setup_slots, etc_slots, current_version FROM Characters
+        WHERE id = chr_id;
+
+    IF current_version = known_version THEN
+        LEAVE proc;
+    END IF;
+
+    SELECT Storages.id INTO storage_id FROM Storages
+        JOIN Characters ON Storages.account_id = Characters.account_id AND Storages.world = Characters.world
+        WHERE Characters.id = chr_id;
+
+    SELECT CharacterEquipment.id, Equipment.id, Items.id, item_id, flags, owner, level, slots,
+        str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump
+        FROM Items JOIN Equipment ON Items.id = item
+        JOIN CharacterEquipment ON Equipment.id = CharacterEquipment.equip
+        JOIN EquippedEquipment ON CharacterEquipment.id = EquippedEquipment.equip
+        WHERE character_id = chr_id;
+
+    SELECT CharacterEquipment.id, Equipment.id, Items.id, item_id, flags, owner, level, slots,
+        str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump, slot
+        FROM Items JOIN Equipment ON Items.id = item
+        JOIN CharacterEquipment ON Equipment.id = CharacterEquipment.equip
+        JOIN InventoryEquipment ON CharacterEquipment.equip = InventoryEquipment.equip
+        WHERE character_id = chr_id;
+
+    SELECT id, item_id, flags, owner, slot, count
+        FROM InventoryItems JOIN Items ON item = id
+        WHERE character_id = chr_id;
+
+    SELECT id, slots, mesos FROM Storages WHERE id = storage_id;
+
+    SELECT StorageSlots.id, StorageSlots.slot, count, Items.id, item_id, flags, owner
+        FROM StorageItems JOIN Items ON item = id
+        JOIN StorageSlots ON StorageItems.slot = StorageSlots.id
+        WHERE storage = storage_id;
+
+    SELECT StorageSlots.id, StorageSlots.slot, Equipment.id, Items.id, item_id, flags, owner, level, slots,
+        str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump
+        FROM Items JOIN Equipment ON Items.id = item
+        JOIN StorageEquipment ON Equipment.id = equip
+        JOIN StorageSlots ON StorageEquipment.slot = StorageSlots.id
+        WHERE storage = storage_id;
+
+    SELECT quest_id FROM InProgressQuests WHERE character_id = chr_id;
+
+    SELECT quest_id, progress_id, progress FROM Progresses WHERE character_id = chr_id;
+
+    SELECT info_id, progress FROM QuestInfos WHERE character_id = chr_id;
+
+    SELECT quest_id, time FROM CompletedQuests WHERE character_id = chr_id;
+
+    SELECT skill_id, level, master FROM Skills WHERE character_id = chr_id;
+
+    SELECT card_id, quantity FROM MonsterBooks WHERE character_id = chr_id;
+
+    SELECT `key`, type, action FROM Keymaps WHERE character_id = chr_id;
+END//
+DELIMITER ;
@@ -0,0 +1,131 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Size class i holds blocks of 2^(i + ARENA_MIN_CLASS_SHIFT) bytes
+#define ARENA_MIN_CLASS_SHIFT 4
+#define ARENA_SIZE_CLASSES (sizeof(size_t) * 8 - ARENA_MIN_CLASS_SHIFT)
+
+struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+// Precedes every pooled allocation so that arena_pool_free() knows which free list it belongs to
+union PoolHeader {
+    size_t sizeClass;
+    max_align_t align;
+};
+
+struct PoolBlock {
+    struct PoolBlock *next;
+};
+
+struct Arena {
+    size_t chunkSize;
+    struct ArenaChunk *chunks;
+    struct PoolBlock *freeLists[ARENA_SIZE_CLASSES];
+};
+
+static size_t size_class(size_t size);
+
+struct Arena *arena_create(size_t chunk_size)
+{
+    struct Arena *arena = malloc(sizeof(struct Arena));
+    if (arena == NULL)
+        return NULL;
+
+    arena->chunkSize = chunk_size;
+    arena->chunks = NULL;
+    for (size_t i = 0; i < ARENA_SIZE_CLASSES; i++)
+        arena->freeLists[i] = NULL;
+
+    return arena;
+}
+
+void arena_destroy(struct Arena *arena)
+{
+    if (arena == NULL)
+        return;
+
+    struct ArenaChunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        struct ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+void *arena_alloc(struct Arena *arena, size_t size)
+{
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+
+    struct ArenaChunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > arena->chunkSize ? size : arena->chunkSize;
+        struct ArenaChunk *new = malloc(sizeof(struct ArenaChunk) + chunk_size);
+        if (new == NULL)
+            return NULL;
+
+        new->size = chunk_size;
+        new->used = 0;
+
+        // Keep carving from the current chunk if the new one is going to be filled up by this allocation anyway
+        if (chunk != NULL && chunk_size == size) {
+            new->next = chunk->next;
+            chunk->next = new;
+        } else {
+            new->next = chunk;
+            arena->chunks = new;
+        }
+
+        chunk = new;
+    }
+
+    void *ptr = (char *)chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void *arena_pool_alloc(struct Arena *arena, size_t size)
+{
+    size_t class = size_class(size);
+    struct PoolBlock *block = arena->freeLists[class];
+    if (block != NULL) {
+        arena->freeLists[class] = block->next;
+        return block;
+    }
+
+    union PoolHeader *header = arena_alloc(arena, sizeof(union PoolHeader) + ((size_t)1 << (class + ARENA_MIN_CLASS_SHIFT)));
+    if (header == NULL)
+        return NULL;
+
+    header->sizeClass = class;
+    return header + 1;
+}
+
+void arena_pool_free(struct Arena *arena, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    size_t class = ((union PoolHeader *)ptr - 1)->sizeClass;
+    struct PoolBlock *block = ptr;
+    block->next = arena->freeLists[class];
+    arena->freeLists[class] = block;
+}
+
+static size_t size_class(size_t size)
+{
+    size_t class = 0;
+    while (((size_t)1 << (class + ARENA_MIN_CLASS_SHIFT)) < size)
+        class++;
+
+    return class;
+}
+
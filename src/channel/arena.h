@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * A region allocator for data that shares a single lifetime.
+ * Nothing is returned to the system until the arena is destroyed, at which point everything is released at once.
+ */
+struct Arena;
+
+/**
+ * \param chunk_size The size of the blocks the arena carves its allocations from.
+ * Larger allocations get a block of their own.
+ */
+struct Arena *arena_create(size_t chunk_size);
+void arena_destroy(struct Arena *arena);
+
+/**
+ * Allocates \p size bytes suitably aligned for any type.
+ * The memory lives until the arena is destroyed.
+ */
+void *arena_alloc(struct Arena *arena, size_t size);
+
+/**
+ * Like arena_alloc() but the memory can be handed back with arena_pool_free() to be reused by a later allocation.
+ * Allocations are rounded up to a power of two and recycled through a free list per size.
+ */
+void *arena_pool_alloc(struct Arena *arena, size_t size);
+void arena_pool_free(struct Arena *arena, void *ptr);
+
+#endif
+
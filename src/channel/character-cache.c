@@ -0,0 +1,319 @@
+#include "character-cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "../hash-map.h"
+
+// How long a snapshot stays valid after the character logged out
+#define CHARACTER_CACHE_TTL 300
+// Upper bound on the total memory held by snapshots
+#define CHARACTER_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+struct CacheEntry {
+    uint32_t id;
+    uint64_t version;
+    time_t savedAt;
+    size_t size;
+    union DatabaseResult *snapshot;
+    // Least recently inserted entries are at the tail
+    struct CacheEntry *prev;
+    struct CacheEntry *next;
+};
+
+struct CacheNode {
+    uint32_t id;
+    struct CacheEntry *entry;
+};
+
+static mtx_t CACHE_LOCK;
+static struct HashSetU32 *CACHE;
+static struct CacheEntry *HEAD;
+static struct CacheEntry *TAIL;
+static size_t CACHE_SIZE;
+
+static void *dup_array(const void *src, size_t count, size_t size, size_t *total);
+static void unlink_entry(struct CacheEntry *entry);
+static void remove_entry(struct CacheEntry *entry);
+static void evict(time_t now);
+
+int character_cache_init(void)
+{
+    CACHE = hash_set_u32_create(sizeof(struct CacheNode), offsetof(struct CacheNode, id));
+    if (CACHE == NULL)
+        return -1;
+
+    if (mtx_init(&CACHE_LOCK, mtx_plain) != thrd_success) {
+        hash_set_u32_destroy(CACHE);
+        return -1;
+    }
+
+    HEAD = NULL;
+    TAIL = NULL;
+    CACHE_SIZE = 0;
+
+    return 0;
+}
+
+void character_cache_terminate(void)
+{
+    while (TAIL != NULL)
+        remove_entry(TAIL);
+
+    mtx_destroy(&CACHE_LOCK);
+    hash_set_u32_destroy(CACHE);
+}
+
+void character_cache_insert(const struct Character *chr, const struct RequestParams *params, uint64_t version)
+{
+    struct CacheEntry *entry = malloc(sizeof(struct CacheEntry));
+    if (entry == NULL)
+        return;
+
+    union DatabaseResult *snapshot = malloc(sizeof(union DatabaseResult));
+    if (snapshot == NULL) {
+        free(entry);
+        return;
+    }
+
+    size_t size = sizeof(struct CacheEntry) + sizeof(union DatabaseResult);
+
+    // The snapshot has to mirror what is now in the database, so everything that the update wrote
+    // is taken from its parameters and only the columns that it doesn't touch come from `chr`
+    snapshot->getCharacter.accountId = chr->accountId;
+    snapshot->getCharacter.world = chr->world;
+    snapshot->getCharacter.nameLength = chr->nameLength;
+    memcpy(snapshot->getCharacter.name, chr->name, chr->nameLength);
+    snapshot->getCharacter.map = params->updateCharacter.map;
+    snapshot->getCharacter.spawnPoint = params->updateCharacter.spawnPoint;
+    snapshot->getCharacter.job = params->updateCharacter.job;
+    snapshot->getCharacter.level = params->updateCharacter.level;
+    snapshot->getCharacter.exp = params->updateCharacter.exp;
+    snapshot->getCharacter.maxHp = params->updateCharacter.maxHp;
+    snapshot->getCharacter.hp = params->updateCharacter.hp;
+    snapshot->getCharacter.maxMp = params->updateCharacter.maxMp;
+    snapshot->getCharacter.mp = params->updateCharacter.mp;
+    snapshot->getCharacter.str = params->updateCharacter.str;
+    snapshot->getCharacter.dex = params->updateCharacter.dex;
+    snapshot->getCharacter.int_ = params->updateCharacter.int_;
+    snapshot->getCharacter.luk = params->updateCharacter.luk;
+    snapshot->getCharacter.hpmp = chr->hpmp;
+    snapshot->getCharacter.ap = params->updateCharacter.ap;
+    snapshot->getCharacter.sp = params->updateCharacter.sp;
+    snapshot->getCharacter.fame = params->updateCharacter.fame;
+    snapshot->getCharacter.gender = chr->gender ? 1 : 0;
+    snapshot->getCharacter.skin = params->updateCharacter.skin;
+    snapshot->getCharacter.face = params->updateCharacter.face;
+    snapshot->getCharacter.hair = params->updateCharacter.hair;
+    snapshot->getCharacter.mesos = params->updateCharacter.mesos;
+    snapshot->getCharacter.equipSlots = params->updateCharacter.equipSlots;
+    snapshot->getCharacter.useSlots = params->updateCharacter.useSlots;
+    snapshot->getCharacter.setupSlots = params->updateCharacter.setupSlots;
+    snapshot->getCharacter.etcSlots = params->updateCharacter.etcSlots;
+
+    snapshot->getCharacter.equippedCount = params->updateCharacter.equippedCount;
+    memcpy(snapshot->getCharacter.equippedEquipment, params->updateCharacter.equippedEquipment,
+            params->updateCharacter.equippedCount * sizeof(snapshot->getCharacter.equippedEquipment[0]));
+
+    snapshot->getCharacter.equipCount = params->updateCharacter.equipCount;
+    memcpy(snapshot->getCharacter.equipmentInventory, params->updateCharacter.equipmentInventory,
+            params->updateCharacter.equipCount * sizeof(snapshot->getCharacter.equipmentInventory[0]));
+
+    snapshot->getCharacter.itemCount = params->updateCharacter.itemCount;
+    memcpy(snapshot->getCharacter.inventoryItems, params->updateCharacter.inventoryItems,
+            params->updateCharacter.itemCount * sizeof(snapshot->getCharacter.inventoryItems[0]));
+
+    snapshot->getCharacter.storage.id = params->updateCharacter.storage.id;
+    snapshot->getCharacter.storage.slots = params->updateCharacter.storage.slots;
+    snapshot->getCharacter.storage.mesos = params->updateCharacter.storage.mesos;
+
+    snapshot->getCharacter.storageItemCount = params->updateCharacter.storageItemCount;
+    memcpy(snapshot->getCharacter.storageItems, params->updateCharacter.storageItems,
+            params->updateCharacter.storageItemCount * sizeof(snapshot->getCharacter.storageItems[0]));
+
+    snapshot->getCharacter.storageEquipCount = params->updateCharacter.storageEquipCount;
+    memcpy(snapshot->getCharacter.storageEquipment, params->updateCharacter.storageEquipment,
+            params->updateCharacter.storageEquipCount * sizeof(snapshot->getCharacter.storageEquipment[0]));
+
+    snapshot->getCharacter.questCount = params->updateCharacter.questCount;
+    snapshot->getCharacter.quests = dup_array(params->updateCharacter.quests,
+            params->updateCharacter.questCount, sizeof(uint16_t), &size);
+    snapshot->getCharacter.progressCount = params->updateCharacter.progressCount;
+    snapshot->getCharacter.progresses = dup_array(params->updateCharacter.progresses,
+            params->updateCharacter.progressCount, sizeof(struct DatabaseProgress), &size);
+    snapshot->getCharacter.questInfoCount = params->updateCharacter.questInfoCount;
+    snapshot->getCharacter.questInfos = dup_array(params->updateCharacter.questInfos,
+            params->updateCharacter.questInfoCount, sizeof(struct DatabaseInfoProgress), &size);
+    snapshot->getCharacter.completedQuestCount = params->updateCharacter.completedQuestCount;
+    snapshot->getCharacter.completedQuests = dup_array(params->updateCharacter.completedQuests,
+            params->updateCharacter.completedQuestCount, sizeof(struct DatabaseCompletedQuest), &size);
+    snapshot->getCharacter.skillCount = params->updateCharacter.skillCount;
+    snapshot->getCharacter.skills = dup_array(params->updateCharacter.skills,
+            params->updateCharacter.skillCount, sizeof(struct DatabaseSkill), &size);
+    snapshot->getCharacter.monsterBookEntryCount = params->updateCharacter.monsterBookEntryCount;
+    snapshot->getCharacter.monsterBook = dup_array(params->updateCharacter.monsterBook,
+            params->updateCharacter.monsterBookEntryCount, sizeof(struct DatabaseMonsterBookEntry), &size);
+    snapshot->getCharacter.keyMapEntryCount = params->updateCharacter.keyMapEntryCount;
+    snapshot->getCharacter.keyMap = dup_array(params->updateCharacter.keyMap,
+            params->updateCharacter.keyMapEntryCount, sizeof(struct DatabaseKeyMapEntry), &size);
+
+    if ((snapshot->getCharacter.questCount != 0 && snapshot->getCharacter.quests == NULL) ||
+            (snapshot->getCharacter.progressCount != 0 && snapshot->getCharacter.progresses == NULL) ||
+            (snapshot->getCharacter.questInfoCount != 0 && snapshot->getCharacter.questInfos == NULL) ||
+            (snapshot->getCharacter.completedQuestCount != 0 && snapshot->getCharacter.completedQuests == NULL) ||
+            (snapshot->getCharacter.skillCount != 0 && snapshot->getCharacter.skills == NULL) ||
+            (snapshot->getCharacter.monsterBookEntryCount != 0 && snapshot->getCharacter.monsterBook == NULL) ||
+            (snapshot->getCharacter.keyMapEntryCount != 0 && snapshot->getCharacter.keyMap == NULL)) {
+        character_cache_free_snapshot(snapshot);
+        free(entry);
+        // Don't leave an older snapshot behind
+        character_cache_invalidate(chr->id);
+        return;
+    }
+
+    entry->id = chr->id;
+    entry->version = version;
+    entry->savedAt = time(NULL);
+    entry->size = size;
+    entry->snapshot = snapshot;
+
+    mtx_lock(&CACHE_LOCK);
+    struct CacheNode *node = hash_set_u32_get(CACHE, chr->id);
+    if (node != NULL)
+        remove_entry(node->entry);
+
+    struct CacheNode new = {
+        .id = chr->id,
+        .entry = entry
+    };
+
+    if (hash_set_u32_insert(CACHE, &new) == -1) {
+        mtx_unlock(&CACHE_LOCK);
+        character_cache_free_snapshot(snapshot);
+        free(entry);
+        return;
+    }
+
+    entry->prev = NULL;
+    entry->next = HEAD;
+    if (HEAD != NULL)
+        HEAD->prev = entry;
+    HEAD = entry;
+    if (TAIL == NULL)
+        TAIL = entry;
+    CACHE_SIZE += size;
+
+    evict(entry->savedAt);
+    mtx_unlock(&CACHE_LOCK);
+}
+
+bool character_cache_get_version(uint32_t id, uint64_t *version)
+{
+    mtx_lock(&CACHE_LOCK);
+    evict(time(NULL));
+    struct CacheNode *node = hash_set_u32_get(CACHE, id);
+    if (node == NULL) {
+        mtx_unlock(&CACHE_LOCK);
+        return false;
+    }
+
+    *version = node->entry->version;
+    mtx_unlock(&CACHE_LOCK);
+    return true;
+}
+
+union DatabaseResult *character_cache_take(uint32_t id, uint64_t version)
+{
+    mtx_lock(&CACHE_LOCK);
+    evict(time(NULL));
+    struct CacheNode *node = hash_set_u32_get(CACHE, id);
+    if (node == NULL) {
+        mtx_unlock(&CACHE_LOCK);
+        return NULL;
+    }
+
+    struct CacheEntry *entry = node->entry;
+    if (entry->version != version) {
+        // The character was saved elsewhere since this snapshot was taken
+        remove_entry(entry);
+        mtx_unlock(&CACHE_LOCK);
+        return NULL;
+    }
+
+    union DatabaseResult *snapshot = entry->snapshot;
+    hash_set_u32_remove(CACHE, id);
+    unlink_entry(entry);
+    mtx_unlock(&CACHE_LOCK);
+    free(entry);
+
+    return snapshot;
+}
+
+void character_cache_invalidate(uint32_t id)
+{
+    mtx_lock(&CACHE_LOCK);
+    struct CacheNode *node = hash_set_u32_get(CACHE, id);
+    if (node != NULL)
+        remove_entry(node->entry);
+    mtx_unlock(&CACHE_LOCK);
+}
+
+void character_cache_free_snapshot(union DatabaseResult *snapshot)
+{
+    free(snapshot->getCharacter.keyMap);
+    free(snapshot->getCharacter.monsterBook);
+    free(snapshot->getCharacter.skills);
+    free(snapshot->getCharacter.completedQuests);
+    free(snapshot->getCharacter.questInfos);
+    free(snapshot->getCharacter.progresses);
+    free(snapshot->getCharacter.quests);
+    free(snapshot);
+}
+
+static void *dup_array(const void *src, size_t count, size_t size, size_t *total)
+{
+    if (count == 0)
+        return NULL;
+
+    void *dst = malloc(count * size);
+    if (dst == NULL)
+        return NULL;
+
+    memcpy(dst, src, count * size);
+    *total += count * size;
+    return dst;
+}
+
+static void unlink_entry(struct CacheEntry *entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        HEAD = entry->next;
+
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        TAIL = entry->prev;
+
+    CACHE_SIZE -= entry->size;
+}
+
+static void remove_entry(struct CacheEntry *entry)
+{
+    hash_set_u32_remove(CACHE, entry->id);
+    unlink_entry(entry);
+    character_cache_free_snapshot(entry->snapshot);
+    free(entry);
+}
+
+static void evict(time_t now)
+{
+    // Entries are ordered by insertion time so both expired entries and
+    // the ones that should go first when over the memory budget are at the tail
+    while (TAIL != NULL && (CACHE_SIZE > CHARACTER_CACHE_MAX_SIZE || now - TAIL->savedAt >= CHARACTER_CACHE_TTL))
+        remove_entry(TAIL);
+}
+
@@ -0,0 +1,53 @@
+#ifndef CHARACTER_CACHE_H
+#define CHARACTER_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../character.h"
+#include "../database.h"
+
+/**
+ * A process-wide cache of characters that were recently saved on logout.
+ * Each entry is a snapshot in the same shape as a DATABASE_REQUEST_TYPE_GET_CHARACTER result
+ * tagged with the value of `Characters.version` that its save committed.
+ * A relog or channel change back into this process can then skip the full character load
+ * if the version stored in the database still matches the one in the cache.
+ */
+
+int character_cache_init(void);
+void character_cache_terminate(void);
+
+/**
+ * Stores a snapshot of \p chr as it was just written by a DATABASE_REQUEST_TYPE_UPDATE_CHARACTER request.
+ *
+ * \param chr The saved character.
+ * \param params The parameters of the finished update request.
+ * \param version The version of the character that the update committed.
+ */
+void character_cache_insert(const struct Character *chr, const struct RequestParams *params, uint64_t version);
+
+/**
+ * Checks whether an unexpired snapshot of a character exists.
+ *
+ * \param id The character ID.
+ * \param version Set to the version of the snapshot if one exists.
+ *
+ * \returns true if a snapshot exists.
+ */
+bool character_cache_get_version(uint32_t id, uint64_t *version);
+
+/**
+ * Removes a snapshot from the cache and hands it to the caller.
+ * If the snapshot's version doesn't match \p version it is dropped instead.
+ *
+ * \returns The snapshot which must be freed with \p character_cache_free_snapshot(),
+ *  or NULL if there was no matching snapshot.
+ */
+union DatabaseResult *character_cache_take(uint32_t id, uint64_t version);
+
+void character_cache_invalidate(uint32_t id);
+void character_cache_free_snapshot(union DatabaseResult *snapshot);
+
+#endif
+
@@ -1,10 +1,12 @@
 #include "client.h"
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <threads.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <sys/eventfd.h>
 #include <unistd.h>
@@ -13,6 +15,7 @@
 #include "../hash-map.h"
 #include "../packet.h"
 #include "../party.h"
+#include "character-cache.h"
 #include "map.h"
 #include "scripting/client.h"
 #include "shop.h"
@@ -42,13 +45,23 @@ struct Client {
     uint16_t qid;
     uint32_t npc;
     uint32_t shop;
+    // The inventory of the open shop as it was when it was opened, so that a reload doesn't change it under the client
+    size_t shopItemCount;
+    struct ShopItemInfo *shopItems;
     struct HashSetU32 *visibleMapObjects;
 
     struct DatabaseRequest *request;
     int databaseState;
+    // Set when the character is loaded from the character cache instead of from the database
+    union DatabaseResult *cached;
+    uint64_t cachedVersion;
     enum Stat stats;
     struct Party *party;
     bool autoPickup;
+    // When the unanswered ping was sent in milliseconds, 0 if there is none
+    uint64_t pingSentAt;
+    // Smoothed round-trip time in milliseconds, 0 until the first pong
+    uint32_t rtt;
 };
 
 struct ClientSave {
@@ -68,10 +81,18 @@ struct {
 
 mtx_t CLIENTS_LOCK;
 
+static atomic_size_t CLIENT_COUNT;
+
 static void insert_client(uint8_t len, const char *name, uint32_t id);
 static uint32_t find_id_by_name(uint8_t len, const char *name);
 
-static bool check_quest_requirements(struct Character *chr, size_t req_count, const struct QuestRequirement *reqs, uint32_t npc);
+static void finish_character_load(struct Client *client);
+static uint64_t client_now(void);
+static void client_update_rtt(struct Client *client, uint64_t sample);
+
+static bool check_quest_requirements(struct Character *chr, const struct QuestRequirementProgram *program, uint32_t npc);
+static bool check_quest_items(struct Character *chr, size_t count, const struct QuestItemRequirement *items);
+static bool check_quest_requirement(struct Character *chr, const struct QuestRequirement *req, uint32_t npc);
 static bool start_quest(struct Client *client, uint16_t qid, uint32_t npc, bool *success);
 static bool end_quest(struct Client *client, uint16_t qid, uint32_t npc, bool *success);
 
@@ -148,6 +169,11 @@ void clients_terminate(void)
     mtx_destroy(&CLIENTS_LOCK);
 }
 
+size_t clients_get_count(void)
+{
+    return atomic_load_explicit(&CLIENT_COUNT, memory_order_relaxed);
+}
+
 struct Client *client_create(struct Session *session, struct DatabaseConnection *conn, struct ScriptManager *quest_manager, struct ScriptManager *portal_mananger, struct ScriptManager *npc_manager, struct ScriptManager *map_manager)
 {
     struct Client *client = malloc(sizeof(struct Client));
@@ -175,17 +201,23 @@ struct Client *client_create(struct Session *session, struct DatabaseConnection
     client->character.skills = NULL;
     client->character.monsterBook = NULL;
     client->script = NULL;
+    client->cached = NULL;
     client->shop = -1;
+    client->shopItems = NULL;
     client->stats = 0;
     client->party = NULL;
     client->autoPickup = false;
+    client->pingSentAt = 0;
+    client->rtt = 0;
     client->handlerType = PACKET_TYPE_NONE;
 
+    atomic_fetch_add_explicit(&CLIENT_COUNT, 1, memory_order_relaxed);
     return client;
 }
 
 void client_destroy(struct Client *client)
 {
+    atomic_fetch_sub_explicit(&CLIENT_COUNT, 1, memory_order_relaxed);
     hash_set_u32_destroy(client->character.monsterBook);
     hash_set_u32_destroy(client->character.skills);
     hash_set_u16_destroy(client->character.completedQuests);
@@ -194,6 +226,7 @@ void client_destroy(struct Client *client)
     hash_set_u32_destroy(client->character.monsterQuests);
     hash_set_u16_destroy(client->character.quests);
     hash_set_u32_destroy(client->visibleMapObjects);
+    free(client->shopItems);
     free(client);
 }
 
@@ -745,18 +778,31 @@ struct ClientContResult client_resume(struct Client *client, int status)
             if (status != 0)
                 close(session_close_event(client->session));
 
+            client->cached = NULL;
+            // A character that recently logged out of this process might still be cached,
+            // in which case the load stops after the character's row if its version still matches
+            if (!character_cache_get_version(client->character.id, &client->cachedVersion))
+                client->cachedVersion = DATABASE_CHARACTER_VERSION_NONE;
+
             struct RequestParams params = {
                 .type = DATABASE_REQUEST_TYPE_GET_CHARACTER,
                 .getCharacter = {
-                    .id = client->character.id
+                    .id = client->character.id,
+                    .knownVersion = client->cachedVersion
                 }
             };
 
             client->request = database_request_create(client->conn, &params);
+            if (client->request == NULL) {
+                database_connection_unlock(client->conn);
+                return (struct ClientContResult) { -1 };
+            }
+
             client->databaseState++;
             status = database_request_execute(client->request, 0);
             if (status < 0) {
                 database_request_destroy(client->request);
+                database_connection_unlock(client->conn);
                 return (struct ClientContResult) { -1 };
             } else if (status > 0) {
                 return (struct ClientContResult) { status, database_connection_get_fd(client->conn) };
@@ -768,6 +814,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
             status = database_request_execute(client->request, status);
             if (status < 0) {
                 database_request_destroy(client->request);
+                database_connection_unlock(client->conn);
                 return (struct ClientContResult) { -1 };
             } else if (status > 0) {
                 return (struct ClientContResult) { status, database_connection_get_fd(client->conn) };
@@ -776,10 +823,65 @@ struct ClientContResult client_resume(struct Client *client, int status)
         }
 
         if (client->databaseState == 3) {
-            client->databaseState++;
             const union DatabaseResult *res = database_request_result(client->request);
+            if (res->getCharacter.unchanged) {
+                client->cached = character_cache_take(client->character.id, client->cachedVersion);
+                database_request_destroy(client->request);
+                // The snapshot could have expired since its version was read, in which case the character is loaded in full
+                client->databaseState = client->cached != NULL ? 6 : 4;
+            } else {
+                if (client->cachedVersion != DATABASE_CHARACTER_VERSION_NONE)
+                    character_cache_invalidate(client->character.id);
+                client->databaseState = 6;
+            }
+        }
+
+        if (client->databaseState == 4) {
+            struct RequestParams params = {
+                .type = DATABASE_REQUEST_TYPE_GET_CHARACTER,
+                .getCharacter = {
+                    .id = client->character.id,
+                    .knownVersion = DATABASE_CHARACTER_VERSION_NONE
+                }
+            };
+
+            client->request = database_request_create(client->conn, &params);
+            if (client->request == NULL) {
+                database_connection_unlock(client->conn);
+                return (struct ClientContResult) { -1 };
+            }
+
+            client->databaseState++;
+            status = database_request_execute(client->request, 0);
+            if (status < 0) {
+                database_request_destroy(client->request);
+                database_connection_unlock(client->conn);
+                return (struct ClientContResult) { -1 };
+            } else if (status > 0) {
+                return (struct ClientContResult) { status, database_connection_get_fd(client->conn) };
+            }
+            client->databaseState++;
+        }
+
+        if (client->databaseState == 5) {
+            status = database_request_execute(client->request, status);
+            if (status < 0) {
+                database_request_destroy(client->request);
+                database_connection_unlock(client->conn);
+                return (struct ClientContResult) { -1 };
+            } else if (status > 0) {
+                return (struct ClientContResult) { status, database_connection_get_fd(client->conn) };
+            }
+            client->databaseState++;
+        }
+
+        if (client->databaseState == 6) {
+            client->databaseState++;
+            const union DatabaseResult *res = client->cached != NULL ?
+                client->cached : database_request_result(client->request);
             chr->nameLength = res->getCharacter.nameLength;
             memcpy(chr->name, res->getCharacter.name, res->getCharacter.nameLength);
+            chr->world = res->getCharacter.world;
             chr->map = res->getCharacter.map;
             // Will be updated in on_client_join()
             //chr->x = info->x;
@@ -1025,8 +1127,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
 
             chr->quests = hash_set_u16_create(sizeof(struct Quest), offsetof(struct Quest, id));
             if (chr->quests == NULL) {
-                database_request_destroy(client->request);
-                database_connection_unlock(client->conn);
+                finish_character_load(client);
                 return (struct ClientContResult) { -1 };
             }
 
@@ -1034,8 +1135,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
             if (chr->monsterQuests == NULL) {
                 hash_set_u16_destroy(chr->quests);
                 chr->quests = NULL;
-                database_request_destroy(client->request);
-                database_connection_unlock(client->conn);
+                finish_character_load(client);
                 return (struct ClientContResult) { -1 };
             }
 
@@ -1045,8 +1145,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
                 chr->monsterQuests = NULL;
                 hash_set_u16_destroy(chr->quests);
                 chr->quests = NULL;
-                database_request_destroy(client->request);
-                database_connection_unlock(client->conn);
+                finish_character_load(client);
                 return (struct ClientContResult) { -1 };
             }
 
@@ -1133,8 +1232,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
                 chr->monsterQuests = NULL;
                 hash_set_u16_destroy(chr->quests);
                 chr->quests = NULL;
-                database_request_destroy(client->request);
-                database_connection_unlock(client->conn);
+                finish_character_load(client);
                 return (struct ClientContResult) { -1 };
             }
 
@@ -1159,8 +1257,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
                 chr->monsterQuests = NULL;
                 hash_set_u16_destroy(chr->quests);
                 chr->quests = NULL;
-                database_request_destroy(client->request);
-                database_connection_unlock(client->conn);
+                finish_character_load(client);
                 return (struct ClientContResult) { -1 };
             }
 
@@ -1194,8 +1291,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
                 chr->monsterQuests = NULL;
                 hash_set_u16_destroy(chr->quests);
                 chr->quests = NULL;
-                database_request_destroy(client->request);
-                database_connection_unlock(client->conn);
+                finish_character_load(client);
                 return (struct ClientContResult) { -1 };
             }
 
@@ -1222,8 +1318,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
                 chr->monsterQuests = NULL;
                 hash_set_u16_destroy(chr->quests);
                 chr->quests = NULL;
-                database_request_destroy(client->request);
-                database_connection_unlock(client->conn);
+                finish_character_load(client);
                 return (struct ClientContResult) { -1 };
             }
 
@@ -1241,8 +1336,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
                 chr->keyMap[res->getCharacter.keyMap[i].key].action = res->getCharacter.keyMap[i].action;
             }
 
-            database_request_destroy(client->request);
-            database_connection_unlock(client->conn);
+            finish_character_load(client);
 
             {
                 uint8_t packet[SET_FIELD_PACKET_MAX_LENGTH];
@@ -1363,8 +1457,7 @@ struct ClientContResult client_resume(struct Client *client, int status)
                 client_destroy(client);
                 return (struct ClientContResult) { .status = -1 };
             } else {
-                database_request_destroy(client->request);
-                database_connection_unlock(client->conn);
+                // The IDs were handed out from the connection's lease, the result is consumed below
                 client->databaseState++;
             }
         }
@@ -1691,6 +1784,8 @@ struct ClientContResult client_resume(struct Client *client, int status)
             status = database_request_execute(client->request, 0);
             client->databaseState++;
             if (status <= 0) {
+                if (status == 0)
+                    character_cache_insert(chr, &params, database_request_result(client->request)->updateCharacter.version);
                 free(params.updateCharacter.keyMap);
                 free(params.updateCharacter.monsterBook);
                 free(params.updateCharacter.skills);
@@ -1711,6 +1806,9 @@ struct ClientContResult client_resume(struct Client *client, int status)
             status = database_request_execute(client->request, status);
             if (status <= 0) {
                 const struct RequestParams *params = database_request_get_params(client->request);
+                // Keep the saved character around in case it logs back in to this channel soon
+                if (status == 0)
+                    character_cache_insert(chr, params, database_request_result(client->request)->updateCharacter.version);
                 free(params->updateCharacter.keyMap);
                 free(params->updateCharacter.monsterBook);
                 free(params->updateCharacter.skills);
@@ -1736,6 +1834,18 @@ struct ClientContResult client_resume(struct Client *client, int status)
     return (struct ClientContResult) { 0 };
 }
 
+static void finish_character_load(struct Client *client)
+{
+    if (client->cached != NULL) {
+        character_cache_free_snapshot(client->cached);
+        client->cached = NULL;
+    } else {
+        database_request_destroy(client->request);
+    }
+
+    database_connection_unlock(client->conn);
+}
+
 void client_update_conn(struct Client *client, struct DatabaseConnection *conn)
 {
     client->conn = conn;
@@ -1822,34 +1932,6 @@ void client_announce_self_to_map(struct Client *client)
     session_broadcast_to_room(client->session, len, packet);
 }
 
-void client_announce_add_player(struct Client *client, const struct Character *chr)
-{
-    uint8_t packet[ADD_PLAYER_TO_MAP_PACKET_MAX_LENGTH];
-    size_t len = add_player_to_map_packet(chr, packet);
-    session_write(client->session, len, packet);
-}
-
-void client_announce_add_npc(struct Client *client, const struct Npc *npc)
-{
-    {
-        uint8_t packet[SPAWN_NPC_PACKET_LENGTH];
-        spawn_npc_packet(npc->oid, npc->id, npc->x, npc->cy, npc->f == 1, npc->fh, npc->rx0, npc->rx1, packet);
-        session_write(client->session, SPAWN_NPC_PACKET_LENGTH, packet);
-    }
-    {
-        uint8_t packet[SPAWN_NPC_CONTROLLER_PACKET_LENGTH];
-        spawn_npc_controller_packet(npc->oid, npc->id, npc->x, npc->cy, npc->f == 1, npc->fh, npc->rx0, npc->rx1, packet);
-        session_write(client->session, SPAWN_NPC_CONTROLLER_PACKET_LENGTH, packet);
-    }
-}
-
-void client_announce_monster(struct Client *client, const struct Monster *monster)
-{
-    uint8_t packet[SPAWN_MONSTER_PACKET_LENGTH];
-    spawn_monster_packet(monster->oid, monster->id, monster->x, monster->y, monster->fh, false, packet);
-    session_write(client->session, SPAWN_MONSTER_PACKET_LENGTH, packet);
-}
-
 bool client_announce_drop(struct Client *client, uint32_t owner_id, uint32_t dropper_oid, uint8_t type, bool player_drop, const struct Drop *drop)
 {
     struct Character *chr = &client->character;
@@ -1898,49 +1980,36 @@ bool client_announce_drop(struct Client *client, uint32_t owner_id, uint32_t dro
     return true;
 }
 
-bool client_announce_spawn_drop(struct Client *client, uint32_t owner_id, uint32_t dropper_oid, uint8_t type, bool player_drop, const struct Drop *drop)
+size_t client_spawn_drop_packet(struct Client *client, uint32_t owner_id, uint8_t type, bool player_drop, const struct Drop *drop, uint8_t *packet)
 {
     struct Character *chr = &client->character;
     if (hash_set_u32_insert(client->visibleMapObjects, &drop->oid) == -1)
-        return false;
+        return 0;
 
     if (type < 3 && owner_id == chr->id)
         type = 2;
 
     switch (drop->type) {
-    case DROP_TYPE_MESO: {
-        uint8_t packet[SPAWN_MESO_DROP_PACKET_LENGTH];
+    case DROP_TYPE_MESO:
         spawn_meso_drop_packet(drop->oid, drop->meso, owner_id, type, drop->x, drop->y, player_drop, packet);
-        session_write(client->session, SPAWN_MESO_DROP_PACKET_LENGTH, packet);
-    }
-    break;
+        return SPAWN_MESO_DROP_PACKET_LENGTH;
 
-    case DROP_TYPE_ITEM: {
+    case DROP_TYPE_ITEM:
         if (drop->qid != 0) {
             struct Quest *quest = hash_set_u16_get(client->character.quests, drop->qid);
-            if (quest != NULL && hash_set_u32_get(chr->itemQuests, drop->item.item.itemId) != NULL) {
-                uint8_t packet[SPAWN_ITEM_DROP_PACKET_LENGTH];
-                spawn_item_drop_packet(drop->oid, drop->item.item.itemId, owner_id, type, drop->x, drop->y, player_drop, packet);
-                session_write(client->session, SPAWN_ITEM_DROP_PACKET_LENGTH, packet);
-            }
-        } else {
-            uint8_t packet[SPAWN_ITEM_DROP_PACKET_LENGTH];
-            spawn_item_drop_packet(drop->oid, drop->item.item.itemId, owner_id, type, drop->x, drop->y, player_drop, packet);
-            session_write(client->session, SPAWN_ITEM_DROP_PACKET_LENGTH, packet);
+            if (quest == NULL || hash_set_u32_get(chr->itemQuests, drop->item.item.itemId) == NULL)
+                return 0;
         }
-    }
-    break;
 
-    case DROP_TYPE_EQUIP: {
-            uint8_t packet[SPAWN_ITEM_DROP_PACKET_LENGTH];
-            spawn_item_drop_packet(drop->oid, drop->equip.item.itemId, owner_id, type, drop->x, drop->y, player_drop, packet);
-            session_write(client->session, SPAWN_ITEM_DROP_PACKET_LENGTH, packet);
-    }
-    break;
-    }
+        spawn_item_drop_packet(drop->oid, drop->item.item.itemId, owner_id, type, drop->x, drop->y, player_drop, packet);
+        return SPAWN_ITEM_DROP_PACKET_LENGTH;
 
-    return true;
+    case DROP_TYPE_EQUIP:
+        spawn_item_drop_packet(drop->oid, drop->equip.item.itemId, owner_id, type, drop->x, drop->y, player_drop, packet);
+        return SPAWN_ITEM_DROP_PACKET_LENGTH;
+    }
 
+    return 0;
 }
 
 void client_update_player_pos(struct Client *client, int16_t x, int16_t y, uint16_t fh, uint8_t stance)
@@ -3906,7 +3975,7 @@ struct ClientResult client_start_quest(struct Client *client, uint16_t qid, uint
     if ((scripted && !info->startScript) || (!scripted && info->startScript))
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN };
 
-    if (!check_quest_requirements(chr, info->startRequirementCount, info->startRequirements, npc))
+    if (!check_quest_requirements(chr, &wz_get_quest_program(qid)->start, npc))
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN };
 
     for (size_t i = 0; i < info->endRequirementCount; i++) {
@@ -4079,7 +4148,7 @@ struct ClientResult client_end_quest(struct Client *client, uint16_t qid, uint32
     if ((scripted && !info->endScript) || (!scripted && info->endScript))
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN };
 
-    if (!check_quest_requirements(chr, info->endRequirementCount, info->endRequirements, npc))
+    if (!check_quest_requirements(chr, &wz_get_quest_program(qid)->end, npc))
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN };
 
     if (info->endScript) {
@@ -4276,61 +4345,46 @@ void client_close_script(struct Client *client)
     client->script = NULL;
 }
 
-struct CheckProgressContext {
-    struct Session *session;
-    struct HashSetU32 *monsterQuests;
-    uint32_t id;
-};
-
-static void check_progress(void *data, void *ctx);
+static void check_progress(struct Client *client, uint32_t id);
 
 void client_kill_monster(struct Client *client, uint32_t id)
 {
-    struct Character *chr = &client->character;
     const struct MobInfo *info = wz_get_monster_stats(id);
     client_gain_exp(client, info->exp, false);
     client_commit_stats(client);
-    struct CheckProgressContext ctx = {
-        .session = client->session,
-        .monsterQuests = chr->monsterQuests,
-    };
 
     // I could load Mob.wz/QuestCountGroup and parse the files there
     // but since there are a measly 4 records there it seems better to just
     // make a special case for them here
     if (id == 1110100 || id == 1110130) {
-        ctx.id = 9101000;
-        if (hash_set_u32_get(client->character.monsterQuests, ctx.id) != NULL)
-            hash_set_u16_foreach(chr->quests, check_progress, &ctx);
+        check_progress(client, 9101000);
     } else if (id == 2230101 || id == 2230131) {
-        ctx.id = 9101001;
-        if (hash_set_u32_get(client->character.monsterQuests, ctx.id) != NULL)
-            hash_set_u16_foreach(chr->quests, check_progress, &ctx);
+        check_progress(client, 9101001);
     } else if (id == 1140100 || id == 1140130) {
-        ctx.id = 9101002;
-        if (hash_set_u32_get(client->character.monsterQuests, ctx.id) != NULL)
-            hash_set_u16_foreach(chr->quests, check_progress, &ctx);
+        check_progress(client, 9101002);
     } else if (id == 8830003 || id == 8830010) {
-        ctx.id = 9101003;
-        if (hash_set_u32_get(client->character.monsterQuests, ctx.id) != NULL)
-            hash_set_u16_foreach(chr->quests, check_progress, &ctx);
+        check_progress(client, 9101003);
     }
 
-    ctx.id = id;
-
-    if (hash_set_u32_get(client->character.monsterQuests, id) != NULL)
-        hash_set_u16_foreach(chr->quests, check_progress, &ctx);
+    check_progress(client, id);
 }
 
 struct ClientResult client_open_shop(struct Client *client, uint32_t id)
 {
     if (client->shop == -1) {
-        client->shop = id;
-
         const struct ShopInfo *info = shop_info_find(id);
         if (info == NULL)
             return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN, .reason = "" };
 
+        // The shop table can be reloaded while the shop is open, so client_buy() checks against this copy
+        client->shopItems = malloc(info->count * sizeof(struct ShopItemInfo));
+        if (client->shopItems == NULL && info->count > 0)
+            return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_ERROR };
+
+        memcpy(client->shopItems, info->items, info->count * sizeof(struct ShopItemInfo));
+        client->shopItemCount = info->count;
+        client->shop = id;
+
         struct ShopItem items[info->count];
         for (size_t i = 0; i < info->count; i++) {
             items[i].id = info->items[i].id;
@@ -4350,22 +4404,22 @@ struct ClientResult client_buy(struct Client *client, uint16_t pos, uint32_t id,
     if (client->shop == -1)
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN, .reason = "Client tried to buy from a shop that isn't open" };
 
-    const struct ShopInfo *shop = shop_info_find(client->shop);
-    if (pos >= shop->count)
+    if (pos >= client->shopItemCount)
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN, .reason = "Client tried to buy an illegal shop position" };
 
+    const struct ShopItemInfo *item = &client->shopItems[pos];
     // Also implicitly checks that the item ID actuallt exists
-    if (shop->items[pos].id != id)
+    if (item->id != id)
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN, .reason = "Client tried to buy an item with an incorrect ID" };
 
     if (quantity <= 0)
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN, .reason = "Client tried to buy a non-positive quantity of an item" };
 
-    if (shop->items[pos].id / 1000000 == 1 && quantity > 1)
+    if (item->id / 1000000 == 1 && quantity > 1)
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN, .reason = "Client tried to buy multiple of an equipment" };
 
     // TODO: Check if price is per item or total
-    if (shop->items[pos].price != price)
+    if (item->price != price)
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN, .reason = "Client tried to buy an item with an incorrect price" };
 
     // Players can drop meso while in the shop, so this can be a legal packet
@@ -4507,6 +4561,8 @@ bool client_close_shop(struct Client *client)
         return false;
 
     client->shop = -1;
+    free(client->shopItems);
+    client->shopItems = NULL;
     return true;
 }
 
@@ -4816,6 +4872,62 @@ bool client_is_auto_pickup_enabled(struct Client *client)
     return client->autoPickup;
 }
 
+static uint64_t client_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void client_ping(struct Client *client)
+{
+    // Don't stack pings, a pong to an earlier one would otherwise be measured against the later one.
+    // A client that stopped answering still has to look slow, so the unanswered ping counts for at least its age
+    if (client->pingSentAt != 0) {
+        uint64_t age = client_now() - client->pingSentAt;
+        if (age > client->rtt)
+            client_update_rtt(client, age);
+
+        return;
+    }
+
+    uint8_t packet[PING_PACKET_LENGTH];
+    ping_packet(packet);
+    session_write(client->session, PING_PACKET_LENGTH, packet);
+    client->pingSentAt = client_now();
+}
+
+void client_pong(struct Client *client)
+{
+    // Unsolicited
+    if (client->pingSentAt == 0)
+        return;
+
+    uint64_t sample = client_now() - client->pingSentAt;
+    client->pingSentAt = 0;
+    client_update_rtt(client, sample);
+}
+
+uint32_t client_get_rtt(struct Client *client)
+{
+    return client->rtt;
+}
+
+static void client_update_rtt(struct Client *client, uint64_t sample)
+{
+    if (sample > UINT32_MAX)
+        sample = UINT32_MAX;
+
+    // Exponentially weighted like TCP's SRTT so that a single slow pong doesn't hand off the client's monsters
+    if (client->rtt == 0)
+        client->rtt = sample;
+    else
+        client->rtt = ((uint64_t)client->rtt * 7 + sample) / 8;
+
+    if (client->map.player != NULL)
+        map_set_player_rtt(room_get_context(session_get_room(client->session)), client->map.player, client->rtt);
+}
+
 bool client_apply_skill(struct Client *client, uint32_t skill_id, uint8_t *level)
 {
     struct Character *chr = &client->character;
@@ -5088,125 +5200,160 @@ static uint32_t find_id_by_name(uint8_t len, const char *name)
     return ret;
 }
 
-static bool check_quest_requirements(struct Character *chr, size_t req_count, const struct QuestRequirement *reqs, uint32_t npc)
+static bool check_quest_requirements(struct Character *chr, const struct QuestRequirementProgram *program, uint32_t npc)
 {
-    for (size_t i = 0; i < req_count; i++) {
-        switch (reqs[i].type) {
-        case QUEST_REQUIREMENT_TYPE_NPC:
-            if (reqs[i].npc.id != npc)
-                return false;
-        break;
-
-        case QUEST_REQUIREMENT_TYPE_QUEST:
-            switch (reqs[i].quest.state) {
-            case QUEST_STATE_NOT_STARTED:
-                if (hash_set_u16_get(chr->quests, reqs[i].quest.id) != NULL)
-                    return false;
+    if (program->npc != 0 && program->npc != npc)
+        return false;
 
-                if (hash_set_u16_get(chr->completedQuests, reqs[i].quest.id) != NULL)
-                    return false;
-            break;
+    if (chr->level < program->minLevel || chr->level > program->maxLevel)
+        return false;
 
-            case QUEST_STATE_STARTED:
-                if (hash_set_u16_get(chr->quests, reqs[i].quest.id) == NULL)
-                    return false;
-            break;
+    if (chr->mesos < program->meso)
+        return false;
 
-            case QUEST_STATE_COMPLETED:
-                if (hash_set_u16_get(chr->completedQuests, reqs[i].quest.id) == NULL)
-                    return false;
-            break;
-            }
-        break;
+    if (!wz_quest_program_allows_job(program, chr->job))
+        return false;
 
-        case QUEST_REQUIREMENT_TYPE_JOB: {
-            size_t j;
-            for (j = 0; j < reqs[i].job.count; j++) {
-                if (reqs[i].job.jobs[j] == chr->job)
-                    break;
-            }
+    if (program->completedQuests != 0 && hash_set_u16_size(chr->completedQuests) < program->completedQuests)
+        return false;
 
-            if (j == reqs[i].job.count)
+    for (size_t i = 0; i < program->questCount; i++) {
+        const struct QuestStateRequirement *req = &program->quests[i];
+        switch (req->state) {
+        case QUEST_STATE_NOT_STARTED:
+            if (hash_set_u16_get(chr->quests, req->id) != NULL)
                 return false;
-        }
-        break;
 
-        case QUEST_REQUIREMENT_TYPE_COMPLETED_QUEST:
-            if (hash_set_u16_size(chr->completedQuests) < reqs[i].questCompleted.amount)
+            if (hash_set_u16_get(chr->completedQuests, req->id) != NULL)
                 return false;
         break;
 
-        case QUEST_REQUIREMENT_TYPE_MESO:
-            if (chr->mesos < reqs[i].meso.amount)
+        case QUEST_STATE_STARTED:
+            if (hash_set_u16_get(chr->quests, req->id) == NULL)
                 return false;
         break;
 
-        case QUEST_REQUIREMENT_TYPE_MIN_LEVEL:
-            if (chr->level < reqs[i].minLevel.level)
+        case QUEST_STATE_COMPLETED:
+            if (hash_set_u16_get(chr->completedQuests, req->id) == NULL)
                 return false;
         break;
+        }
+    }
 
-        case QUEST_REQUIREMENT_TYPE_MAX_LEVEL:
-            if (chr->level > reqs[i].maxLevel.level)
-                return false;
-        break;
+    if (!check_quest_items(chr, program->itemCount, program->items) ||
+            !check_quest_items(chr, program->absentItemCount, program->items + program->itemCount))
+        return false;
 
-        case QUEST_REQUIREMENT_TYPE_ITEM: {
-            enum InventoryType inv = item_get_inventory(reqs[i].item.id);
-            if (reqs[i].item.count != 0) {
-                int32_t amount = 0;
-                if (inv == INVENTORY_TYPE_EQUIP) {
-                    for (size_t j = 0; j < chr->equipmentInventory.slotCount; j++) {
-                        if (!chr->equipmentInventory.items[j].isEmpty && chr->equipmentInventory.items[j].equip.item.itemId == reqs[i].item.id)
-                            amount++;
-                    }
+    for (size_t i = 0; i < program->otherCount; i++) {
+        if (!check_quest_requirement(chr, program->others[i], npc))
+            return false;
+    }
 
-                    // TODO: Check in the equipped equipment
+    return true;
+}
 
-                    if (amount < reqs[i].item.count)
-                        return false;
-                } else {
-                    for (size_t j = 0; j < chr->inventory[inv - 1].slotCount; j++) {
-                        if (!chr->inventory[inv - 1].items[j].isEmpty && chr->inventory[inv - 1].items[j].item.item.itemId == reqs[i].item.id)
-                            amount += chr->inventory[inv - 1].items[j].item.quantity;
-                    }
+static const struct QuestItemRequirement *find_quest_item(size_t count, const struct QuestItemRequirement *items, uint32_t id)
+{
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (items[mid].id == id)
+            return &items[mid];
 
-                    if (amount < reqs[i].item.count)
-                        return false;
-                }
-            } else {
-                // if count is 0 this means that the player shouldn't have any of the item
-                if (inv == INVENTORY_TYPE_EQUIP) {
-                    for (size_t j = 0; j < chr->equipmentInventory.slotCount; j++) {
-                        if (!chr->equipmentInventory.items[j].isEmpty && chr->equipmentInventory.items[j].equip.item.itemId == reqs[i].item.id)
-                            return false;
-                    }
-                } else {
-                    for (size_t j = 0; j < chr->inventory[inv - 1].slotCount; j++) {
-                        if (!chr->inventory[inv - 1].items[j].isEmpty && chr->inventory[inv - 1].items[j].item.item.itemId == reqs[i].item.id)
-                            return false;
-                    }
-                }
+        if (items[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+static bool check_quest_items(struct Character *chr, size_t count, const struct QuestItemRequirement *items)
+{
+    if (count == 0)
+        return true;
+
+    // Each inventory that holds a required item is scanned once for all of them
+    int32_t amounts[count];
+    for (size_t i = 0; i < count; i++)
+        amounts[i] = 0;
+
+    for (size_t i = 0; i < count; ) {
+        enum InventoryType inv = item_get_inventory(items[i].id);
+        // The items are sorted so the ones in the same inventory are next to each other
+        size_t end = i + 1;
+        while (end < count && item_get_inventory(items[end].id) == inv)
+            end++;
+
+        if (inv == INVENTORY_TYPE_EQUIP) {
+            // TODO: Check in the equipped equipment
+            for (size_t j = 0; j < chr->equipmentInventory.slotCount; j++) {
+                if (chr->equipmentInventory.items[j].isEmpty)
+                    continue;
+
+                const struct QuestItemRequirement *item = find_quest_item(end - i, &items[i], chr->equipmentInventory.items[j].equip.item.itemId);
+                if (item != NULL)
+                    amounts[item - items]++;
+            }
+        } else {
+            for (size_t j = 0; j < chr->inventory[inv - 1].slotCount; j++) {
+                if (chr->inventory[inv - 1].items[j].isEmpty)
+                    continue;
 
+                const struct QuestItemRequirement *item = find_quest_item(end - i, &items[i], chr->inventory[inv - 1].items[j].item.item.itemId);
+                if (item != NULL)
+                    amounts[item - items] += chr->inventory[inv - 1].items[j].item.quantity;
             }
         }
-        break;
 
-        case QUEST_REQUIREMENT_TYPE_INFO: {
-            struct QuestInfoProgress *info = hash_set_u16_get(chr->questInfos, reqs[i].info.number);
-            if (info == NULL)
-                return false;
+        i = end;
+    }
 
-            // TODO: For now, only implement single quest-info value
-            if (strcmp(info->value, reqs[i].info.infos[0]))
-                return false;
-        }
-        break;
+    for (size_t i = 0; i < count; i++) {
+        // if count is 0 this means that the player shouldn't have any of the item
+        if (items[i].count == 0 ? amounts[i] != 0 : amounts[i] < items[i].count)
+            return false;
+    }
 
-        default: {
-            fprintf(stderr, "Unimplemented\n");
-        }
+    return true;
+}
+
+// Checks the requirements that weren't compiled into the quest's program
+static bool check_quest_requirement(struct Character *chr, const struct QuestRequirement *req, uint32_t npc)
+{
+    switch (req->type) {
+    case QUEST_REQUIREMENT_TYPE_NPC:
+        if (req->npc.id != npc)
+            return false;
+    break;
+
+    case QUEST_REQUIREMENT_TYPE_JOB: {
+        size_t j;
+        for (j = 0; j < req->job.count; j++) {
+            if (req->job.jobs[j] == chr->job)
+                break;
         }
+
+        if (j == req->job.count)
+            return false;
+    }
+    break;
+
+    case QUEST_REQUIREMENT_TYPE_INFO: {
+        struct QuestInfoProgress *info = hash_set_u16_get(chr->questInfos, req->info.number);
+        if (info == NULL)
+            return false;
+
+        // TODO: For now, only implement single quest-info value
+        if (strcmp(info->value, req->info.infos[0]))
+            return false;
+    }
+    break;
+
+    default: {
+        fprintf(stderr, "Unimplemented\n");
+    }
     }
 
     return true;
@@ -5539,35 +5686,36 @@ static bool end_quest(struct Client *client, uint16_t qid, uint32_t npc, bool *s
     return true;
 }
 
-static void check_progress(void *data, void *ctx_)
+static void check_progress(struct Client *client, uint32_t id)
 {
-    struct CheckProgressContext *ctx = ctx_;
-    struct Quest *quest = data;
-    const struct QuestInfo *info = wz_get_quest_info(quest->id);
-
-    for (size_t i = 0; i < info->endRequirementCount; i++) {
-        if (info->endRequirements[i].type == QUEST_REQUIREMENT_TYPE_MOB) {
-            const struct QuestRequirement *req = &info->endRequirements[i];
-            for (size_t i = 0; i < req->mob.count; i++) {
-                if (req->mob.mobs[i].id == ctx->id && quest->progress[i] < req->mob.mobs[i].count) {
-                    quest->progress[i]++;
-                    if (quest->progress[i] == req->mob.mobs[i].count) {
-                        struct MonsterRefCount *monster = hash_set_u32_get(ctx->monsterQuests, ctx->id);
-                        monster->refCount--;
-                        if (monster->refCount == 0)
-                            hash_set_u32_remove(ctx->monsterQuests, ctx->id);
-                    }
+    struct Character *chr = &client->character;
+    if (hash_set_u32_get(chr->monsterQuests, id) == NULL)
+        return;
 
-                    char progress[15];
-                    size_t prog_len = quest_get_progress_string(quest, progress);
-                    uint8_t packet[UPDATE_QUEST_PACKET_MAX_LENGTH];
-                    size_t len = update_quest_packet(quest->id, prog_len, progress, packet);
-                    session_write(ctx->session, len, packet);
-                    break;
-                }
-            }
-            break;
+    size_t count;
+    const struct QuestMonsterTarget *targets = wz_get_quests_for_monster(id, &count);
+    for (size_t i = 0; i < count; i++) {
+        struct Quest *quest = hash_set_u16_get(chr->quests, targets[i].quest);
+        if (quest == NULL || quest->progress[targets[i].index] >= targets[i].count)
+            continue;
+
+        quest->progress[targets[i].index]++;
+        if (quest->progress[targets[i].index] == targets[i].count) {
+            struct MonsterRefCount *monster = hash_set_u32_get(chr->monsterQuests, id);
+            monster->refCount--;
+            if (monster->refCount == 0)
+                hash_set_u32_remove(chr->monsterQuests, id);
         }
+
+        char progress[15];
+        size_t prog_len = quest_get_progress_string(quest, progress);
+        uint8_t packet[UPDATE_QUEST_PACKET_MAX_LENGTH];
+        size_t len = update_quest_packet(quest->id, prog_len, progress, packet);
+        session_write(client->session, len, packet);
+
+        // A kill only counts once per quest
+        while (i + 1 < count && targets[i + 1].quest == targets[i].quest)
+            i++;
     }
 }
 
@@ -56,6 +56,7 @@ struct ClientSave;
 
 int clients_init(void);
 void clients_terminate(void);
+size_t clients_get_count(void);
 
 struct Client *client_create(struct Session *session, struct DatabaseConnection *conn, struct ScriptManager *quest_manager, struct ScriptManager *portal_mananger, struct ScriptManager *npc_manager, struct ScriptManager *map_manager);
 void client_destroy(struct Client *client);
@@ -72,11 +73,9 @@ uint32_t client_get_active_npc(struct Client *client);
 uint16_t client_get_active_quest(struct Client *client);
 struct MapHandleContainer *client_get_map(struct Client *client);
 void client_announce_self_to_map(struct Client *client);
-void client_announce_add_player(struct Client *client, const struct Character *chr);
-void client_announce_add_npc(struct Client *client, const struct Npc *npc);
-void client_announce_monster(struct Client *client, const struct Monster *monster);
 bool client_announce_drop(struct Client *client, uint32_t owner_id, uint32_t dropper_oid, uint8_t type, bool player_drop, const struct Drop *drop);
-bool client_announce_spawn_drop(struct Client *client, uint32_t owner_id, uint32_t dropper_oid, uint8_t type, bool player_drop, const struct Drop *drop);
+// Writes the packet that shows an already dropped \p drop to the client, returns its length or 0 if the client shouldn't see it
+size_t client_spawn_drop_packet(struct Client *client, uint32_t owner_id, uint8_t type, bool player_drop, const struct Drop *drop, uint8_t *packet);
 void client_update_player_pos(struct Client *client, int16_t x, int16_t y, uint16_t fh, uint8_t stance);
 void client_set_hp(struct Client *client, int16_t hp);
 void client_set_hp_now(struct Client *client, int16_t hp);
@@ -152,6 +151,9 @@ struct ClientResult client_launch_portal_script(struct Client *client, const cha
 void client_enable_actions(struct Client *client);
 void client_toggle_auto_pickup(struct Client *client);
 bool client_is_auto_pickup_enabled(struct Client *client);
+void client_ping(struct Client *client);
+void client_pong(struct Client *client);
+uint32_t client_get_rtt(struct Client *client);
 bool client_apply_skill(struct Client *client, uint32_t skill_id, uint8_t *level);
 bool client_add_key(struct Client *client, uint32_t key, uint8_t type, uint32_t action);
 bool client_add_skill_key(struct Client *client, uint32_t key, uint32_t skill_id);
@@ -125,6 +125,26 @@ int channel_config_load(const char *file_name)
     JSON_GET_STRING(ROOT, "listen", &listen);
     CHANNEL_CONFIG.listen = json_object_get_string(listen);
 
+    json_object *item_compactor;
+    if (json_object_object_get_ex(ROOT, "item_compactor", &item_compactor)) {
+        if (json_object_get_type(item_compactor) != json_type_object) {
+            json_object_put(ROOT);
+            return -1;
+        }
+
+        json_object *max_clients;
+        JSON_GET_INT(item_compactor, "max_clients", &max_clients);
+        if (json_object_get_int(max_clients) < 0) {
+            json_object_put(ROOT);
+            return -1;
+        }
+
+        CHANNEL_CONFIG.itemCompactor.enabled = true;
+        CHANNEL_CONFIG.itemCompactor.maxClients = json_object_get_int(max_clients);
+    } else {
+        CHANNEL_CONFIG.itemCompactor.enabled = false;
+    }
+
     return 0;
 }
 
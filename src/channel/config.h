@@ -1,6 +1,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 struct ChannelConfig {
@@ -12,6 +13,12 @@ struct ChannelConfig {
         const char *db;
     } database;
     const char *listen;
+    // Only set in the one channel process that should reclaim deleted items
+    struct {
+        bool enabled;
+        // Compaction pauses while more clients than this are connected
+        uint32_t maxClients;
+    } itemCompactor;
 };
 
 extern struct ChannelConfig CHANNEL_CONFIG;
@@ -1,23 +1,80 @@
 #include "drops.h"
 
+#include <stdatomic.h>
+#include <stdlib.h>
+
 #include <cmph.h>
 
+#include "rcu.h"
+
 struct DropInfoNode {
     uint32_t id;
     struct MonsterDropInfo info;
 };
 
-size_t DROP_INFO_COUNT;
-struct DropInfoNode *DROP_INFOS;
-cmph_t *DROP_INFO_MPH;
+struct DropTable {
+    size_t count;
+    struct DropInfoNode *infos;
+    cmph_t *mph;
+};
+
+struct Drops {
+    struct DropTable monsters;
+    struct DropTable reactors;
+};
 
-size_t REACTOR_DROP_INFO_COUNT;
-struct DropInfoNode *REACTOR_DROP_INFOS;
-cmph_t *REACTOR_DROP_INFO_MPH;
+// Published through RCU so that the workers can look up drops while a reload replaces them
+static _Atomic(struct Drops *) DROPS;
 
+static struct Drops *load_drops(struct DatabaseConnection *conn);
+static void free_drops(struct Drops *drops);
+static void drop_table_build_mph(struct DropTable *table);
+static void drop_table_free(struct DropTable *table);
+static const struct MonsterDropInfo *drop_table_find(const struct DropTable *table, uint32_t id);
 
 int drops_load_from_db(struct DatabaseConnection *conn)
 {
+    struct Drops *drops = load_drops(conn);
+    if (drops == NULL)
+        return -1;
+
+    atomic_store_explicit(&DROPS, drops, memory_order_release);
+    return 0;
+}
+
+int drops_reload(struct DatabaseConnection *conn)
+{
+    struct Drops *drops = load_drops(conn);
+    if (drops == NULL)
+        return -1;
+
+    struct Drops *old = atomic_exchange_explicit(&DROPS, drops, memory_order_acq_rel);
+    rcu_synchronize();
+    free_drops(old);
+    return 0;
+}
+
+void drops_unload(void)
+{
+    free_drops(atomic_exchange_explicit(&DROPS, NULL, memory_order_acq_rel));
+}
+
+const struct MonsterDropInfo *drop_info_find(uint32_t id)
+{
+    return drop_table_find(&atomic_load_explicit(&DROPS, memory_order_acquire)->monsters, id);
+}
+
+const struct MonsterDropInfo *reactor_drop_info_find(uint32_t id)
+{
+    return drop_table_find(&atomic_load_explicit(&DROPS, memory_order_acquire)->reactors, id);
+}
+
+static struct Drops *load_drops(struct DatabaseConnection *conn)
+{
+    struct Drops *drops = calloc(1, sizeof(struct Drops));
+    if (drops == NULL)
+        return NULL;
+
     struct RequestParams params = {
         .type = DATABASE_REQUEST_TYPE_GET_MONSTER_DROPS
     };
@@ -25,168 +82,158 @@ int drops_load_from_db(struct DatabaseConnection *conn)
 
     if (database_request_execute(req, 0) == -1) {
         database_request_destroy(req);
-        return -1;
+        free(drops);
+        return NULL;
     }
 
     const union DatabaseResult *res = database_request_result(req);
-    DROP_INFOS = malloc(res->getMonsterDrops.count * sizeof(struct DropInfoNode));
+    struct DropTable *table = &drops->monsters;
+    table->infos = malloc(res->getMonsterDrops.count * sizeof(struct DropInfoNode));
     for (size_t i = 0; i < res->getMonsterDrops.count; i++) {
         const struct MonsterDrops *monster = &res->getMonsterDrops.monsters[i];
-        DROP_INFOS[DROP_INFO_COUNT].id = monster->id;
-        DROP_INFOS[DROP_INFO_COUNT].info.drops = malloc((monster->itemDrops.count + monster->questItemDrops.count + (monster->mesoDrop.max != 0 ? 1 : 0) + monster->multiItemDrops.count) * sizeof(struct DropInfo));
-        DROP_INFOS[DROP_INFO_COUNT].info.count = 0;
+        struct DropInfoNode *node = &table->infos[table->count];
+        node->id = monster->id;
+        node->info.drops = malloc((monster->itemDrops.count + monster->questItemDrops.count + (monster->mesoDrop.max != 0 ? 1 : 0) + monster->multiItemDrops.count) * sizeof(struct DropInfo));
+        node->info.count = 0;
         for (size_t i = 0; i < monster->itemDrops.count; i++) {
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].itemId = monster->itemDrops.drops[i].itemId;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].isQuest = false;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].min = 1;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].max = 1;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].chance = monster->itemDrops.drops[i].chance;
-            DROP_INFOS[DROP_INFO_COUNT].info.count++;
+            node->info.drops[node->info.count].itemId = monster->itemDrops.drops[i].itemId;
+            node->info.drops[node->info.count].isQuest = false;
+            node->info.drops[node->info.count].min = 1;
+            node->info.drops[node->info.count].max = 1;
+            node->info.drops[node->info.count].chance = monster->itemDrops.drops[i].chance;
+            node->info.count++;
         }
 
         for (size_t i = 0; i < monster->questItemDrops.count; i++) {
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].itemId = monster->questItemDrops.drops[i].itemId;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].isQuest = true;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].questId = monster->questItemDrops.drops[i].questId;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].min = 1;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].max = 1;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].chance = monster->questItemDrops.drops[i].chance;
-            DROP_INFOS[DROP_INFO_COUNT].info.count++;
+            node->info.drops[node->info.count].itemId = monster->questItemDrops.drops[i].itemId;
+            node->info.drops[node->info.count].isQuest = true;
+            node->info.drops[node->info.count].questId = monster->questItemDrops.drops[i].questId;
+            node->info.drops[node->info.count].min = 1;
+            node->info.drops[node->info.count].max = 1;
+            node->info.drops[node->info.count].chance = monster->questItemDrops.drops[i].chance;
+            node->info.count++;
         }
 
         if (monster->mesoDrop.max != 0) {
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].itemId = 0;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].isQuest = false;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].min = monster->mesoDrop.min;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].max = monster->mesoDrop.max;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].chance = monster->mesoDrop.chance;
-            DROP_INFOS[DROP_INFO_COUNT].info.count++;
+            node->info.drops[node->info.count].itemId = 0;
+            node->info.drops[node->info.count].isQuest = false;
+            node->info.drops[node->info.count].min = monster->mesoDrop.min;
+            node->info.drops[node->info.count].max = monster->mesoDrop.max;
+            node->info.drops[node->info.count].chance = monster->mesoDrop.chance;
+            node->info.count++;
         }
 
         for (size_t i = 0; i < monster->multiItemDrops.count; i++) {
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].itemId = monster->multiItemDrops.drops[i].id;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].isQuest = false;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].min = monster->multiItemDrops.drops[i].min;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].max = monster->multiItemDrops.drops[i].max;
-            DROP_INFOS[DROP_INFO_COUNT].info.drops[DROP_INFOS[DROP_INFO_COUNT].info.count].chance = monster->multiItemDrops.drops[i].chance;
-            DROP_INFOS[DROP_INFO_COUNT].info.count++;
+            node->info.drops[node->info.count].itemId = monster->multiItemDrops.drops[i].id;
+            node->info.drops[node->info.count].isQuest = false;
+            node->info.drops[node->info.count].min = monster->multiItemDrops.drops[i].min;
+            node->info.drops[node->info.count].max = monster->multiItemDrops.drops[i].max;
+            node->info.drops[node->info.count].chance = monster->multiItemDrops.drops[i].chance;
+            node->info.count++;
         }
 
-        DROP_INFO_COUNT++;
+        table->count++;
     }
 
     database_request_destroy(req);
 
-    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(DROP_INFOS, sizeof(struct DropInfoNode), offsetof(struct DropInfoNode, id), sizeof(uint32_t), DROP_INFO_COUNT);
-    cmph_config_t *config = cmph_config_new(adapter);
-    cmph_config_set_algo(config, CMPH_BDZ);
-    DROP_INFO_MPH = cmph_new(config);
-    cmph_config_destroy(config);
-    cmph_io_struct_vector_adapter_destroy(adapter);
-
-    size_t i = 0;
-    while (i < DROP_INFO_COUNT) {
-        cmph_uint32 j = cmph_search(DROP_INFO_MPH, (void *)&DROP_INFOS[i].id, sizeof(uint32_t));
-        if (i != j) {
-            struct DropInfoNode temp = DROP_INFOS[j];
-            DROP_INFOS[j] = DROP_INFOS[i];
-            DROP_INFOS[i] = temp;
-        } else {
-            i++;
-        }
-    }
+    drop_table_build_mph(table);
 
     params.type = DATABASE_REQUEST_TYPE_GET_REACTOR_DROPS;
     req = database_request_create(conn, &params);
 
     if (database_request_execute(req, 0) == -1) {
         database_request_destroy(req);
-        return -1;
+        drop_table_free(&drops->monsters);
+        free(drops);
+        return NULL;
     }
 
     res = database_request_result(req);
-    REACTOR_DROP_INFOS = malloc(res->getReactorDrops.count * sizeof(struct DropInfoNode));
+    table = &drops->reactors;
+    table->infos = malloc(res->getReactorDrops.count * sizeof(struct DropInfoNode));
     for (size_t i = 0; i < res->getReactorDrops.count; i++) {
         const struct ReactorDrops *reactor = &res->getReactorDrops.reactors[i];
-        REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].id = reactor->id;
-        REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops = malloc((reactor->itemDrops.count + reactor->questItemDrops.count) * sizeof(struct DropInfo));
-        REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count = 0;
+        struct DropInfoNode *node = &table->infos[table->count];
+        node->id = reactor->id;
+        node->info.drops = malloc((reactor->itemDrops.count + reactor->questItemDrops.count) * sizeof(struct DropInfo));
+        node->info.count = 0;
         for (size_t i = 0; i < reactor->itemDrops.count; i++) {
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].itemId = reactor->itemDrops.drops[i].itemId;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].isQuest = false;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].min = 1;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].max = 1;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].chance = reactor->itemDrops.drops[i].chance;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count++;
+            node->info.drops[node->info.count].itemId = reactor->itemDrops.drops[i].itemId;
+            node->info.drops[node->info.count].isQuest = false;
+            node->info.drops[node->info.count].min = 1;
+            node->info.drops[node->info.count].max = 1;
+            node->info.drops[node->info.count].chance = reactor->itemDrops.drops[i].chance;
+            node->info.count++;
         }
 
         for (size_t i = 0; i < reactor->questItemDrops.count; i++) {
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].itemId = reactor->questItemDrops.drops[i].itemId;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].isQuest = true;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].questId = reactor->questItemDrops.drops[i].questId;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].min = 1;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].max = 1;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.drops[REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count].chance = reactor->questItemDrops.drops[i].chance;
-            REACTOR_DROP_INFOS[REACTOR_DROP_INFO_COUNT].info.count++;
+            node->info.drops[node->info.count].itemId = reactor->questItemDrops.drops[i].itemId;
+            node->info.drops[node->info.count].isQuest = true;
+            node->info.drops[node->info.count].questId = reactor->questItemDrops.drops[i].questId;
+            node->info.drops[node->info.count].min = 1;
+            node->info.drops[node->info.count].max = 1;
+            node->info.drops[node->info.count].chance = reactor->questItemDrops.drops[i].chance;
+            node->info.count++;
         }
 
-        REACTOR_DROP_INFO_COUNT++;
+        table->count++;
     }
 
     database_request_destroy(req);
 
-    adapter = cmph_io_struct_vector_adapter(REACTOR_DROP_INFOS, sizeof(struct DropInfoNode), offsetof(struct DropInfoNode, id), sizeof(uint32_t), REACTOR_DROP_INFO_COUNT);
-    config = cmph_config_new(adapter);
+    drop_table_build_mph(table);
+
+    return drops;
+}
+
+static void free_drops(struct Drops *drops)
+{
+    if (drops == NULL)
+        return;
+
+    drop_table_free(&drops->reactors);
+    drop_table_free(&drops->monsters);
+    free(drops);
+}
+
+static void drop_table_build_mph(struct DropTable *table)
+{
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(table->infos, sizeof(struct DropInfoNode), offsetof(struct DropInfoNode, id), sizeof(uint32_t), table->count);
+    cmph_config_t *config = cmph_config_new(adapter);
     cmph_config_set_algo(config, CMPH_BDZ);
-    REACTOR_DROP_INFO_MPH = cmph_new(config);
+    table->mph = cmph_new(config);
     cmph_config_destroy(config);
     cmph_io_struct_vector_adapter_destroy(adapter);
 
-    i = 0;
-    while (i < REACTOR_DROP_INFO_COUNT) {
-        cmph_uint32 j = cmph_search(REACTOR_DROP_INFO_MPH, (void *)&REACTOR_DROP_INFOS[i].id, sizeof(uint32_t));
+    size_t i = 0;
+    while (i < table->count) {
+        cmph_uint32 j = cmph_search(table->mph, (void *)&table->infos[i].id, sizeof(uint32_t));
         if (i != j) {
-            struct DropInfoNode temp = REACTOR_DROP_INFOS[j];
-            REACTOR_DROP_INFOS[j] = REACTOR_DROP_INFOS[i];
-            REACTOR_DROP_INFOS[i] = temp;
+            struct DropInfoNode temp = table->infos[j];
+            table->infos[j] = table->infos[i];
+            table->infos[i] = temp;
         } else {
             i++;
         }
     }
-
-    return 0;
 }
 
-void drops_unload(void)
+static void drop_table_free(struct DropTable *table)
 {
-    cmph_destroy(REACTOR_DROP_INFO_MPH);
-    for (size_t i = 0; i < REACTOR_DROP_INFO_COUNT; i++) {
-        free(REACTOR_DROP_INFOS[i].info.drops);
+    cmph_destroy(table->mph);
+    for (size_t i = 0; i < table->count; i++) {
+        free(table->infos[i].info.drops);
     }
-    free(REACTOR_DROP_INFOS);
-
-    cmph_destroy(DROP_INFO_MPH);
-    for (size_t i = 0; i < DROP_INFO_COUNT; i++) {
-        free(DROP_INFOS[i].info.drops);
-    }
-    free(DROP_INFOS);
-}
-
-const struct MonsterDropInfo *drop_info_find(uint32_t id)
-{
-    cmph_uint32 index = cmph_search(DROP_INFO_MPH, (void *)&id, sizeof(uint32_t));
-    if (DROP_INFOS[index].id != id)
-        return NULL;
-
-    return &DROP_INFOS[index].info;
+    free(table->infos);
 }
 
-const struct MonsterDropInfo *reactor_drop_info_find(uint32_t id)
+static const struct MonsterDropInfo *drop_table_find(const struct DropTable *table, uint32_t id)
 {
-    cmph_uint32 index = cmph_search(REACTOR_DROP_INFO_MPH, (void *)&id, sizeof(uint32_t));
-    if (REACTOR_DROP_INFOS[index].id != id)
+    cmph_uint32 index = cmph_search(table->mph, (void *)&id, sizeof(uint32_t));
+    if (table->infos[index].id != id)
         return NULL;
 
-    return &REACTOR_DROP_INFOS[index].info;
+    return &table->infos[index].info;
 }
 
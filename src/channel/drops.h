@@ -21,6 +21,11 @@ struct MonsterDropInfo {
 };
 
 int drops_load_from_db(struct DatabaseConnection *conn);
+/**
+ * Loads the drop tables again and swaps them in. Lookups keep working while this runs,
+ * the old tables are freed once no worker can still be reading them.
+ */
+int drops_reload(struct DatabaseConnection *conn);
 void drops_unload(void);
 const struct MonsterDropInfo *drop_info_find(uint32_t id);
 const struct MonsterDropInfo *reactor_drop_info_find(uint32_t id);
@@ -0,0 +1,211 @@
+#include "item-compactor.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#include <poll.h>
+
+#include "client.h"
+#include "timing.h"
+
+// Number of rows deleted by a single statement
+#define COMPACTION_BATCH_SIZE 500
+// The compactor sleeps this many times the duration of the last batch before running the next one,
+// so it never takes more than a tenth of the database's time even when it is under load
+#define COMPACTION_THROTTLE_FACTOR 9
+#define COMPACTION_MIN_DELAY_MS 10
+// How long to wait before checking for deleted rows again once everything was reclaimed
+#define COMPACTION_IDLE_DELAY_MS (60 * 1000)
+#define COMPACTION_ERROR_DELAY_MS (10 * 1000)
+// How long to wait before checking the number of connected clients again
+#define COMPACTION_BUSY_DELAY_MS (60 * 1000)
+
+struct ItemCompactor {
+    struct DatabaseConnection *conn;
+    size_t maxClients;
+    OnLog *onLog;
+    thrd_t thread;
+    mtx_t mtx;
+    cnd_t cnd;
+    bool stop;
+};
+
+static int compactor_thread(void *ctx);
+static int64_t compact_batch(struct DatabaseConnection *conn);
+static bool compactor_wait(struct ItemCompactor *compactor, uint64_t msec);
+
+struct ItemCompactor *item_compactor_start(struct DatabaseConnection *conn, size_t max_clients, OnLog *on_log)
+{
+    if (conn == NULL)
+        return NULL;
+
+    struct ItemCompactor *compactor = malloc(sizeof(struct ItemCompactor));
+    if (compactor == NULL) {
+        database_connection_destroy(conn);
+        return NULL;
+    }
+
+    compactor->conn = conn;
+    compactor->maxClients = max_clients;
+    compactor->onLog = on_log;
+    compactor->stop = false;
+
+    if (mtx_init(&compactor->mtx, mtx_plain) != thrd_success) {
+        free(compactor);
+        database_connection_destroy(conn);
+        return NULL;
+    }
+
+    if (cnd_init(&compactor->cnd) != thrd_success) {
+        mtx_destroy(&compactor->mtx);
+        free(compactor);
+        database_connection_destroy(conn);
+        return NULL;
+    }
+
+    if (thrd_create(&compactor->thread, compactor_thread, compactor) != thrd_success) {
+        cnd_destroy(&compactor->cnd);
+        mtx_destroy(&compactor->mtx);
+        free(compactor);
+        database_connection_destroy(conn);
+        return NULL;
+    }
+
+    return compactor;
+}
+
+void item_compactor_stop(struct ItemCompactor *compactor)
+{
+    if (compactor == NULL)
+        return;
+
+    mtx_lock(&compactor->mtx);
+    compactor->stop = true;
+    cnd_signal(&compactor->cnd);
+    mtx_unlock(&compactor->mtx);
+
+    thrd_join(compactor->thread, NULL);
+    cnd_destroy(&compactor->cnd);
+    mtx_destroy(&compactor->mtx);
+    database_connection_destroy(compactor->conn);
+    free(compactor);
+}
+
+static int compactor_thread(void *ctx)
+{
+    struct ItemCompactor *compactor = ctx;
+    uint64_t reclaimed = 0;
+    struct timespec run_start;
+    clock_gettime(CLOCK_MONOTONIC, &run_start);
+
+    while (true) {
+        // Deleted rows can wait, so the database is left to the players' saves while the channel is busy
+        if (clients_get_count() > compactor->maxClients) {
+            if (!compactor_wait(compactor, COMPACTION_BUSY_DELAY_MS))
+                break;
+            continue;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int64_t deleted = compact_batch(compactor->conn);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        uint64_t delay;
+        if (deleted < 0) {
+            compactor->onLog(LOG_ERR, "Item compaction failed\n");
+            delay = COMPACTION_ERROR_DELAY_MS;
+        } else if (deleted < COMPACTION_BATCH_SIZE) {
+            // Caught up with the saves
+            reclaimed += deleted;
+            if (reclaimed > 0) {
+                uint64_t ms = timing_elapsed_ms(&run_start, &end);
+                compactor->onLog(LOG_OUT, "Item compaction reclaimed %" PRIu64 " rows in %" PRIu64 " ms (%" PRIu64 " rows/s)\n",
+                        reclaimed, ms, ms > 0 ? reclaimed * 1000 / ms : reclaimed);
+            }
+
+            reclaimed = 0;
+            delay = COMPACTION_IDLE_DELAY_MS;
+        } else {
+            reclaimed += deleted;
+            // A slow batch means that the database is busy, back off accordingly
+            delay = timing_elapsed_ms(&start, &end) * COMPACTION_THROTTLE_FACTOR;
+            if (delay < COMPACTION_MIN_DELAY_MS)
+                delay = COMPACTION_MIN_DELAY_MS;
+        }
+
+        if (!compactor_wait(compactor, delay))
+            break;
+
+        if (reclaimed == 0)
+            clock_gettime(CLOCK_MONOTONIC, &run_start);
+    }
+
+    return 0;
+}
+
+static int64_t compact_batch(struct DatabaseConnection *conn)
+{
+    struct RequestParams params = {
+        .type = DATABASE_REQUEST_TYPE_COMPACT_ITEMS,
+        .compactItems = {
+            .batchSize = COMPACTION_BATCH_SIZE
+        }
+    };
+
+    struct DatabaseRequest *req = database_request_create(conn, &params);
+    if (req == NULL)
+        return -1;
+
+    // The connection is owned by this thread so it is fine to just block on it
+    int status = database_request_execute(req, 0);
+    while (status > 0) {
+        struct pollfd fd = {
+            .fd = database_connection_get_fd(conn),
+            .events = status
+        };
+
+        if (poll(&fd, 1, -1) == -1) {
+            database_request_destroy(req);
+            return -1;
+        }
+
+        status = database_request_execute(req, fd.revents);
+    }
+
+    if (status < 0) {
+        database_request_destroy(req);
+        return -1;
+    }
+
+    int64_t deleted = database_request_result(req)->compactItems.deleted;
+    database_request_destroy(req);
+    return deleted;
+}
+
+// Returns false if the compactor was stopped while waiting
+static bool compactor_wait(struct ItemCompactor *compactor, uint64_t msec)
+{
+    struct timespec deadline;
+    timespec_get(&deadline, TIME_UTC);
+    deadline.tv_sec += msec / 1000;
+    deadline.tv_nsec += (msec % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    mtx_lock(&compactor->mtx);
+    while (!compactor->stop) {
+        if (cnd_timedwait(&compactor->cnd, &compactor->mtx, &deadline) == thrd_timedout)
+            break;
+    }
+    bool running = !compactor->stop;
+    mtx_unlock(&compactor->mtx);
+
+    return running;
+}
+
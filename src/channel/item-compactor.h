@@ -0,0 +1,29 @@
+#ifndef ITEM_COMPACTOR_H
+#define ITEM_COMPACTOR_H
+
+#include <stddef.h>
+
+#include "../database.h"
+#include "server.h"
+
+/**
+ * A background thread that deletes the `Items` rows (and their dependent rows) that saves left marked as deleted.
+ * It works in small batches on its own connection and throttles itself so that it never holds up live saves.
+ * It only runs while few clients are connected, and only one process per database should start it.
+ */
+struct ItemCompactor;
+
+/**
+ * Starts the compactor.
+ *
+ * \param conn A connection that is used exclusively by the compactor. The compactor takes ownership of it.
+ * \param max_clients Compaction pauses while more clients than this are connected to this process.
+ * \param on_log Where progress and failures are reported.
+ *
+ * \returns The compactor or NULL on failure in which case \p conn is destroyed.
+ */
+struct ItemCompactor *item_compactor_start(struct DatabaseConnection *conn, size_t max_clients, OnLog *on_log);
+void item_compactor_stop(struct ItemCompactor *compactor);
+
+#endif
+
@@ -15,13 +15,17 @@
 #include "../packet.h"
 #include "../party.h"
 #include "../reader.h"
+#include "character-cache.h"
 #include "client.h"
 #include "config.h"
 #include "drops.h"
 #include "events.h"
+#include "item-compactor.h"
 #include "map.h"
+#include "reloader.h"
 #include "server.h"
 #include "shop.h"
+#include "startup.h"
 
 #define ACCOUNT_MAX_NAME_LENGTH 12
 #define ACCOUNT_MAX_PASSWORD_LENGTH 12
@@ -35,6 +39,39 @@ struct GlobalContext {
     struct ScriptManager *reactorManager;
 };
 
+enum StartupTaskIndex {
+    STARTUP_TASK_DROPS,
+    STARTUP_TASK_SHOPS,
+    STARTUP_TASK_WZ,
+    STARTUP_TASK_SERVER,
+    STARTUP_TASK_QUEST_SCRIPTS,
+    STARTUP_TASK_PORTAL_SCRIPTS,
+    STARTUP_TASK_MAP_SCRIPTS,
+    STARTUP_TASK_NPC_SCRIPTS,
+    STARTUP_TASK_REACTOR_SCRIPTS,
+    STARTUP_TASK_COUNT
+};
+
+#define AFTER(task) ((uint32_t)1 << (task))
+
+struct ScriptManagerTask {
+    struct ScriptManager **manager;
+    const char *dir;
+    size_t entryPointCount;
+    struct ScriptEntryPoint entryPoints[2];
+};
+
+static int load_drops(void *ctx);
+static void unload_drops(void *ctx);
+static int load_shops(void *ctx);
+static void unload_shops(void *ctx);
+static int load_wz(void *ctx);
+static void unload_wz(void *ctx);
+static int create_server(void *ctx);
+static void destroy_server(void *ctx);
+static int create_script_manager(void *ctx);
+static void destroy_script_manager(void *ctx);
+
 static void on_log(enum LogType type, const char *fmt, ...);
 
 static void *create_context(void);
@@ -48,51 +85,36 @@ static void on_unassigned_client_packet(struct Session *session, size_t size, ui
 static void on_client_resume(struct Session *session, int fd, int status);
 static int on_room_create(struct Room *room, void *thread_ctx);
 static void on_room_destroy(struct Room *room);
+static int on_room_reset(struct Room *room);
+static void on_room_tick(struct Room *room);
 static void on_client_command(struct Session *session, void *cmd);
 static void on_client_timer(struct Session *session);
 
 static void on_sigint(int sig);
+static void on_sighup(int sig);
 
 struct ChannelServer *SERVER;
+static struct Reloader *RELOADER;
 
-int main(void)
+int main(int argc, char **argv)
 {
-    if (channel_config_load("channel/config.json") == -1)
-        return -1;
-    const char *ip;
-    const char *socket;
-    struct in_addr addr4;
-    struct in6_addr addr6;
-    if (inet_pton(AF_INET, CHANNEL_CONFIG.database.host, &addr4) == 1 || inet_pton(AF_INET6, CHANNEL_CONFIG.database.host, &addr6) == 1) {
-        ip = CHANNEL_CONFIG.database.host;
-        socket = NULL;
-    } else {
-        ip = NULL;
-        socket = CHANNEL_CONFIG.database.host;
-    }
+    // `channel wz compile` writes the WZ snapshot and exits
+    if (argc == 3 && !strcmp(argv[1], "wz") && !strcmp(argv[2], "compile"))
+        return wz_compile() == 0 ? 0 : -1;
 
-    struct DatabaseConnection *conn = database_connection_create(ip, CHANNEL_CONFIG.database.user, CHANNEL_CONFIG.database.password, CHANNEL_CONFIG.database.db, CHANNEL_CONFIG.database.port, socket);
-    if (conn == NULL) {
-        channel_config_unload();
-        return -1;
-    }
-    int ret = drops_load_from_db(conn);
-    if (ret == -1) {
-        channel_config_unload();
-        return -1;
-    }
+    // `channel wz bench` measures foothold lookups on the real maps
+    if (argc == 3 && !strcmp(argv[1], "wz") && !strcmp(argv[2], "bench"))
+        return wz_benchmark_footholds() == 0 ? 0 : -1;
 
-    ret = shops_load_from_db(conn);
-    database_connection_destroy(conn);
-    if (ret == -1) {
-        drops_unload();
-        channel_config_unload();
+    // `channel wz selftest` checks the quest requirement compiler
+    if (argc == 3 && !strcmp(argv[1], "wz") && !strcmp(argv[2], "selftest"))
+        return wz_self_test() == 0 ? 0 : -1;
+
+    if (channel_config_load("channel/config.json") == -1)
         return -1;
-    }
 
-    if (wz_init() != 0) {
-        shops_unload();
-        drops_unload();
+    // The startup tasks connect to the database concurrently
+    if (database_init() == -1) {
         channel_config_unload();
         return -1;
     }
@@ -101,68 +123,68 @@ int main(void)
 
     enum ScriptValueType arg1 = SCRIPT_VALUE_TYPE_USERDATA;
     enum ScriptValueType arg2 = SCRIPT_VALUE_TYPE_USERDATA;
-    struct ScriptEntryPoint eps[] = {
-        {
-            .name = "start",
-            .argCount = 1,
-            .args = &arg1,
-        },
-        {
-            .name = "end_",
-            .argCount = 1,
-            .args = &arg2,
+    struct ScriptManagerTask quest_scripts = {
+        .manager = &ctx.questManager,
+        .dir = "script/quest",
+        .entryPointCount = 2,
+        .entryPoints = {
+            {
+                .name = "start",
+                .argCount = 1,
+                .args = &arg1,
+            },
+            {
+                .name = "end_",
+                .argCount = 1,
+                .args = &arg2,
+            }
         }
     };
+    struct ScriptManagerTask portal_scripts = {
+        .manager = &ctx.portalManager,
+        .dir = "script/portal",
+        .entryPointCount = 1,
+        .entryPoints = { { .name = "enter", .argCount = 1, .args = &arg1 } }
+    };
+    struct ScriptManagerTask map_scripts = {
+        .manager = &ctx.mapManager,
+        .dir = "script/map/onUserEnter",
+        .entryPointCount = 1,
+        .entryPoints = { { .name = "enter", .argCount = 1, .args = &arg1 } }
+    };
+    struct ScriptManagerTask npc_scripts = {
+        .manager = &ctx.npcManager,
+        .dir = "script/npc",
+        .entryPointCount = 1,
+        .entryPoints = { { .name = "talk", .argCount = 1, .args = &arg1 } }
+    };
+    struct ScriptManagerTask reactor_scripts = {
+        .manager = &ctx.reactorManager,
+        .dir = "script/reactor",
+        .entryPointCount = 1,
+        .entryPoints = { { .name = "act", .argCount = 1, .args = &arg1 } }
+    };
 
-    SERVER = channel_server_create(7575, on_log, CHANNEL_CONFIG.listen, create_context, destroy_context, on_client_connect, on_client_disconnect, on_client_join, on_unassigned_client_packet, on_client_packet, on_room_create, on_room_destroy, on_client_command, on_client_timer, &ctx, 8);
-    if (SERVER == NULL)
-        return -1;
-
-    ctx.questManager = script_manager_create(SERVER, "script/quest", "def.lua", 2, eps);
-    if (ctx.questManager == NULL) {
-        wz_terminate();
-        return -1;
-    }
-
-    eps->name = "enter";
-    ctx.portalManager = script_manager_create(SERVER, "script/portal", "def.lua", 1, eps);
-    if (ctx.portalManager == NULL) {
-        script_manager_destroy(ctx.questManager);
-        wz_terminate();
-        return -1;
-    }
-
-    ctx.mapManager = script_manager_create(SERVER, "script/map/onUserEnter", "def.lua", 1, eps);
-    if (ctx.mapManager == NULL) {
-        script_manager_destroy(ctx.portalManager);
-        script_manager_destroy(ctx.questManager);
-        wz_terminate();
-        return -1;
-    }
-
-    eps->name = "talk";
-    ctx.npcManager = script_manager_create(SERVER, "script/npc", "def.lua", 1, eps);
-    if (ctx.npcManager == NULL) {
-        script_manager_destroy(ctx.mapManager);
-        script_manager_destroy(ctx.portalManager);
-        script_manager_destroy(ctx.questManager);
-        wz_terminate();
-        return -1;
-    }
+    // The database loads, the WZ parsing and the script compilation don't depend on each other
+    const struct StartupTask tasks[] = {
+        [STARTUP_TASK_DROPS] = { "drops", 0, load_drops, unload_drops, NULL },
+        [STARTUP_TASK_SHOPS] = { "shops", 0, load_shops, unload_shops, NULL },
+        [STARTUP_TASK_WZ] = { "wz", 0, load_wz, unload_wz, NULL },
+        [STARTUP_TASK_SERVER] = { "server", 0, create_server, destroy_server, &ctx },
+        [STARTUP_TASK_QUEST_SCRIPTS] = { "scripts/quest", AFTER(STARTUP_TASK_SERVER), create_script_manager, destroy_script_manager, &quest_scripts },
+        [STARTUP_TASK_PORTAL_SCRIPTS] = { "scripts/portal", AFTER(STARTUP_TASK_SERVER), create_script_manager, destroy_script_manager, &portal_scripts },
+        [STARTUP_TASK_MAP_SCRIPTS] = { "scripts/map", AFTER(STARTUP_TASK_SERVER), create_script_manager, destroy_script_manager, &map_scripts },
+        [STARTUP_TASK_NPC_SCRIPTS] = { "scripts/npc", AFTER(STARTUP_TASK_SERVER), create_script_manager, destroy_script_manager, &npc_scripts },
+        [STARTUP_TASK_REACTOR_SCRIPTS] = { "scripts/reactor", AFTER(STARTUP_TASK_SERVER), create_script_manager, destroy_script_manager, &reactor_scripts },
+    };
 
-    eps->name = "act";
-    ctx.reactorManager = script_manager_create(SERVER, "script/reactor", "def.lua", 1, eps);
-    if (ctx.reactorManager == NULL) {
-        script_manager_destroy(ctx.npcManager);
-        script_manager_destroy(ctx.mapManager);
-        script_manager_destroy(ctx.portalManager);
-        script_manager_destroy(ctx.questManager);
-        wz_terminate();
+    if (startup_run(STARTUP_TASK_COUNT, tasks) == -1) {
+        database_terminate();
+        channel_config_unload();
         return -1;
     }
 
     // TODO: Failure check
-    event_global_respawn_init(SERVER);
     event_boat_init(SERVER);
     event_train_init(SERVER);
     event_genie_init(SERVER);
@@ -171,21 +193,105 @@ int main(void)
 
     parties_init();
     clients_init();
+    character_cache_init();
+    struct ItemCompactor *compactor = NULL;
+    if (CHANNEL_CONFIG.itemCompactor.enabled) {
+        compactor = item_compactor_start(create_context(), CHANNEL_CONFIG.itemCompactor.maxClients, on_log);
+        if (compactor == NULL)
+            fprintf(stderr, "Failed to start the item compactor, deleted items will not be reclaimed\n");
+    }
+
+    RELOADER = reloader_start(create_context());
+    if (RELOADER == NULL)
+        fprintf(stderr, "Failed to start the reloader, drops and shops can't be reloaded without a restart\n");
 
     // Doesn't matter which thread will get the signal
     signal(SIGINT, on_sigint);
+    // `kill -HUP` reloads the drops and shops from the database
+    signal(SIGHUP, on_sighup);
     channel_server_start(SERVER);
+    signal(SIGHUP, SIG_IGN);
+    reloader_stop(RELOADER);
+    item_compactor_stop(compactor);
     channel_server_destroy(SERVER);
     script_manager_destroy(ctx.reactorManager);
     script_manager_destroy(ctx.mapManager);
     script_manager_destroy(ctx.npcManager);
     script_manager_destroy(ctx.portalManager);
     script_manager_destroy(ctx.questManager);
+    character_cache_terminate();
     clients_terminate();
     parties_terminate();
     wz_terminate();
     shops_unload();
     drops_unload();
+    database_terminate();
+}
+
+static int load_drops(void *ctx)
+{
+    struct DatabaseConnection *conn = create_context();
+    if (conn == NULL)
+        return -1;
+
+    int ret = drops_load_from_db(conn);
+    database_connection_destroy(conn);
+    return ret;
+}
+
+static void unload_drops(void *ctx)
+{
+    drops_unload();
+}
+
+static int load_shops(void *ctx)
+{
+    struct DatabaseConnection *conn = create_context();
+    if (conn == NULL)
+        return -1;
+
+    int ret = shops_load_from_db(conn);
+    database_connection_destroy(conn);
+    return ret;
+}
+
+static void unload_shops(void *ctx)
+{
+    shops_unload();
+}
+
+static int load_wz(void *ctx)
+{
+    return wz_init() == 0 ? 0 : -1;
+}
+
+static void unload_wz(void *ctx)
+{
+    wz_terminate();
+}
+
+static int create_server(void *ctx)
+{
+    SERVER = channel_server_create(7575, on_log, CHANNEL_CONFIG.listen, create_context, destroy_context, on_client_connect, on_client_disconnect, on_client_join, on_unassigned_client_packet, on_client_packet, on_room_create, on_room_destroy, on_room_reset, on_room_tick, on_client_command, on_client_timer, ctx, 7);
+    return SERVER == NULL ? -1 : 0;
+}
+
+static void destroy_server(void *ctx)
+{
+    channel_server_destroy(SERVER);
+}
+
+static int create_script_manager(void *ctx)
+{
+    struct ScriptManagerTask *task = ctx;
+    *task->manager = script_manager_create(SERVER, task->dir, "def.lua", task->entryPointCount, task->entryPoints);
+    return *task->manager == NULL ? -1 : 0;
+}
+
+static void destroy_script_manager(void *ctx)
+{
+    struct ScriptManagerTask *task = ctx;
+    script_manager_destroy(*task->manager);
 }
 
 static void on_log(enum LogType type, const char *fmt, ...)
@@ -262,6 +368,10 @@ static void on_client_packet(struct Session *session, size_t size, uint8_t *pack
     packet += 2;
     size -= 2;
     switch (opcode) {
+    case RECEIVE_OPCODE_PONG:
+        client_pong(client);
+    break;
+
     case RECEIVE_OPCODE_PORTAL: {
         uint32_t target;
         uint16_t len = PORTAL_INFO_NAME_MAX_LENGTH;
@@ -484,11 +594,10 @@ static void on_client_packet(struct Session *session, size_t size, uint8_t *pack
             session_broadcast_to_room(session, len, packet);
         }
 
-        for (uint8_t i = 0; i < monster_count; i++) {
-            uint32_t killed = map_damage_monster_by(map, client_get_map(client)->player, chr->id, oids[i], hit_count, damage + i * hit_count);
-            if (killed != -1)
-                client_kill_monster(client, killed);
-        }
+        uint32_t killed[15];
+        size_t killed_count = map_apply_attack(map, client_get_map(client)->player, monster_count, oids, hit_count, damage, killed);
+        for (size_t i = 0; i < killed_count; i++)
+            client_kill_monster(client, killed[i]);
     }
     break;
 
@@ -547,11 +656,10 @@ static void on_client_packet(struct Session *session, size_t size, uint8_t *pack
             session_broadcast_to_room(session, len, packet);
         }
 
-        for (uint8_t i = 0; i < monster_count; i++) {
-            uint32_t killed = map_damage_monster_by(map, client_get_map(client)->player, chr->id, oids[i], hit_count, damage + i * hit_count);
-            if (killed != -1)
-                client_kill_monster(client, killed);
-        }
+        uint32_t killed[15];
+        size_t killed_count = map_apply_attack(map, client_get_map(client)->player, monster_count, oids, hit_count, damage, killed);
+        for (size_t i = 0; i < killed_count; i++)
+            client_kill_monster(client, killed[i]);
     }
     break;
 
@@ -604,11 +712,10 @@ static void on_client_packet(struct Session *session, size_t size, uint8_t *pack
             session_broadcast_to_room(session, len, packet);
         }
 
-        for (uint8_t i = 0; i < monster_count; i++) {
-            uint32_t killed = map_damage_monster_by(map, client_get_map(client)->player, chr->id, oids[i], hit_count, damage + i * hit_count);
-            if (killed != -1)
-                client_kill_monster(client, killed);
-        }
+        uint32_t killed[15];
+        size_t killed_count = map_apply_attack(map, client_get_map(client)->player, monster_count, oids, hit_count, damage, killed);
+        for (size_t i = 0; i < killed_count; i++)
+            client_kill_monster(client, killed[i]);
 
     }
     break;
@@ -1560,10 +1667,14 @@ static void on_client_timer(struct Session *session)
 {
     struct Client *client = session_get_context(session);
 
-    if (client_save_start(client) == -1)
+    if (client_save_start(client) == -1) {
         // Kick immediatly, as to not let the player lose any further progress
         // hopefuly the database flush will succeed when kicking the player
         session_kick(session);
+        return;
+    }
+
+    client_ping(client);
 }
 
 static void on_unassigned_client_packet(struct Session *session, size_t size, uint8_t *packet)
@@ -1673,9 +1784,24 @@ static void on_room_destroy(struct Room *room)
     map_destroy(room_get_context(room));
 }
 
+static int on_room_reset(struct Room *room)
+{
+    return map_reset(room_get_context(room));
+}
+
+static void on_room_tick(struct Room *room)
+{
+    map_respawn(room_get_context(room));
+}
+
 static void on_sigint(int sig)
 {
     channel_server_stop(SERVER);
     signal(sig, SIG_DFL);
 }
 
+static void on_sighup(int sig)
+{
+    reloader_trigger(RELOADER);
+}
+
@@ -2,17 +2,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <time.h>
 
 #include <unistd.h>
 #include <sys/eventfd.h>
 
-#define XXH_INLINE_ALL
-#include <xxhash.h>
-
 #include "../hash-map.h"
 #include "../packet.h"
 #include "../wz.h"
+#include "arena.h"
 #include "client.h"
 #include "drops.h"
 #include "events.h"
@@ -38,20 +38,34 @@ struct MapObject {
     size_t index2; // Currently used for the index of the drop in a drop batch while 'index' is used for the drop batch index itself
 };
 
+// The low 16 bits of an oid index directly into the slot array, the upper ones hold the slot's generation
+// which is bumped every time the slot is reused. The top bit is always set to keep the oids far from the character IDs
+#define OBJECT_LIST_GENERATION_MASK 0x7FFF
+#define OBJECT_LIST_OID(slot, generation) (0x80000000 | ((uint32_t)(generation) << 16) | (uint32_t)(slot))
+
 struct ObjectList {
-    size_t objectCapacity;
+    size_t capacity;
+    // Slots below this have been handed out at least once
+    size_t slotCount;
     size_t objectCount;
-    size_t freeStackCapacity;
     size_t freeStackTop;
     struct MapObject *objects;
-    uint32_t *freeStack;
+    uint16_t *freeStack;
 };
 
+// Monsters are referred to by their index in map->monsters, so that growing the array doesn't invalidate anything
+#define MAP_MONSTER_NONE SIZE_MAX
+
 struct MapPlayer {
+    // Index in map->players
+    size_t index;
     struct MapHandleContainer *container;
     struct ControllerHeapNode *node;
+    // Smoothed round-trip time to the client in milliseconds, 0 if it isn't known yet
+    uint32_t rtt;
     size_t monsterCount;
-    struct MapMonster **monsters;
+    // Head of the list of the monsters this player controls, linked through MapMonster::nextControlled
+    size_t firstMonster;
     // Drops that this player owns
     size_t dropCapacity;
     size_t dropCount;
@@ -73,9 +87,11 @@ struct Spawner {
 
 struct MapMonster {
     struct Monster monster;
+    const struct MobInfo *stats;
     size_t spawnerIndex;
     struct MapPlayer *controller;
-    size_t indexInController;
+    size_t prevControlled;
+    size_t nextControlled;
 };
 
 struct Reactor {
@@ -85,6 +101,20 @@ struct Reactor {
     int16_t y;
     uint8_t state;
     bool keepAlive;
+    // Only set while the reactor waits to respawn
+    struct TimerHandle *respawnTimer;
+    uint64_t respawnAt;
+};
+
+// The immutable WZ data of a map, resolved once in map_create() so that
+// the hot paths don't have to look up the same IDs over and over.
+// Drop tables aren't cached here as a reload may free them once the current callback returns
+struct MapStatic {
+    const struct MapInfo *info;
+    // Parallel to Map::spawners
+    const struct MobInfo **spawnerStats;
+    // Parallel to MapInfo::reactors
+    const struct ReactorInfo **reactorInfos;
 };
 
 static int object_list_init(struct ObjectList *list);
@@ -93,9 +123,17 @@ static struct MapObject *object_list_allocate(struct ObjectList *list);
 static void object_list_free(struct ObjectList *list, uint32_t oid);
 static struct MapObject *object_list_get(struct ObjectList *list, uint32_t oid);
 
+// Every this many milliseconds of round-trip time weigh as much as controlling one more monster
+#define CONTROLLER_RTT_PER_MONSTER 25
+// A controller only hands monsters off to the least loaded one when their loads are further apart than this,
+// otherwise RTT jitter would keep moving monsters back and forth between two similar clients
+#define CONTROLLER_HANDOFF_MARGIN 4
+
+// Ordered by the number of monsters the controller has plus its latency penalty,
+// map_control_monster() and map_uncontrol_monster() keep it up to date
 struct ControllerHeapNode {
     size_t index;
-    size_t controlleeCount;
+    size_t latencyPenalty;
     struct MapPlayer *controller;
 };
 
@@ -107,8 +145,9 @@ struct ControllerHeap {
 
 static int heap_init(struct ControllerHeap *heap);
 static void heap_destroy(struct ControllerHeap *heap);
-static struct ControllerHeapNode *heap_push(struct ControllerHeap *heap, size_t count, struct MapPlayer *client);
-static size_t heap_inc(struct ControllerHeap *heap, size_t count);
+static size_t heap_key(const struct ControllerHeapNode *node);
+static struct ControllerHeapNode *heap_push(struct ControllerHeap *heap, size_t penalty, struct MapPlayer *client);
+static void heap_update(struct ControllerHeap *heap, struct ControllerHeapNode *node);
 static void heap_remove(struct ControllerHeap *heap, struct ControllerHeapNode *node);
 static struct ControllerHeapNode *heap_top(struct ControllerHeap *heap);
 
@@ -121,6 +160,8 @@ struct DroppingBatch {
     size_t indexInPlayer;
     uint32_t ownerId;
     uint32_t dropperOid;
+    struct DroppingBatch *prevOwned;
+    struct DroppingBatch *nextOwned;
     struct Drop drops[];
 };
 
@@ -130,22 +171,64 @@ struct DropBatch {
     struct MapPlayer *owner;
     size_t indexInPlayer;
     uint32_t ownerId;
+    struct DropBatch *prevOwned;
+    struct DropBatch *nextOwned;
     bool exclusive;
+    // Deadlines on the map_now() clock, so that a dormant map can catch up without its timers
+    uint64_t exclusiveUntil;
+    uint64_t expiresAt;
     struct Drop drops[];
 };
 
+// Every live batch by the character that owns it, so that the owner can claim them on map_join() without going through all the drops
+struct OwnedBatches {
+    uint32_t ownerId;
+    struct DropBatch *drops;
+    struct DroppingBatch *droppings;
+};
+
+static struct OwnedBatches *owned_batches_get_or_insert(struct HashSetU32 *set, uint32_t owner_id);
+static void owned_batches_link_drop(struct OwnedBatches *owned, struct DropBatch *batch);
+static void owned_batches_link_dropping(struct OwnedBatches *owned, struct DroppingBatch *batch);
+static void owned_batches_unlink_drop(struct HashSetU32 *set, struct DropBatch *batch);
+static void owned_batches_unlink_dropping(struct HashSetU32 *set, struct DroppingBatch *batch);
+
+// In milliseconds
+#define DROP_EXCLUSIVE_TIME (15 * 1000)
+#define DROP_EXPIRE_TIME (300 * 1000)
+#define REACTOR_RESPAWN_TIME 3000
+
+#define MAP_ARENA_CHUNK_SIZE 4096
+
+// A snapshot holds everything a joining player has to be told about as back to back packets in the format of session_write_batch()
+#define SNAPSHOT_RECORD_LENGTH(len) (sizeof(uint16_t) + (len))
+#define SPAWN_DROP_PACKET_MAX_LENGTH (SPAWN_ITEM_DROP_PACKET_LENGTH > SPAWN_MESO_DROP_PACKET_LENGTH ? SPAWN_ITEM_DROP_PACKET_LENGTH : SPAWN_MESO_DROP_PACKET_LENGTH)
+
+struct Snapshot {
+    size_t len;
+    uint8_t *data;
+};
+
+static uint8_t *snapshot_packet(struct Snapshot *snapshot);
+static void snapshot_commit(struct Snapshot *snapshot, size_t len);
+
 struct Map {
+    struct Arena *arena;
     struct Room *room;
-    uint32_t respawnListener;
     uint32_t listener;
+    bool listening;
     struct ChannelServer *server;
     size_t playerCapacity;
     size_t playerCount;
-    struct MapPlayer *players;
+    // Each player is allocated separately so that pointers to it stay valid when the array grows
+    struct MapPlayer **players;
+    struct MapStatic *statics;
     const struct FootholdRTree *footholdTree;
     struct ObjectList objectList;
     size_t npcCount;
     struct Npc *npcs;
+    // NPCs never change so their part of the join snapshot is built once
+    struct Snapshot npcSnapshot;
     size_t spawnerCount;
     struct Spawner *spawners;
     size_t monsterCapacity;
@@ -156,6 +239,9 @@ struct Map {
     struct ControllerHeap heap;
     size_t reactorCount;
     struct Reactor *reactors;
+    // Rebuilt on the next join after any reactor changed its state
+    struct Snapshot reactorSnapshot;
+    bool reactorSnapshotDirty;
     struct ScriptManager *reactorManager;
     size_t droppingBatchCapacity;
     size_t droppingBatchCount;
@@ -164,12 +250,20 @@ struct Map {
     size_t dropBatchStart;
     size_t dropBatchEnd;
     struct DropBatch **dropBatches;
+    struct HashSetU32 *ownedBatches; // Uses struct OwnedBatches
     bool *occupiedSeats;
+    // Area boss maps decide whether to spawn their boss when they are created, so they can't be reused
+    bool areaBoss;
+    // A map without players goes dormant: instead of running the drop and reactor timers it only keeps their deadlines
+    // and catches up on everything that came due once a player joins or the last deadline passes
+    struct TimerHandle *dormancyTimer;
+    uint64_t dormantUntil;
+    bool respawnPending;
     struct Spawner bossSpawner;
     struct MapMonster boss;
 };
 
-static void on_respawn(void *ctx);
+static size_t map_respawn_monsters(struct Map *map, struct ControllerHeapNode *next);
 
 static void dock_undock_boat(void *ctx);
 static void start_sailing(void *ctx);
@@ -189,33 +283,72 @@ static void end_subway(void *ctx);
 
 static void respawn_boss(void *ctx);
 
+struct TransportListener {
+    size_t event;
+    uint32_t property;
+    void (*f)(void *ctx);
+};
+
+static bool map_transport_listener(uint32_t id, struct TransportListener *l);
+static void map_listen(struct Map *map);
+static void map_unlisten(struct Map *map);
+
+static struct MapStatic *map_static_create(struct Arena *arena, const struct MapInfo *info);
+static void map_spawn_initial_monsters(struct Map *map);
+static void map_monster_die(struct Map *map, struct MapPlayer *player, struct MapObject *object);
 static void map_kill_monster(struct Map *map, uint32_t oid);
+static void map_control_monster(struct Map *map, struct MapPlayer *controller, size_t index);
+static void map_uncontrol_monster(struct Map *map, size_t index);
 static bool map_calculate_drop_position(struct Map *map, struct Point *p);
 static void map_destroy_reactor(struct Map *map, uint32_t oid);
 static int map_drop_batch_from_map_object(struct Map *map, struct MapPlayer *player, struct MapObject *object, size_t count, struct Drop *drops);
 static bool do_client_auto_pickup(struct Map *map, struct Client *client, struct Drop *drop);
+static void map_expire_drop_batch(struct Map *map);
+
+static uint64_t map_now(void);
+static void map_go_dormant(struct Map *map);
+static void map_extend_dormancy(struct Map *map, uint64_t deadline);
+static void map_catch_up(struct Map *map);
 
 static void on_next_drop(struct Room *room, struct TimerHandle *handle);
 static void on_exclusive_drop_time_expired(struct Room *room, struct TimerHandle *handle);
 static void on_drop_time_expired(struct Room *room, struct TimerHandle *handle);
 static void on_respawn_reactor(struct Room *room, struct TimerHandle *handle);
+static void on_dormancy_expired(struct Room *room, struct TimerHandle *handle);
 
 struct Map *map_create(struct ChannelServer *server, struct Room *room, struct ScriptManager *reactor_manager)
 {
-    struct Map *map = malloc(sizeof(struct Map));
-    if (map == NULL)
+    // Everything that has the lifetime of the map and never grows is carved from the map's arena
+    struct Arena *arena = arena_create(MAP_ARENA_CHUNK_SIZE);
+    if (arena == NULL)
         return NULL;
 
-    if (object_list_init(&map->objectList) == -1) {
-        free(map);
+    struct Map *map = arena_alloc(arena, sizeof(struct Map));
+    if (map == NULL) {
+        arena_destroy(arena);
+        return NULL;
+    }
+
+    map->arena = arena;
+
+    // The map ID must exist in this point, but a lazily loaded map can still fail to be parsed
+    const struct MapInfo *info = wz_get_map(room_get_id(room));
+    if (info == NULL) {
+        arena_destroy(arena);
         return NULL;
     }
 
-    map->footholdTree = wz_get_foothold_tree_for_map(room_get_id(room));
+    map->statics = map_static_create(arena, info);
+    if (map->statics == NULL) {
+        arena_destroy(arena);
+        return NULL;
+    }
+
+    const struct MapInfo *map_info = map->statics->info;
+    map->footholdTree = map_info->footholdTree;
 
-    // The map ID must exist in this point so infos can't be NULL
-    size_t life_count;
-    const struct LifeInfo *infos = wz_get_life_for_map(room_get_id(room), &life_count);
+    size_t life_count = map_info->lifeCount;
+    const struct LifeInfo *infos = map_info->lives;
 
     map->npcCount = 0;
     map->spawnerCount = 0;
@@ -231,92 +364,89 @@ struct Map *map_create(struct ChannelServer *server, struct Room *room, struct S
         }
     }
 
-    map->npcs = malloc(map->npcCount * sizeof(struct Npc));
-    if (map->npcs == NULL) {
-        object_list_destroy(&map->objectList);
-        free(map);
-        return NULL;
-    }
+    const struct MapReactorInfo *reactors_info = map_info->reactors;
+    map->reactorCount = map_info->reactorCount;
 
-    map->spawners = malloc(map->spawnerCount * sizeof(struct Spawner));
-    if (map->spawners == NULL && map->spawnerCount != 0) {
-        free(map->npcs);
-        object_list_destroy(&map->objectList);
-        free(map);
+    map->npcs = arena_alloc(arena, map->npcCount * sizeof(struct Npc));
+    map->spawners = arena_alloc(arena, map->spawnerCount * sizeof(struct Spawner));
+    map->dead = arena_alloc(arena, map->spawnerCount * sizeof(size_t));
+    map->reactors = arena_alloc(arena, map->reactorCount * sizeof(struct Reactor));
+    map->occupiedSeats = arena_alloc(arena, map_info->seats * sizeof(bool));
+    map->npcSnapshot.data = arena_alloc(arena, map->npcCount * (SNAPSHOT_RECORD_LENGTH(SPAWN_NPC_PACKET_LENGTH) + SNAPSHOT_RECORD_LENGTH(SPAWN_NPC_CONTROLLER_PACKET_LENGTH)));
+    map->reactorSnapshot.data = arena_alloc(arena, map->reactorCount * SNAPSHOT_RECORD_LENGTH(SPAWN_REACTOR_PACKET_LENGTH));
+    if (map->npcs == NULL || map->spawners == NULL || map->dead == NULL || map->reactors == NULL || map->occupiedSeats == NULL ||
+            map->npcSnapshot.data == NULL || map->reactorSnapshot.data == NULL) {
+        arena_destroy(arena);
         return NULL;
     }
 
-    map->dead = malloc(map->spawnerCount * sizeof(size_t));
-    if (map->dead == NULL && map->spawnerCount != 0) {
-        free(map->spawners);
-        free(map->npcs);
-        object_list_destroy(&map->objectList);
-        free(map);
+    for (size_t i = 0; i < map_info->seats; i++)
+        map->occupiedSeats[i] = false;
+
+    // The arrays below grow and shrink with the map's population so they stay on the heap
+    if (object_list_init(&map->objectList) == -1) {
+        arena_destroy(arena);
         return NULL;
     }
 
     map->droppingBatches = malloc(sizeof(struct DroppingBatch *));
     if (map->droppingBatches == NULL) {
-        free(map->dead);
-        free(map->spawners);
-        free(map->npcs);
         object_list_destroy(&map->objectList);
-        free(map);
+        arena_destroy(arena);
         return NULL;
     }
 
     map->dropBatches = malloc(sizeof(struct DropBatch *));
     if (map->dropBatches == NULL) {
         free(map->droppingBatches);
-        free(map->dead);
-        free(map->spawners);
-        free(map->npcs);
         object_list_destroy(&map->objectList);
-        free(map);
+        arena_destroy(arena);
         return NULL;
     }
 
-    const struct MapReactorInfo *reactors_info = wz_get_reactors_for_map(room_get_id(room), &map->reactorCount);
+    map->players = malloc(sizeof(struct MapPlayer *));
+    if (map->players == NULL) {
+        free(map->dropBatches);
+        free(map->droppingBatches);
+        object_list_destroy(&map->objectList);
+        arena_destroy(arena);
+        return NULL;
+    }
 
-    map->reactors = malloc(map->reactorCount * sizeof(struct Reactor));
-    if (map->reactors == NULL && map->reactorCount != 0) {
+    if (heap_init(&map->heap) == -1) {
+        free(map->players);
         free(map->dropBatches);
         free(map->droppingBatches);
-        free(map->dead);
-        free(map->spawners);
-        free(map->npcs);
         object_list_destroy(&map->objectList);
-        free(map);
+        arena_destroy(arena);
         return NULL;
     }
 
-    map->players = malloc(sizeof(struct MapPlayer));
-    if (map->players == NULL) {
-        free(map->reactors);
+    map->monsters = malloc((map->spawnerCount != 0 ? map->spawnerCount : 1) * sizeof(struct MapMonster));
+    if (map->monsters == NULL) {
+        heap_destroy(&map->heap);
+        free(map->players);
         free(map->dropBatches);
         free(map->droppingBatches);
-        free(map->dead);
-        free(map->spawners);
-        free(map->npcs);
         object_list_destroy(&map->objectList);
-        free(map);
+        arena_destroy(arena);
         return NULL;
     }
 
-    if (heap_init(&map->heap) == -1) {
+    map->ownedBatches = hash_set_u32_create(sizeof(struct OwnedBatches), offsetof(struct OwnedBatches, ownerId));
+    if (map->ownedBatches == NULL) {
+        free(map->monsters);
+        heap_destroy(&map->heap);
         free(map->players);
-        free(map->reactors);
         free(map->dropBatches);
         free(map->droppingBatches);
-        free(map->dead);
-        free(map->spawners);
-        free(map->npcs);
         object_list_destroy(&map->objectList);
-        free(map);
+        arena_destroy(arena);
         return NULL;
     }
 
     map->npcCount = 0;
+    map->npcSnapshot.len = 0;
     map->spawnerCount = 0;
     for (size_t i = 0; i < life_count; i++) {
         switch (infos[i].type) {
@@ -333,6 +463,13 @@ struct Map *map_create(struct ChannelServer *server, struct Room *room, struct S
             map->npcs[map->npcCount].rx0 = infos[i].rx0;
             map->npcs[map->npcCount].rx1 = infos[i].rx1;
             map->npcs[map->npcCount].f = infos[i].f;
+
+            const struct Npc *npc = &map->npcs[map->npcCount];
+            spawn_npc_packet(npc->oid, npc->id, npc->x, npc->cy, npc->f == 1, npc->fh, npc->rx0, npc->rx1, snapshot_packet(&map->npcSnapshot));
+            snapshot_commit(&map->npcSnapshot, SPAWN_NPC_PACKET_LENGTH);
+            spawn_npc_controller_packet(npc->oid, npc->id, npc->x, npc->cy, npc->f == 1, npc->fh, npc->rx0, npc->rx1, snapshot_packet(&map->npcSnapshot));
+            snapshot_commit(&map->npcSnapshot, SPAWN_NPC_CONTROLLER_PACKET_LENGTH);
+
             map->npcCount++;
         }
         break;
@@ -347,52 +484,8 @@ struct Map *map_create(struct ChannelServer *server, struct Room *room, struct S
         }
     }
 
-    map->monsters = malloc((map->spawnerCount != 0 ? map->spawnerCount : 1) * sizeof(struct MapMonster));
-    if (map->monsters == NULL) {
-        heap_destroy(&map->heap);
-        free(map->players);
-        free(map->reactors);
-        free(map->dropBatches);
-        free(map->droppingBatches);
-        free(map->dead);
-        free(map->spawners);
-        free(map->npcs);
-        object_list_destroy(&map->objectList);
-        free(map);
-        return NULL;
-    }
-
-    map->occupiedSeats = calloc(wz_get_map_seat_count(room_get_id(room)), sizeof(bool));
-    if (map->occupiedSeats == NULL) {
-        free(map->monsters);
-        heap_destroy(&map->heap);
-        free(map->players);
-        free(map->reactors);
-        free(map->dropBatches);
-        free(map->droppingBatches);
-        free(map->dead);
-        free(map->spawners);
-        free(map->npcs);
-        object_list_destroy(&map->objectList);
-        free(map);
-        return NULL;
-    }
-
-    for (size_t i = 0; i < map->spawnerCount; i++) {
-        struct MapObject *obj = object_list_allocate(&map->objectList);
-        obj->type = MAP_OBJECT_MONSTER;
-        obj->index = i;
-        map->monsters[i].monster.oid = obj->oid;
-        map->monsters[i].monster.id = map->spawners[i].id;
-        map->monsters[i].monster.x = map->spawners[i].x;
-        map->monsters[i].monster.y = map->spawners[i].y;
-        map->monsters[i].monster.fh = map->spawners[i].fh;
-        map->monsters[i].monster.hp = wz_get_monster_stats(map->spawners[i].id)->hp;
-        map->monsters[i].spawnerIndex = i;
-        map->monsters[i].controller = NULL;
-    }
     map->monsterCapacity = map->spawnerCount != 0 ? map->spawnerCount : 1;
-    map->monsterCount = map->spawnerCount;
+    map_spawn_initial_monsters(map);
 
     for (size_t i = 0; i < map->reactorCount; i++) {
         struct MapObject *obj = object_list_allocate(&map->objectList);
@@ -404,43 +497,27 @@ struct Map *map_create(struct ChannelServer *server, struct Room *room, struct S
         map->reactors[i].y = reactors_info[i].pos.y;
         map->reactors[i].state = 0;
         map->reactors[i].keepAlive = false;
+        map->reactors[i].respawnTimer = NULL;
+        map->reactors[i].respawnAt = 0;
     }
+    map->reactorSnapshotDirty = true;
 
     map->boss.monster.oid = -1;
+    map->areaBoss = false;
+    map->dormancyTimer = NULL;
+    map->dormantUntil = 0;
+    map->respawnPending = false;
 
-    map->respawnListener = event_add_listener(channel_server_get_event(server, EVENT_GLOBAL_RESPAWN), room_get_base(room), 0, on_respawn, map);
+    map->listening = false;
 
     uint32_t id = room_get_id(room);
-    if (id == 101000300 || id == 200000111 ) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_BOAT), room_get_base(room), EVENT_BOAT_PROPERTY_SAILING, dock_undock_boat, map);
-    } else if (id == 101000301 || id == 200000112) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_BOAT), room_get_base(room), EVENT_BOAT_PROPERTY_SAILING, start_sailing, map);
-    } else if (id / 10 == 20009001 || id / 10 == 20009000) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_BOAT), room_get_base(room), EVENT_BOAT_PROPERTY_SAILING, end_sailing, map);
-    } else if (id == 200000121 || id == 220000110) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_TRAIN), room_get_base(room), EVENT_TRAIN_PROPERTY_SAILING, dock_undock_train, map);
-    } else if (id == 200000122 || id == 220000111) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_TRAIN), room_get_base(room), EVENT_TRAIN_PROPERTY_SAILING, start_train, map);
-    } else if (id == 200090100 || id == 200090110) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_TRAIN), room_get_base(room), EVENT_TRAIN_PROPERTY_SAILING, end_train, map);
-    } else if (id == 200000151 || id == 260000100) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_GENIE), room_get_base(room), EVENT_GENIE_PROPERTY_SAILING, dock_undock_genie, map);
-    } else if (id == 200000152 || id == 260000110) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_GENIE), room_get_base(room), EVENT_GENIE_PROPERTY_SAILING, start_genie, map);
-    } else if (id == 200090400 || id == 200090410) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_GENIE), room_get_base(room), EVENT_GENIE_PROPERTY_SAILING, end_genie, map);
-    } else if (id == 103000100 || id == 600010001) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_SUBWAY), room_get_base(room), EVENT_SUBWAY_PROPERTY_SAILING, dock_undock_subway, map);
-    } else if (id == 600010004 || id == 600010002) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_SUBWAY), room_get_base(room), EVENT_SUBWAY_PROPERTY_SAILING, start_subway, map);
-    } else if (id == 600010005 || id == 600010003) {
-        map->listener = event_add_listener(channel_server_get_event(server, EVENT_SUBWAY), room_get_base(room), EVENT_SUBWAY_PROPERTY_SAILING, end_subway, map);
-    } else if (id == 100040105 || id == 100040106 || id == 101030404 || id == 104000400 || id == 105090310 ||
+    if (id == 100040105 || id == 100040106 || id == 101030404 || id == 104000400 || id == 105090310 ||
             id == 107000300 || id == 110040000 || id == 200010300 || id == 220050000 || id == 220050100 ||
             id == 220050200 || id == 221040301 || id == 222010310 || id == 230020100 || id == 240040401 ||
             id == 250010304 || id == 250010504 || id == 251010102 || id == 260010201 || id == 261030000 ||
             id == 677000001 || id == 677000003 || id == 677000005 || id == 677000007 || id == 677000009 || id == 677000012) {
         map->listener = event_add_listener(channel_server_get_event(server, EVENT_AREA_BOSS), room_get_base(room), EVENT_AREA_BOSS_PROPERTY_RESET, respawn_boss, map);
+        map->areaBoss = true;
 
         if (!event_area_boss_register(id)) {
             room_keep_alive(room);
@@ -620,7 +697,9 @@ struct Map *map_create(struct ChannelServer *server, struct Room *room, struct S
             map->boss.monster.x = map->bossSpawner.x;
             map->boss.monster.y = map->bossSpawner.y;
             map->boss.monster.fh = map->bossSpawner.fh;
-            map->boss.monster.hp = wz_get_monster_stats(map->bossSpawner.id)->hp;
+            // The boss keeps its stats across respawns
+            map->boss.stats = wz_get_monster_stats(map->bossSpawner.id);
+            map->boss.monster.hp = map->boss.stats->hp;
         }
     }
 
@@ -642,22 +721,17 @@ struct Map *map_create(struct ChannelServer *server, struct Room *room, struct S
 
     map->reactorManager = reactor_manager;
 
+    map_listen(map);
+
     return map;
 }
 
 void map_destroy(struct Map *map)
 {
-    event_remove_listener(channel_server_get_event(map->server, EVENT_GLOBAL_RESPAWN), 0, map->respawnListener);
+    map_unlisten(map);
+
     uint32_t id = room_get_id(map->room);
-    if (id == 101000300 || id == 101000301 || id / 10 == 20009001 || id == 200000111 || id == 200000112 || id / 10 == 20009000) {
-        event_remove_listener(channel_server_get_event(map->server, EVENT_BOAT), EVENT_BOAT_PROPERTY_SAILING, map->listener);
-    } else if (id == 200000121 || id == 220000110 || id == 200000122 || id == 220000111 || id == 200090100 || id == 200090110) {
-        event_remove_listener(channel_server_get_event(map->server, EVENT_TRAIN), EVENT_TRAIN_PROPERTY_SAILING, map->listener);
-    } else if (id == 200000151 || id == 260000100 || id == 200000152 || id == 260000110 || id == 200090400 || id == 200090410) {
-        event_remove_listener(channel_server_get_event(map->server, EVENT_GENIE), EVENT_GENIE_PROPERTY_SAILING, map->listener);
-    } else if (id == 103000100 || id == 600010001 || id == 600010004 || id == 600010002 || id == 600010005 || id == 600010003) {
-        event_remove_listener(channel_server_get_event(map->server, EVENT_SUBWAY), EVENT_SUBWAY_PROPERTY_SAILING, map->listener);
-    } else if (id == 100040105 || id == 100040106 || id == 101030404 || id == 104000400 || id == 105090310 ||
+    if (id == 100040105 || id == 100040106 || id == 101030404 || id == 104000400 || id == 105090310 ||
             id == 107000300 || id == 110040000 || id == 200010300 || id == 220050000 || id == 220050100 ||
             id == 220050200 || id == 221040301 || id == 222010310 || id == 230020100 || id == 240040401 ||
             id == 250010304 || id == 250010504 || id == 251010102 || id == 260010201 || id == 261030000 ||
@@ -665,27 +739,52 @@ void map_destroy(struct Map *map)
         event_remove_listener(channel_server_get_event(map->server, EVENT_AREA_BOSS), EVENT_AREA_BOSS_PROPERTY_RESET, map->listener);
     }
 
-    free(map->occupiedSeats);
-    free(map->reactors);
-
-    for (size_t i = map->dropBatchStart; i < map->dropBatchEnd; i++) {
-        free(map->dropBatches[i]);
-    }
-
+    // The drop batches live in the arena
+    hash_set_u32_destroy(map->ownedBatches);
     free(map->dropBatches);
-
-    for (size_t i = 0; i < map->droppingBatchCount; i++)
-        free(map->droppingBatches[i]);
-
     free(map->droppingBatches);
     object_list_destroy(&map->objectList);
     heap_destroy(&map->heap);
-    free(map->dead);
-    free(map->spawners);
     free(map->monsters);
-    free(map->npcs);
     free(map->players);
-    free(map);
+    // Also frees the map itself
+    arena_destroy(map->arena);
+}
+
+int map_reset(struct Map *map)
+{
+    // respawn_boss() has to keep firing while nobody is in the map, as it re-registers the boss and keeps the room
+    // alive, which an idle room can't do. Area boss maps are destroyed and created anew instead
+    if (map->areaBoss)
+        return -1;
+
+    // An idle room must not get any event callbacks, as they could add timers to it.
+    // map_join() registers the listener again once the room is reused
+    map_unlisten(map);
+
+    // The room has no sessions and no timers left, so there are no players, drops or pending reactor respawns.
+    // Only the monsters and the reactor states diverge from a freshly created map
+    for (size_t i = 0; i < map->monsterCount; i++)
+        object_list_free(&map->objectList, map->monsters[i].monster.oid);
+
+    map_spawn_initial_monsters(map);
+    map->deadCount = 0;
+    map->respawnPending = false;
+
+    for (size_t i = 0; i < map->reactorCount; i++) {
+        map->reactors[i].state = 0;
+        map->reactors[i].keepAlive = false;
+        map->reactors[i].respawnAt = 0;
+    }
+    map->reactorSnapshotDirty = true;
+
+    for (size_t i = 0; i < map->statics->info->seats; i++)
+        map->occupiedSeats[i] = false;
+
+    map->dropBatchStart = 0;
+    map->dropBatchEnd = 0;
+
+    return 0;
 }
 
 uint32_t map_get_id(struct Map *map)
@@ -697,6 +796,9 @@ int map_join(struct Map *map, struct Client *client, struct MapHandleContainer *
 {
     struct Session *session = client_get_session(client);
 
+    if (!map->listening)
+        map_listen(map);
+
     if (room_get_id(map->room) == 101000301 || room_get_id(map->room) == 200000112) {
         if (event_get_property(channel_server_get_event(map->server, EVENT_BOAT), EVENT_BOAT_PROPERTY_SAILING) == 2) {
             client_warp(client, room_get_id(map->room) == 101000301 ? 200090010 : 200090000, 0);
@@ -709,142 +811,175 @@ int map_join(struct Map *map, struct Client *client, struct MapHandleContainer *
         }
     }
 
+    // Catch up before anything is announced to the new player
+    if (map->playerCount == 0)
+        map_catch_up(map);
+
     if (map->playerCount == map->playerCapacity) {
-        void *temp = realloc(map->players, (map->playerCapacity * 2) * sizeof(struct MapPlayer));
+        void *temp = realloc(map->players, (map->playerCapacity * 2) * sizeof(struct MapPlayer *));
         if (temp == NULL)
             return -1;
 
         map->players = temp;
-        for (size_t i = 0; i < map->playerCount; i++) {
-            map->players[i].container->player = &map->players[i];
-            map->players[i].node->controller = &map->players[i];
-            for (size_t j = 0; j < map->players[i].monsterCount; j++)
-                map->players[i].monsters[j]->controller = &map->players[i];
-        }
-
         map->playerCapacity *= 2;
     }
 
-    player->player = &map->players[map->playerCount];
-
-    client_announce_self_to_map(client);
-
-    for (size_t i = 0; i < map->playerCount; i++)
-        client_announce_add_player(client, client_get_character(map->players[i].client));
-
-    for (size_t i = 0; i < map->npcCount; i++)
-        client_announce_add_npc(client, &map->npcs[i]);
-
-    player->player->monsters = malloc(map->monsterCapacity * sizeof(struct MapMonster *));
-    if (player->player->monsters == NULL)
+    player->player = arena_pool_alloc(map->arena, sizeof(struct MapPlayer));
+    if (player->player == NULL)
         return -1;
 
+    player->player->firstMonster = MAP_MONSTER_NONE;
     player->player->monsterCount = 0;
-    if (map->heap.count == 0) {
-        for (size_t i = 0; i < map->monsterCount; i++) {
-            if (map->monsters[i].monster.hp > 0) {
-                player->player->monsters[player->player->monsterCount] = &map->monsters[i];
-                map->monsters[i].controller = player->player;
-                map->monsters[i].indexInController = player->player->monsterCount;
-                player->player->monsterCount++;
+    player->player->rtt = client_get_rtt(client);
+
+    if (map->reactorSnapshotDirty) {
+        const struct MapReactorInfo *reactors_info = map->statics->info->reactors;
+        map->reactorSnapshot.len = 0;
+        for (size_t i = 0; i < map->reactorCount; i++) {
+            const struct ReactorInfo *info = map->statics->reactorInfos[i];
+            if (info->states[map->reactors[i].state].eventCount != 0) {
+                spawn_reactor_packet(map->reactors[i].oid, reactors_info[i].id, reactors_info[i].pos.x, reactors_info[i].pos.y, map->reactors[i].state, snapshot_packet(&map->reactorSnapshot));
+                snapshot_commit(&map->reactorSnapshot, SPAWN_REACTOR_PACKET_LENGTH);
             }
         }
+        map->reactorSnapshotDirty = false;
+    }
+
+    size_t visible_drop_count = 0;
+    for (size_t i = map->dropBatchStart; i < map->dropBatchEnd; i++) {
+        if (map->dropBatches[i] != NULL)
+            visible_drop_count += map->dropBatches[i]->count;
     }
 
-    player->player->node = heap_push(&map->heap, player->player->monsterCount, player->player);
+    for (size_t i = 0; i < map->droppingBatchCount; i++)
+        visible_drop_count += map->droppingBatches[i]->current;
+
+    // Everything the player gets to see is sent with a single write, the boss counts as one more monster
+    struct Snapshot snapshot = { .len = 0 };
+    snapshot.data = malloc(map->playerCount * SNAPSHOT_RECORD_LENGTH(ADD_PLAYER_TO_MAP_PACKET_MAX_LENGTH) +
+            map->npcSnapshot.len +
+            (map->monsterCount + 1) * (SNAPSHOT_RECORD_LENGTH(SPAWN_MONSTER_PACKET_LENGTH) + SNAPSHOT_RECORD_LENGTH(SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH)) +
+            map->reactorSnapshot.len +
+            visible_drop_count * SNAPSHOT_RECORD_LENGTH(SPAWN_DROP_PACKET_MAX_LENGTH));
+    if (snapshot.data == NULL) {
+        arena_pool_free(map->arena, player->player);
+        player->player = NULL;
+        return -1;
+    }
+
+    player->player->node = heap_push(&map->heap, player->player->rtt / CONTROLLER_RTT_PER_MONSTER, player->player);
     if (player->player->node == NULL) {
-        free(player->player->monsters);
+        free(snapshot.data);
+        arena_pool_free(map->arena, player->player);
+        player->player = NULL;
         return -1;
     }
 
+    client_announce_self_to_map(client);
+
+    for (size_t i = 0; i < map->playerCount; i++) {
+        size_t len = add_player_to_map_packet(client_get_character(map->players[i]->client), snapshot_packet(&snapshot));
+        snapshot_commit(&snapshot, len);
+    }
+
+    memcpy(snapshot.data + snapshot.len, map->npcSnapshot.data, map->npcSnapshot.len);
+    snapshot.len += map->npcSnapshot.len;
+
+    if (map->heap.count == 1) {
+        for (size_t i = 0; i < map->monsterCount; i++) {
+            if (map->monsters[i].monster.hp > 0)
+                map_control_monster(map, player->player, i);
+        }
+    }
+
     player->player->client = client;
 
     for (size_t i = 0; i < map->monsterCount; i++) {
-        const struct MapMonster *monster = &map->monsters[i];
-        client_announce_monster(client, &monster->monster);
+        const struct Monster *monster = &map->monsters[i].monster;
+        spawn_monster_packet(monster->oid, monster->id, monster->x, monster->y, monster->fh, false, snapshot_packet(&snapshot));
+        snapshot_commit(&snapshot, SPAWN_MONSTER_PACKET_LENGTH);
     }
 
-    for (size_t i = 0; i < player->player->monsterCount; i++) {
-        const struct Monster *monster = &player->player->monsters[i]->monster;
-        uint8_t packet[SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH];
-        spawn_monster_controller_packet(monster->oid, false, monster->id, monster->x, monster->y, monster->fh, false, packet);
-        session_write(session, SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH, packet);
+    for (size_t i = player->player->firstMonster; i != MAP_MONSTER_NONE; i = map->monsters[i].nextControlled) {
+        const struct Monster *monster = &map->monsters[i].monster;
+        spawn_monster_controller_packet(monster->oid, false, monster->id, monster->x, monster->y, monster->fh, false, snapshot_packet(&snapshot));
+        snapshot_commit(&snapshot, SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH);
     }
 
-    const struct MapReactorInfo *reactors_info = wz_get_reactors_for_map(room_get_id(map->room), NULL);
-    for (size_t i = 0; i < map->reactorCount; i++) {
-        const struct ReactorInfo *info = wz_get_reactor_info(reactors_info[i].id);
-        if (info->states[map->reactors[i].state].eventCount != 0) {
-            uint8_t packet[SPAWN_REACTOR_PACKET_LENGTH];
-            spawn_reactor_packet(map->reactors[i].oid, reactors_info[i].id, reactors_info[i].pos.x, reactors_info[i].pos.y, map->reactors[i].state, packet);
-            session_write(session, SPAWN_REACTOR_PACKET_LENGTH, packet);
-        }
-    }
+    memcpy(snapshot.data + snapshot.len, map->reactorSnapshot.data, map->reactorSnapshot.len);
+    snapshot.len += map->reactorSnapshot.len;
 
-    size_t drop_count = 0;
     for (size_t i = map->dropBatchStart; i < map->dropBatchEnd; i++) {
         if (map->dropBatches[i] != NULL) {
-            if (map->dropBatches[i]->ownerId == client_get_character(client)->id) {
-                map->dropBatches[i]->owner = player->player;
-                drop_count++;
-            }
-
             for (size_t j = 0; j < map->dropBatches[i]->count; j++) {
                 struct Drop *drop = &map->dropBatches[i]->drops[j];
-                client_announce_spawn_drop(client, 0, 0, map->dropBatches[i]->exclusive ? 1 : 2, false, drop);
+                size_t len = client_spawn_drop_packet(client, 0, map->dropBatches[i]->exclusive ? 1 : 2, false, drop, snapshot_packet(&snapshot));
+                snapshot_commit(&snapshot, len);
             }
         }
     }
 
-    player->player->dropCapacity = drop_count != 0 ? drop_count : 1;
-    player->player->drops = malloc(player->player->dropCapacity * sizeof(struct DropBatch *));
-    player->player->dropCount = 0;
-    for (size_t i = map->dropBatchStart; i < map->dropBatchEnd; i++) {
-        if (map->dropBatches[i] != NULL && map->dropBatches[i]->ownerId == client_get_character(client)->id) {
-            player->player->drops[player->player->dropCount] = map->dropBatches[i];
-            map->dropBatches[i]->indexInPlayer = player->player->dropCount;
-            player->player->dropCount++;
-        }
-    }
-
-    drop_count = 0;
     for (size_t i = 0; i < map->droppingBatchCount; i++) {
-        if (map->droppingBatches[i]->ownerId == client_get_character(client)->id) {
-            map->droppingBatches[i]->owner = player->player;
-            drop_count++;
-        }
-
         for (size_t j = 0; j < map->droppingBatches[i]->current; j++) {
             struct Drop *drop = &map->droppingBatches[i]->drops[j];
             // Dropping batches can only be exclusive as they must come from a monster or a reactor
-            client_announce_spawn_drop(client, 0, 0, 1, false, drop);
+            size_t len = client_spawn_drop_packet(client, 0, 1, false, drop, snapshot_packet(&snapshot));
+            snapshot_commit(&snapshot, len);
         }
     }
 
-    player->player->droppingCapacity = drop_count != 0 ? drop_count : 1;
+    // Claim the batches the character left behind the last time they were here
+    const struct OwnedBatches *owned = hash_set_u32_get(map->ownedBatches, client_get_character(client)->id);
+    size_t drop_count = 0;
+    size_t dropping_count = 0;
+    if (owned != NULL) {
+        for (struct DropBatch *batch = owned->drops; batch != NULL; batch = batch->nextOwned)
+            drop_count++;
+
+        for (struct DroppingBatch *batch = owned->droppings; batch != NULL; batch = batch->nextOwned)
+            dropping_count++;
+    }
+
+    player->player->dropCapacity = drop_count != 0 ? drop_count : 1;
+    player->player->drops = malloc(player->player->dropCapacity * sizeof(struct DropBatch *));
+    player->player->dropCount = 0;
+    player->player->droppingCapacity = dropping_count != 0 ? dropping_count : 1;
     player->player->droppings = malloc(player->player->droppingCapacity * sizeof(struct DroppingBatch *));
     player->player->droppingCount = 0;
-    for (size_t i = 0; i < map->droppingBatchCount; i++) {
-        if (map->droppingBatches[i]->owner == player->player) {
-            player->player->droppings[player->player->droppingCount] = map->droppingBatches[i];
-            map->droppingBatches[i]->indexInPlayer = player->player->droppingCount;
+    if (owned != NULL) {
+        for (struct DropBatch *batch = owned->drops; batch != NULL; batch = batch->nextOwned) {
+            batch->owner = player->player;
+            batch->indexInPlayer = player->player->dropCount;
+            player->player->drops[player->player->dropCount] = batch;
+            player->player->dropCount++;
+        }
+
+        for (struct DroppingBatch *batch = owned->droppings; batch != NULL; batch = batch->nextOwned) {
+            batch->owner = player->player;
+            batch->indexInPlayer = player->player->droppingCount;
+            player->player->droppings[player->player->droppingCount] = batch;
             player->player->droppingCount++;
         }
     }
 
     if (map->boss.monster.oid != -1) {
-        client_announce_monster(client, &map->boss.monster);
+        const struct Monster *monster = &map->boss.monster;
+        spawn_monster_packet(monster->oid, monster->id, monster->x, monster->y, monster->fh, false, snapshot_packet(&snapshot));
+        snapshot_commit(&snapshot, SPAWN_MONSTER_PACKET_LENGTH);
         if (map->boss.controller == NULL) {
             map->boss.controller = player->player;
-            const struct Monster *monster = &map->boss.monster;
-            uint8_t packet[SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH];
-            spawn_monster_controller_packet(monster->oid, false, monster->id, monster->x, monster->y, monster->fh, false, packet);
-            session_write(session, SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH, packet);
+            spawn_monster_controller_packet(monster->oid, false, monster->id, monster->x, monster->y, monster->fh, false, snapshot_packet(&snapshot));
+            snapshot_commit(&snapshot, SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH);
         }
     }
 
+    session_write_batch(session, snapshot.len, snapshot.data);
+    free(snapshot.data);
+
     player->player->container = player;
     player->player->script = NULL;
+    player->player->index = map->playerCount;
+    map->players[map->playerCount] = player->player;
     map->playerCount++;
 
     return 0;
@@ -856,16 +991,15 @@ void map_leave(struct Map *map, struct MapPlayer *player)
         heap_remove(&map->heap, player->node);
         struct ControllerHeapNode *next = heap_top(&map->heap);
         if (next != NULL) {
-            for (size_t i = 0; i < player->monsterCount; i++) {
-                player->monsters[i]->controller = next->controller;
-                player->monsters[i]->indexInController = next->controller->monsterCount;
-                next->controller->monsters[next->controller->monsterCount] = player->monsters[i];
-                next->controller->monsterCount++;
+            size_t i = player->firstMonster;
+            while (i != MAP_MONSTER_NONE) {
+                size_t next_monster = map->monsters[i].nextControlled;
+                map_control_monster(map, next->controller, i);
+                i = next_monster;
             }
-            free(player->monsters);
 
-            for (size_t i = 0; i < next->controller->monsterCount; i++) {
-                struct Monster *monster = &next->controller->monsters[i]->monster;
+            for (size_t i = next->controller->firstMonster; i != MAP_MONSTER_NONE; i = map->monsters[i].nextControlled) {
+                struct Monster *monster = &map->monsters[i].monster;
                 uint8_t packet[SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH];
                 spawn_monster_controller_packet(monster->oid, false, monster->id, monster->x, monster->y, monster->fh, false, packet);
                 session_write(client_get_session(next->controller->client), SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH, packet);
@@ -888,18 +1022,15 @@ void map_leave(struct Map *map, struct MapPlayer *player)
                 player->droppings[i]->owner = NULL;
 
             free(player->droppings);
-
-            if (player - map->players != map->playerCount - 1) {
-                map->players[player - map->players] = map->players[map->playerCount - 1];
-                map->players[player - map->players].container->player = &map->players[player - map->players];
-                map->players[player - map->players].node->controller = &map->players[player - map->players];
-                for (size_t i = 0; i < map->players[player - map->players].monsterCount; i++)
-                    map->players[player - map->players].monsters[i]->controller = &map->players[player - map->players];
-            }
         } else {
-            for (size_t i = 0; i < player->monsterCount; i++)
-                player->monsters[i]->controller = NULL;
-            free(player->monsters);
+            size_t i = player->firstMonster;
+            while (i != MAP_MONSTER_NONE) {
+                size_t next_monster = map->monsters[i].nextControlled;
+                map->monsters[i].controller = NULL;
+                map->monsters[i].prevControlled = MAP_MONSTER_NONE;
+                map->monsters[i].nextControlled = MAP_MONSTER_NONE;
+                i = next_monster;
+            }
 
             // Since this is the last player, they must have the control over the boss
             map->boss.controller = NULL;
@@ -915,10 +1046,64 @@ void map_leave(struct Map *map, struct MapPlayer *player)
             free(player->droppings);
         }
 
+        map->players[player->index] = map->players[map->playerCount - 1];
+        map->players[player->index]->index = player->index;
         map->playerCount--;
+        arena_pool_free(map->arena, player);
+
+        if (map->playerCount == 0)
+            map_go_dormant(map);
     }
 }
 
+void map_set_player_rtt(struct Map *map, struct MapPlayer *player, uint32_t rtt)
+{
+    player->rtt = rtt;
+    player->node->latencyPenalty = rtt / CONTROLLER_RTT_PER_MONSTER;
+    heap_update(&map->heap, player->node);
+
+    struct ControllerHeapNode *best = heap_top(&map->heap);
+    if (best == player->node)
+        return;
+
+    size_t load = heap_key(player->node);
+    size_t best_load = heap_key(best);
+    if (load <= best_load + CONTROLLER_HANDOFF_MARGIN)
+        return;
+
+    // Hand off just enough monsters to bring the two loads within the margin of each other
+    size_t count = (load - best_load - CONTROLLER_HANDOFF_MARGIN + 1) / 2;
+    if (count > player->monsterCount)
+        count = player->monsterCount;
+
+    // The gap is all latency penalty, there is nothing to hand off
+    if (count == 0)
+        return;
+
+    uint8_t *packets = malloc(count * (SNAPSHOT_RECORD_LENGTH(REMOVE_MONSTER_CONTROLLER_PACKET_LENGTH) + SNAPSHOT_RECORD_LENGTH(SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH)));
+    // The player can just keep controlling them
+    if (packets == NULL)
+        return;
+
+    struct Snapshot removals = { .len = 0, .data = packets };
+    struct Snapshot spawns = { .len = 0, .data = packets + count * SNAPSHOT_RECORD_LENGTH(REMOVE_MONSTER_CONTROLLER_PACKET_LENGTH) };
+    for (size_t i = 0; i < count; i++) {
+        size_t index = player->firstMonster;
+        struct Monster *monster = &map->monsters[index].monster;
+        map_uncontrol_monster(map, index);
+        map_control_monster(map, best->controller, index);
+
+        remove_monster_controller_packet(monster->oid, snapshot_packet(&removals));
+        snapshot_commit(&removals, REMOVE_MONSTER_CONTROLLER_PACKET_LENGTH);
+        spawn_monster_controller_packet(monster->oid, false, monster->id, monster->x, monster->y, monster->fh, false, snapshot_packet(&spawns));
+        snapshot_commit(&spawns, SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH);
+    }
+
+    session_write_batch(client_get_session(player->client), removals.len, removals.data);
+    session_write_batch(client_get_session(best->controller->client), spawns.len, spawns.data);
+    free(packets);
+}
+
 void map_for_each_drop(struct Map *map, void (*f)(struct Drop *, void *), void *ctx)
 {
     for (size_t i = map->dropBatchStart; i < map->dropBatchEnd; i++) {
@@ -937,7 +1122,8 @@ void map_for_each_drop(struct Map *map, void (*f)(struct Drop *, void *), void *
 
 void map_spawn(struct Map *map, uint32_t id, struct Point p)
 {
-    if (wz_get_monster_stats(id) == NULL)
+    const struct MobInfo *stats = wz_get_monster_stats(id);
+    if (stats == NULL)
         return;
 
     if (map->monsterCount == map->monsterCapacity) {
@@ -946,18 +1132,6 @@ void map_spawn(struct Map *map, uint32_t id, struct Point p)
             return;
 
         map->monsters = temp;
-
-        for (size_t i = 0; i < map->playerCount; i++) {
-            void *temp = realloc(map->players[i].monsters, (map->monsterCapacity * 2) * sizeof(struct MapMonster *));
-            if (temp == NULL)
-                return;
-
-            map->players[i].monsters = temp;
-        }
-
-        for (size_t i = 0; i < map->monsterCount; i++)
-            map->monsters[i].controller->monsters[map->monsters[i].indexInController] = &map->monsters[map->monsterCount];
-
         map->monsterCapacity *= 2;
     }
 
@@ -976,14 +1150,12 @@ void map_spawn(struct Map *map, uint32_t id, struct Point p)
     // Sometimes the player can be a unit below the foothold's line
     // so to make sure the y coordinate is ABOVE (not ON) the foothold, move up y coordinate by 2
     monster->y = p.y - 2;
-    monster->hp = wz_get_monster_stats(id)->hp;
+    monster->hp = stats->hp;
     monster->fh = fh->id;
     monster->stance = 0;
-    map->monsters[map->monsterCount].controller = controller;
-    map->monsters[map->monsterCount].indexInController = controller->monsterCount;
+    map->monsters[map->monsterCount].stats = stats;
     map->monsters[map->monsterCount].spawnerIndex = -1;
-    controller->monsters[controller->monsterCount] = &map->monsters[map->monsterCount];
-    controller->monsterCount++;
+    map_control_monster(map, controller, map->monsterCount);
     map->monsterCount++;
 
     {
@@ -1012,162 +1184,197 @@ bool map_monster_is_alive(struct Map *map, uint32_t id, uint32_t oid)
     return monster->hp > 0;
 }
 
-uint32_t map_damage_monster_by(struct Map *map, struct MapPlayer *player, uint32_t char_id, uint32_t oid, size_t hit_count, int32_t *damage)
+size_t map_apply_attack(struct Map *map, struct MapPlayer *player, size_t monster_count, const uint32_t *oids, size_t hit_count, const int32_t *damage, uint32_t *killed)
 {
-    struct MapObject *object = object_list_get(&map->objectList, oid);
-    if (object == NULL || (object->type != MAP_OBJECT_MONSTER && object->type != MAP_OBJECT_BOSS))
-        return -1;
+    if (monster_count == 0)
+        return 0;
 
-    struct MapMonster *monster = object->type == MAP_OBJECT_MONSTER ? &map->monsters[object->index] : &map->boss;
+    // Everything the attacker has to be told goes out in a single write
+    uint8_t data[monster_count * (SNAPSHOT_RECORD_LENGTH(SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH) + SNAPSHOT_RECORD_LENGTH(MONSTER_HP_PACKET_LENGTH))];
+    struct Snapshot batch = { .len = 0, .data = data };
+
+    // The monsters that were taken over from another player, by their previous controller
+    struct MapPlayer *old_controllers[monster_count];
+    uint32_t taken_oids[monster_count];
+    size_t taken_count = 0;
+
+    // Deaths are handled after all the damage is in as killing a monster moves the others around
+    uint32_t dead_oids[monster_count];
+    size_t dead_count = 0;
+
+    for (size_t i = 0; i < monster_count; i++) {
+        struct MapObject *object = object_list_get(&map->objectList, oids[i]);
+        if (object == NULL || (object->type != MAP_OBJECT_MONSTER && object->type != MAP_OBJECT_BOSS))
+            continue;
+
+        struct MapMonster *monster = object->type == MAP_OBJECT_MONSTER ? &map->monsters[object->index] : &map->boss;
+        if (monster->monster.hp <= 0)
+            continue;
 
-    if (monster->monster.hp > 0) {
         if (monster->controller != player) {
             // Switch the control of the monster
-            struct MapPlayer *old = monster->controller;
+            if (monster->controller != NULL) {
+                old_controllers[taken_count] = monster->controller;
+                taken_oids[taken_count] = oids[i];
+                taken_count++;
+            }
+
             if (object->type == MAP_OBJECT_MONSTER) {
-                old->monsterCount--;
-                old->monsters[monster->indexInController] = old->monsters[old->monsterCount];
-                old->monsters[monster->indexInController]->indexInController = monster->indexInController;
-                monster->controller = player;
-                monster->indexInController = player->monsterCount;
-                player->monsters[player->monsterCount] = monster;
-                player->monsterCount++;
+                map_uncontrol_monster(map, object->index);
+                map_control_monster(map, player, object->index);
             } else {
                 map->boss.controller = player;
             }
 
-            {
-                uint8_t packet[REMOVE_MONSTER_CONTROLLER_PACKET_LENGTH];
-                remove_monster_controller_packet(oid, packet);
-                session_write(client_get_session(old->client), REMOVE_MONSTER_CONTROLLER_PACKET_LENGTH, packet);
-            }
-
-            {
-                uint8_t packet[SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH];
-                spawn_monster_controller_packet(oid, false, monster->monster.id, monster->monster.x, monster->monster.y, monster->monster.fh, false, packet);
-                session_write(client_get_session(player->client), SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH, packet);
-            }
+            spawn_monster_controller_packet(oids[i], false, monster->monster.id, monster->monster.x, monster->monster.y, monster->monster.fh, false, snapshot_packet(&batch));
+            snapshot_commit(&batch, SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH);
         }
 
-        for (size_t i = 0; i < hit_count && monster->monster.hp > 0; i++)
-            monster->monster.hp -= damage[i];
+        const int32_t *hits = damage + i * hit_count;
+        for (size_t j = 0; j < hit_count && monster->monster.hp > 0; j++)
+            monster->monster.hp -= hits[j];
 
         if (monster->monster.hp < 0)
             monster->monster.hp = 0;
 
-        {
-            uint8_t packet[MONSTER_HP_PACKET_LENGTH];
-            monster_hp_packet(monster->monster.oid, monster->monster.hp * 100 / wz_get_monster_stats(monster->monster.id)->hp, packet);
-            session_write(client_get_session(player->client), MONSTER_HP_PACKET_LENGTH, packet);
-        }
+        monster_hp_packet(monster->monster.oid, monster->monster.hp * 100 / monster->stats->hp, snapshot_packet(&batch));
+        snapshot_commit(&batch, MONSTER_HP_PACKET_LENGTH);
 
         if (monster->monster.hp == 0) {
-            const struct MonsterDropInfo *info = drop_info_find(monster->monster.id);
+            killed[dead_count] = monster->monster.id;
+            dead_oids[dead_count] = oids[i];
+            dead_count++;
+        }
+    }
 
-            // Remove the controller from the monster
-            // TODO: Why is there a NULL check here?
-            if (monster->controller != NULL) {
-                if (object->type == MAP_OBJECT_MONSTER) {
-                    monster->controller->monsters[monster->indexInController] = monster->controller->monsters[monster->controller->monsterCount - 1];
-                    monster->controller->monsters[monster->indexInController]->indexInController = monster->indexInController;
-                    monster->controller->monsterCount--;
-                    monster->controller = NULL;
-                } else {
-                    monster->controller = NULL;
-                }
+    // One write per player that lost control over some of the monsters
+    for (size_t i = 0; i < taken_count; i++) {
+        if (old_controllers[i] == NULL)
+            continue;
+
+        uint8_t removals[(taken_count - i) * SNAPSHOT_RECORD_LENGTH(REMOVE_MONSTER_CONTROLLER_PACKET_LENGTH)];
+        struct Snapshot removal_batch = { .len = 0, .data = removals };
+        struct MapPlayer *old = old_controllers[i];
+        for (size_t j = i; j < taken_count; j++) {
+            if (old_controllers[j] == old) {
+                remove_monster_controller_packet(taken_oids[j], snapshot_packet(&removal_batch));
+                snapshot_commit(&removal_batch, REMOVE_MONSTER_CONTROLLER_PACKET_LENGTH);
+                old_controllers[j] = NULL;
             }
+        }
 
-            if (info != NULL) {
-                struct DropInfo drops_copy[info->count];
-                for (size_t i = 0; i < info->count; i++)
-                    drops_copy[i] = info->drops[i];
+        session_write_batch(client_get_session(old->client), removal_batch.len, removal_batch.data);
+    }
 
-                size_t max_drops = 0;
-                for (size_t i = 0; i < info->count; i++) {
-                    drops_copy[i].chance *= 16;
-                    max_drops += drops_copy[i].chance / 1000000 + 1;
-                }
-                struct Drop drops[max_drops];
-                size_t drop_count = 0;
-                for (size_t i = 0; i < info->count; i++) {
-                    if (drops_copy[i].chance > 1000000) {
-                        enum DropType type = drops_copy[i].itemId == 0 ? DROP_TYPE_MESO : (drops_copy[i].itemId / 1000000 == 1 ? DROP_TYPE_EQUIP : DROP_TYPE_ITEM);
-                        switch (type) {
-                        case DROP_TYPE_MESO:
-                            drops[drop_count].type = DROP_TYPE_MESO;
-                            drops[drop_count].meso = rand() % (drops_copy[i].max - drops_copy[i].min + 1) + drops_copy[i].min;
-                            drop_count++;
-                        break;
-
-                        case DROP_TYPE_ITEM:
-                            for (size_t j = 0; j < drops_copy[i].chance / 1000000; j++) {
-                                drops[drop_count].type = DROP_TYPE_ITEM;
-                                drops[drop_count].qid = drops_copy[i].isQuest ? drops_copy[i].questId : 0;
-                                drops[drop_count].item.item.id = 0;
-                                drops[drop_count].item.item.itemId = drops_copy[i].itemId;
-                                drops[drop_count].item.item.ownerLength = 0;
-                                drops[drop_count].item.item.flags = 0;
-                                drops[drop_count].item.item.expiration = -1;
-                                drops[drop_count].item.item.giftFromLength = 0;
-                                drops[drop_count].item.quantity = rand() % (drops_copy[i].max - drops_copy[i].min + 1) + drops_copy[i].min;
-                                drop_count++;
-                            }
+    session_write_batch(client_get_session(player->client), batch.len, batch.data);
 
-                            drops_copy[i].chance %= 1000000;
-                        break;
+    for (size_t i = 0; i < dead_count; i++)
+        map_monster_die(map, player, object_list_get(&map->objectList, dead_oids[i]));
 
-                        case DROP_TYPE_EQUIP:
-                            for (size_t j = 0; j < drops_copy[i].chance / 1000000; j++) {
-                                drops[drop_count].type = DROP_TYPE_EQUIP;
-                                drops[drop_count].equip = equipment_from_info(wz_get_equip_info(drops_copy[i].itemId));
-                                drop_count++;
-                            }
+    return dead_count;
+}
 
-                            drops_copy[i].chance %= 1000000;
-                        break;
-                        }
+// Drops the loot of a monster whose HP just reached 0, it is removed from the map once all of it has been dropped
+static void map_monster_die(struct Map *map, struct MapPlayer *player, struct MapObject *object)
+{
+    struct MapMonster *monster = object->type == MAP_OBJECT_MONSTER ? &map->monsters[object->index] : &map->boss;
+    const struct MonsterDropInfo *info = drop_info_find(monster->monster.id);
 
+    // Remove the controller from the monster
+    // TODO: Why is there a NULL check here?
+    if (monster->controller != NULL) {
+        if (object->type == MAP_OBJECT_MONSTER) {
+            map_uncontrol_monster(map, object->index);
+        } else {
+            monster->controller = NULL;
+        }
+    }
+
+    if (info != NULL) {
+        struct DropInfo drops_copy[info->count];
+        for (size_t i = 0; i < info->count; i++)
+            drops_copy[i] = info->drops[i];
+
+        size_t max_drops = 0;
+        for (size_t i = 0; i < info->count; i++) {
+            drops_copy[i].chance *= 16;
+            max_drops += drops_copy[i].chance / 1000000 + 1;
+        }
+        struct Drop drops[max_drops];
+        size_t drop_count = 0;
+        for (size_t i = 0; i < info->count; i++) {
+            if (drops_copy[i].chance > 1000000) {
+                enum DropType type = drops_copy[i].itemId == 0 ? DROP_TYPE_MESO : (drops_copy[i].itemId / 1000000 == 1 ? DROP_TYPE_EQUIP : DROP_TYPE_ITEM);
+                switch (type) {
+                case DROP_TYPE_MESO:
+                    drops[drop_count].type = DROP_TYPE_MESO;
+                    drops[drop_count].meso = rand() % (drops_copy[i].max - drops_copy[i].min + 1) + drops_copy[i].min;
+                    drop_count++;
+                break;
+
+                case DROP_TYPE_ITEM:
+                    for (size_t j = 0; j < drops_copy[i].chance / 1000000; j++) {
+                        drops[drop_count].type = DROP_TYPE_ITEM;
+                        drops[drop_count].qid = drops_copy[i].isQuest ? drops_copy[i].questId : 0;
+                        drops[drop_count].item.item.id = 0;
+                        drops[drop_count].item.item.itemId = drops_copy[i].itemId;
+                        drops[drop_count].item.item.ownerLength = 0;
+                        drops[drop_count].item.item.flags = 0;
+                        drops[drop_count].item.item.expiration = -1;
+                        drops[drop_count].item.item.giftFromLength = 0;
+                        drops[drop_count].item.quantity = rand() % (drops_copy[i].max - drops_copy[i].min + 1) + drops_copy[i].min;
+                        drop_count++;
                     }
 
-                    if (rand() % 1000000 < drops_copy[i].chance) {
-                        drops[drop_count].type = drops_copy[i].itemId == 0 ? DROP_TYPE_MESO : (drops_copy[i].itemId / 1000000 == 1 ? DROP_TYPE_EQUIP : DROP_TYPE_ITEM);
-                        switch (drops[drop_count].type) {
-                        case DROP_TYPE_MESO:
-                            drops[drop_count].meso = rand() % (drops_copy[i].max - drops_copy[i].min + 1) + drops_copy[i].min;
-                        break;
-
-                        case DROP_TYPE_ITEM:
-                            drops[drop_count].qid = drops_copy[i].isQuest ? drops_copy[i].questId : 0;
-                            drops[drop_count].item.item.id = 0;
-                            drops[drop_count].item.item.itemId = drops_copy[i].itemId;
-                            drops[drop_count].item.item.ownerLength = 0;
-                            drops[drop_count].item.item.flags = 0;
-                            drops[drop_count].item.item.expiration = -1;
-                            drops[drop_count].item.item.giftFromLength = 0;
-                            drops[drop_count].item.quantity = rand() % (drops_copy[i].max - drops_copy[i].min + 1) + drops_copy[i].min;
-                        break;
-
-                        case DROP_TYPE_EQUIP:
-                            drops[drop_count].equip = equipment_from_info(wz_get_equip_info(drops_copy[i].itemId));
-                        break;
-                        }
+                    drops_copy[i].chance %= 1000000;
+                break;
+
+                case DROP_TYPE_EQUIP:
+                    for (size_t j = 0; j < drops_copy[i].chance / 1000000; j++) {
+                        drops[drop_count].type = DROP_TYPE_EQUIP;
+                        drops[drop_count].equip = equipment_from_info(wz_get_equip_info(drops_copy[i].itemId));
                         drop_count++;
                     }
-                }
 
-                map_drop_batch_from_map_object(map, player, object, drop_count, drops);
+                    drops_copy[i].chance %= 1000000;
+                break;
+                }
 
-                if (drop_count == 1)
-                    map_kill_monster(map, monster->monster.oid);
-            } else {
-                map_kill_monster(map, monster->monster.oid);
             }
 
-            return monster->monster.id;
+            if (rand() % 1000000 < drops_copy[i].chance) {
+                drops[drop_count].type = drops_copy[i].itemId == 0 ? DROP_TYPE_MESO : (drops_copy[i].itemId / 1000000 == 1 ? DROP_TYPE_EQUIP : DROP_TYPE_ITEM);
+                switch (drops[drop_count].type) {
+                case DROP_TYPE_MESO:
+                    drops[drop_count].meso = rand() % (drops_copy[i].max - drops_copy[i].min + 1) + drops_copy[i].min;
+                break;
+
+                case DROP_TYPE_ITEM:
+                    drops[drop_count].qid = drops_copy[i].isQuest ? drops_copy[i].questId : 0;
+                    drops[drop_count].item.item.id = 0;
+                    drops[drop_count].item.item.itemId = drops_copy[i].itemId;
+                    drops[drop_count].item.item.ownerLength = 0;
+                    drops[drop_count].item.item.flags = 0;
+                    drops[drop_count].item.item.expiration = -1;
+                    drops[drop_count].item.item.giftFromLength = 0;
+                    drops[drop_count].item.quantity = rand() % (drops_copy[i].max - drops_copy[i].min + 1) + drops_copy[i].min;
+                break;
+
+                case DROP_TYPE_EQUIP:
+                    drops[drop_count].equip = equipment_from_info(wz_get_equip_info(drops_copy[i].itemId));
+                break;
+                }
+                drop_count++;
+            }
         }
-    }
 
-    return -1;
+        map_drop_batch_from_map_object(map, player, object, drop_count, drops);
+
+        if (drop_count == 1)
+            map_kill_monster(map, monster->monster.oid);
+    } else {
+        map_kill_monster(map, monster->monster.oid);
+    }
 }
 
 uint32_t *map_kill_all_by(struct Map *map, struct MapPlayer *player, size_t *count)
@@ -1181,9 +1388,8 @@ uint32_t *map_kill_all_by(struct Map *map, struct MapPlayer *player, size_t *cou
     for (size_t i = 0; i < map->monsterCount; i++) {
         if (map->monsters[i].monster.hp > 0) {
             uint32_t oid = map->monsters[i].monster.oid;
-            uint32_t id = map_damage_monster_by(map, player, client_get_character(player->client)->id, oid, 1, &map->monsters[i].monster.hp);
-            ids[*count] = id;
-            (*count)++;
+            int32_t damage = map->monsters[i].monster.hp;
+            *count += map_apply_attack(map, player, 1, &oid, 1, &damage, &ids[*count]);
 
             // If the OID of the monster doesn't exist anymore then map_kill_monster was called
             // And so the current monster index was replaced with the last monster
@@ -1202,7 +1408,7 @@ struct ClientResult map_hit_reactor(struct Map *map, struct MapPlayer *player, u
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_BAN };
 
     struct Reactor *reactor = &map->reactors[object->index];
-    const struct ReactorInfo *info = wz_get_reactor_info(reactor->id);
+    const struct ReactorInfo *info = map->statics->reactorInfos[object->index];
     if (info->states[reactor->state].eventCount == 0)
         return (struct ClientResult) { .type = CLIENT_RESULT_TYPE_SUCCESS };
 
@@ -1210,6 +1416,7 @@ struct ClientResult map_hit_reactor(struct Map *map, struct MapPlayer *player, u
     for (size_t i = 0; i < info->states[reactor->state].eventCount; i++) {
         if (info->states[reactor->state].events[i].type == REACTOR_EVENT_TYPE_HIT) {
             reactor->state = info->states[reactor->state].events[i].next;
+            map->reactorSnapshotDirty = true;
             found = true;
             break;
         }
@@ -1316,8 +1523,7 @@ int map_drop_batch_from_reactor(struct Map *map, struct MapPlayer *player, uint3
     if (object == NULL || object->type != MAP_OBJECT_REACTOR)
         return -1;
 
-    const struct MapReactorInfo *reactor = &wz_get_reactors_for_map(map_get_id(map), NULL)[object->index];
-    const struct MonsterDropInfo *info = reactor_drop_info_find(reactor->id);
+    const struct MonsterDropInfo *info = reactor_drop_info_find(map->reactors[object->index].id);
 
     struct DropInfo drops_copy[info->count];
     for (size_t i = 0; i < info->count; i++)
@@ -1410,7 +1616,7 @@ static int map_drop_batch_from_map_object(struct Map *map, struct MapPlayer *pla
         pos.x = map->boss.monster.x;
         pos.y = map->boss.monster.y;
     } else if (object->type == MAP_OBJECT_REACTOR) {
-        pos = wz_get_reactors_for_map(room_get_id(map->room), NULL)[object->index].pos;
+        pos = map->statics->info->reactors[object->index].pos;
     } else if (object->type == MAP_OBJECT_DROP) {
         pos.x = map->dropBatches[object->index]->drops[object->index2].x;
         pos.y = map->dropBatches[object->index]->drops[object->index2].y;
@@ -1453,7 +1659,11 @@ static int map_drop_batch_from_map_object(struct Map *map, struct MapPlayer *pla
             player->droppingCapacity *= 2;
         }
 
-        struct DroppingBatch *batch = malloc(sizeof(struct DroppingBatch) + count * sizeof(struct Drop));
+        struct OwnedBatches *owned = owned_batches_get_or_insert(map->ownedBatches, client_get_character(player->client)->id);
+        if (owned == NULL)
+            return -1;
+
+        struct DroppingBatch *batch = arena_pool_alloc(map->arena, sizeof(struct DroppingBatch) + count * sizeof(struct Drop));
         if (batch == NULL)
             return -1;
 
@@ -1469,7 +1679,7 @@ static int map_drop_batch_from_map_object(struct Map *map, struct MapPlayer *pla
         drop_object->index2 = 0;
 
         for (size_t i = 0; i < map->playerCount; i++)
-            client_announce_drop(map->players[i].client, client_get_character(player->client)->id, object_copy.oid, 1, false, drop);
+            client_announce_drop(map->players[i]->client, client_get_character(player->client)->id, object_copy.oid, 1, false, drop);
 
         for (size_t i = 0; i < count; i++)
             batch->drops[i] = drops[i];
@@ -1481,6 +1691,7 @@ static int map_drop_batch_from_map_object(struct Map *map, struct MapPlayer *pla
         batch->owner = player;
         batch->indexInPlayer = player->droppingCount;
         batch->ownerId = client_get_character(player->client)->id;
+        owned_batches_link_dropping(owned, batch);
         player->droppings[player->droppingCount] = batch;
         player->droppingCount++;
         batch->dropperOid = object_copy.oid;
@@ -1514,10 +1725,16 @@ static int map_drop_batch_from_map_object(struct Map *map, struct MapPlayer *pla
             player->dropCapacity *= 2;
         }
 
-        map->dropBatches[map->dropBatchEnd] = malloc(sizeof(struct DropBatch) + sizeof(struct Drop)); // Only 1 drop
+        struct OwnedBatches *owned = owned_batches_get_or_insert(map->ownedBatches, client_get_character(player->client)->id);
+        if (owned == NULL)
+            return -1;
+
+        map->dropBatches[map->dropBatchEnd] = arena_pool_alloc(map->arena, sizeof(struct DropBatch) + sizeof(struct Drop)); // Only 1 drop
         map->dropBatchEnd++;
         struct DropBatch *batch = map->dropBatches[map->dropBatchEnd - 1];
-        batch->timer = room_add_timer(map->room, 15 * 1000, on_exclusive_drop_time_expired, NULL);
+        batch->timer = room_add_timer(map->room, DROP_EXCLUSIVE_TIME, on_exclusive_drop_time_expired, NULL);
+        batch->exclusiveUntil = map_now() + DROP_EXCLUSIVE_TIME;
+        batch->expiresAt = batch->exclusiveUntil - DROP_EXCLUSIVE_TIME + DROP_EXPIRE_TIME;
 
         batch->drops[0] = *drops;
         struct Drop *drop = &batch->drops[0];
@@ -1530,6 +1747,7 @@ static int map_drop_batch_from_map_object(struct Map *map, struct MapPlayer *pla
         batch->owner = player;
         batch->indexInPlayer = player->dropCount;
         batch->ownerId = client_get_character(player->client)->id;
+        owned_batches_link_drop(owned, batch);
         batch->exclusive = true;
         player->drops[player->dropCount] = batch;
         player->dropCount++;
@@ -1544,7 +1762,7 @@ static int map_drop_batch_from_map_object(struct Map *map, struct MapPlayer *pla
 
         case DROP_TYPE_ITEM: {
             for (size_t i = 0; i < map->playerCount; i++)
-                client_announce_drop(map->players[i].client, batch->ownerId, object_copy.oid, 1, false, drop);
+                client_announce_drop(map->players[i]->client, batch->ownerId, object_copy.oid, 1, false, drop);
         }
         break;
 
@@ -1628,10 +1846,16 @@ void map_add_player_drop(struct Map *map, struct MapPlayer *player, struct Drop
         player->dropCapacity *= 2;
     }
 
-    map->dropBatches[map->dropBatchEnd] = malloc(sizeof(struct DropBatch) + sizeof(struct Drop));
+    struct OwnedBatches *owned = owned_batches_get_or_insert(map->ownedBatches, client_get_character(player->client)->id);
+    if (owned == NULL)
+        return;
+
+    map->dropBatches[map->dropBatchEnd] = arena_pool_alloc(map->arena, sizeof(struct DropBatch) + sizeof(struct Drop));
     map->dropBatchEnd++;
     struct DropBatch *batch = map->dropBatches[map->dropBatchEnd - 1];
-    batch->timer = room_add_timer(map->room, 300 * 1000, on_drop_time_expired, NULL);
+    batch->timer = room_add_timer(map->room, DROP_EXPIRE_TIME, on_drop_time_expired, NULL);
+    batch->exclusiveUntil = 0;
+    batch->expiresAt = map_now() + DROP_EXPIRE_TIME;
 
     batch->drops[0] = *drop;
     drop = &batch->drops[0];
@@ -1643,6 +1867,7 @@ void map_add_player_drop(struct Map *map, struct MapPlayer *player, struct Drop
     batch->count = 1;
     batch->owner = player;
     batch->ownerId = client_get_character(player->client)->id;
+    owned_batches_link_drop(owned, batch);
     batch->indexInPlayer = player->dropCount;
     batch->exclusive = false;
     player->drops[player->dropCount] = batch;
@@ -1727,7 +1952,8 @@ void map_remove_drop(struct Map *map, uint32_t char_id, uint32_t oid)
                 }
             }
             room_stop_timer(batch->timer);
-            free(batch);
+            owned_batches_unlink_drop(map->ownedBatches, batch);
+            arena_pool_free(map->arena, batch);
             map->dropBatches[batch_index] = NULL;
         }
 
@@ -1822,8 +2048,8 @@ static void start_sailing(void *ctx)
         // client_warp() calls map_leave() which in turn swaps the last player in the array
         // with the current one so we need to decrease i to check the same index again
         for (size_t i = 0; i < map->playerCount; i++) {
-            client_close_script(map->players[i].client);
-            if (client_warp(map->players[i].client, room_get_id(map->room) == 101000301 ? 200090010 : 200090000, 0))
+            client_close_script(map->players[i]->client);
+            if (client_warp(map->players[i]->client, room_get_id(map->room) == 101000301 ? 200090010 : 200090000, 0))
                 i--;
         }
     }
@@ -1836,7 +2062,7 @@ static void end_sailing(void *ctx)
     if (state == 0) {
         // There is no suspending script when on the sail map so client_close_script() is unnecessary
         for (size_t i = 0; i < map->playerCount; i++) {
-            if (client_warp(map->players[i].client, room_get_id(map->room) / 10 == 20009001 ? 200000100 : 101000300, 0))
+            if (client_warp(map->players[i]->client, room_get_id(map->room) / 10 == 20009001 ? 200000100 : 101000300, 0))
                 i--;
         }
     }
@@ -1863,8 +2089,8 @@ static void start_train(void *ctx)
     int32_t state = event_get_property(channel_server_get_event(map->server, EVENT_TRAIN), EVENT_TRAIN_PROPERTY_SAILING);
     if (state == 2) {
         for (size_t i = 0; i < map->playerCount; i++) {
-            client_close_script(map->players[i].client);
-            if (client_warp(map->players[i].client, room_get_id(map->room) == 200000122 ? 200090100 : 200090110, 0))
+            client_close_script(map->players[i]->client);
+            if (client_warp(map->players[i]->client, room_get_id(map->room) == 200000122 ? 200090100 : 200090110, 0))
                 i--;
         }
     }
@@ -1876,7 +2102,7 @@ static void end_train(void *ctx)
     int32_t state = event_get_property(channel_server_get_event(map->server, EVENT_TRAIN), EVENT_TRAIN_PROPERTY_SAILING);
     if (state == 0) {
         for (size_t i = 0; i < map->playerCount; i++) {
-            if (client_warp(map->players[i].client, room_get_id(map->room) == 200090100 ? 220000110 : 200000100, 0))
+            if (client_warp(map->players[i]->client, room_get_id(map->room) == 200090100 ? 220000110 : 200000100, 0))
                 i--;
         }
     }
@@ -1903,8 +2129,8 @@ static void start_genie(void *ctx)
     int32_t state = event_get_property(channel_server_get_event(map->server, EVENT_GENIE), EVENT_GENIE_PROPERTY_SAILING);
     if (state == 2) {
         for (size_t i = 0; i < map->playerCount; i++) {
-            client_close_script(map->players[i].client);
-            if (client_warp(map->players[i].client, room_get_id(map->room) == 200000152 ? 200090400 : 200090410, 0))
+            client_close_script(map->players[i]->client);
+            if (client_warp(map->players[i]->client, room_get_id(map->room) == 200000152 ? 200090400 : 200090410, 0))
                 i--;
         }
     }
@@ -1916,7 +2142,7 @@ static void end_genie(void *ctx)
     int32_t state = event_get_property(channel_server_get_event(map->server, EVENT_GENIE), EVENT_GENIE_PROPERTY_SAILING);
     if (state == 0) {
         for (size_t i = 0; i < map->playerCount; i++) {
-            if (client_warp(map->players[i].client, room_get_id(map->room) == 200090400 ? 260000100 : 200000100, 0))
+            if (client_warp(map->players[i]->client, room_get_id(map->room) == 200090400 ? 260000100 : 200000100, 0))
                 i--;
         }
     }
@@ -1940,8 +2166,8 @@ static void start_subway(void *ctx)
     int32_t state = event_get_property(channel_server_get_event(map->server, EVENT_SUBWAY), EVENT_SUBWAY_PROPERTY_SAILING);
     if (state == 2) {
         for (size_t i = 0; i < map->playerCount; i++) {
-            client_close_script(map->players[i].client);
-            if (client_warp(map->players[i].client, room_get_id(map->room) == 600010004 ? 600010005 : 600010003, 0))
+            client_close_script(map->players[i]->client);
+            if (client_warp(map->players[i]->client, room_get_id(map->room) == 600010004 ? 600010005 : 600010003, 0))
                 i--;
         }
     }
@@ -1953,13 +2179,66 @@ static void end_subway(void *ctx)
     int32_t state = event_get_property(channel_server_get_event(map->server, EVENT_SUBWAY), EVENT_SUBWAY_PROPERTY_SAILING);
     if (state == 0) {
         for (size_t i = 0; i < map->playerCount; i++) {
-            client_close_script(map->players[i].client);
-            if (client_warp(map->players[i].client, room_get_id(map->room) == 600010005 ? 600010001 : 103000100, 0))
+            client_close_script(map->players[i]->client);
+            if (client_warp(map->players[i]->client, room_get_id(map->room) == 600010005 ? 600010001 : 103000100, 0))
                 i--;
         }
     }
 }
 
+static bool map_transport_listener(uint32_t id, struct TransportListener *l)
+{
+    if (id == 101000300 || id == 200000111) {
+        *l = (struct TransportListener) { EVENT_BOAT, EVENT_BOAT_PROPERTY_SAILING, dock_undock_boat };
+    } else if (id == 101000301 || id == 200000112) {
+        *l = (struct TransportListener) { EVENT_BOAT, EVENT_BOAT_PROPERTY_SAILING, start_sailing };
+    } else if (id / 10 == 20009001 || id / 10 == 20009000) {
+        *l = (struct TransportListener) { EVENT_BOAT, EVENT_BOAT_PROPERTY_SAILING, end_sailing };
+    } else if (id == 200000121 || id == 220000110) {
+        *l = (struct TransportListener) { EVENT_TRAIN, EVENT_TRAIN_PROPERTY_SAILING, dock_undock_train };
+    } else if (id == 200000122 || id == 220000111) {
+        *l = (struct TransportListener) { EVENT_TRAIN, EVENT_TRAIN_PROPERTY_SAILING, start_train };
+    } else if (id == 200090100 || id == 200090110) {
+        *l = (struct TransportListener) { EVENT_TRAIN, EVENT_TRAIN_PROPERTY_SAILING, end_train };
+    } else if (id == 200000151 || id == 260000100) {
+        *l = (struct TransportListener) { EVENT_GENIE, EVENT_GENIE_PROPERTY_SAILING, dock_undock_genie };
+    } else if (id == 200000152 || id == 260000110) {
+        *l = (struct TransportListener) { EVENT_GENIE, EVENT_GENIE_PROPERTY_SAILING, start_genie };
+    } else if (id == 200090400 || id == 200090410) {
+        *l = (struct TransportListener) { EVENT_GENIE, EVENT_GENIE_PROPERTY_SAILING, end_genie };
+    } else if (id == 103000100 || id == 600010001) {
+        *l = (struct TransportListener) { EVENT_SUBWAY, EVENT_SUBWAY_PROPERTY_SAILING, dock_undock_subway };
+    } else if (id == 600010004 || id == 600010002) {
+        *l = (struct TransportListener) { EVENT_SUBWAY, EVENT_SUBWAY_PROPERTY_SAILING, start_subway };
+    } else if (id == 600010005 || id == 600010003) {
+        *l = (struct TransportListener) { EVENT_SUBWAY, EVENT_SUBWAY_PROPERTY_SAILING, end_subway };
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static void map_listen(struct Map *map)
+{
+    struct TransportListener l;
+    if (!map_transport_listener(room_get_id(map->room), &l))
+        return;
+
+    map->listener = event_add_listener(channel_server_get_event(map->server, l.event), room_get_base(map->room), l.property, l.f, map);
+    map->listening = true;
+}
+
+static void map_unlisten(struct Map *map)
+{
+    struct TransportListener l;
+    if (!map->listening || !map_transport_listener(room_get_id(map->room), &l))
+        return;
+
+    event_remove_listener(channel_server_get_event(map->server, l.event), l.property, map->listener);
+    map->listening = false;
+}
+
 static void respawn_boss(void *ctx)
 {
     struct Map *map = ctx;
@@ -1977,7 +2256,7 @@ static void respawn_boss(void *ctx)
         map->boss.monster.x = map->bossSpawner.x;
         map->boss.monster.y = map->bossSpawner.y;
         map->boss.monster.fh = map->bossSpawner.fh;
-        map->boss.monster.hp = wz_get_monster_stats(map->boss.monster.id)->hp;
+        map->boss.monster.hp = map->boss.stats->hp;
 
         struct Monster *monster = &map->boss.monster;
         for (size_t i = 0; i < map->playerCount; i++) {
@@ -2092,6 +2371,59 @@ static void respawn_boss(void *ctx)
     }
 }
 
+static struct MapStatic *map_static_create(struct Arena *arena, const struct MapInfo *info)
+{
+    size_t spawner_count = 0;
+    for (size_t i = 0; i < info->lifeCount; i++) {
+        if (info->lives[i].type == LIFE_TYPE_MOB)
+            spawner_count++;
+    }
+
+    // All of the arrays share the allocation of the block itself
+    struct MapStatic *statics = arena_alloc(arena, sizeof(struct MapStatic) + (spawner_count + info->reactorCount) * sizeof(void *));
+    if (statics == NULL)
+        return NULL;
+
+    statics->info = info;
+    statics->spawnerStats = (const struct MobInfo **)(statics + 1);
+    statics->reactorInfos = (const struct ReactorInfo **)(statics->spawnerStats + spawner_count);
+
+    spawner_count = 0;
+    for (size_t i = 0; i < info->lifeCount; i++) {
+        if (info->lives[i].type == LIFE_TYPE_MOB) {
+            statics->spawnerStats[spawner_count] = wz_get_monster_stats(info->lives[i].id);
+            spawner_count++;
+        }
+    }
+
+    for (size_t i = 0; i < info->reactorCount; i++) {
+        statics->reactorInfos[i] = wz_get_reactor_info(info->reactors[i].id);
+    }
+
+    return statics;
+}
+
+static void map_spawn_initial_monsters(struct Map *map)
+{
+    for (size_t i = 0; i < map->spawnerCount; i++) {
+        struct MapObject *obj = object_list_allocate(&map->objectList);
+        obj->type = MAP_OBJECT_MONSTER;
+        obj->index = i;
+        map->monsters[i].monster.oid = obj->oid;
+        map->monsters[i].monster.id = map->spawners[i].id;
+        map->monsters[i].monster.x = map->spawners[i].x;
+        map->monsters[i].monster.y = map->spawners[i].y;
+        map->monsters[i].monster.fh = map->spawners[i].fh;
+        map->monsters[i].monster.hp = map->statics->spawnerStats[i]->hp;
+        map->monsters[i].stats = map->statics->spawnerStats[i];
+        map->monsters[i].spawnerIndex = i;
+        map->monsters[i].controller = NULL;
+        map->monsters[i].prevControlled = MAP_MONSTER_NONE;
+        map->monsters[i].nextControlled = MAP_MONSTER_NONE;
+    }
+    map->monsterCount = map->spawnerCount;
+}
+
 static void map_kill_monster(struct Map *map, uint32_t oid)
 {
     struct MapObject *object = object_list_get(&map->objectList, oid);
@@ -2101,10 +2433,24 @@ static void map_kill_monster(struct Map *map, uint32_t oid)
             map->dead[map->deadCount] = monster->spawnerIndex;
             map->deadCount++;
         }
-        map->monsters[object->index] = map->monsters[map->monsterCount - 1];
-        if (map->monsters[object->index].controller != NULL)
-            map->monsters[object->index].controller->monsters[map->monsters[object->index].indexInController] = &map->monsters[object->index];
-        object_list_get(&map->objectList, map->monsters[object->index].monster.oid)->index = object->index;
+        if (monster->controller != NULL)
+            map_uncontrol_monster(map, object->index);
+
+        if (object->index != map->monsterCount - 1) {
+            // Move the last monster into the hole, only its neighbours in its controller's list need to be patched
+            struct MapMonster *last = &map->monsters[object->index];
+            *last = map->monsters[map->monsterCount - 1];
+            if (last->controller != NULL) {
+                if (last->prevControlled != MAP_MONSTER_NONE)
+                    map->monsters[last->prevControlled].nextControlled = object->index;
+                else
+                    last->controller->firstMonster = object->index;
+
+                if (last->nextControlled != MAP_MONSTER_NONE)
+                    map->monsters[last->nextControlled].prevControlled = object->index;
+            }
+            object_list_get(&map->objectList, last->monster.oid)->index = object->index;
+        }
         map->monsterCount--;
         object_list_free(&map->objectList, oid);
         uint8_t packet[KILL_MONSTER_PACKET_LENGTH];
@@ -2119,16 +2465,55 @@ static void map_kill_monster(struct Map *map, uint32_t oid)
     }
 }
 
+static void map_control_monster(struct Map *map, struct MapPlayer *controller, size_t index)
+{
+    struct MapMonster *monster = &map->monsters[index];
+    monster->controller = controller;
+    monster->prevControlled = MAP_MONSTER_NONE;
+    monster->nextControlled = controller->firstMonster;
+    if (controller->firstMonster != MAP_MONSTER_NONE)
+        map->monsters[controller->firstMonster].prevControlled = index;
+    controller->firstMonster = index;
+    controller->monsterCount++;
+    heap_update(&map->heap, controller->node);
+}
+
+static void map_uncontrol_monster(struct Map *map, size_t index)
+{
+    struct MapMonster *monster = &map->monsters[index];
+    if (monster->prevControlled != MAP_MONSTER_NONE)
+        map->monsters[monster->prevControlled].nextControlled = monster->nextControlled;
+    else
+        monster->controller->firstMonster = monster->nextControlled;
+
+    if (monster->nextControlled != MAP_MONSTER_NONE)
+        map->monsters[monster->nextControlled].prevControlled = monster->prevControlled;
+
+    monster->controller->monsterCount--;
+    heap_update(&map->heap, monster->controller->node);
+    monster->controller = NULL;
+    monster->prevControlled = MAP_MONSTER_NONE;
+    monster->nextControlled = MAP_MONSTER_NONE;
+}
+
 static void map_destroy_reactor(struct Map *map, uint32_t oid)
 {
     struct MapObject *object = object_list_get(&map->objectList, oid);
     struct Reactor *reactor = &map->reactors[object->index];
 
+    const struct MapReactorInfo *info = &map->statics->info->reactors[object->index];
+
     uint8_t packet[DESTROY_REACTOR_PACKET_LENGTH];
-    destroy_reactor_packet(oid, reactor->state, wz_get_reactors_for_map(room_get_id(map->room), NULL)[object->index].pos.x, wz_get_reactors_for_map(room_get_id(map->room), NULL)[object->index].pos.y, packet);
+    destroy_reactor_packet(oid, reactor->state, info->pos.x, info->pos.y, packet);
     room_broadcast(map->room, DESTROY_REACTOR_PACKET_LENGTH, packet);
 
-    room_add_timer(map->room, 3000, on_respawn_reactor, reactor);
+    reactor->respawnAt = map_now() + REACTOR_RESPAWN_TIME;
+    if (map->playerCount == 0) {
+        reactor->respawnTimer = NULL;
+        map_extend_dormancy(map, reactor->respawnAt);
+    } else {
+        reactor->respawnTimer = room_add_timer(map->room, REACTOR_RESPAWN_TIME, on_respawn_reactor, reactor);
+    }
 }
 
 static bool map_calculate_drop_position(struct Map *map, struct Point *p)
@@ -2211,7 +2596,7 @@ static void on_next_drop(struct Room *room, struct TimerHandle *handle)
     object->index2 = batch->current;
 
     for (size_t i = 0; i < map->playerCount; i++)
-        client_announce_drop(map->players[i].client, batch->ownerId, batch->dropperOid, 1, false, drop);
+        client_announce_drop(map->players[i]->client, batch->ownerId, batch->dropperOid, 1, false, drop);
 
     batch->current++;
     if (batch->current < batch->count) {
@@ -2237,10 +2622,19 @@ static void on_next_drop(struct Room *room, struct TimerHandle *handle)
             batch->owner->dropCapacity *= 2;
         }
 
-        map->dropBatches[map->dropBatchEnd] = malloc(sizeof(struct DropBatch) + batch->count * sizeof(struct Drop));
+        map->dropBatches[map->dropBatchEnd] = arena_pool_alloc(map->arena, sizeof(struct DropBatch) + batch->count * sizeof(struct Drop));
         map->dropBatchEnd++;
         struct DropBatch *new = map->dropBatches[map->dropBatchEnd - 1];
-        new->timer = room_add_timer(map->room, 15 * 1000, on_exclusive_drop_time_expired, NULL);
+        uint64_t now = map_now();
+        new->exclusiveUntil = now + DROP_EXCLUSIVE_TIME;
+        new->expiresAt = now + DROP_EXPIRE_TIME;
+        // The last player may have left while the batch was still dropping
+        if (map->playerCount == 0) {
+            new->timer = NULL;
+            map_extend_dormancy(map, new->expiresAt);
+        } else {
+            new->timer = room_add_timer(map->room, DROP_EXCLUSIVE_TIME, on_exclusive_drop_time_expired, NULL);
+        }
 
         if (batch->owner != NULL) {
             batch->owner->droppings[batch->indexInPlayer] = batch->owner->droppings[batch->owner->droppingCount - 1];
@@ -2284,6 +2678,9 @@ static void on_next_drop(struct Room *room, struct TimerHandle *handle)
             batch->owner->dropCount++;
         }
         new->ownerId = batch->ownerId;
+        // Link the new batch first so that the owner's entry doesn't go away in between
+        owned_batches_link_drop(hash_set_u32_get(map->ownedBatches, new->ownerId), new);
+        owned_batches_unlink_dropping(map->ownedBatches, batch);
         new->exclusive = true;
 
         object = object_list_get(&map->objectList, batch->dropperOid);
@@ -2295,7 +2692,7 @@ static void on_next_drop(struct Room *room, struct TimerHandle *handle)
         if (batch->owner != NULL && client_is_auto_pickup_enabled(batch->owner->client))
             do_client_auto_pickup(map, batch->owner->client, drop);
 
-        free(batch);
+        arena_pool_free(map->arena, batch);
     }
 }
 
@@ -2308,7 +2705,7 @@ static void on_exclusive_drop_time_expired(struct Room *room, struct TimerHandle
 
     (*batch)->exclusive = false;
 
-    (*batch)->timer = room_add_timer(room, 285 * 1000, on_drop_time_expired, NULL);
+    (*batch)->timer = room_add_timer(room, DROP_EXPIRE_TIME - DROP_EXCLUSIVE_TIME, on_drop_time_expired, NULL);
 }
 
 static void on_drop_time_expired(struct Room *room, struct TimerHandle *handle)
@@ -2322,6 +2719,13 @@ static void on_drop_time_expired(struct Room *room, struct TimerHandle *handle)
         room_broadcast(map->room, REMOVE_DROP_PACKET_LENGTH, packet);
     }
 
+    map_expire_drop_batch(map);
+}
+
+// Removes the oldest drop batch without telling anyone
+static void map_expire_drop_batch(struct Map *map)
+{
+    struct DropBatch *batch = map->dropBatches[map->dropBatchStart];
     for (size_t i = 0; i < batch->count; i++) {
         assert(object_list_get(&map->objectList, batch->drops[i].oid)->type == MAP_OBJECT_DROP);
         object_list_free(&map->objectList, batch->drops[i].oid);
@@ -2341,7 +2745,8 @@ static void on_drop_time_expired(struct Room *room, struct TimerHandle *handle)
         }
     }
 
-    free(batch);
+    owned_batches_unlink_drop(map->ownedBatches, batch);
+    arena_pool_free(map->arena, batch);
     map->dropBatches[map->dropBatchStart] = NULL;
 
     while (map->dropBatchStart < map->dropBatchEnd && map->dropBatches[map->dropBatchStart] == NULL) {
@@ -2376,33 +2781,48 @@ static void on_drop_time_expired(struct Room *room, struct TimerHandle *handle)
 
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
-static void on_respawn(void *ctx)
+void map_respawn(struct Map *map)
 {
-    struct Map *map = ctx;
+    // Nobody would see the new monsters, so just remember that they are due and spawn them when someone joins
+    if (map->playerCount == 0) {
+        map->respawnPending = true;
+        return;
+    }
+
+    struct ControllerHeapNode *next = heap_top(&map->heap);
+    size_t count = map_respawn_monsters(map, next);
+
+    for (size_t i = map->monsterCount - count; i < map->monsterCount; i++) {
+        const struct Monster *monster = &map->monsters[i].monster;
+        uint8_t packet[SPAWN_MONSTER_PACKET_LENGTH];
+        spawn_monster_packet(monster->oid, monster->id, monster->x, monster->y, monster->fh, true, packet);
+        room_broadcast(map->room, SPAWN_MONSTER_PACKET_LENGTH, packet);
+    }
+
+    if (next != NULL) {
+        for (size_t i = map->monsterCount - count; i < map->monsterCount; i++) {
+            const struct Monster *monster = &map->monsters[i].monster;
+            uint8_t packet[SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH];
+            spawn_monster_controller_packet(monster->oid, false, monster->id, monster->x, monster->y, monster->fh, true, packet);
+            session_write(client_get_session(next->controller->client), SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH, packet);
+        }
+    }
+}
 
+// Refills the map up to its spawn limit and gives the new monsters to \p next, if any.
+// Returns how many monsters were spawned, they are the last ones in Map::monsters
+static size_t map_respawn_monsters(struct Map *map, struct ControllerHeapNode *next)
+{
     size_t maxSpawnCount = ceil((0.7 + (0.05 * MIN(6, map->playerCount))) * map->spawnerCount);
 
-    struct ControllerHeapNode *next = heap_top(&map->heap);
     size_t count = 0;
     while (map->monsterCount < maxSpawnCount) {
         if (map->monsterCount == map->monsterCapacity) {
             struct MapMonster *temp = realloc(map->monsters, (map->monsterCapacity * 2) * sizeof(struct MapMonster));
             if (temp == NULL)
-                return;
+                break;
 
             map->monsters = temp;
-
-            for (size_t i = 0; i < map->playerCount; i++) {
-                void *temp = realloc(map->players[i].monsters, (map->monsterCapacity * 2) * sizeof(struct MapMonster *));
-                if (temp == NULL)
-                    return;
-
-                map->players[i].monsters = temp;
-            }
-
-            for (size_t i = 0; i < map->monsterCount; i++)
-                map->monsters[i].controller->monsters[map->monsters[i].indexInController] = &map->monsters[map->monsterCount];
-
             map->monsterCapacity *= 2;
         }
 
@@ -2419,15 +2839,15 @@ static void on_respawn(void *ctx)
         map->monsters[map->monsterCount].monster.x = map->spawners[i].x;
         map->monsters[map->monsterCount].monster.y = map->spawners[i].y;
         map->monsters[map->monsterCount].monster.fh = map->spawners[i].fh;
-        map->monsters[map->monsterCount].monster.hp = wz_get_monster_stats(map->spawners[i].id)->hp;
+        map->monsters[map->monsterCount].monster.hp = map->statics->spawnerStats[i]->hp;
+        map->monsters[map->monsterCount].stats = map->statics->spawnerStats[i];
         map->monsters[map->monsterCount].spawnerIndex = i;
         if (next != NULL) {
-            map->monsters[map->monsterCount].controller = next->controller;
-            map->monsters[map->monsterCount].indexInController = next->controller->monsterCount;
-            next->controller->monsters[next->controller->monsterCount] = &map->monsters[map->monsterCount];
-            next->controller->monsterCount++;
+            map_control_monster(map, next->controller, map->monsterCount);
         } else {
             map->monsters[map->monsterCount].controller = NULL;
+            map->monsters[map->monsterCount].prevControlled = MAP_MONSTER_NONE;
+            map->monsters[map->monsterCount].nextControlled = MAP_MONSTER_NONE;
         }
 
         map->monsterCount++;
@@ -2435,54 +2855,243 @@ static void on_respawn(void *ctx)
         map->deadCount--;
     }
 
-    if (next != NULL)
-        heap_inc(&map->heap, count);
-
-    for (size_t i = map->monsterCount - count; i < map->monsterCount; i++) {
-        const struct Monster *monster = &map->monsters[i].monster;
-        uint8_t packet[SPAWN_MONSTER_PACKET_LENGTH];
-        spawn_monster_packet(monster->oid, monster->id, monster->x, monster->y, monster->fh, true, packet);
-        room_broadcast(map->room, SPAWN_MONSTER_PACKET_LENGTH, packet);
-    }
-
-    if (next != NULL) {
-        for (size_t i = map->monsterCount - count; i < map->monsterCount; i++) {
-            const struct Monster *monster = &map->monsters[i].monster;
-            uint8_t packet[SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH];
-            spawn_monster_controller_packet(monster->oid, false, monster->id, monster->x, monster->y, monster->fh, true, packet);
-            session_write(client_get_session(next->controller->client), SPAWN_MONSTER_CONTROLLER_PACKET_LENGTH, packet);
-        }
-    }
+    return count;
 }
 
 static void on_respawn_reactor(struct Room *room, struct TimerHandle *handle)
 {
+    struct Map *map = room_get_context(room);
     struct Reactor *reactor = timer_get_data(handle);
     reactor->state = 0;
+    map->reactorSnapshotDirty = true;
     reactor->keepAlive = false;
+    reactor->respawnTimer = NULL;
+    reactor->respawnAt = 0;
 
     uint8_t packet[SPAWN_REACTOR_PACKET_LENGTH];
     spawn_reactor_packet(reactor->oid, reactor->id, reactor->x, reactor->y, reactor->state, packet);
     room_broadcast(room, SPAWN_REACTOR_PACKET_LENGTH, packet);
 }
 
+static uint64_t map_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void map_go_dormant(struct Map *map)
+{
+    uint64_t until = 0;
+    for (size_t i = map->dropBatchStart; i < map->dropBatchEnd; i++) {
+        if (map->dropBatches[i] != NULL && map->dropBatches[i]->expiresAt > until)
+            until = map->dropBatches[i]->expiresAt;
+    }
+
+    for (size_t i = 0; i < map->reactorCount; i++) {
+        if (map->reactors[i].respawnTimer != NULL && map->reactors[i].respawnAt > until)
+            until = map->reactors[i].respawnAt;
+    }
+
+    if (until == 0)
+        return;
+
+    // Armed before the other timers are stopped so that the room never looks unused in between
+    uint64_t now = map_now();
+    map->dormancyTimer = room_add_timer(map->room, until > now ? until - now : 0, on_dormancy_expired, NULL);
+    if (map->dormancyTimer == NULL)
+        return; // Just keep running the timers
+    map->dormantUntil = until;
+
+    for (size_t i = map->dropBatchStart; i < map->dropBatchEnd; i++) {
+        if (map->dropBatches[i] != NULL) {
+            room_stop_timer(map->dropBatches[i]->timer);
+            map->dropBatches[i]->timer = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < map->reactorCount; i++) {
+        if (map->reactors[i].respawnTimer != NULL) {
+            room_stop_timer(map->reactors[i].respawnTimer);
+            map->reactors[i].respawnTimer = NULL;
+        }
+    }
+}
+
+static void map_extend_dormancy(struct Map *map, uint64_t deadline)
+{
+    if (deadline > map->dormantUntil)
+        map->dormantUntil = deadline;
+
+    // A running timer re-arms itself if the deadline moved
+    if (map->dormancyTimer == NULL) {
+        uint64_t now = map_now();
+        map->dormancyTimer = room_add_timer(map->room, map->dormantUntil > now ? map->dormantUntil - now : 0, on_dormancy_expired, NULL);
+    }
+}
+
+static void map_catch_up(struct Map *map)
+{
+    uint64_t now = map_now();
+
+    // Every batch lives for the same amount of time so they expire in the order they were created
+    while (map->dropBatchStart < map->dropBatchEnd && map->dropBatches[map->dropBatchStart]->timer == NULL &&
+            map->dropBatches[map->dropBatchStart]->expiresAt <= now)
+        map_expire_drop_batch(map);
+
+    for (size_t i = map->dropBatchStart; i < map->dropBatchEnd; i++) {
+        struct DropBatch *batch = map->dropBatches[i];
+        if (batch == NULL || batch->timer != NULL)
+            continue;
+
+        if (batch->exclusive && batch->exclusiveUntil > now) {
+            batch->timer = room_add_timer(map->room, batch->exclusiveUntil - now, on_exclusive_drop_time_expired, NULL);
+        } else {
+            batch->exclusive = false;
+            batch->timer = room_add_timer(map->room, batch->expiresAt - now, on_drop_time_expired, NULL);
+        }
+    }
+
+    for (size_t i = 0; i < map->reactorCount; i++) {
+        struct Reactor *reactor = &map->reactors[i];
+        if (reactor->respawnAt == 0 || reactor->respawnTimer != NULL)
+            continue;
+
+        if (reactor->respawnAt <= now) {
+            reactor->state = 0;
+            map->reactorSnapshotDirty = true;
+            reactor->keepAlive = false;
+            reactor->respawnAt = 0;
+        } else {
+            reactor->respawnTimer = room_add_timer(map->room, reactor->respawnAt - now, on_respawn_reactor, reactor);
+        }
+    }
+
+    if (map->respawnPending) {
+        map->respawnPending = false;
+        map_respawn_monsters(map, NULL);
+    }
+
+    map->dormantUntil = 0;
+    if (map->dormancyTimer != NULL) {
+        // Stopped last so that the room stays in use while the other timers are re-armed
+        room_stop_timer(map->dormancyTimer);
+        map->dormancyTimer = NULL;
+    }
+}
+
+static void on_dormancy_expired(struct Room *room, struct TimerHandle *handle)
+{
+    struct Map *map = room_get_context(room);
+    map->dormancyTimer = NULL;
+
+    uint64_t now = map_now();
+    if (now < map->dormantUntil) {
+        map->dormancyTimer = room_add_timer(room, map->dormantUntil - now, on_dormancy_expired, NULL);
+        return;
+    }
+
+    // Everything came due, so this only cleans up and the room can be released once this timer is gone
+    map_catch_up(map);
+}
+
+static struct OwnedBatches *owned_batches_get_or_insert(struct HashSetU32 *set, uint32_t owner_id)
+{
+    struct OwnedBatches *owned = hash_set_u32_get(set, owner_id);
+    if (owned != NULL)
+        return owned;
+
+    struct OwnedBatches new = {
+        .ownerId = owner_id,
+        .drops = NULL,
+        .droppings = NULL
+    };
+    if (hash_set_u32_insert(set, &new) == -1)
+        return NULL;
+
+    return hash_set_u32_get(set, owner_id);
+}
+
+static void owned_batches_link_drop(struct OwnedBatches *owned, struct DropBatch *batch)
+{
+    batch->prevOwned = NULL;
+    batch->nextOwned = owned->drops;
+    if (owned->drops != NULL)
+        owned->drops->prevOwned = batch;
+    owned->drops = batch;
+}
+
+static void owned_batches_link_dropping(struct OwnedBatches *owned, struct DroppingBatch *batch)
+{
+    batch->prevOwned = NULL;
+    batch->nextOwned = owned->droppings;
+    if (owned->droppings != NULL)
+        owned->droppings->prevOwned = batch;
+    owned->droppings = batch;
+}
+
+static void owned_batches_unlink_drop(struct HashSetU32 *set, struct DropBatch *batch)
+{
+    struct OwnedBatches *owned = hash_set_u32_get(set, batch->ownerId);
+    if (batch->prevOwned != NULL)
+        batch->prevOwned->nextOwned = batch->nextOwned;
+    else
+        owned->drops = batch->nextOwned;
+
+    if (batch->nextOwned != NULL)
+        batch->nextOwned->prevOwned = batch->prevOwned;
+
+    if (owned->drops == NULL && owned->droppings == NULL)
+        hash_set_u32_remove(set, batch->ownerId);
+}
+
+static void owned_batches_unlink_dropping(struct HashSetU32 *set, struct DroppingBatch *batch)
+{
+    struct OwnedBatches *owned = hash_set_u32_get(set, batch->ownerId);
+    if (batch->prevOwned != NULL)
+        batch->prevOwned->nextOwned = batch->nextOwned;
+    else
+        owned->droppings = batch->nextOwned;
+
+    if (batch->nextOwned != NULL)
+        batch->nextOwned->prevOwned = batch->prevOwned;
+
+    if (owned->drops == NULL && owned->droppings == NULL)
+        hash_set_u32_remove(set, batch->ownerId);
+}
+
+static uint8_t *snapshot_packet(struct Snapshot *snapshot)
+{
+    return snapshot->data + snapshot->len + sizeof(uint16_t);
+}
+
+// Frames the packet that was just written to snapshot_packet()
+static void snapshot_commit(struct Snapshot *snapshot, size_t len)
+{
+    if (len == 0)
+        return;
+
+    uint16_t packet_len = len;
+    memcpy(snapshot->data + snapshot->len, &packet_len, sizeof(uint16_t));
+    snapshot->len += SNAPSHOT_RECORD_LENGTH(len);
+}
+
 static int object_list_init(struct ObjectList *list)
 {
     list->objects = malloc(sizeof(struct MapObject));
     if (list->objects == NULL)
         return -1;
 
-    list->freeStack = malloc(sizeof(uint32_t));
+    list->freeStack = malloc(sizeof(uint16_t));
     if (list->freeStack == NULL) {
         free(list->objects);
         return -1;
     }
 
-    list->objectCapacity = 1;
+    list->capacity = 1;
+    list->slotCount = 0;
     list->objectCount = 0;
-    list->freeStackCapacity = 1;
     list->freeStackTop = 0;
-    list->objects[0].type = MAP_OBJECT_NONE;
 
     return 0;
 }
@@ -2495,125 +3104,67 @@ static void object_list_destroy(struct ObjectList *list)
 
 static struct MapObject *object_list_allocate(struct ObjectList *list)
 {
-    // Highly unlikely, but just to make sure that we don't overflow oid
+    // Highly unlikely, but just to make sure that the slot fits in the oid
     if (list->objectCount == UINT16_MAX)
         return NULL;
 
-    if (list->objectCount == list->objectCapacity) {
-        struct MapObject *new = malloc((list->objectCapacity * 2) * sizeof(struct MapObject));
-        if (new == NULL)
-            return NULL;
-
-        if (list->freeStackCapacity < list->objectCapacity * 2) {
-            void *temp = realloc(list->freeStack, (list->objectCapacity * 2) * sizeof(uint32_t));
-            if (temp == NULL) {
-                free(new);
+    struct MapObject *object;
+    if (list->freeStackTop > 0) {
+        list->freeStackTop--;
+        object = &list->objects[list->freeStack[list->freeStackTop]];
+        // Bump the generation so that the previous occupant's oid no longer resolves to this slot
+        object->oid = OBJECT_LIST_OID(object->oid & 0xFFFF, ((object->oid >> 16) + 1) & OBJECT_LIST_GENERATION_MASK);
+    } else {
+        if (list->slotCount == list->capacity) {
+            void *temp = realloc(list->objects, (list->capacity * 2) * sizeof(struct MapObject));
+            if (temp == NULL)
                 return NULL;
-            }
-
-            list->freeStack = temp;
-            list->freeStackCapacity *= 2;
-        }
 
-        for (size_t i = 0; i < list->objectCapacity * 2; i++)
-            new[i].type = MAP_OBJECT_NONE;
+            list->objects = temp;
 
-        for (size_t i = 0; i < list->objectCapacity; i++) {
-            size_t new_i = XXH3_64bits(&list->objects[i].oid, sizeof(uint32_t)) % (list->objectCapacity * 2);
-            while (new[new_i].type != MAP_OBJECT_NONE) {
-                new_i++;
-                new_i %= list->objectCapacity * 2;
-            }
+            // Every slot can be free at the same time
+            temp = realloc(list->freeStack, (list->capacity * 2) * sizeof(uint16_t));
+            if (temp == NULL)
+                return NULL;
 
-            new[new_i] = list->objects[i];
+            list->freeStack = temp;
+            list->capacity *= 2;
         }
 
-        free(list->objects);
-        list->objects = new;
-        list->objectCapacity *= 2;
-    }
-
-    uint32_t oid;
-    if (list->freeStackTop > 0) {
-        list->freeStackTop--;
-        oid = list->freeStack[list->freeStackTop];
-    } else {
-        oid = list->objectCount;
-    }
-
-    oid |= 0xFFFF0000;
-
-    size_t index = XXH3_64bits(&oid, sizeof(uint32_t)) % list->objectCapacity;
-    while (list->objects[index].type != MAP_OBJECT_NONE && list->objects[index].type != MAP_OBJECT_DELETED) {
-        index++;
-        index %= list->objectCapacity;
+        object = &list->objects[list->slotCount];
+        object->oid = OBJECT_LIST_OID(list->slotCount, 0);
+        list->slotCount++;
     }
 
-    list->objects[index].type = MAP_OBJECT_NONE;
-    list->objects[index].oid = oid;
+    object->type = MAP_OBJECT_NONE;
 
     list->objectCount++;
-    return &list->objects[index];
+    return object;
 }
 
 static void object_list_free(struct ObjectList *list, uint32_t oid)
 {
-    size_t index = XXH3_64bits(&oid, sizeof(uint32_t)) % list->objectCapacity;
-    while (list->objects[index].type == MAP_OBJECT_DELETED || list->objects[index].oid != oid) {
-        assert(list->objects[index].type != MAP_OBJECT_NONE);
-        index++;
-        index %= list->objectCapacity;
-    }
+    struct MapObject *object = &list->objects[oid & 0xFFFF];
+    assert(object->oid == oid && object->type != MAP_OBJECT_DELETED);
 
-    list->objects[index].type = MAP_OBJECT_DELETED;
+    object->type = MAP_OBJECT_DELETED;
     list->freeStack[list->freeStackTop] = oid & 0xFFFF;
     list->freeStackTop++;
     list->objectCount--;
-    if (list->objectCount < list->objectCapacity / 4) {
-        struct MapObject *temp = malloc((list->objectCapacity / 2) * sizeof(struct MapObject));
-        if (temp == NULL)
-            return;
-
-        for (size_t i = 0; i < list->objectCapacity / 2; i++)
-            temp[i].type = MAP_OBJECT_NONE;
-
-        for (size_t i = 0; i < list->objectCapacity; i++) {
-            if (list->objects[i].type != MAP_OBJECT_NONE && list->objects[i].type != MAP_OBJECT_DELETED) {
-                size_t new_i = XXH3_64bits(&list->objects[i].oid, sizeof(uint32_t)) % (list->objectCapacity / 2);
-                while (temp[new_i].type != MAP_OBJECT_NONE) {
-                    new_i++;
-                    new_i %= list->objectCapacity / 2;
-                }
-
-                temp[new_i] = list->objects[i];
-           }
-        }
-
-        free(list->objects);
-        list->objects = temp;
-        list->objectCapacity /= 2;
-    }
 }
 
 static struct MapObject *object_list_get(struct ObjectList *list, uint32_t oid)
 {
-    if (list->objectCount == 0)
+    // oids come from the client so they can be out of range or belong to an object that was already freed
+    size_t slot = oid & 0xFFFF;
+    if (slot >= list->slotCount)
         return NULL;
 
-    size_t start = XXH3_64bits(&oid, sizeof(uint32_t)) % list->objectCapacity;
-    size_t index = start;
-    while (list->objects[index].type == MAP_OBJECT_DELETED ||
-            (list->objects[index].type != MAP_OBJECT_NONE && list->objects[index].oid != oid)) {
-        index++;
-        index %= list->objectCapacity;
-        if (index == start)
-            return NULL;
-    }
-
-    if (list->objects[index].type == MAP_OBJECT_NONE)
+    struct MapObject *object = &list->objects[slot];
+    if (object->oid != oid || object->type == MAP_OBJECT_NONE || object->type == MAP_OBJECT_DELETED)
         return NULL;
 
-    return &list->objects[index];
+    return object;
 }
 
 static int heap_init(struct ControllerHeap *heap)
@@ -2638,7 +3189,12 @@ static void heap_destroy(struct ControllerHeap *heap)
 static void sift_down(struct ControllerHeap *heap, size_t i);
 static void sift_up(struct ControllerHeap *heap, size_t i);
 
-static struct ControllerHeapNode *heap_push(struct ControllerHeap *heap, size_t count, struct MapPlayer *controller)
+static size_t heap_key(const struct ControllerHeapNode *node)
+{
+    return node->controller->monsterCount + node->latencyPenalty;
+}
+
+static struct ControllerHeapNode *heap_push(struct ControllerHeap *heap, size_t penalty, struct MapPlayer *controller)
 {
     struct ControllerHeapNode *node = malloc(sizeof(struct ControllerHeapNode));
     if (node == NULL)
@@ -2656,7 +3212,7 @@ static struct ControllerHeapNode *heap_push(struct ControllerHeap *heap, size_t
     }
 
     node->index = heap->count;
-    node->controlleeCount = count;
+    node->latencyPenalty = penalty;
     node->controller = controller;
 
     heap->controllers[heap->count] = node;
@@ -2667,11 +3223,11 @@ static struct ControllerHeapNode *heap_push(struct ControllerHeap *heap, size_t
     return node;
 }
 
-static size_t heap_inc(struct ControllerHeap *heap, size_t count)
+static void heap_update(struct ControllerHeap *heap, struct ControllerHeapNode *node)
 {
-    heap->controllers[0]->controlleeCount += count;
-    sift_down(heap, 0);
-    return 0;
+    // Only one of them moves the node
+    sift_up(heap, node->index);
+    sift_down(heap, node->index);
 }
 
 static void heap_remove(struct ControllerHeap *heap, struct ControllerHeapNode *node)
@@ -2680,7 +3236,7 @@ static void heap_remove(struct ControllerHeap *heap, struct ControllerHeapNode *
     heap->controllers[node->index]->index = node->index;
     heap->count--;
     if (node->index == 0 ||
-            heap->controllers[(node->index-1) / 2]->controlleeCount < heap->controllers[node->index]->controlleeCount)
+            heap_key(heap->controllers[(node->index-1) / 2]) < heap_key(heap->controllers[node->index]))
         sift_down(heap, node->index);
     else
         sift_up(heap, node->index);
@@ -2702,27 +3258,27 @@ static void sift_down(struct ControllerHeap *heap, size_t i)
 {
     while (i*2 + 1 < heap->count) {
         if (i*2 + 2 == heap->count) {
-            if (heap->controllers[i]->controlleeCount > heap->controllers[i*2 + 1]->controlleeCount)
+            if (heap_key(heap->controllers[i]) > heap_key(heap->controllers[i*2 + 1]))
                 swap(heap, i, i*2 + 1);
 
             break;
         }
 
-        if (heap->controllers[i]->controlleeCount <= heap->controllers[i*2 + 1]->controlleeCount &&
-                heap->controllers[i]->controlleeCount <= heap->controllers[i*2 + 2]->controlleeCount) {
+        if (heap_key(heap->controllers[i]) <= heap_key(heap->controllers[i*2 + 1]) &&
+                heap_key(heap->controllers[i]) <= heap_key(heap->controllers[i*2 + 2])) {
             break;
         }
 
-        if (heap->controllers[i]->controlleeCount > heap->controllers[i*2 + 1]->controlleeCount &&
-                heap->controllers[i]->controlleeCount > heap->controllers[i*2 + 2]->controlleeCount) {
-            if (heap->controllers[i*2 + 1]->controlleeCount < heap->controllers[i*2 + 2]->controlleeCount) {
+        if (heap_key(heap->controllers[i]) > heap_key(heap->controllers[i*2 + 1]) &&
+                heap_key(heap->controllers[i]) > heap_key(heap->controllers[i*2 + 2])) {
+            if (heap_key(heap->controllers[i*2 + 1]) < heap_key(heap->controllers[i*2 + 2])) {
                 swap(heap, i, i*2 + 1);
                 i = i*2 + 1;
             } else {
                 swap(heap, i, i*2 + 2);
                 i = i*2 + 2;
             }
-        } else if (heap->controllers[i]->controlleeCount > heap->controllers[i*2 + 1]->controlleeCount) {
+        } else if (heap_key(heap->controllers[i]) > heap_key(heap->controllers[i*2 + 1])) {
             swap(heap, i, i*2 + 1);
             i = i*2 + 1;
         } else {
@@ -2735,7 +3291,7 @@ static void sift_down(struct ControllerHeap *heap, size_t i)
 static void sift_up(struct ControllerHeap *heap, size_t i)
 {
     while (i > 0) {
-        if (heap->controllers[(i-1) / 2]->controlleeCount > heap->controllers[i]->controlleeCount) {
+        if (heap_key(heap->controllers[(i-1) / 2]) > heap_key(heap->controllers[i])) {
             swap(heap, (i-1) / 2, i);
             i = (i-1) / 2;
         } else {
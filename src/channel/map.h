@@ -34,6 +34,14 @@ struct Map *map_create(struct ChannelServer *server, struct Room *room, struct S
  */
 void map_destroy(struct Map *map);
 
+/**
+ * Brings an empty map back to the state map_create() leaves it in so that it can be reused.
+ * Must only be called when the map's room has no sessions and no timers.
+ *
+ * \return 0 if the map can be reused; -1 if it must be destroyed instead
+ */
+int map_reset(struct Map *map);
+
 uint32_t map_get_id(struct Map *map);
 
 /**
@@ -66,6 +74,11 @@ void map_for_each_drop(struct Map *map, void (*f)(struct Drop *, void *), void *
 
 void map_spawn(struct Map *map, uint32_t id, struct Point p);
 
+/**
+ * Refills the map's spawn points that are empty, should be called periodically
+ */
+void map_respawn(struct Map *map);
+
 /**
  * Get if the monster is alive
  *
@@ -78,19 +91,28 @@ void map_spawn(struct Map *map, uint32_t id, struct Point p);
 bool map_monster_is_alive(struct Map *map, uint32_t id, uint32_t oid);
 
 /**
- * Damage a monster.
- * If its health drops below 0 it will be killed and it will drop its loot.
- *
- * \param map The map the monster is in
- * \param controller The map player that damaged the monster
- * \param char_id Additional context to pass as the second argument to \p f
- * \param oid The object ID of the damaged monster
- * \param hit_count The size of \p damage array
- * \param damage An array with damage values to apply to the monster
+ * Apply all the damage of a single attack.
+ * Monsters whose health drops to 0 are killed and drop their loot.
+ *
+ * \param map The map the monsters are in
+ * \param player The map player that attacked, takes the control of the monsters it hit
+ * \param monster_count The number of targets in \p oids
+ * \param oids The object IDs of the targets, ones that don't refer to a living monster are skipped
+ * \param hit_count The number of hits on each target
+ * \param damage \p monster_count * \p hit_count damage values, the hits of each target follow each other
+ * \param[out] killed The IDs of the monsters that were killed, must have room for \p monster_count IDs
+ *
+ * \return The number of killed monsters
+ */
+size_t map_apply_attack(struct Map *map, struct MapPlayer *player, size_t monster_count, const uint32_t *oids, size_t hit_count, const int32_t *damage, uint32_t *killed);
+
+/**
+ * Updates the round-trip time of \p player, which new monsters are assigned by alongside the number of monsters a player controls.
+ * If the player is now noticeably worse off than the least loaded player, some of its monsters are handed off to that player.
  *
- * \return If the monster was killed, its ID; otherwise -1.
+ * \param rtt The smoothed round-trip time in milliseconds
  */
-uint32_t map_damage_monster_by(struct Map *map, struct MapPlayer *player, uint32_t char_id, uint32_t oid, size_t hit_count, int32_t *damage);
+void map_set_player_rtt(struct Map *map, struct MapPlayer *player, uint32_t rtt);
 
 /**
  * Kill all monsters on the map
@@ -0,0 +1,67 @@
+#include "rcu.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#define RCU_SYNCHRONIZE_POLL_MS 10
+
+struct RcuReader {
+    // Each reader gets its own cache line as they are written to all the time
+    alignas(64) atomic_uint_fast64_t epoch;
+};
+
+static atomic_uint_fast64_t EPOCH;
+static size_t READER_COUNT;
+static struct RcuReader *READERS;
+
+int rcu_init(size_t reader_count)
+{
+    READERS = aligned_alloc(alignof(struct RcuReader), (reader_count != 0 ? reader_count : 1) * sizeof(struct RcuReader));
+    if (READERS == NULL)
+        return -1;
+
+    // A reader that didn't report yet is at epoch 0, which is behind any writer
+    atomic_init(&EPOCH, 1);
+    for (size_t i = 0; i < reader_count; i++)
+        atomic_init(&READERS[i].epoch, 0);
+    READER_COUNT = reader_count;
+
+    return 0;
+}
+
+void rcu_terminate(void)
+{
+    free(READERS);
+    READERS = NULL;
+    READER_COUNT = 0;
+}
+
+void rcu_quiescent(size_t reader)
+{
+    // Sequentially consistent so that none of the reader's earlier loads can be reordered after this store
+    atomic_store(&READERS[reader].epoch, atomic_load(&EPOCH));
+}
+
+void rcu_offline(size_t reader)
+{
+    atomic_store(&READERS[reader].epoch, UINT_FAST64_MAX);
+}
+
+void rcu_synchronize(void)
+{
+    uint_fast64_t target = atomic_fetch_add(&EPOCH, 1) + 1;
+    for (size_t i = 0; i < READER_COUNT; i++) {
+        while (atomic_load(&READERS[i].epoch) < target) {
+            struct timespec delay = {
+                .tv_sec = 0,
+                .tv_nsec = RCU_SYNCHRONIZE_POLL_MS * 1000000
+            };
+            thrd_sleep(&delay, NULL);
+        }
+    }
+}
+
@@ -0,0 +1,34 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <stddef.h>
+
+/**
+ * Read-copy-update for data that the workers read without locking and that is only ever replaced as a whole,
+ * such as the drop and shop tables.
+ *
+ * Readers load the published pointer with acquire semantics and must not keep what they read past the callback
+ * they are running in. Every worker reports a quiescent point between callbacks, so a writer that published a
+ * new version only has to wait in rcu_synchronize() before it can free the old one.
+ */
+
+int rcu_init(size_t reader_count);
+void rcu_terminate(void);
+
+/**
+ * Reports that \p reader holds no references to published data.
+ */
+void rcu_quiescent(size_t reader);
+
+/**
+ * Reports that \p reader stopped reading published data for good.
+ */
+void rcu_offline(size_t reader);
+
+/**
+ * Waits until every reader went through a quiescent point after this call was made.
+ */
+void rcu_synchronize(void);
+
+#endif
+
@@ -0,0 +1,105 @@
+#include "reloader.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#include <semaphore.h>
+
+#include "drops.h"
+#include "shop.h"
+#include "timing.h"
+
+struct Reloader {
+    struct DatabaseConnection *conn;
+    thrd_t thread;
+    // Posted from the signal handler, so it can't be a condition variable
+    sem_t sem;
+    atomic_bool stop;
+};
+
+static int reloader_thread(void *ctx);
+
+struct Reloader *reloader_start(struct DatabaseConnection *conn)
+{
+    if (conn == NULL)
+        return NULL;
+
+    struct Reloader *reloader = malloc(sizeof(struct Reloader));
+    if (reloader == NULL) {
+        database_connection_destroy(conn);
+        return NULL;
+    }
+
+    reloader->conn = conn;
+    atomic_init(&reloader->stop, false);
+
+    if (sem_init(&reloader->sem, 0, 0) == -1) {
+        free(reloader);
+        database_connection_destroy(conn);
+        return NULL;
+    }
+
+    if (thrd_create(&reloader->thread, reloader_thread, reloader) != thrd_success) {
+        sem_destroy(&reloader->sem);
+        free(reloader);
+        database_connection_destroy(conn);
+        return NULL;
+    }
+
+    return reloader;
+}
+
+void reloader_stop(struct Reloader *reloader)
+{
+    if (reloader == NULL)
+        return;
+
+    atomic_store(&reloader->stop, true);
+    sem_post(&reloader->sem);
+
+    thrd_join(reloader->thread, NULL);
+    sem_destroy(&reloader->sem);
+    database_connection_destroy(reloader->conn);
+    free(reloader);
+}
+
+void reloader_trigger(struct Reloader *reloader)
+{
+    if (reloader != NULL)
+        sem_post(&reloader->sem);
+}
+
+static int reloader_thread(void *ctx)
+{
+    struct Reloader *reloader = ctx;
+
+    while (true) {
+        while (sem_wait(&reloader->sem) == -1)
+            ;
+
+        // Requests that piled up during the last reload are served by this one
+        while (sem_trywait(&reloader->sem) == 0)
+            ;
+
+        if (atomic_load(&reloader->stop))
+            break;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (drops_reload(reloader->conn) == -1)
+            fprintf(stderr, "Failed to reload the drop tables, keeping the old ones\n");
+
+        if (shops_reload(reloader->conn) == -1)
+            fprintf(stderr, "Failed to reload the shops, keeping the old ones\n");
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        printf("Reloaded drops and shops in %" PRIu64 " ms\n", timing_elapsed_ms(&start, &end));
+    }
+
+    return 0;
+}
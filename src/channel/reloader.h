@@ -0,0 +1,28 @@
+#ifndef RELOADER_H
+#define RELOADER_H
+
+#include "../database.h"
+
+/**
+ * A background thread that reloads the drop and shop tables from the database on request,
+ * without stopping the channel. See rcu.h for how the new tables are swapped in.
+ */
+struct Reloader;
+
+/**
+ * Starts the reloader.
+ *
+ * \param conn A connection that is used exclusively by the reloader. The reloader takes ownership of it.
+ *
+ * \returns The reloader or NULL on failure in which case \p conn is destroyed.
+ */
+struct Reloader *reloader_start(struct DatabaseConnection *conn);
+void reloader_stop(struct Reloader *reloader);
+
+/**
+ * Requests a reload. Async-signal-safe.
+ */
+void reloader_trigger(struct Reloader *reloader);
+
+#endif
+
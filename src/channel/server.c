@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <setjmp.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -22,6 +23,7 @@
 #include <event2/listener.h>
 #include <event2/thread.h>
 
+#include "rcu.h"
 #include "thread-coordinator.h"
 
 #include "../crypt.h"
@@ -30,6 +32,15 @@
 #define MAPLE_VERSION 83
 
 #define TIMER_FREQ 10
+// How often an idle worker reports a quiescent point, bounds how long rcu_synchronize() waits
+#define RCU_QUIESCENT_INTERVAL_MS 100
+
+// How many empty rooms each worker keeps warm so that re-entering them skips OnRoomCreate
+#define ROOM_POOL_CAPACITY 32
+#define ROOM_POOL_REPORT_INTERVAL 1024
+
+// Each worker ticks its rooms in ROOM_TICK_SLICES groups spread over the interval instead of all at once
+#define ROOM_TICK_SLICES 10
 
 struct Session {
     struct sockaddr_storage addr;
@@ -147,6 +158,8 @@ struct ChannelServer {
     /// Worker thread handles
     size_t threadCount;
     thrd_t *threads;
+    // Set once the workers were told to exit and joined
+    bool workersStopped;
 
     size_t eventCount;
     struct Event *events;
@@ -191,6 +204,13 @@ struct Room {
     void *userData;
     OnRoomResume *onResume;
     bool keepAlive;
+    // An idle room has no sessions and no timers and sits in its manager's pool until it is entered again or evicted
+    bool idle;
+    struct Room *idlePrev;
+    struct Room *idleNext;
+    size_t tickSlice;
+    struct Room *tickPrev;
+    struct Room *tickNext;
 };
 
 static struct Room *create_room(struct RoomManager *manager, uint32_t id);
@@ -208,10 +228,30 @@ struct SessionRoom {
 // TODO: Maybe use a thread_local global instead of passing the struct between event callbacks
 struct RoomManager {
     struct Worker worker;
+    // The worker's RCU reader index
+    size_t index;
+    struct event *quiescentEvent;
     OnClientJoin *onClientJoin;
     OnResume *onResumeClientJoin;
     OnRoomCreate *onRoomCreate;
     OnRoomDestroy *onRoomDestroy;
+    OnRoomReset *onRoomReset;
+    OnRoomTick *onRoomTick;
+
+    struct event *tickEvent;
+    size_t tickSlice;
+    // Every room of the worker is in exactly one of these lists, the next slice is ticked each ROOM_TICK_INTERVAL_MS / ROOM_TICK_SLICES
+    struct Room *tickHeads[ROOM_TICK_SLICES];
+    size_t tickCounts[ROOM_TICK_SLICES];
+
+    // Idle rooms, most recently used first
+    struct Room *idleHead;
+    struct Room *idleTail;
+    size_t idleCount;
+    uint64_t poolHits;
+    uint64_t poolMisses;
+    // Set once the worker is shutting down so that rooms are destroyed instead of pooled
+    bool stopping;
 
     // Used when session_send_command() is called to indicate if the command was successfully sent to the target
     OnClientTimer *onClientTimer;
@@ -252,6 +292,8 @@ struct WorkerCommand {
 static int start_worker(void *ctx_);
 
 static void on_worker_command(int fd, short what, void *ctx_);
+static void on_quiescent(int fd, short what, void *ctx);
+static void on_tick_slice(int fd, short what, void *ctx);
 static void on_user_fd_ready(int fd, short what, void *ctx);
 static void on_pending_session_user_fd_ready(int fd, short what, void *ctx);
 static void on_session_user_fd_ready(int fd, short what, void *ctx);
@@ -260,14 +302,18 @@ static struct Session *create_session(struct ChannelServer *server, int fd, stru
 static void destroy_pending_session(struct Session *session);
 static void destroy_session(struct Session *session);
 static void kick_common(struct Worker *worker, struct Session *session, void (*destroy)(struct Session *session));
+static void release_room(struct Room *room);
+static void acquire_room(struct Room *room);
+static void unlink_idle_room(struct Room *room);
 static void destroy_room(struct Room *room);
+static void log_room_pool(struct RoomManager *manager);
 
 static short poll_to_libevent(int mask);
 static int libevent_to_poll(short mask);
 
 static void do_transfer(struct Session *session);
 
-struct ChannelServer *channel_server_create(uint16_t port, OnLog *on_log, const char *host, CreateUserContext *create_user_context, DestroyUserContext destroy_user_ctx, OnClientConnect *on_client_connect, OnClientDisconnect *on_client_disconnect, OnClientJoin *on_client_join, OnClientPacket *on_pending_client_packet, OnClientPacket *on_client_packet, OnRoomCreate *on_room_create, OnRoomDestroy *on_room_destroy, OnClientCommand on_client_command, OnClientTimer on_client_timer, void *global_ctx, size_t event_count)
+struct ChannelServer *channel_server_create(uint16_t port, OnLog *on_log, const char *host, CreateUserContext *create_user_context, DestroyUserContext destroy_user_ctx, OnClientConnect *on_client_connect, OnClientDisconnect *on_client_disconnect, OnClientJoin *on_client_join, OnClientPacket *on_pending_client_packet, OnClientPacket *on_client_packet, OnRoomCreate *on_room_create, OnRoomDestroy *on_room_destroy, OnRoomReset *on_room_reset, OnRoomTick *on_room_tick, OnClientCommand on_client_command, OnClientTimer on_client_timer, void *global_ctx, size_t event_count)
 {
     struct ChannelServer *server = malloc(sizeof(struct ChannelServer));
     if (server == NULL)
@@ -364,9 +410,12 @@ struct ChannelServer *channel_server_create(uint16_t port, OnLog *on_log, const
     if (event_add(server->commandEvent, NULL) == -1)
         goto free_command_event;
 
+    if (rcu_init(nproc) == -1)
+        goto free_command_event;
+
     server->threads = malloc(nproc * sizeof(thrd_t));
     if (server->threads == NULL)
-        goto free_command_event;
+        goto terminate_rcu;
 
     for (server->threadCount = 0; server->threadCount < nproc; server->threadCount++) {
         struct RoomManager *manager;
@@ -436,9 +485,47 @@ struct ChannelServer *channel_server_create(uint16_t port, OnLog *on_log, const
             goto exit_threads;
         }
 
+        manager->index = server->threadCount;
+        manager->quiescentEvent = event_new(manager->worker.base, -1, EV_PERSIST, on_quiescent, manager);
+        struct timeval interval = {
+            .tv_sec = 0,
+            .tv_usec = RCU_QUIESCENT_INTERVAL_MS * 1000
+        };
+        if (manager->quiescentEvent == NULL || event_add(manager->quiescentEvent, &interval) == -1) {
+            if (manager->quiescentEvent != NULL)
+                event_free(manager->quiescentEvent);
+            event_free(manager->worker.transportEvent);
+            event_base_free(manager->worker.base);
+            destroy_user_ctx(manager->worker.userData);
+            free(manager);
+            mtx_destroy(&server->worker.transportMuteces[server->threadCount]);
+            close(pair[0]);
+            close(pair[1]);
+            goto exit_threads;
+        }
+
+        manager->tickEvent = event_new(manager->worker.base, -1, EV_PERSIST, on_tick_slice, manager);
+        interval.tv_sec = ROOM_TICK_INTERVAL_MS / ROOM_TICK_SLICES / 1000;
+        interval.tv_usec = ROOM_TICK_INTERVAL_MS / ROOM_TICK_SLICES % 1000 * 1000;
+        if (manager->tickEvent == NULL || event_add(manager->tickEvent, &interval) == -1) {
+            if (manager->tickEvent != NULL)
+                event_free(manager->tickEvent);
+            event_free(manager->quiescentEvent);
+            event_free(manager->worker.transportEvent);
+            event_base_free(manager->worker.base);
+            destroy_user_ctx(manager->worker.userData);
+            free(manager);
+            mtx_destroy(&server->worker.transportMuteces[server->threadCount]);
+            close(pair[0]);
+            close(pair[1]);
+            goto exit_threads;
+        }
+
         manager->rooms = hash_set_u32_create(sizeof(struct RoomId),
                                             offsetof(struct RoomId, id));
         if (manager->rooms == NULL) {
+            event_free(manager->tickEvent);
+            event_free(manager->quiescentEvent);
             event_free(manager->worker.transportEvent);
             event_base_free(manager->worker.base);
             destroy_user_ctx(manager->worker.userData);
@@ -465,11 +552,26 @@ struct ChannelServer *channel_server_create(uint16_t port, OnLog *on_log, const
         manager->onClientJoin = on_client_join;
         manager->onRoomCreate = on_room_create;
         manager->onRoomDestroy = on_room_destroy;
+        manager->onRoomReset = on_room_reset;
+        manager->onRoomTick = on_room_tick;
+        manager->tickSlice = 0;
+        for (size_t i = 0; i < ROOM_TICK_SLICES; i++) {
+            manager->tickHeads[i] = NULL;
+            manager->tickCounts[i] = 0;
+        }
+        manager->idleHead = NULL;
+        manager->idleTail = NULL;
+        manager->idleCount = 0;
+        manager->poolHits = 0;
+        manager->poolMisses = 0;
+        manager->stopping = false;
         manager->onClientCommand = on_client_command;
         manager->onClientTimer = on_client_timer;
         manager->userData = global_ctx;
 
         if (thrd_create(server->threads + server->threadCount, start_worker, manager) != thrd_success) {
+            event_free(manager->tickEvent);
+            event_free(manager->quiescentEvent);
             event_free(manager->worker.transportEvent);
             event_base_free(manager->worker.base);
             destroy_user_ctx(manager->worker.userData);
@@ -503,6 +605,7 @@ struct ChannelServer *channel_server_create(uint16_t port, OnLog *on_log, const
 
     server->userData = global_ctx;
     server->first = 0;
+    server->workersStopped = false;
 
     return server;
 
@@ -521,6 +624,9 @@ exit_threads:
 
     free(server->threads);
 
+terminate_rcu:
+    rcu_terminate();
+
 free_command_event:
     close(event_get_fd(server->commandEvent));
     event_free(server->commandEvent);
@@ -545,6 +651,8 @@ free_server:
     return NULL;
 }
 
+static void stop_workers(struct ChannelServer *server);
+
 static void do_destroy_property(void *data, void *ctx)
 {
     struct Property *property = data;
@@ -554,6 +662,9 @@ static void do_destroy_property(void *data, void *ctx)
 
 void channel_server_destroy(struct ChannelServer *server)
 {
+    // The server can be destroyed without ever being started if the rest of the startup failed
+    stop_workers(server);
+
     for (size_t i = 0; i < server->eventCount; i++) {
         hash_set_u32_foreach(server->events[i].properties, do_destroy_property, NULL);
         hash_set_u32_destroy(server->events[i].properties);
@@ -577,6 +688,7 @@ void channel_server_destroy(struct ChannelServer *server)
 
     hash_set_u32_destroy(server->pendings);
     free(server->threads);
+    rcu_terminate();
     mtx_destroy(server->worker.sessionsLock);
     free(server->worker.sessionsLock);
     map_thread_coordinator_destroy(server->worker.coordinator);
@@ -598,6 +710,16 @@ enum ResponderResult channel_server_start(struct ChannelServer *server)
 {
     int status = event_base_dispatch(server->worker.base);
 
+    stop_workers(server);
+
+    return status == -1 ? RESPONDER_RESULT_ERROR : RESPONDER_RESULT_SUCCESS;
+}
+
+static void stop_workers(struct ChannelServer *server)
+{
+    if (server->workersStopped)
+        return;
+
     for (size_t i = 0; i < server->threadCount; i++) {
         mtx_lock(&server->worker.transportMuteces[i]);
         close(server->worker.transportSinks[i]);
@@ -608,7 +730,7 @@ enum ResponderResult channel_server_start(struct ChannelServer *server)
     for (size_t i = 0; i < server->threadCount; i++)
         thrd_join(server->threads[i], NULL);
 
-    return status == -1 ? RESPONDER_RESULT_ERROR : RESPONDER_RESULT_SUCCESS;
+    server->workersStopped = true;
 }
 
 void channel_server_stop(struct ChannelServer *server)
@@ -831,7 +953,7 @@ void do_transfer(struct Session *session)
         if (sent) {
             hash_set_u32_remove(room->sessions, id);
             if (room->timerCount == 0 && hash_set_u32_size(room->sessions) == 0 && !room->keepAlive)
-                destroy_room(room);
+                release_room(room);
 
             mtx_lock(manager->worker.sessionsLock);
             // By this time the client could be kicked by the other thread,
@@ -864,6 +986,14 @@ void session_write(struct Session *session, size_t len, uint8_t *packet)
     bufferevent_write(session->event, packet, len);
 }
 
+void session_write_batch(struct Session *session, size_t len, uint8_t *packets)
+{
+    if (len == 0)
+        return;
+
+    bufferevent_write(session->event, packets, len);
+}
+
 void session_set_context(struct Session *session, void *ctx)
 {
     session->userData = ctx;
@@ -1104,7 +1234,7 @@ void room_break_off(struct Room *room)
 {
     room->keepAlive = false;
     if (room->timerCount == 0 && hash_set_u32_size(room->sessions) == 0)
-        destroy_room(room);
+        release_room(room);
 }
 
 void event_set_property(struct Event *event, uint32_t property, int32_t value)
@@ -1162,6 +1292,15 @@ uint32_t event_add_listener(struct Event *event, void *base, uint32_t property,
     event_add(new, NULL);
 
     mtx_lock(&prop->mtx);
+    // Reuse the slot of a removed listener, pooled rooms remove and add theirs every time they go idle
+    for (size_t i = 0; i < prop->eventCount; i++) {
+        if (prop->events[i] == NULL) {
+            prop->events[i] = new;
+            mtx_unlock(&prop->mtx);
+            return i;
+        }
+    }
+
     void *temp = realloc(prop->events, (prop->eventCount + 1) * sizeof(struct event *));
     if (temp == NULL)
         ; // TODO
@@ -1252,7 +1391,7 @@ void room_stop_timer(struct TimerHandle *timer)
     free(timer);
 
     if (room->timerCount == 0 && hash_set_u32_size(room->sessions) == 0 && !room->keepAlive)
-        destroy_room(room);
+        release_room(room);
 }
 
 struct Room *timer_get_room(struct TimerHandle *handle)
@@ -1493,7 +1632,7 @@ static void on_timer_expired(int fd, short what, void *ctx)
     room->timers[handle->index]->index = handle->index;
     room->timerCount--;
     if (room->timerCount == 0 && hash_set_u32_size(room->sessions) == 0 && !room->keepAlive)
-        destroy_room(room);
+        release_room(room);
 
     event_free(handle->event);
     free(handle);
@@ -1517,6 +1656,27 @@ static void do_kill_room(void *data, void *ctx)
     }
 }
 
+static void on_quiescent(int fd, short what, void *ctx)
+{
+    // Callbacks run one at a time so nothing on this worker is reading published data right now
+    struct RoomManager *manager = ctx;
+    rcu_quiescent(manager->index);
+}
+
+static void on_tick_slice(int fd, short what, void *ctx)
+{
+    struct RoomManager *manager = ctx;
+    struct Room *room = manager->tickHeads[manager->tickSlice];
+    while (room != NULL) {
+        // Pooled rooms are brought up to date by OnRoomReset anyway
+        if (!room->idle)
+            manager->onRoomTick(room);
+        room = room->tickNext;
+    }
+
+    manager->tickSlice = (manager->tickSlice + 1) % ROOM_TICK_SLICES;
+}
+
 static void on_worker_command(int fd, short what, void *ctx_)
 {
     struct RoomManager *manager = ctx_;
@@ -1527,7 +1687,10 @@ static void on_worker_command(int fd, short what, void *ctx_)
         // Shutdown request
         event_free(manager->worker.transportEvent);
         close(fd);
+        event_free(manager->quiescentEvent);
+        event_free(manager->tickEvent);
 
+        manager->stopping = true;
         hash_set_u32_foreach(manager->rooms, do_kill_room, manager);
     } else if (status != -1) {
         switch (cmd->type) {
@@ -1549,8 +1712,12 @@ static void on_worker_command(int fd, short what, void *ctx_)
                     ; // TODO
                 if (manager->onRoomCreate(session->room, manager->userData) != 0)
                     ; // TODO
+
+                manager->poolMisses++;
+                log_room_pool(manager);
             } else {
                 session->room = ((struct RoomId *)hash_set_u32_get(manager->rooms, session->targetRoom))->room;
+                acquire_room(session->room);
             }
 
             {
@@ -1899,6 +2066,8 @@ static int start_worker(void *ctx_)
     struct RoomManager *manager = ctx_;
 
     event_base_dispatch(manager->worker.base);
+    // So that a reload running during the shutdown doesn't wait on this worker
+    rcu_offline(manager->index);
 
     hash_set_u32_destroy(manager->rooms);
     manager->worker.destroyContext(manager->worker.userData);
@@ -1982,6 +2151,22 @@ static struct Room *create_room(struct RoomManager *manager, uint32_t id)
     room->timerCapacity = 1;
     room->timerCount = 0;
     room->keepAlive = false;
+    room->idle = false;
+
+    // Keep the slices balanced so that every tick has about the same amount of work
+    size_t slice = 0;
+    for (size_t i = 1; i < ROOM_TICK_SLICES; i++) {
+        if (manager->tickCounts[i] < manager->tickCounts[slice])
+            slice = i;
+    }
+
+    room->tickSlice = slice;
+    room->tickPrev = NULL;
+    room->tickNext = manager->tickHeads[slice];
+    if (room->tickNext != NULL)
+        room->tickNext->tickPrev = room;
+    manager->tickHeads[slice] = room;
+    manager->tickCounts[slice]++;
 
     return room;
 }
@@ -2054,7 +2239,7 @@ static void destroy_session(struct Session *session)
 
     hash_set_u32_remove(room->sessions, session->id);
     if (room->timerCount == 0 && hash_set_u32_size(room->sessions) == 0 && !room->keepAlive)
-        destroy_room(room);
+        release_room(room);
 
     free(session);
 }
@@ -2072,10 +2257,75 @@ static void kick_common(struct Worker *worker, struct Session *session, void (*d
     }
 }
 
+static void release_room(struct Room *room)
+{
+    struct RoomManager *manager = room->manager;
+
+    // A timer could have been added and expired while the room was already idle
+    if (room->idle)
+        return;
+
+    if (manager->stopping || manager->onRoomReset(room) == -1) {
+        destroy_room(room);
+        return;
+    }
+
+    room->idle = true;
+    room->idlePrev = NULL;
+    room->idleNext = manager->idleHead;
+    if (manager->idleHead != NULL)
+        manager->idleHead->idlePrev = room;
+    else
+        manager->idleTail = room;
+    manager->idleHead = room;
+    manager->idleCount++;
+
+    if (manager->idleCount > ROOM_POOL_CAPACITY)
+        destroy_room(manager->idleTail);
+}
+
+static void acquire_room(struct Room *room)
+{
+    if (room->idle) {
+        unlink_idle_room(room);
+        room->manager->poolHits++;
+        log_room_pool(room->manager);
+    }
+}
+
+static void unlink_idle_room(struct Room *room)
+{
+    struct RoomManager *manager = room->manager;
+
+    if (room->idlePrev != NULL)
+        room->idlePrev->idleNext = room->idleNext;
+    else
+        manager->idleHead = room->idleNext;
+
+    if (room->idleNext != NULL)
+        room->idleNext->idlePrev = room->idlePrev;
+    else
+        manager->idleTail = room->idlePrev;
+
+    manager->idleCount--;
+    room->idle = false;
+}
+
 static void destroy_room(struct Room *room)
 {
     struct RoomManager *manager = room->manager;
 
+    if (room->idle)
+        unlink_idle_room(room);
+
+    if (room->tickPrev != NULL)
+        room->tickPrev->tickNext = room->tickNext;
+    else
+        manager->tickHeads[room->tickSlice] = room->tickNext;
+    if (room->tickNext != NULL)
+        room->tickNext->tickPrev = room->tickPrev;
+    manager->tickCounts[room->tickSlice]--;
+
     for (size_t i = 0; i < room->timerCount; i++) {
         struct TimerHandle *timer = room->timers[i];
         event_free(timer->event);
@@ -2090,6 +2340,16 @@ static void destroy_room(struct Room *room)
     free(room);
 }
 
+static void log_room_pool(struct RoomManager *manager)
+{
+    uint64_t total = manager->poolHits + manager->poolMisses;
+    if (total % ROOM_POOL_REPORT_INTERVAL != 0)
+        return;
+
+    manager->worker.onLog(LOG_OUT, "Room pool: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate), %zu idle rooms\n",
+            manager->poolHits, manager->poolMisses, 100.0 * manager->poolHits / total, manager->idleCount);
+}
+
 static short poll_to_libevent(int mask)
 {
     if (mask < 0)
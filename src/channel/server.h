@@ -8,6 +8,8 @@
 #include <sys/socket.h>
 #include <poll.h>
 
+#define ROOM_TICK_INTERVAL_MS 10000
+
 enum LogType {
     LOG_OUT,
     LOG_ERR
@@ -47,6 +49,11 @@ typedef void OnClientPacket(struct Session *session, size_t size, uint8_t *packe
 
 typedef int OnRoomCreate(struct Room *room, void *thread_ctx);
 typedef void OnRoomDestroy(struct Room *room);
+// Called when a room becomes empty to bring it back to the state OnRoomCreate leaves it in, so it can be pooled.
+// Returning -1 destroys the room instead
+typedef int OnRoomReset(struct Room *room);
+// Called every ROOM_TICK_INTERVAL_MS for each room that is in use. Must not stop the room's timers
+typedef void OnRoomTick(struct Room *room);
 
 typedef void OnClientTimer(struct Session *session);
 typedef void OnClientCommandResult(struct Session *session, void *cmd, bool sent);
@@ -55,7 +62,7 @@ typedef void OnClientCommand(struct Session *session, void *cmd);
 typedef void *CreateUserContext(void);
 typedef void DestroyUserContext(void *ctx);
 
-struct ChannelServer *channel_server_create(uint16_t port, OnLog *on_log, const char *host, CreateUserContext *create_user_context, DestroyUserContext destroy_user_ctx, OnClientConnect *on_client_connect, OnClientDisconnect *on_client_disconnect, OnClientJoin *on_client_join, OnClientPacket *on_pending_client_packet, OnClientPacket *on_client_packet, OnRoomCreate *on_room_create, OnRoomDestroy *on_room_destroy, OnClientCommand on_client_command, OnClientTimer on_client_timer, void *global_ctx, size_t event_count);
+struct ChannelServer *channel_server_create(uint16_t port, OnLog *on_log, const char *host, CreateUserContext *create_user_context, DestroyUserContext destroy_user_ctx, OnClientConnect *on_client_connect, OnClientDisconnect *on_client_disconnect, OnClientJoin *on_client_join, OnClientPacket *on_pending_client_packet, OnClientPacket *on_client_packet, OnRoomCreate *on_room_create, OnRoomDestroy *on_room_destroy, OnRoomReset *on_room_reset, OnRoomTick *on_room_tick, OnClientCommand on_client_command, OnClientTimer on_client_timer, void *global_ctx, size_t event_count);
 void channel_server_destroy(struct ChannelServer *server);
 struct Event *channel_server_get_event(struct ChannelServer *server, size_t event);
 enum ResponderResult channel_server_start(struct ChannelServer *server);
@@ -67,6 +74,8 @@ bool session_assign_id(struct Session *session, uint32_t id);
 void session_change_room(struct Session *session, uint32_t id);
 void session_kick(struct Session *session);
 void session_write(struct Session *session, size_t len, uint8_t *packet);
+// Writes several packets at once, each of them preceded by its length as a uint16_t
+void session_write_batch(struct Session *session, size_t len, uint8_t *packets);
 void session_set_context(struct Session *session, void *ctx);
 void *session_get_context(struct Session *session);
 int session_get_event_disposition(struct Session *session);
@@ -1,18 +1,72 @@
 #include "shop.h"
 
+#include <stdatomic.h>
+#include <stdlib.h>
+
 #include <cmph.h>
 
+#include "rcu.h"
+
 struct ShopInfoNode {
     uint32_t id;
     struct ShopInfo info;
 };
 
-size_t SHOP_INFO_COUNT;
-struct ShopInfoNode *SHOP_INFOS;
-cmph_t *SHOP_INFO_MPH;
+struct Shops {
+    size_t count;
+    struct ShopInfoNode *infos;
+    cmph_t *mph;
+};
+
+// Published through RCU, see drops.c
+static _Atomic(struct Shops *) SHOPS;
+
+static struct Shops *load_shops(struct DatabaseConnection *conn);
+static void free_shops(struct Shops *shops);
 
 int shops_load_from_db(struct DatabaseConnection *conn)
 {
+    struct Shops *shops = load_shops(conn);
+    if (shops == NULL)
+        return -1;
+
+    atomic_store_explicit(&SHOPS, shops, memory_order_release);
+    return 0;
+}
+
+int shops_reload(struct DatabaseConnection *conn)
+{
+    struct Shops *shops = load_shops(conn);
+    if (shops == NULL)
+        return -1;
+
+    struct Shops *old = atomic_exchange_explicit(&SHOPS, shops, memory_order_acq_rel);
+    rcu_synchronize();
+    free_shops(old);
+    return 0;
+}
+
+void shops_unload(void)
+{
+    free_shops(atomic_exchange_explicit(&SHOPS, NULL, memory_order_acq_rel));
+}
+
+const struct ShopInfo *shop_info_find(uint32_t id)
+{
+    const struct Shops *shops = atomic_load_explicit(&SHOPS, memory_order_acquire);
+    cmph_uint32 index = cmph_search(shops->mph, (void *)&id, sizeof(uint32_t));
+    if (shops->infos[index].id != id)
+        return NULL;
+
+    return &shops->infos[index].info;
+}
+
+static struct Shops *load_shops(struct DatabaseConnection *conn)
+{
+    struct Shops *shops = malloc(sizeof(struct Shops));
+    if (shops == NULL)
+        return NULL;
+
     struct RequestParams params = {
         .type = DATABASE_REQUEST_TYPE_GET_SHOPS
     };
@@ -20,71 +74,70 @@ int shops_load_from_db(struct DatabaseConnection *conn)
 
     if (database_request_execute(req, 0) == -1) {
         database_request_destroy(req);
-        return -1;
+        free(shops);
+        return NULL;
     }
 
     const union DatabaseResult *res = database_request_result(req);
-    SHOP_INFOS = malloc(res->getShops.count * sizeof(struct ShopInfoNode));
+    shops->count = 0;
+    shops->infos = malloc(res->getShops.count * sizeof(struct ShopInfoNode));
     for (size_t i = 0; i < res->getShops.count; i++) {
         const struct Shop *shop = &res->getShops.shops[i];
-        SHOP_INFOS[SHOP_INFO_COUNT].id = shop->id;
-        SHOP_INFOS[SHOP_INFO_COUNT].info.items = malloc(shop->count * sizeof(struct ShopItemInfo));
-        if (SHOP_INFOS[SHOP_INFO_COUNT].info.items == NULL) {
+        struct ShopInfoNode *node = &shops->infos[shops->count];
+        node->id = shop->id;
+        node->info.items = malloc(shop->count * sizeof(struct ShopItemInfo));
+        if (node->info.items == NULL) {
             for (size_t j = 0; j < i; j++)
-                free(SHOP_INFOS[j].info.items);
-            free(SHOP_INFOS);
+                free(shops->infos[j].info.items);
+            free(shops->infos);
+            free(shops);
             database_request_destroy(req);
-            return -1;
+            return NULL;
         }
-        SHOP_INFOS[SHOP_INFO_COUNT].info.count = 0;
+        node->info.count = 0;
         for (size_t i = 0; i < shop->count; i++) {
-            SHOP_INFOS[SHOP_INFO_COUNT].info.items[SHOP_INFOS[SHOP_INFO_COUNT].info.count].id = shop->items[i].id;
-            SHOP_INFOS[SHOP_INFO_COUNT].info.items[SHOP_INFOS[SHOP_INFO_COUNT].info.count].price = shop->items[i].price;
-            SHOP_INFOS[SHOP_INFO_COUNT].info.count++;
+            node->info.items[node->info.count].id = shop->items[i].id;
+            node->info.items[node->info.count].price = shop->items[i].price;
+            node->info.count++;
         }
 
-        SHOP_INFO_COUNT++;
+        shops->count++;
     }
 
     database_request_destroy(req);
 
-    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(SHOP_INFOS, sizeof(struct ShopInfoNode), offsetof(struct ShopInfoNode, id), sizeof(uint32_t), SHOP_INFO_COUNT);
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(shops->infos, sizeof(struct ShopInfoNode), offsetof(struct ShopInfoNode, id), sizeof(uint32_t), shops->count);
     cmph_config_t *config = cmph_config_new(adapter);
     cmph_config_set_algo(config, CMPH_BDZ);
-    SHOP_INFO_MPH = cmph_new(config);
+    shops->mph = cmph_new(config);
     cmph_config_destroy(config);
     cmph_io_struct_vector_adapter_destroy(adapter);
 
     size_t i = 0;
-    while (i < SHOP_INFO_COUNT) {
-        cmph_uint32 j = cmph_search(SHOP_INFO_MPH, (void *)&SHOP_INFOS[i].id, sizeof(uint32_t));
+    while (i < shops->count) {
+        cmph_uint32 j = cmph_search(shops->mph, (void *)&shops->infos[i].id, sizeof(uint32_t));
         if (i != j) {
-            struct ShopInfoNode temp = SHOP_INFOS[j];
-            SHOP_INFOS[j] = SHOP_INFOS[i];
-            SHOP_INFOS[i] = temp;
+            struct ShopInfoNode temp = shops->infos[j];
+            shops->infos[j] = shops->infos[i];
+            shops->infos[i] = temp;
         } else {
             i++;
         }
     }
 
-    return 0;
-}
-
-void shops_unload(void)
-{
-    cmph_destroy(SHOP_INFO_MPH);
-    for (size_t i = 0; i < SHOP_INFO_COUNT; i++) {
-        free(SHOP_INFOS[i].info.items);
-    }
-    free(SHOP_INFOS);
+    return shops;
 }
 
-const struct ShopInfo *shop_info_find(uint32_t id)
+static void free_shops(struct Shops *shops)
 {
-    cmph_uint32 index = cmph_search(SHOP_INFO_MPH, (void *)&id, sizeof(uint32_t));
-    if (SHOP_INFOS[index].id != id)
-        return NULL;
+    if (shops == NULL)
+        return;
 
-    return &SHOP_INFOS[index].info;
+    cmph_destroy(shops->mph);
+    for (size_t i = 0; i < shops->count; i++) {
+        free(shops->infos[i].info.items);
+    }
+    free(shops->infos);
+    free(shops);
 }
 
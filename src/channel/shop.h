@@ -17,6 +17,10 @@ struct ShopInfo {
 };
 
 int shops_load_from_db(struct DatabaseConnection *conn);
+/**
+ * Like drops_reload() for the shop inventories.
+ */
+int shops_reload(struct DatabaseConnection *conn);
 void shops_unload(void);
 const struct ShopInfo *shop_info_find(uint32_t id);
 
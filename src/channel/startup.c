@@ -0,0 +1,157 @@
+#include "startup.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <threads.h>
+#include <time.h>
+
+#include "timing.h"
+
+enum TaskState {
+    TASK_STATE_PENDING,
+    TASK_STATE_SUCCEEDED,
+    TASK_STATE_FAILED,
+    // A dependency failed so the task never ran
+    TASK_STATE_SKIPPED
+};
+
+struct TaskRun {
+    struct Startup *startup;
+    size_t index;
+    enum TaskState state;
+    struct timespec start;
+    struct timespec end;
+};
+
+struct Startup {
+    mtx_t mtx;
+    cnd_t cnd;
+    const struct StartupTask *tasks;
+    // Bitmasks of the tasks that are done, by outcome
+    uint32_t succeeded;
+    uint32_t failed;
+    struct timespec start;
+    struct TaskRun runs[STARTUP_MAX_TASKS];
+};
+
+static int task_thread(void *ctx);
+static void finish_task(struct TaskRun *run, enum TaskState state);
+
+int startup_run(size_t count, const struct StartupTask *tasks)
+{
+    if (count > STARTUP_MAX_TASKS)
+        return -1;
+
+    // Only allowing dependencies on earlier tasks rules out cycles
+    for (size_t i = 0; i < count; i++) {
+        if (tasks[i].dependencies >> i != 0)
+            return -1;
+    }
+
+    struct Startup startup;
+    if (mtx_init(&startup.mtx, mtx_plain) != thrd_success)
+        return -1;
+
+    if (cnd_init(&startup.cnd) != thrd_success) {
+        mtx_destroy(&startup.mtx);
+        return -1;
+    }
+
+    startup.tasks = tasks;
+    startup.succeeded = 0;
+    startup.failed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &startup.start);
+
+    thrd_t threads[STARTUP_MAX_TASKS];
+    bool started[STARTUP_MAX_TASKS];
+    for (size_t i = 0; i < count; i++) {
+        startup.runs[i].startup = &startup;
+        startup.runs[i].index = i;
+        startup.runs[i].state = TASK_STATE_PENDING;
+        startup.runs[i].start = startup.start;
+        startup.runs[i].end = startup.start;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        started[i] = thrd_create(&threads[i], task_thread, &startup.runs[i]) == thrd_success;
+        if (!started[i]) {
+            fprintf(stderr, "Failed to start a thread for %s\n", tasks[i].name);
+            finish_task(&startup.runs[i], TASK_STATE_FAILED);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (started[i])
+            thrd_join(threads[i], NULL);
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("Startup timings (start -> end, duration):\n");
+    uint64_t busy = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct TaskRun *run = &startup.runs[i];
+        uint64_t start_ms = timing_elapsed_ms(&startup.start, &run->start);
+        uint64_t end_ms = timing_elapsed_ms(&startup.start, &run->end);
+        busy += end_ms - start_ms;
+        const char *outcome = run->state == TASK_STATE_FAILED ? " FAILED" : (run->state == TASK_STATE_SKIPPED ? " SKIPPED" : "");
+        printf("  %-24s %6" PRIu64 " -> %6" PRIu64 " ms %6" PRIu64 " ms%s\n", tasks[i].name, start_ms, end_ms, end_ms - start_ms, outcome);
+    }
+    printf("  %-24s %16" PRIu64 " ms (%" PRIu64 " ms if run serially)\n", "total", timing_elapsed_ms(&startup.start, &end), busy);
+
+    cnd_destroy(&startup.cnd);
+    mtx_destroy(&startup.mtx);
+
+    if (startup.failed == 0)
+        return 0;
+
+    for (size_t i = count; i > 0; i--) {
+        if (startup.runs[i - 1].state == TASK_STATE_SUCCEEDED && tasks[i - 1].undo != NULL)
+            tasks[i - 1].undo(tasks[i - 1].ctx);
+    }
+
+    return -1;
+}
+
+static int task_thread(void *ctx)
+{
+    struct TaskRun *run = ctx;
+    struct Startup *startup = run->startup;
+    const struct StartupTask *task = &startup->tasks[run->index];
+
+    mtx_lock(&startup->mtx);
+    while ((startup->succeeded & task->dependencies) != task->dependencies && (startup->failed & task->dependencies) == 0)
+        cnd_wait(&startup->cnd, &startup->mtx);
+    bool skip = (startup->failed & task->dependencies) != 0;
+    mtx_unlock(&startup->mtx);
+
+    if (skip) {
+        finish_task(run, TASK_STATE_SKIPPED);
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &run->start);
+    int ret = task->run(task->ctx);
+    finish_task(run, ret == 0 ? TASK_STATE_SUCCEEDED : TASK_STATE_FAILED);
+    return 0;
+}
+
+static void finish_task(struct TaskRun *run, enum TaskState state)
+{
+    struct Startup *startup = run->startup;
+    clock_gettime(CLOCK_MONOTONIC, &run->end);
+    // A skipped task shows up as a zero length one at the point it was given up
+    if (state == TASK_STATE_SKIPPED)
+        run->start = run->end;
+
+    mtx_lock(&startup->mtx);
+    run->state = state;
+    if (state == TASK_STATE_SUCCEEDED)
+        startup->succeeded |= (uint32_t)1 << run->index;
+    else
+        startup->failed |= (uint32_t)1 << run->index;
+    cnd_broadcast(&startup->cnd);
+    mtx_unlock(&startup->mtx);
+}
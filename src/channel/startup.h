@@ -0,0 +1,31 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STARTUP_MAX_TASKS 32
+
+/**
+ * A step of the channel's startup.
+ * A task runs on its own thread as soon as all of its dependencies finished successfully.
+ */
+struct StartupTask {
+    const char *name;
+    // Bitmask of the indices of the tasks that must finish before this one starts
+    uint32_t dependencies;
+    int (*run)(void *ctx);
+    // Undoes a successful run() if another task failed, may be NULL
+    void (*undo)(void *ctx);
+    void *ctx;
+};
+
+/**
+ * Runs \p tasks concurrently while respecting their dependencies and prints how long each of them took.
+ *
+ * \returns 0 if all of the tasks succeeded, otherwise -1 in which case the tasks that did succeed are undone.
+ */
+int startup_run(size_t count, const struct StartupTask *tasks);
+
+#endif
+
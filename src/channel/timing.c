@@ -0,0 +1,6 @@
+#include "timing.h"
+
+uint64_t timing_elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
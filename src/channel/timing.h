@@ -0,0 +1,12 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * \return The number of whole milliseconds from \p start to \p end
+ */
+uint64_t timing_elapsed_ms(const struct timespec *start, const struct timespec *end);
+
+#endif
@@ -136,6 +136,7 @@ size_t quest_get_progress_string(struct Quest *quest, char *out);
 struct Character {
     uint32_t id;
     uint32_t accountId;
+    uint8_t world;
     uint8_t nameLength;
     char name[CHARACTER_MAX_NAME_LENGTH];
     uint32_t map;
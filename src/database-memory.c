@@ -0,0 +1,1232 @@
+// An implementation of database.h that keeps everything in the process' memory instead of talking to MariaDB.
+// It is meant for load tests that want to measure the server's own CPU cost on a single machine,
+// and is selected at build time with `make DATABASE=memory`.
+//
+// Requests that are executed asynchronously with MariaDB complete only after an artificial delay
+// that is configured with the environment variables SYRUP_DATABASE_LATENCY_US and SYRUP_DATABASE_JITTER_US.
+// The delay is implemented with a timerfd per connection, so callers see the same non-blocking fd semantics
+// as with a real connection: database_request_execute() asks to wait for POLLIN on database_connection_get_fd().
+//
+// The store is shared by all of the connections in the process and lives as long as at least one of them does.
+// Characters that don't exist are created on their first DATABASE_REQUEST_TYPE_GET_CHARACTER so that
+// the channel server can be loaded without going through the login server first.
+
+#include "database.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "hash-map.h"
+
+#define LATENCY_ENV "SYRUP_DATABASE_LATENCY_US"
+#define JITTER_ENV "SYRUP_DATABASE_JITTER_US"
+
+// Default map of characters that are created on the fly
+#define DEFAULT_MAP 10000
+
+struct LockQueueNode {
+    struct LockQueueNode *next;
+    int value;
+};
+
+struct LockQueue {
+    struct LockQueueNode *head;
+    struct LockQueueNode *last;
+};
+
+static void lock_queue_init(struct LockQueue *queue);
+static int lock_queue_enqueue(struct LockQueue *queue, int value);
+static int lock_queue_dequeue(struct LockQueue *queue);
+static bool lock_queue_empty(struct LockQueue *queue);
+
+enum IdSequence {
+    ID_SEQUENCE_ITEMS,
+    ID_SEQUENCE_EQUIPMENT,
+    ID_SEQUENCE_CHARACTER_EQUIPMENT,
+    ID_SEQUENCE_STORAGES,
+    ID_SEQUENCE_COUNT
+};
+
+struct MemoryCharacter;
+
+// Like the Storages table there is one storage per account and world, shared by all of its characters there
+struct MemoryStorage {
+    // Bumped on every write, it is part of the version of each character that shares the storage
+    uint64_t version;
+    uint64_t id;
+    uint8_t slots;
+    int32_t mesos;
+    size_t itemCount;
+    struct {
+        uint64_t slotId;
+        uint8_t slot;
+        int16_t count;
+        struct DatabaseItem item;
+    } items[252];
+    size_t equipCount;
+    struct {
+        uint64_t slotId;
+        uint8_t slot;
+        struct DatabaseEquipment equip;
+    } equipment[252];
+};
+
+struct MemoryAccount {
+    uint32_t id;
+    uint8_t nameLength;
+    char name[ACCOUNT_NAME_MAX_LENGTH];
+    uint8_t hash[ACCOUNT_HASH_LEN];
+    uint64_t salt;
+    uint8_t picLength;
+    char pic[ACCOUNT_PIC_MAX_LENGTH];
+    uint8_t tos;
+    my_bool isGenderNull;
+    uint8_t gender;
+    size_t characterCount;
+    size_t characterCapacity;
+    struct MemoryCharacter **characters;
+    // Next account in the same name bucket
+    struct MemoryAccount *next;
+};
+
+struct MemoryCharacter {
+    uint32_t id;
+    uint64_t version;
+    struct MemoryStorage *storage;
+    // Next character in the same name bucket
+    struct MemoryCharacter *next;
+    // Kept in the shape of a DATABASE_REQUEST_TYPE_GET_CHARACTER result
+    union DatabaseResult data;
+};
+
+struct AccountNode {
+    uint32_t id;
+    struct MemoryAccount *account;
+};
+
+struct CharacterNode {
+    uint32_t id;
+    struct MemoryCharacter *chr;
+};
+
+struct StorageNode {
+    uint32_t accountId;
+    struct MemoryStorage *worlds[WORLD_COUNT];
+};
+
+// Names are unique case-insensitively, like with the default collation
+struct NameBucket {
+    uint32_t hash;
+    void *head;
+};
+
+static struct {
+    once_flag once;
+    mtx_t lock;
+    size_t connectionCount;
+    struct HashSetU32 *accounts;
+    struct HashSetU32 *accountNames;
+    struct HashSetU32 *characters;
+    struct HashSetU32 *characterNames;
+    struct HashSetU32 *storages;
+    uint32_t nextAccountId;
+    uint32_t nextCharacterId;
+    uint64_t nextId[ID_SEQUENCE_COUNT];
+} STORE = {
+    .once = ONCE_FLAG_INIT
+};
+
+static void store_init_lock(void);
+static int store_ref(void);
+static void store_unref(void);
+static void free_account(void *data, void *ctx);
+static void free_character(void *data, void *ctx);
+static void free_storages(void *data, void *ctx);
+
+struct DatabaseConnection {
+    int fd;
+    struct LockQueue queue;
+    uint64_t latency;
+    uint64_t jitter;
+    unsigned int seed;
+};
+
+struct DatabaseRequest {
+    struct DatabaseConnection *conn;
+    struct RequestParams params;
+    // 0 - Initial, 1 - Waiting for the connection's timer, 2 - Finished
+    int state;
+    union DatabaseResult res;
+};
+
+static uint64_t env_to_u64(const char *name);
+
+// The store is created with the first connection so there is no library to set up
+int database_init(void)
+{
+    return 0;
+}
+
+void database_terminate(void)
+{
+}
+
+struct DatabaseConnection *database_connection_create(const char *host, const char *user, const char *password, const char *db, uint16_t port, const char *socket)
+{
+    struct DatabaseConnection *conn = malloc(sizeof(struct DatabaseConnection));
+    if (conn == NULL)
+        return NULL;
+
+    conn->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (conn->fd == -1) {
+        free(conn);
+        return NULL;
+    }
+
+    if (store_ref() == -1) {
+        close(conn->fd);
+        free(conn);
+        return NULL;
+    }
+
+    lock_queue_init(&conn->queue);
+    conn->latency = env_to_u64(LATENCY_ENV);
+    conn->jitter = env_to_u64(JITTER_ENV);
+    conn->seed = time(NULL) ^ conn->fd;
+
+    return conn;
+}
+
+void database_connection_destroy(struct DatabaseConnection *conn)
+{
+    if (conn != NULL) {
+        close(conn->fd);
+        store_unref();
+    }
+    free(conn);
+}
+
+int database_connection_get_fd(struct DatabaseConnection *conn)
+{
+    return conn->fd;
+}
+
+int database_connection_lock(struct DatabaseConnection *conn)
+{
+    if (lock_queue_empty(&conn->queue)) {
+        if (lock_queue_enqueue(&conn->queue, -1) == -1)
+            return -1;
+
+        return -2;
+    }
+
+    int fd = eventfd(0, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (lock_queue_enqueue(&conn->queue, fd) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int database_connection_unlock(struct DatabaseConnection *conn)
+{
+    uint64_t one = 1;
+    return write(lock_queue_dequeue(&conn->queue), &one, sizeof(uint64_t));
+}
+
+struct DatabaseRequest *database_request_create(struct DatabaseConnection *conn, const struct RequestParams *params)
+{
+    struct DatabaseRequest *req = malloc(sizeof(struct DatabaseRequest));
+    if (req == NULL)
+        return NULL;
+
+    req->conn = conn;
+    req->state = 0;
+    req->params = *params;
+
+    if (req->params.type == DATABASE_REQUEST_TYPE_GET_MONSTER_DROPS) {
+        req->res.getMonsterDrops.count = 0;
+        req->res.getMonsterDrops.monsters = NULL;
+    } else if (req->params.type == DATABASE_REQUEST_TYPE_GET_REACTOR_DROPS) {
+        req->res.getReactorDrops.count = 0;
+        req->res.getReactorDrops.reactors = NULL;
+    } else if (req->params.type == DATABASE_REQUEST_TYPE_GET_SHOPS) {
+        req->res.getShops.count = 0;
+        req->res.getShops.shops = NULL;
+    } else if (req->params.type == DATABASE_REQUEST_TYPE_GET_CHARACTER) {
+        req->res.getCharacter.quests = NULL;
+        req->res.getCharacter.progresses = NULL;
+        req->res.getCharacter.questInfos = NULL;
+        req->res.getCharacter.completedQuests = NULL;
+        req->res.getCharacter.skills = NULL;
+        req->res.getCharacter.monsterBook = NULL;
+        req->res.getCharacter.keyMap = NULL;
+    }
+
+    return req;
+}
+
+const struct RequestParams *database_request_get_params(struct DatabaseRequest *req)
+{
+    return &req->params;
+}
+
+void database_request_destroy(struct DatabaseRequest *req)
+{
+    // Drops and shops are never populated by this backend
+    if (req->params.type == DATABASE_REQUEST_TYPE_GET_CHARACTER) {
+        free(req->res.getCharacter.keyMap);
+        free(req->res.getCharacter.monsterBook);
+        free(req->res.getCharacter.skills);
+        free(req->res.getCharacter.completedQuests);
+        free(req->res.getCharacter.questInfos);
+        free(req->res.getCharacter.progresses);
+        free(req->res.getCharacter.quests);
+    }
+
+    free(req);
+}
+
+static int do_try_create_account(struct DatabaseRequest *req);
+static int do_get_account_credentials(struct DatabaseRequest *req);
+static int do_get_account(struct DatabaseRequest *req);
+static int do_update_account(struct DatabaseRequest *req);
+static int do_get_characters_for_account_for_world(struct DatabaseRequest *req);
+static int do_get_characters_for_account(struct DatabaseRequest *req);
+static int do_get_characters_exists(struct DatabaseRequest *req);
+static int do_try_create_character(struct DatabaseRequest *req);
+static int do_get_character(struct DatabaseRequest *req);
+static int do_get_monster_drops(struct DatabaseRequest *req);
+static int do_get_reactor_drops(struct DatabaseRequest *req);
+static int do_get_shops(struct DatabaseRequest *req);
+static int do_allocate_ids(struct DatabaseRequest *req);
+static int do_update_character(struct DatabaseRequest *req);
+static int do_compact_items(struct DatabaseRequest *req);
+
+static bool is_synchronous(struct DatabaseRequest *req);
+static int arm_timer(struct DatabaseConnection *conn);
+
+int database_request_execute(struct DatabaseRequest *req, int status)
+{
+    int (*do_request[])(struct DatabaseRequest *) = {
+        do_try_create_account,
+        do_get_account_credentials,
+        do_get_account,
+        do_update_account,
+        do_get_characters_for_account_for_world,
+        do_get_characters_for_account,
+        do_get_characters_exists,
+        do_try_create_character,
+        do_get_character,
+        do_get_monster_drops,
+        do_get_reactor_drops,
+        do_get_shops,
+        do_allocate_ids,
+        do_update_character,
+        do_compact_items
+    };
+
+    if (req->state == 0) {
+        if (!is_synchronous(req)) {
+            if (arm_timer(req->conn) == -1)
+                return -1;
+
+            req->state = 1;
+            return POLLIN;
+        }
+    } else {
+        uint64_t expirations;
+        if (read(req->conn->fd, &expirations, sizeof(uint64_t)) == -1) {
+            if (errno == EAGAIN)
+                return POLLIN;
+
+            return -1;
+        }
+    }
+
+    req->state = 2;
+
+    mtx_lock(&STORE.lock);
+    int ret = do_request[req->params.type](req);
+    mtx_unlock(&STORE.lock);
+
+    return ret;
+}
+
+const union DatabaseResult *database_request_result(struct DatabaseRequest *req)
+{
+    return &req->res;
+}
+
+static uint32_t name_hash(size_t len, const char *name);
+static bool name_equals(size_t len1, const char *name1, size_t len2, const char *name2);
+static struct MemoryAccount *find_account(uint32_t id);
+static struct MemoryAccount *find_account_by_name(size_t len, const char *name);
+static struct MemoryCharacter *find_character(uint32_t id);
+static struct MemoryCharacter *find_character_by_name(size_t len, const char *name);
+static struct MemoryCharacter *insert_character(uint32_t id, size_t nameLength, const char *name, struct MemoryStorage *storage);
+static struct MemoryCharacter *synthesize_character(uint32_t id);
+static struct MemoryStorage *get_storage(uint32_t account_id, uint8_t world);
+static uint64_t character_version(const struct MemoryCharacter *chr);
+static void database_equipment_from_equipment(const struct Equipment *equip, uint64_t itemId, uint64_t equipId, struct DatabaseEquipment *out);
+static int copy_array(void **dst, const void *src, size_t count, size_t size);
+
+static int do_try_create_account(struct DatabaseRequest *req)
+{
+    req->res.tryCreateAccount.created = false;
+    if (find_account_by_name(req->params.tryCreateAccount.nameLength, req->params.tryCreateAccount.name) != NULL)
+        return 0;
+
+    struct MemoryAccount *account = malloc(sizeof(struct MemoryAccount));
+    if (account == NULL)
+        return -1;
+
+    account->id = STORE.nextAccountId;
+    account->nameLength = req->params.tryCreateAccount.nameLength;
+    memcpy(account->name, req->params.tryCreateAccount.name, account->nameLength);
+    memcpy(account->hash, req->params.tryCreateAccount.hash, ACCOUNT_HASH_LEN);
+    account->salt = req->params.tryCreateAccount.salt;
+    account->picLength = 0;
+    account->tos = 0;
+    account->isGenderNull = true;
+    account->gender = 0;
+    account->characterCount = 0;
+    account->characterCapacity = 0;
+    account->characters = NULL;
+
+    struct AccountNode node = {
+        .id = account->id,
+        .account = account
+    };
+
+    if (hash_set_u32_insert(STORE.accounts, &node) == -1) {
+        free(account);
+        return -1;
+    }
+
+    uint32_t hash = name_hash(account->nameLength, account->name);
+    struct NameBucket *bucket = hash_set_u32_get(STORE.accountNames, hash);
+    if (bucket == NULL) {
+        struct NameBucket new = {
+            .hash = hash,
+            .head = NULL
+        };
+
+        if (hash_set_u32_insert(STORE.accountNames, &new) == -1) {
+            hash_set_u32_remove(STORE.accounts, account->id);
+            free(account);
+            return -1;
+        }
+
+        bucket = hash_set_u32_get(STORE.accountNames, hash);
+    }
+
+    account->next = bucket->head;
+    bucket->head = account;
+
+    STORE.nextAccountId++;
+    req->res.tryCreateAccount.created = true;
+    req->res.tryCreateAccount.id = account->id;
+
+    return 0;
+}
+
+static int do_get_account_credentials(struct DatabaseRequest *req)
+{
+    struct MemoryAccount *account = find_account_by_name(req->params.getAccountCredentials.nameLength, req->params.getAccountCredentials.name);
+    req->res.getAccountCredentials.found = account != NULL;
+    if (account == NULL)
+        return 0;
+
+    req->res.getAccountCredentials.id = account->id;
+    memcpy(req->res.getAccountCredentials.hash, account->hash, ACCOUNT_HASH_LEN);
+    req->res.getAccountCredentials.salt = account->salt;
+
+    return 0;
+}
+
+static int do_get_account(struct DatabaseRequest *req)
+{
+    struct MemoryAccount *account = find_account(req->params.getAccount.id);
+    if (account == NULL) {
+        req->res.getAccount.picLength = 0;
+        req->res.getAccount.tos = 0;
+        req->res.getAccount.isGenderNull = true;
+        return 0;
+    }
+
+    req->res.getAccount.picLength = account->picLength;
+    memcpy(req->res.getAccount.pic, account->pic, account->picLength);
+    req->res.getAccount.tos = account->tos;
+    req->res.getAccount.isGenderNull = account->isGenderNull;
+    req->res.getAccount.gender = account->gender;
+
+    return 0;
+}
+
+static int do_update_account(struct DatabaseRequest *req)
+{
+    struct MemoryAccount *account = find_account(req->params.updateAccount.id);
+    if (account == NULL)
+        return 0;
+
+    account->picLength = req->params.updateAccount.picLength;
+    memcpy(account->pic, req->params.updateAccount.pic, account->picLength);
+    account->tos = req->params.updateAccount.tos;
+    account->isGenderNull = req->params.updateAccount.isGenderNull;
+    account->gender = req->params.updateAccount.gender;
+
+    return 0;
+}
+
+static int do_get_characters_for_account_for_world(struct DatabaseRequest *req)
+{
+    req->res.getCharactersForAccountForWorld.characterCount = 0;
+
+    struct MemoryAccount *account = find_account(req->params.getCharactersForAccountForWorld.id);
+    if (account == NULL)
+        return 0;
+
+    for (size_t i = 0; i < account->characterCount && req->res.getCharactersForAccountForWorld.characterCount < ACCOUNT_MAX_CHARACTERS_PER_WORLD; i++) {
+        struct MemoryCharacter *chr = account->characters[i];
+        if (chr->data.getCharacter.world != req->params.getCharactersForAccountForWorld.world)
+            continue;
+
+        size_t j = req->res.getCharactersForAccountForWorld.characterCount;
+        req->res.getCharactersForAccountForWorld.characters[j].id = chr->id;
+        req->res.getCharactersForAccountForWorld.characters[j].nameLength = chr->data.getCharacter.nameLength;
+        memcpy(req->res.getCharactersForAccountForWorld.characters[j].name, chr->data.getCharacter.name, req->res.getCharactersForAccountForWorld.characters[j].nameLength);
+        req->res.getCharactersForAccountForWorld.characters[j].job = chr->data.getCharacter.job;
+        req->res.getCharactersForAccountForWorld.characters[j].level = chr->data.getCharacter.level;
+        req->res.getCharactersForAccountForWorld.characters[j].exp = chr->data.getCharacter.exp;
+        req->res.getCharactersForAccountForWorld.characters[j].maxHp = chr->data.getCharacter.maxHp;
+        req->res.getCharactersForAccountForWorld.characters[j].hp = chr->data.getCharacter.hp;
+        req->res.getCharactersForAccountForWorld.characters[j].maxMp = chr->data.getCharacter.maxMp;
+        req->res.getCharactersForAccountForWorld.characters[j].mp = chr->data.getCharacter.mp;
+        req->res.getCharactersForAccountForWorld.characters[j].str = chr->data.getCharacter.str;
+        req->res.getCharactersForAccountForWorld.characters[j].dex = chr->data.getCharacter.dex;
+        req->res.getCharactersForAccountForWorld.characters[j].int_ = chr->data.getCharacter.int_;
+        req->res.getCharactersForAccountForWorld.characters[j].luk = chr->data.getCharacter.luk;
+        req->res.getCharactersForAccountForWorld.characters[j].ap = chr->data.getCharacter.ap;
+        req->res.getCharactersForAccountForWorld.characters[j].sp = chr->data.getCharacter.sp;
+        req->res.getCharactersForAccountForWorld.characters[j].fame = chr->data.getCharacter.fame;
+        req->res.getCharactersForAccountForWorld.characters[j].gender = chr->data.getCharacter.gender;
+        req->res.getCharactersForAccountForWorld.characters[j].skin = chr->data.getCharacter.skin;
+        req->res.getCharactersForAccountForWorld.characters[j].face = chr->data.getCharacter.face;
+        req->res.getCharactersForAccountForWorld.characters[j].hair = chr->data.getCharacter.hair;
+        req->res.getCharactersForAccountForWorld.characters[j].equipCount = chr->data.getCharacter.equippedCount;
+        for (size_t k = 0; k < chr->data.getCharacter.equippedCount; k++)
+            req->res.getCharactersForAccountForWorld.characters[j].equipment[k] = chr->data.getCharacter.equippedEquipment[k].equip.item.itemId;
+
+        req->res.getCharactersForAccountForWorld.characterCount++;
+    }
+
+    return 0;
+}
+
+static int do_get_characters_for_account(struct DatabaseRequest *req)
+{
+    // The request has no result shape and isn't implemented by the MariaDB backend either,
+    // so report it instead of answering with an empty list
+    fprintf(stderr, "DATABASE_REQUEST_TYPE_GET_CHARACTERS_FOR_ACCOUNT is not supported\n");
+    return -1;
+}
+
+static int do_get_characters_exists(struct DatabaseRequest *req)
+{
+    req->res.getCharacterExists.exists = find_character_by_name(req->params.getCharacterExists.nameLength, req->params.getCharacterExists.name) != NULL;
+    return 0;
+}
+
+static int do_try_create_character(struct DatabaseRequest *req)
+{
+    req->res.tryCreateCharacter.created = false;
+    if (find_character_by_name(req->params.tryCreateCharacter.nameLength, req->params.tryCreateCharacter.name) != NULL)
+        return 0;
+
+    struct MemoryStorage *storage = get_storage(req->params.tryCreateCharacter.accountId, req->params.tryCreateCharacter.world);
+    if (storage == NULL)
+        return -1;
+
+    struct MemoryAccount *account = find_account(req->params.tryCreateCharacter.accountId);
+    if (account != NULL && account->characterCount == account->characterCapacity) {
+        size_t capacity = account->characterCapacity == 0 ? ACCOUNT_MAX_CHARACTERS_PER_WORLD : account->characterCapacity * 2;
+        void *temp = realloc(account->characters, capacity * sizeof(struct MemoryCharacter *));
+        if (temp == NULL)
+            return -1;
+
+        account->characters = temp;
+        account->characterCapacity = capacity;
+    }
+
+    struct MemoryCharacter *chr = insert_character(STORE.nextCharacterId, req->params.tryCreateCharacter.nameLength, req->params.tryCreateCharacter.name, storage);
+    if (chr == NULL)
+        return -1;
+
+    chr->data.getCharacter.accountId = req->params.tryCreateCharacter.accountId;
+    chr->data.getCharacter.world = req->params.tryCreateCharacter.world;
+    chr->data.getCharacter.map = req->params.tryCreateCharacter.map;
+    chr->data.getCharacter.job = req->params.tryCreateCharacter.job;
+    chr->data.getCharacter.gender = req->params.tryCreateCharacter.gender;
+    chr->data.getCharacter.skin = req->params.tryCreateCharacter.skin;
+    chr->data.getCharacter.face = req->params.tryCreateCharacter.face;
+    chr->data.getCharacter.hair = req->params.tryCreateCharacter.hair;
+
+    // Same as the MariaDB backend, there is only a bottom with a coat
+    const struct Equipment *equips[] = {
+        &req->params.tryCreateCharacter.top,
+        &req->params.tryCreateCharacter.bottom,
+        &req->params.tryCreateCharacter.shoes,
+        &req->params.tryCreateCharacter.weapon
+    };
+
+    for (size_t i = 0; i < sizeof(equips) / sizeof(equips[0]); i++) {
+        if (i == 1 && equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) != EQUIP_TYPE_COAT)
+            continue;
+
+        struct DatabaseCharacterEquipment *equip = &chr->data.getCharacter.equippedEquipment[chr->data.getCharacter.equippedCount];
+        equip->id = STORE.nextId[ID_SEQUENCE_CHARACTER_EQUIPMENT]++;
+        database_equipment_from_equipment(equips[i], STORE.nextId[ID_SEQUENCE_ITEMS]++, STORE.nextId[ID_SEQUENCE_EQUIPMENT]++, &equip->equip);
+        chr->data.getCharacter.equippedCount++;
+    }
+
+    STORE.nextCharacterId++;
+    if (account != NULL)
+        account->characters[account->characterCount++] = chr;
+
+    req->res.tryCreateCharacter.created = true;
+    req->res.tryCreateCharacter.id = chr->id;
+
+    return 0;
+}
+
+static int do_get_character(struct DatabaseRequest *req)
+{
+    struct MemoryCharacter *chr = find_character(req->params.getCharacter.id);
+    if (chr == NULL) {
+        chr = synthesize_character(req->params.getCharacter.id);
+        if (chr == NULL)
+            return -1;
+    }
+
+    uint64_t version = character_version(chr);
+    if (req->params.getCharacter.knownVersion == version) {
+        req->res.getCharacter.version = version;
+        req->res.getCharacter.unchanged = true;
+        return 0;
+    }
+
+    // The arrays are owned by the store so each one is replaced with a copy;
+    // they are set to NULL first so that database_request_destroy() only frees the ones that were copied
+    req->res.getCharacter = chr->data.getCharacter;
+    req->res.getCharacter.quests = NULL;
+    req->res.getCharacter.progresses = NULL;
+    req->res.getCharacter.questInfos = NULL;
+    req->res.getCharacter.completedQuests = NULL;
+    req->res.getCharacter.skills = NULL;
+    req->res.getCharacter.monsterBook = NULL;
+    req->res.getCharacter.keyMap = NULL;
+
+    union DatabaseResult *out = &req->res;
+    const union DatabaseResult *in = &chr->data;
+    if (copy_array((void **)&out->getCharacter.quests, in->getCharacter.quests, in->getCharacter.questCount, sizeof(uint16_t)) == -1 ||
+            copy_array((void **)&out->getCharacter.progresses, in->getCharacter.progresses, in->getCharacter.progressCount, sizeof(struct DatabaseProgress)) == -1 ||
+            copy_array((void **)&out->getCharacter.questInfos, in->getCharacter.questInfos, in->getCharacter.questInfoCount, sizeof(struct DatabaseInfoProgress)) == -1 ||
+            copy_array((void **)&out->getCharacter.completedQuests, in->getCharacter.completedQuests, in->getCharacter.completedQuestCount, sizeof(struct DatabaseCompletedQuest)) == -1 ||
+            copy_array((void **)&out->getCharacter.skills, in->getCharacter.skills, in->getCharacter.skillCount, sizeof(struct DatabaseSkill)) == -1 ||
+            copy_array((void **)&out->getCharacter.monsterBook, in->getCharacter.monsterBook, in->getCharacter.monsterBookEntryCount, sizeof(struct DatabaseMonsterBookEntry)) == -1 ||
+            copy_array((void **)&out->getCharacter.keyMap, in->getCharacter.keyMap, in->getCharacter.keyMapEntryCount, sizeof(struct DatabaseKeyMapEntry)) == -1)
+        return -1;
+
+    const struct MemoryStorage *storage = chr->storage;
+    out->getCharacter.storage.id = storage->id;
+    out->getCharacter.storage.slots = storage->slots;
+    out->getCharacter.storage.mesos = storage->mesos;
+    out->getCharacter.storageItemCount = storage->itemCount;
+    memcpy(out->getCharacter.storageItems, storage->items, storage->itemCount * sizeof(out->getCharacter.storageItems[0]));
+    out->getCharacter.storageEquipCount = storage->equipCount;
+    memcpy(out->getCharacter.storageEquipment, storage->equipment, storage->equipCount * sizeof(out->getCharacter.storageEquipment[0]));
+
+    req->res.getCharacter.version = version;
+    req->res.getCharacter.unchanged = false;
+
+    return 0;
+}
+
+static int do_get_monster_drops(struct DatabaseRequest *req)
+{
+    return 0;
+}
+
+static int do_get_reactor_drops(struct DatabaseRequest *req)
+{
+    return 0;
+}
+
+static int do_get_shops(struct DatabaseRequest *req)
+{
+    return 0;
+}
+
+static int do_allocate_ids(struct DatabaseRequest *req)
+{
+    uint64_t *next = STORE.nextId;
+
+    for (size_t i = 0; i < req->params.allocateIds.itemCount; i++)
+        req->res.allocateIds.items[i] = next[ID_SEQUENCE_ITEMS]++;
+
+    for (size_t i = 0; i < req->params.allocateIds.equippedCount; i++) {
+        if (req->params.allocateIds.equippedEquipment[i].id == 0)
+            req->params.allocateIds.equippedEquipment[i].id = next[ID_SEQUENCE_ITEMS]++;
+        if (req->params.allocateIds.equippedEquipment[i].equipId == 0)
+            req->params.allocateIds.equippedEquipment[i].equipId = next[ID_SEQUENCE_EQUIPMENT]++;
+        req->res.allocateIds.equippedEquipment[i] = next[ID_SEQUENCE_CHARACTER_EQUIPMENT]++;
+    }
+
+    for (size_t i = 0; i < req->params.allocateIds.equipCount; i++) {
+        if (req->params.allocateIds.equipmentInventory[i].id == 0)
+            req->params.allocateIds.equipmentInventory[i].id = next[ID_SEQUENCE_ITEMS]++;
+        if (req->params.allocateIds.equipmentInventory[i].equipId == 0)
+            req->params.allocateIds.equipmentInventory[i].equipId = next[ID_SEQUENCE_EQUIPMENT]++;
+        req->res.allocateIds.equipmentInventory[i] = next[ID_SEQUENCE_CHARACTER_EQUIPMENT]++;
+    }
+
+    return 0;
+}
+
+static int do_update_character(struct DatabaseRequest *req)
+{
+    struct MemoryCharacter *chr = find_character(req->params.updateCharacter.id);
+    if (chr == NULL)
+        return -1;
+
+    union DatabaseResult *out = &chr->data;
+    const struct RequestParams *in = &req->params;
+
+    // Allocate everything up front so that a failure leaves the character as it was
+    uint16_t *quests = NULL;
+    struct DatabaseProgress *progresses = NULL;
+    struct DatabaseInfoProgress *questInfos = NULL;
+    struct DatabaseCompletedQuest *completedQuests = NULL;
+    struct DatabaseSkill *skills = NULL;
+    struct DatabaseMonsterBookEntry *monsterBook = NULL;
+    struct DatabaseKeyMapEntry *keyMap = NULL;
+    if (copy_array((void **)&quests, in->updateCharacter.quests, in->updateCharacter.questCount, sizeof(uint16_t)) == -1 ||
+            copy_array((void **)&progresses, in->updateCharacter.progresses, in->updateCharacter.progressCount, sizeof(struct DatabaseProgress)) == -1 ||
+            copy_array((void **)&questInfos, in->updateCharacter.questInfos, in->updateCharacter.questInfoCount, sizeof(struct DatabaseInfoProgress)) == -1 ||
+            copy_array((void **)&completedQuests, in->updateCharacter.completedQuests, in->updateCharacter.completedQuestCount, sizeof(struct DatabaseCompletedQuest)) == -1 ||
+            copy_array((void **)&skills, in->updateCharacter.skills, in->updateCharacter.skillCount, sizeof(struct DatabaseSkill)) == -1 ||
+            copy_array((void **)&monsterBook, in->updateCharacter.monsterBook, in->updateCharacter.monsterBookEntryCount, sizeof(struct DatabaseMonsterBookEntry)) == -1 ||
+            copy_array((void **)&keyMap, in->updateCharacter.keyMap, in->updateCharacter.keyMapEntryCount, sizeof(struct DatabaseKeyMapEntry)) == -1) {
+        free(keyMap);
+        free(monsterBook);
+        free(skills);
+        free(completedQuests);
+        free(questInfos);
+        free(progresses);
+        free(quests);
+        return -1;
+    }
+
+    out->getCharacter.map = in->updateCharacter.map;
+    out->getCharacter.spawnPoint = in->updateCharacter.spawnPoint;
+    out->getCharacter.job = in->updateCharacter.job;
+    out->getCharacter.level = in->updateCharacter.level;
+    out->getCharacter.exp = in->updateCharacter.exp;
+    out->getCharacter.maxHp = in->updateCharacter.maxHp;
+    out->getCharacter.hp = in->updateCharacter.hp;
+    out->getCharacter.maxMp = in->updateCharacter.maxMp;
+    out->getCharacter.mp = in->updateCharacter.mp;
+    out->getCharacter.str = in->updateCharacter.str;
+    out->getCharacter.dex = in->updateCharacter.dex;
+    out->getCharacter.int_ = in->updateCharacter.int_;
+    out->getCharacter.luk = in->updateCharacter.luk;
+    out->getCharacter.ap = in->updateCharacter.ap;
+    out->getCharacter.sp = in->updateCharacter.sp;
+    out->getCharacter.fame = in->updateCharacter.fame;
+    out->getCharacter.skin = in->updateCharacter.skin;
+    out->getCharacter.face = in->updateCharacter.face;
+    out->getCharacter.hair = in->updateCharacter.hair;
+    out->getCharacter.mesos = in->updateCharacter.mesos;
+    out->getCharacter.equipSlots = in->updateCharacter.equipSlots;
+    out->getCharacter.useSlots = in->updateCharacter.useSlots;
+    out->getCharacter.setupSlots = in->updateCharacter.setupSlots;
+    out->getCharacter.etcSlots = in->updateCharacter.etcSlots;
+
+    out->getCharacter.equippedCount = in->updateCharacter.equippedCount;
+    memcpy(out->getCharacter.equippedEquipment, in->updateCharacter.equippedEquipment, in->updateCharacter.equippedCount * sizeof(out->getCharacter.equippedEquipment[0]));
+    out->getCharacter.equipCount = in->updateCharacter.equipCount;
+    memcpy(out->getCharacter.equipmentInventory, in->updateCharacter.equipmentInventory, in->updateCharacter.equipCount * sizeof(out->getCharacter.equipmentInventory[0]));
+    out->getCharacter.itemCount = in->updateCharacter.itemCount;
+    memcpy(out->getCharacter.inventoryItems, in->updateCharacter.inventoryItems, in->updateCharacter.itemCount * sizeof(out->getCharacter.inventoryItems[0]));
+
+    struct MemoryStorage *storage = chr->storage;
+    storage->slots = in->updateCharacter.storage.slots;
+    storage->mesos = in->updateCharacter.storage.mesos;
+    storage->itemCount = in->updateCharacter.storageItemCount;
+    memcpy(storage->items, in->updateCharacter.storageItems, in->updateCharacter.storageItemCount * sizeof(storage->items[0]));
+    storage->equipCount = in->updateCharacter.storageEquipCount;
+    memcpy(storage->equipment, in->updateCharacter.storageEquipment, in->updateCharacter.storageEquipCount * sizeof(storage->equipment[0]));
+
+    free(out->getCharacter.keyMap);
+    free(out->getCharacter.monsterBook);
+    free(out->getCharacter.skills);
+    free(out->getCharacter.completedQuests);
+    free(out->getCharacter.questInfos);
+    free(out->getCharacter.progresses);
+    free(out->getCharacter.quests);
+    out->getCharacter.questCount = in->updateCharacter.questCount;
+    out->getCharacter.quests = quests;
+    out->getCharacter.progressCount = in->updateCharacter.progressCount;
+    out->getCharacter.progresses = progresses;
+    out->getCharacter.questInfoCount = in->updateCharacter.questInfoCount;
+    out->getCharacter.questInfos = questInfos;
+    out->getCharacter.completedQuestCount = in->updateCharacter.completedQuestCount;
+    out->getCharacter.completedQuests = completedQuests;
+    out->getCharacter.skillCount = in->updateCharacter.skillCount;
+    out->getCharacter.skills = skills;
+    out->getCharacter.monsterBookEntryCount = in->updateCharacter.monsterBookEntryCount;
+    out->getCharacter.monsterBook = monsterBook;
+    out->getCharacter.keyMapEntryCount = in->updateCharacter.keyMapEntryCount;
+    out->getCharacter.keyMap = keyMap;
+
+    // Every save rewrites the storage, which invalidates the other characters that share it like StoragesBumpVersion does
+    chr->version++;
+    storage->version++;
+    req->res.updateCharacter.version = character_version(chr);
+
+    return 0;
+}
+
+static int do_compact_items(struct DatabaseRequest *req)
+{
+    // Removed items are never kept around
+    req->res.compactItems.deleted = 0;
+    return 0;
+}
+
+static bool is_synchronous(struct DatabaseRequest *req)
+{
+    // These are only used during startup and are blocking with MariaDB as well
+    if (req->params.type == DATABASE_REQUEST_TYPE_GET_MONSTER_DROPS ||
+            req->params.type == DATABASE_REQUEST_TYPE_GET_REACTOR_DROPS ||
+            req->params.type == DATABASE_REQUEST_TYPE_GET_SHOPS)
+        return true;
+
+    return req->conn->latency == 0 && req->conn->jitter == 0;
+}
+
+static int arm_timer(struct DatabaseConnection *conn)
+{
+    uint64_t delay = conn->latency;
+    if (conn->jitter != 0)
+        delay += rand_r(&conn->seed) % (conn->jitter + 1);
+
+    // A zero it_value would disarm the timer instead
+    if (delay == 0)
+        delay = 1;
+
+    struct itimerspec spec = {
+        .it_interval = { 0, 0 },
+        .it_value = {
+            .tv_sec = delay / 1000000,
+            .tv_nsec = (delay % 1000000) * 1000
+        }
+    };
+
+    // This also clears an expiration that was left over by a request that was destroyed while waiting
+    return timerfd_settime(conn->fd, 0, &spec, NULL);
+}
+
+static uint64_t env_to_u64(const char *name)
+{
+    const char *value = getenv(name);
+    if (value == NULL)
+        return 0;
+
+    char *end;
+    uint64_t ret = strtoull(value, &end, 10);
+    if (*end != '\0') {
+        fprintf(stderr, "Invalid value for %s: %s\n", name, value);
+        return 0;
+    }
+
+    return ret;
+}
+
+static uint32_t name_hash(size_t len, const char *name)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)tolower((unsigned char)name[i]);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static bool name_equals(size_t len1, const char *name1, size_t len2, const char *name2)
+{
+    return len1 == len2 && strncasecmp(name1, name2, len1) == 0;
+}
+
+static struct MemoryAccount *find_account(uint32_t id)
+{
+    struct AccountNode *node = hash_set_u32_get(STORE.accounts, id);
+    return node == NULL ? NULL : node->account;
+}
+
+static struct MemoryAccount *find_account_by_name(size_t len, const char *name)
+{
+    struct NameBucket *bucket = hash_set_u32_get(STORE.accountNames, name_hash(len, name));
+    if (bucket == NULL)
+        return NULL;
+
+    for (struct MemoryAccount *account = bucket->head; account != NULL; account = account->next) {
+        if (name_equals(account->nameLength, account->name, len, name))
+            return account;
+    }
+
+    return NULL;
+}
+
+static struct MemoryCharacter *find_character(uint32_t id)
+{
+    struct CharacterNode *node = hash_set_u32_get(STORE.characters, id);
+    return node == NULL ? NULL : node->chr;
+}
+
+static struct MemoryCharacter *find_character_by_name(size_t len, const char *name)
+{
+    struct NameBucket *bucket = hash_set_u32_get(STORE.characterNames, name_hash(len, name));
+    if (bucket == NULL)
+        return NULL;
+
+    for (struct MemoryCharacter *chr = bucket->head; chr != NULL; chr = chr->next) {
+        if (name_equals(chr->data.getCharacter.nameLength, chr->data.getCharacter.name, len, name))
+            return chr;
+    }
+
+    return NULL;
+}
+
+// Creates a character with the column defaults from db.sql and the default key map
+static struct MemoryCharacter *insert_character(uint32_t id, size_t nameLength, const char *name, struct MemoryStorage *storage)
+{
+    struct MemoryCharacter *chr = calloc(1, sizeof(struct MemoryCharacter));
+    if (chr == NULL)
+        return NULL;
+
+    chr->data.getCharacter.keyMap = malloc(DEFAULT_KEY_COUNT * sizeof(struct DatabaseKeyMapEntry));
+    if (chr->data.getCharacter.keyMap == NULL) {
+        free(chr);
+        return NULL;
+    }
+
+    chr->id = id;
+    chr->version = 0;
+    chr->storage = storage;
+    chr->data.getCharacter.nameLength = nameLength;
+    memcpy(chr->data.getCharacter.name, name, nameLength);
+    chr->data.getCharacter.level = 1;
+    chr->data.getCharacter.maxHp = 50;
+    chr->data.getCharacter.hp = 50;
+    chr->data.getCharacter.maxMp = 5;
+    chr->data.getCharacter.mp = 5;
+    chr->data.getCharacter.str = 12;
+    chr->data.getCharacter.dex = 5;
+    chr->data.getCharacter.int_ = 4;
+    chr->data.getCharacter.luk = 4;
+    chr->data.getCharacter.equipSlots = 24;
+    chr->data.getCharacter.useSlots = 24;
+    chr->data.getCharacter.setupSlots = 24;
+    chr->data.getCharacter.etcSlots = 24;
+
+    chr->data.getCharacter.keyMapEntryCount = DEFAULT_KEY_COUNT;
+    for (size_t i = 0; i < DEFAULT_KEY_COUNT; i++) {
+        chr->data.getCharacter.keyMap[i].key = DEFAULT_KEY[i];
+        chr->data.getCharacter.keyMap[i].type = DEFAULT_TYPE[i];
+        chr->data.getCharacter.keyMap[i].action = DEFAULT_ACTION[i];
+    }
+
+    struct CharacterNode node = {
+        .id = id,
+        .chr = chr
+    };
+
+    if (hash_set_u32_insert(STORE.characters, &node) == -1) {
+        free(chr->data.getCharacter.keyMap);
+        free(chr);
+        return NULL;
+    }
+
+    uint32_t hash = name_hash(nameLength, name);
+    struct NameBucket *bucket = hash_set_u32_get(STORE.characterNames, hash);
+    if (bucket == NULL) {
+        struct NameBucket new = {
+            .hash = hash,
+            .head = NULL
+        };
+
+        if (hash_set_u32_insert(STORE.characterNames, &new) == -1) {
+            hash_set_u32_remove(STORE.characters, id);
+            free(chr->data.getCharacter.keyMap);
+            free(chr);
+            return NULL;
+        }
+
+        bucket = hash_set_u32_get(STORE.characterNames, hash);
+    }
+
+    chr->next = bucket->head;
+    bucket->head = chr;
+
+    return chr;
+}
+
+static struct MemoryCharacter *synthesize_character(uint32_t id)
+{
+    // '#' can't appear in the name of a character that was created normally
+    char name[CHARACTER_MAX_NAME_LENGTH + 1];
+    int len = snprintf(name, sizeof(name), "#%" PRIu32, id);
+
+    struct MemoryStorage *storage = get_storage(id, 0);
+    if (storage == NULL)
+        return NULL;
+
+    struct MemoryCharacter *chr = insert_character(id, len, name, storage);
+    if (chr == NULL)
+        return NULL;
+
+    chr->data.getCharacter.accountId = id;
+    chr->data.getCharacter.map = DEFAULT_MAP;
+    chr->data.getCharacter.face = 20000;
+    chr->data.getCharacter.hair = 30000;
+
+    if (STORE.nextCharacterId <= id)
+        STORE.nextCharacterId = id + 1;
+
+    return chr;
+}
+
+// Creates the storage on first use, with the column defaults from db.sql
+static struct MemoryStorage *get_storage(uint32_t account_id, uint8_t world)
+{
+    if (world >= WORLD_COUNT)
+        return NULL;
+
+    struct StorageNode *node = hash_set_u32_get(STORE.storages, account_id);
+    if (node == NULL) {
+        struct StorageNode new = {
+            .accountId = account_id
+        };
+
+        if (hash_set_u32_insert(STORE.storages, &new) == -1)
+            return NULL;
+
+        node = hash_set_u32_get(STORE.storages, account_id);
+    }
+
+    if (node->worlds[world] == NULL) {
+        struct MemoryStorage *storage = malloc(sizeof(struct MemoryStorage));
+        if (storage == NULL)
+            return NULL;
+
+        storage->version = 0;
+        storage->id = STORE.nextId[ID_SEQUENCE_STORAGES]++;
+        storage->slots = 4;
+        storage->mesos = 0;
+        storage->itemCount = 0;
+        storage->equipCount = 0;
+        node->worlds[world] = storage;
+    }
+
+    return node->worlds[world];
+}
+
+// Both versions only ever grow, so their sum changes whenever the character or its storage is written
+static uint64_t character_version(const struct MemoryCharacter *chr)
+{
+    return chr->version + chr->storage->version;
+}
+
+static void database_equipment_from_equipment(const struct Equipment *equip, uint64_t itemId, uint64_t equipId, struct DatabaseEquipment *out)
+{
+    out->id = equipId;
+    out->item.id = itemId;
+    out->item.itemId = equip->item.itemId;
+    out->item.ownerLength = 0;
+    out->item.flags = 0;
+    out->item.expiration = 0;
+    out->item.giverLength = 0;
+    out->level = equip->level;
+    out->slots = equip->slots;
+    out->str = equip->str;
+    out->dex = equip->dex;
+    out->int_ = equip->int_;
+    out->luk = equip->luk;
+    out->hp = equip->hp;
+    out->mp = equip->mp;
+    out->atk = equip->atk;
+    out->matk = equip->matk;
+    out->def = equip->def;
+    out->mdef = equip->mdef;
+    out->acc = equip->acc;
+    out->avoid = equip->avoid;
+    out->hands = equip->hands;
+    out->speed = equip->speed;
+    out->jump = equip->jump;
+}
+
+static int copy_array(void **dst, const void *src, size_t count, size_t size)
+{
+    if (count == 0) {
+        *dst = NULL;
+        return 0;
+    }
+
+    *dst = malloc(count * size);
+    if (*dst == NULL)
+        return -1;
+
+    memcpy(*dst, src, count * size);
+    return 0;
+}
+
+static void store_init_lock(void)
+{
+    mtx_init(&STORE.lock, mtx_plain);
+}
+
+static int store_ref(void)
+{
+    call_once(&STORE.once, store_init_lock);
+
+    mtx_lock(&STORE.lock);
+    if (STORE.connectionCount == 0) {
+        STORE.accounts = hash_set_u32_create(sizeof(struct AccountNode), offsetof(struct AccountNode, id));
+        STORE.accountNames = hash_set_u32_create(sizeof(struct NameBucket), offsetof(struct NameBucket, hash));
+        STORE.characters = hash_set_u32_create(sizeof(struct CharacterNode), offsetof(struct CharacterNode, id));
+        STORE.characterNames = hash_set_u32_create(sizeof(struct NameBucket), offsetof(struct NameBucket, hash));
+        STORE.storages = hash_set_u32_create(sizeof(struct StorageNode), offsetof(struct StorageNode, accountId));
+        if (STORE.accounts == NULL || STORE.accountNames == NULL || STORE.characters == NULL || STORE.characterNames == NULL || STORE.storages == NULL) {
+            if (STORE.storages != NULL)
+                hash_set_u32_destroy(STORE.storages);
+            if (STORE.characterNames != NULL)
+                hash_set_u32_destroy(STORE.characterNames);
+            if (STORE.characters != NULL)
+                hash_set_u32_destroy(STORE.characters);
+            if (STORE.accountNames != NULL)
+                hash_set_u32_destroy(STORE.accountNames);
+            if (STORE.accounts != NULL)
+                hash_set_u32_destroy(STORE.accounts);
+            mtx_unlock(&STORE.lock);
+            return -1;
+        }
+
+        STORE.nextAccountId = 1;
+        STORE.nextCharacterId = 1;
+        for (size_t i = 0; i < ID_SEQUENCE_COUNT; i++)
+            STORE.nextId[i] = 1;
+    }
+
+    STORE.connectionCount++;
+    mtx_unlock(&STORE.lock);
+
+    return 0;
+}
+
+static void store_unref(void)
+{
+    mtx_lock(&STORE.lock);
+    STORE.connectionCount--;
+    if (STORE.connectionCount == 0) {
+        hash_set_u32_foreach(STORE.characters, free_character, NULL);
+        hash_set_u32_foreach(STORE.accounts, free_account, NULL);
+        hash_set_u32_foreach(STORE.storages, free_storages, NULL);
+        hash_set_u32_destroy(STORE.storages);
+        hash_set_u32_destroy(STORE.characterNames);
+        hash_set_u32_destroy(STORE.characters);
+        hash_set_u32_destroy(STORE.accountNames);
+        hash_set_u32_destroy(STORE.accounts);
+    }
+    mtx_unlock(&STORE.lock);
+}
+
+static void free_account(void *data, void *ctx)
+{
+    struct AccountNode *node = data;
+    free(node->account->characters);
+    free(node->account);
+}
+
+static void free_character(void *data, void *ctx)
+{
+    struct CharacterNode *node = data;
+    struct MemoryCharacter *chr = node->chr;
+    free(chr->data.getCharacter.keyMap);
+    free(chr->data.getCharacter.monsterBook);
+    free(chr->data.getCharacter.skills);
+    free(chr->data.getCharacter.completedQuests);
+    free(chr->data.getCharacter.questInfos);
+    free(chr->data.getCharacter.progresses);
+    free(chr->data.getCharacter.quests);
+    free(chr);
+}
+
+static void free_storages(void *data, void *ctx)
+{
+    struct StorageNode *node = data;
+    for (size_t i = 0; i < WORLD_COUNT; i++)
+        free(node->worlds[i]);
+}
+
+static void lock_queue_init(struct LockQueue *queue)
+{
+    queue->head = NULL;
+}
+
+static int lock_queue_enqueue(struct LockQueue *queue, int value)
+{
+    struct LockQueueNode *new = malloc(sizeof(struct LockQueueNode));
+    if (new == NULL)
+        return -1;
+
+    new->next = NULL;
+    new->value = value;
+
+    queue->last = (queue->head == NULL) ? (queue->head = new) : (queue->last->next = new);
+    return 0;
+}
+
+static int lock_queue_dequeue(struct LockQueue *queue)
+{
+    struct LockQueueNode *next = queue->head->next;
+    free(queue->head);
+    queue->head = next;
+    return queue->head == NULL ? -1 : queue->head->value;
+}
+
+static bool lock_queue_empty(struct LockQueue *queue)
+{
+    return queue->head == NULL;
+}
+
@@ -31,12 +31,37 @@ static int lock_queue_enqueue(struct LockQueue *queue, int value);
 static int lock_queue_dequeue(struct LockQueue *queue);
 static bool lock_queue_empty(struct LockQueue *queue);
 
+// Row IDs are leased from `IdSequences` in blocks of this size
+#define ID_LEASE_SIZE 10000
+
+enum IdSequence {
+    ID_SEQUENCE_ITEMS,
+    ID_SEQUENCE_EQUIPMENT,
+    ID_SEQUENCE_CHARACTER_EQUIPMENT,
+    ID_SEQUENCE_COUNT
+};
+
+static const char *ID_SEQUENCE_NAMES[] = {
+    "Items",
+    "Equipment",
+    "CharacterEquipment"
+};
+
+// IDs in [next, end) are reserved for this connection
+struct IdLease {
+    uint64_t next;
+    uint64_t end;
+};
+
 struct DatabaseConnection {
     MYSQL *conn;
     struct LockQueue queue;
+    // Only accessed by the request that currently holds the connection's lock
+    struct IdLease leases[ID_SEQUENCE_COUNT];
 };
 
 struct DatabaseRequest {
+    struct DatabaseConnection *conn;
     struct RequestParams params;
     int state;
     bool running;
@@ -50,6 +75,7 @@ struct DatabaseRequest {
         };
         struct {
             uint64_t id[4];
+            uint64_t newId[4];
         } createCharacter;
         struct {
             size_t i;
@@ -91,6 +117,8 @@ struct DatabaseRequest {
         } getCharacter;
         struct {
             size_t i;
+            uint64_t needed[ID_SEQUENCE_COUNT];
+            uint64_t count;
         } allocateIds;
         struct {
             size_t i;
@@ -110,6 +138,16 @@ struct DatabaseRequest {
 static int mariadb_to_poll(int status);
 static int poll_to_mariadb(int status);
 
+int database_init(void)
+{
+    return mysql_library_init(0, NULL, NULL) == 0 ? 0 : -1;
+}
+
+void database_terminate(void)
+{
+    mysql_library_end();
+}
+
 struct DatabaseConnection *database_connection_create(const char *host, const char *user, const char *password, const char *db, uint16_t port, const char *socket)
 {
     struct DatabaseConnection *conn = malloc(sizeof(struct DatabaseConnection));
@@ -123,13 +161,15 @@ struct DatabaseConnection *database_connection_create(const char *host, const ch
     }
 
     mysql_options(conn->conn, MYSQL_OPT_NONBLOCK, 0);
-    if (mysql_real_connect(conn->conn, host, user, password, db, port, socket, 0) == NULL) {
+    // CLIENT_MULTI_RESULTS is required for stored procedures that return multiple result sets
+    if (mysql_real_connect(conn->conn, host, user, password, db, port, socket, CLIENT_MULTI_RESULTS) == NULL) {
         mysql_close(conn->conn);
         free(conn);
         return NULL;
     }
 
     lock_queue_init(&conn->queue);
+    memset(conn->leases, 0, sizeof(conn->leases));
 
     return conn;
 }
@@ -186,6 +226,7 @@ struct DatabaseRequest *database_request_create(struct DatabaseConnection *conn,
         return NULL;
     }
 
+    req->conn = conn;
     req->state = 0;
     req->running = false;
     req->params = *params;
@@ -540,6 +581,7 @@ static int do_get_reactor_drops(struct DatabaseRequest *req, int status);
 static int do_get_shops(struct DatabaseRequest *req, int status);
 static int do_allocate_ids(struct DatabaseRequest *req, int status);
 static int do_update_character(struct DatabaseRequest *req, int status);
+static int do_compact_items(struct DatabaseRequest *req, int status);
 
 int database_request_execute(struct DatabaseRequest *req, int status)
 {
@@ -557,7 +599,8 @@ int database_request_execute(struct DatabaseRequest *req, int status)
         do_get_reactor_drops,
         do_get_shops,
         do_allocate_ids,
-        do_update_character
+        do_update_character,
+        do_compact_items
     };
 
     return do_request[req->params.type](req, status);
@@ -948,40 +991,68 @@ static int do_try_create_character(struct DatabaseRequest *req, int status)
 
     DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
 
+    // Row IDs come from IdSequences as the channel servers lease them in blocks from there
+    query = "UPDATE IdSequences SET next_id = LAST_INSERT_ID(next_id + 4) WHERE name = 'Items'";
+    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
+    DO_ASYNC_INT(mysql_stmt_execute, req, status);
+
+    // Rows are inserted in the order top, bottom, shoes, weapon where there is only a bottom with a coat
+    req->temp.createCharacter.newId[0] = mysql_stmt_insert_id(req->stmt) - 4;
+    req->temp.createCharacter.newId[1] = req->temp.createCharacter.newId[0] + 1;
+    req->temp.createCharacter.newId[2] = req->temp.createCharacter.newId[0] + (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 2 : 1);
+    req->temp.createCharacter.newId[3] = req->temp.createCharacter.newId[2] + 1;
+
+    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+
     if (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT)
-        query = "INSERT INTO Items (item_id) VALUES (?), (?), (?), (?)";
+        query = "INSERT INTO Items (id, item_id) VALUES (?, ?), (?, ?), (?, ?), (?, ?)";
     else
-        query = "INSERT INTO Items (item_id) VALUES (?), (?), (?)";
+        query = "INSERT INTO Items (id, item_id) VALUES (?, ?), (?, ?), (?, ?)";
 
     DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
 
-    INPUT_BINDER_INIT(equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 4 : 3);
+    INPUT_BINDER_INIT(equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 2 * 4 : 2 * 3);
     // Top
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[0]);
     INPUT_BINDER_u32(&req->params.tryCreateCharacter.top.item.itemId);
 
     // Bottom
     if (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT) {
+        INPUT_BINDER_u64(&req->temp.createCharacter.newId[1]);
         INPUT_BINDER_u32(&req->params.tryCreateCharacter.bottom.item.itemId);
     }
 
     // Shoes
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[2]);
     INPUT_BINDER_u32(&req->params.tryCreateCharacter.shoes.item.itemId);
 
     // Weapon
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[3]);
     INPUT_BINDER_u32(&req->params.tryCreateCharacter.weapon.item.itemId);
 
     INPUT_BINDER_FINALIZE(req->stmt);
 
     DO_ASYNC_INT(mysql_stmt_execute, req, status);
 
-    req->temp.createCharacter.id[0] = mysql_stmt_insert_id(req->stmt);
+    req->temp.createCharacter.id[0] = req->temp.createCharacter.newId[0];
+
+    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+
+    query = "UPDATE IdSequences SET next_id = LAST_INSERT_ID(next_id + 4) WHERE name = 'Equipment'";
+    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
+    DO_ASYNC_INT(mysql_stmt_execute, req, status);
+
+    req->temp.createCharacter.newId[0] = mysql_stmt_insert_id(req->stmt) - 4;
+    req->temp.createCharacter.newId[1] = req->temp.createCharacter.newId[0] + 1;
+    req->temp.createCharacter.newId[2] = req->temp.createCharacter.newId[0] + (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 2 : 1);
+    req->temp.createCharacter.newId[3] = req->temp.createCharacter.newId[2] + 1;
 
     DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
 
     if (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT)
-        query = "INSERT INTO Equipment (item, str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump, slots) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+        query = "INSERT INTO Equipment (id, item, str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump, slots) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
     else
-        query = "INSERT INTO Equipment (item, str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump, slots) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+        query = "INSERT INTO Equipment (id, item, str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump, slots) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?), (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
 
     DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
 
@@ -989,8 +1060,9 @@ static int do_try_create_character(struct DatabaseRequest *req, int status)
     req->temp.createCharacter.id[2] = req->temp.createCharacter.id[0] + 1;
     req->temp.createCharacter.id[3] = req->temp.createCharacter.id[0] + 2;
 
-    INPUT_BINDER_INIT(equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 16 * 4 : 16 * 3);
+    INPUT_BINDER_INIT(equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 17 * 4 : 17 * 3);
     // Top
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[0]);
     INPUT_BINDER_u64(&req->temp.createCharacter.id[0]);
     INPUT_BINDER_i16(&req->params.tryCreateCharacter.top.str);
     INPUT_BINDER_i16(&req->params.tryCreateCharacter.top.dex);
@@ -1010,6 +1082,7 @@ static int do_try_create_character(struct DatabaseRequest *req, int status)
 
     // Bottom
     if (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT) {
+        INPUT_BINDER_u64(&req->temp.createCharacter.newId[1]);
         INPUT_BINDER_u64(&req->temp.createCharacter.id[1]);
         INPUT_BINDER_i16(&req->params.tryCreateCharacter.bottom.str);
         INPUT_BINDER_i16(&req->params.tryCreateCharacter.bottom.dex);
@@ -1031,6 +1104,7 @@ static int do_try_create_character(struct DatabaseRequest *req, int status)
     }
 
     // Shoes
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[2]);
     INPUT_BINDER_u64(&req->temp.createCharacter.id[2]);
     INPUT_BINDER_i16(&req->params.tryCreateCharacter.shoes.str);
     INPUT_BINDER_i16(&req->params.tryCreateCharacter.shoes.dex);
@@ -1049,6 +1123,7 @@ static int do_try_create_character(struct DatabaseRequest *req, int status)
     INPUT_BINDER_i8(&req->params.tryCreateCharacter.shoes.slots);
 
     // Weapon
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[3]);
     INPUT_BINDER_u64(&req->temp.createCharacter.id[3]);
     INPUT_BINDER_i16(&req->params.tryCreateCharacter.weapon.str);
     INPUT_BINDER_i16(&req->params.tryCreateCharacter.weapon.dex);
@@ -1069,14 +1144,25 @@ static int do_try_create_character(struct DatabaseRequest *req, int status)
     INPUT_BINDER_FINALIZE(req->stmt);
     DO_ASYNC_INT(mysql_stmt_execute, req, status);
 
-    req->temp.createCharacter.id[0] = mysql_stmt_insert_id(req->stmt);
+    req->temp.createCharacter.id[0] = req->temp.createCharacter.newId[0];
+
+    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+
+    query = "UPDATE IdSequences SET next_id = LAST_INSERT_ID(next_id + 4) WHERE name = 'CharacterEquipment'";
+    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
+    DO_ASYNC_INT(mysql_stmt_execute, req, status);
+
+    req->temp.createCharacter.newId[0] = mysql_stmt_insert_id(req->stmt) - 4;
+    req->temp.createCharacter.newId[1] = req->temp.createCharacter.newId[0] + 1;
+    req->temp.createCharacter.newId[2] = req->temp.createCharacter.newId[0] + (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 2 : 1);
+    req->temp.createCharacter.newId[3] = req->temp.createCharacter.newId[2] + 1;
 
     DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
 
     if (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT)
-        query = "INSERT INTO CharacterEquipment (equip, character_id) VALUES (?, ?), (?, ?), (?, ?), (?, ?)";
+        query = "INSERT INTO CharacterEquipment (id, equip, character_id) VALUES (?, ?, ?), (?, ?, ?), (?, ?, ?), (?, ?, ?)";
     else
-        query = "INSERT INTO CharacterEquipment (equip, character_id) VALUES (?, ?), (?, ?), (?, ?)";
+        query = "INSERT INTO CharacterEquipment (id, equip, character_id) VALUES (?, ?, ?), (?, ?, ?), (?, ?, ?)";
 
     DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
 
@@ -1084,14 +1170,16 @@ static int do_try_create_character(struct DatabaseRequest *req, int status)
     req->temp.createCharacter.id[2] = req->temp.createCharacter.id[0] + 1;
     req->temp.createCharacter.id[3] = req->temp.createCharacter.id[0] + 2;
 
-    INPUT_BINDER_INIT(equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 2 * 4 : 2 * 3);
+    INPUT_BINDER_INIT(equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT ? 3 * 4 : 3 * 3);
 
     // Top/Overall
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[0]);
     INPUT_BINDER_u64(&req->temp.createCharacter.id[0]);
     INPUT_BINDER_u32(&req->res.tryCreateCharacter.id);
 
     // Bottom
     if (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT) {
+        INPUT_BINDER_u64(&req->temp.createCharacter.newId[1]);
         INPUT_BINDER_u64(&req->temp.createCharacter.id[1]);
         INPUT_BINDER_u32(&req->res.tryCreateCharacter.id);
         req->temp.createCharacter.id[2]++;
@@ -1099,17 +1187,19 @@ static int do_try_create_character(struct DatabaseRequest *req, int status)
     }
 
     // Shoes
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[2]);
     INPUT_BINDER_u64(&req->temp.createCharacter.id[2]);
     INPUT_BINDER_u32(&req->res.tryCreateCharacter.id);
 
     // Weapon
+    INPUT_BINDER_u64(&req->temp.createCharacter.newId[3]);
     INPUT_BINDER_u64(&req->temp.createCharacter.id[3]);
     INPUT_BINDER_u32(&req->res.tryCreateCharacter.id);
     INPUT_BINDER_FINALIZE(req->stmt);
 
     DO_ASYNC_INT(mysql_stmt_execute, req, status);
 
-    req->temp.createCharacter.id[0] = mysql_stmt_insert_id(req->stmt);
+    req->temp.createCharacter.id[0] = req->temp.createCharacter.newId[0];
 
     if (equip_type_from_id(req->params.tryCreateCharacter.top.item.itemId) == EQUIP_TYPE_COAT)
         query = "INSERT INTO EquippedEquipment (equip) VALUES (?), (?), (?), (?)";
@@ -1165,17 +1255,20 @@ static int do_get_character(struct DatabaseRequest *req, int status)
     int ret;
     const char *query;
     BEGIN_ASYNC(req)
-    query = "SELECT account_id, world, name, map, spawn, job, level, exp, max_hp, hp, max_mp, mp, "
-        "str, dex, int_, luk, hpmp, ap, sp, fame, gender, skin, face, hair, mesos, "
-        "equip_slots, use_slots, setup_slots, etc_slots FROM Characters "
-        "WHERE id = ?";
+    // All the independent result sets are fetched by a single stored procedure call
+    // so that loading a character costs one round-trip instead of one per table
+    query = "CALL GetCharacter(?, ?)";
     DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
 
-    INPUT_BINDER_INIT(1);
+    INPUT_BINDER_INIT(2);
     INPUT_BINDER_u32(&req->params.getCharacter.id);
+    INPUT_BINDER_u64(&req->params.getCharacter.knownVersion);
     INPUT_BINDER_FINALIZE(req->stmt);
 
-    OUTPUT_BINDER_INIT(29);
+    DO_ASYNC_INT(mysql_stmt_execute, req, status);
+
+    // The result sets of a CALL are only known after execution so the output binding must come after it
+    OUTPUT_BINDER_INIT(30);
     OUTPUT_BINDER_u32(&req->res.getCharacter.accountId);
     OUTPUT_BINDER_u8(&req->res.getCharacter.world);
     req->res.getCharacter.nameLength = CHARACTER_MAX_NAME_LENGTH;
@@ -1206,26 +1299,28 @@ static int do_get_character(struct DatabaseRequest *req, int status)
     OUTPUT_BINDER_u8(&req->res.getCharacter.useSlots);
     OUTPUT_BINDER_u8(&req->res.getCharacter.setupSlots);
     OUTPUT_BINDER_u8(&req->res.getCharacter.etcSlots);
+    OUTPUT_BINDER_u64(&req->res.getCharacter.version);
     OUTPUT_BINDER_FINALIZE(req->stmt);
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
-    DO_ASYNC_FETCH(req, status);
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+    // Each result set must be fully consumed before moving on to the next one
+    req->res.getCharacter.version = DATABASE_CHARACTER_VERSION_NONE;
+    DO_ASYNC_FETCH_RESULT(ret, req, status);
+    while (ret != MYSQL_NO_DATA)
+        DO_ASYNC_FETCH_RESULT(ret, req, status);
 
-    // Load equipped equipment
-    query = "SELECT CharacterEquipment.id, Equipment.id, Items.id, item_id, flags, owner, level, slots, str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump "
-        "FROM Items JOIN Equipment ON Items.id = item "
-        "JOIN CharacterEquipment ON Equipment.id = CharacterEquipment.equip "
-        "JOIN EquippedEquipment ON CharacterEquipment.id = EquippedEquipment.equip "
-        "WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
+    // The procedure stops after the first result set if the caller's copy is still current
+    req->res.getCharacter.unchanged = req->params.getCharacter.knownVersion != DATABASE_CHARACTER_VERSION_NONE &&
+        req->res.getCharacter.version == req->params.getCharacter.knownVersion;
+    if (req->res.getCharacter.unchanged) {
+        DO_ASYNC_INT(mysql_stmt_next_result, req, status);
+        DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+        return 0;
+    }
 
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Equipped equipment
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
-    OUTPUT_BINDER_INIT(23);
+    OUTPUT_BINDER_INIT(22);
     struct DatabaseCharacterEquipment *equip = &req->res.getCharacter.equippedEquipment[EQUIP_SLOT_COUNT - 1];
     OUTPUT_BINDER_u64(&equip->id);
     OUTPUT_BINDER_u64(&equip->equip.id);
@@ -1254,7 +1349,6 @@ static int do_get_character(struct DatabaseRequest *req, int status)
 
     req->res.getCharacter.equippedCount = 0;
     req->res.getCharacter.equippedEquipment[EQUIP_SLOT_COUNT - 1].equip.item.giverLength = 0;
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
 
     DO_ASYNC_FETCH_RESULT(ret, req, status);
     while (ret != MYSQL_NO_DATA) {
@@ -1268,20 +1362,8 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    // Load inventory equipment
-    query = "SELECT CharacterEquipment.id, Equipment.id, Items.id, item_id, flags, owner, level, slots, "
-          "str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump, slot "
-        "FROM Items JOIN Equipment ON Items.id = item "
-        "JOIN CharacterEquipment ON Equipment.id = CharacterEquipment.equip "
-        "JOIN InventoryEquipment ON CharacterEquipment.equip = InventoryEquipment.equip "
-        "WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Inventory equipment
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(23);
     struct DatabaseCharacterEquipment *equip = &req->res.getCharacter.equipmentInventory[251].equip;
@@ -1314,7 +1396,6 @@ static int do_get_character(struct DatabaseRequest *req, int status)
 
     req->res.getCharacter.equipCount = 0;
     req->res.getCharacter.equipmentInventory[251].equip.equip.item.giverLength = 0;
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
 
     DO_ASYNC_FETCH_RESULT(ret, req, status);
     while (ret != MYSQL_NO_DATA) {
@@ -1328,17 +1409,8 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    // Load inventory itmes
-    query = "SELECT id, item_id, flags, owner, slot, count "
-        "FROM InventoryItems JOIN Items ON item = id "
-        "WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Inventory items
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(6);
     OUTPUT_BINDER_u64(&req->res.getCharacter.inventoryItems[4*252 - 1].item.id);
@@ -1353,7 +1425,6 @@ static int do_get_character(struct DatabaseRequest *req, int status)
 
     req->res.getCharacter.itemCount = 0;
     req->res.getCharacter.inventoryItems[252*4 - 1].item.giverLength = 0;
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
 
     DO_ASYNC_FETCH_RESULT(ret, req, status);
     while (ret != MYSQL_NO_DATA) {
@@ -1367,15 +1438,8 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT id, slots, mesos FROM Storages WHERE account_id = ? AND world = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(2);
-    INPUT_BINDER_u32(&req->res.getCharacter.accountId);
-    INPUT_BINDER_u8(&req->res.getCharacter.world);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Storage
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(3);
     OUTPUT_BINDER_u64(&req->res.getCharacter.storage.id);
@@ -1383,21 +1447,12 @@ static int do_get_character(struct DatabaseRequest *req, int status)
     OUTPUT_BINDER_i32(&req->res.getCharacter.storage.mesos);
     OUTPUT_BINDER_FINALIZE(req->stmt);
 
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
     DO_ASYNC_FETCH_RESULT(ret, req, status);
+    while (ret != MYSQL_NO_DATA)
+        DO_ASYNC_FETCH_RESULT(ret, req, status);
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT StorageSlots.id, StorageSlots.slot, count, Items.id, item_id, flags, owner "
-        "FROM StorageItems JOIN Items ON item = id "
-        "JOIN StorageSlots ON StorageItems.slot = StorageSlots.id "
-        "WHERE storage = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u64(&req->res.getCharacter.storage.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Storage items
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(7);
     OUTPUT_BINDER_u64(&req->res.getCharacter.storageItems[252 - 1].slotId);
@@ -1413,7 +1468,6 @@ static int do_get_character(struct DatabaseRequest *req, int status)
 
     req->res.getCharacter.storageItemCount = 0;
     req->res.getCharacter.storageItems[252 - 1].item.giverLength = 0;
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
 
     DO_ASYNC_FETCH_RESULT(ret, req, status);
     while (ret != MYSQL_NO_DATA) {
@@ -1427,18 +1481,8 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT StorageSlots.id, StorageSlots.slot, Equipment.id, Items.id, item_id, flags, owner, level, slots, str, dex, int_, luk, hp, mp, atk, matk, def, mdef, acc, avoid, speed, jump "
-        "FROM Items JOIN Equipment ON Items.id = item "
-        "JOIN StorageEquipment ON Equipment.id = equip "
-        "JOIN StorageSlots ON StorageEquipment.slot = StorageSlots.id "
-        "WHERE storage = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u64(&req->res.getCharacter.storage.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Storage equipment
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(23);
     OUTPUT_BINDER_u64(&req->res.getCharacter.storageEquipment[252 - 1].slotId);
@@ -1470,35 +1514,26 @@ static int do_get_character(struct DatabaseRequest *req, int status)
 
     req->res.getCharacter.storageEquipCount = 0;
     req->res.getCharacter.storageEquipment[252 - 1].equip.item.giverLength = 0;
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
 
     DO_ASYNC_FETCH_RESULT(ret, req, status);
     while (ret != MYSQL_NO_DATA) {
         if (req->temp.getCharacter.isNull)
             req->res.getCharacter.storageEquipment[252 - 1].equip.item.ownerLength = 0;
 
-        req->res.getCharacter.storageEquipment[req->res.getCharacter.storageItemCount] =
+        req->res.getCharacter.storageEquipment[req->res.getCharacter.storageEquipCount] =
             req->res.getCharacter.storageEquipment[252 - 1];
         req->res.getCharacter.storageEquipCount++;
 
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT quest_id FROM InProgressQuests WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // In-progress quests
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(1);
     OUTPUT_BINDER_u16(&req->temp.getCharacter.quest);
     OUTPUT_BINDER_FINALIZE(req->stmt);
 
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
     DO_ASYNC_INT(mysql_stmt_store_result, req, status);
 
     req->res.getCharacter.quests = malloc(mysql_stmt_num_rows(req->stmt) * sizeof(uint16_t));
@@ -1514,14 +1549,8 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT quest_id, progress_id, progress FROM Progresses WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Quest progresses
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(3);
     OUTPUT_BINDER_u16(&req->temp.getCharacter.quest);
@@ -1529,8 +1558,6 @@ static int do_get_character(struct DatabaseRequest *req, int status)
     OUTPUT_BINDER_i16(&req->temp.getCharacter.progress);
     OUTPUT_BINDER_FINALIZE(req->stmt);
 
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
     DO_ASYNC_INT(mysql_stmt_store_result, req, status);
 
     req->res.getCharacter.progresses = malloc(mysql_stmt_num_rows(req->stmt) * sizeof(struct DatabaseProgress));
@@ -1550,22 +1577,15 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT info_id, progress FROM QuestInfos WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Quest infos
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(2);
     OUTPUT_BINDER_u16(&req->temp.getCharacter.infoId);
+    req->temp.getCharacter.infoProgressLength = 12;
     OUTPUT_BINDER_sized_string(&req->temp.getCharacter.infoProgressLength, req->temp.getCharacter.infoProgress);
     OUTPUT_BINDER_FINALIZE(req->stmt);
 
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
     DO_ASYNC_INT(mysql_stmt_store_result, req, status);
 
     req->res.getCharacter.questInfos = malloc(mysql_stmt_num_rows(req->stmt) * sizeof(struct DatabaseInfoProgress));
@@ -1586,22 +1606,14 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT quest_id, time FROM CompletedQuests WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Completed quests
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(2);
     OUTPUT_BINDER_u16(&req->temp.getCharacter.quest);
     OUTPUT_BINDER_time(&req->temp.getCharacter.time);
     OUTPUT_BINDER_FINALIZE(req->stmt);
 
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
     DO_ASYNC_INT(mysql_stmt_store_result, req, status);
 
     req->res.getCharacter.completedQuests =
@@ -1621,14 +1633,8 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT skill_id, level, master FROM Skills WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Skills
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(3);
     OUTPUT_BINDER_u32(&req->temp.getCharacter.skillId);
@@ -1636,8 +1642,6 @@ static int do_get_character(struct DatabaseRequest *req, int status)
     OUTPUT_BINDER_i8(&req->temp.getCharacter.skillMasterLevel);
     OUTPUT_BINDER_FINALIZE(req->stmt);
 
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
     DO_ASYNC_INT(mysql_stmt_store_result, req, status);
 
     req->res.getCharacter.skills = malloc(mysql_stmt_num_rows(req->stmt) * sizeof(struct DatabaseSkill));
@@ -1656,22 +1660,14 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT card_id, quantity FROM MonsterBooks WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Monster book
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(2);
     OUTPUT_BINDER_u32(&req->temp.getCharacter.cardId);
     OUTPUT_BINDER_i8(&req->temp.getCharacter.quantity);
     OUTPUT_BINDER_FINALIZE(req->stmt);
 
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
     DO_ASYNC_INT(mysql_stmt_store_result, req, status);
 
     req->res.getCharacter.monsterBook =
@@ -1691,14 +1687,8 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "SELECT `key`, type, action FROM Keymaps WHERE character_id = ?";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    INPUT_BINDER_INIT(1);
-    INPUT_BINDER_u32(&req->params.getCharacter.id);
-    INPUT_BINDER_FINALIZE(req->stmt);
+    // Key map
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
 
     OUTPUT_BINDER_INIT(3);
     OUTPUT_BINDER_u32(&req->temp.getCharacter.key);
@@ -1706,8 +1696,6 @@ static int do_get_character(struct DatabaseRequest *req, int status)
     OUTPUT_BINDER_u32(&req->temp.getCharacter.action);
     OUTPUT_BINDER_FINALIZE(req->stmt);
 
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
     DO_ASYNC_INT(mysql_stmt_store_result, req, status);
 
     req->res.getCharacter.keyMap = malloc(mysql_stmt_num_rows(req->stmt) * sizeof(struct DatabaseKeyMapEntry));
@@ -1726,6 +1714,9 @@ static int do_get_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_FETCH_RESULT(ret, req, status);
     }
 
+    // Consume the status result that terminates every CALL
+    DO_ASYNC_INT(mysql_stmt_next_result, req, status);
+
     DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
 
     END_ASYNC()
@@ -1736,92 +1727,71 @@ static int do_get_character(struct DatabaseRequest *req, int status)
 static int do_allocate_ids(struct DatabaseRequest *req, int status)
 {
     size_t *i = &req->temp.allocateIds.i;
+    uint64_t *needed = req->temp.allocateIds.needed;
+    struct IdLease *leases = req->conn->leases;
     const char *query;
     BEGIN_ASYNC(req)
-    query = "INSERT INTO Items (item_id) VALUES (?)";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    for (*i = 0; *i < req->params.allocateIds.itemCount; (*i)++) {
-        INPUT_BINDER_INIT(1);
-        INPUT_BINDER_u32(&req->params.allocateIds.items[*i]);
-        INPUT_BINDER_FINALIZE(req->stmt);
-
-        DO_ASYNC_INT(mysql_stmt_execute, req, status);
-        req->res.allocateIds.items[*i] = mysql_stmt_insert_id(req->stmt);
+    needed[ID_SEQUENCE_ITEMS] = req->params.allocateIds.itemCount;
+    needed[ID_SEQUENCE_EQUIPMENT] = 0;
+    needed[ID_SEQUENCE_CHARACTER_EQUIPMENT] = req->params.allocateIds.equippedCount + req->params.allocateIds.equipCount;
+
+    for (size_t j = 0; j < req->params.allocateIds.equippedCount; j++) {
+        if (req->params.allocateIds.equippedEquipment[j].id == 0)
+            needed[ID_SEQUENCE_ITEMS]++;
+        if (req->params.allocateIds.equippedEquipment[j].equipId == 0)
+            needed[ID_SEQUENCE_EQUIPMENT]++;
     }
 
-    for (*i = 0; *i < req->params.allocateIds.equippedCount; (*i)++) {
-        if (req->params.allocateIds.equippedEquipment[*i].id == 0) {
-            INPUT_BINDER_INIT(1);
-            INPUT_BINDER_u32(&req->params.allocateIds.equippedEquipment[*i].itemId);
-            INPUT_BINDER_FINALIZE(req->stmt);
-
-            DO_ASYNC_INT(mysql_stmt_execute, req, status);
-            req->params.allocateIds.equippedEquipment[*i].id = mysql_stmt_insert_id(req->stmt);
-        }
-    }
-
-    for (*i = 0; *i < req->params.allocateIds.equipCount; (*i)++) {
-        if (req->params.allocateIds.equipmentInventory[*i].id == 0) {
-            INPUT_BINDER_INIT(1);
-            INPUT_BINDER_u32(&req->params.allocateIds.equipmentInventory[*i].itemId);
-            INPUT_BINDER_FINALIZE(req->stmt);
-
-            DO_ASYNC_INT(mysql_stmt_execute, req, status);
-            req->params.allocateIds.equipmentInventory[*i].id = mysql_stmt_insert_id(req->stmt);
-        }
+    for (size_t j = 0; j < req->params.allocateIds.equipCount; j++) {
+        if (req->params.allocateIds.equipmentInventory[j].id == 0)
+            needed[ID_SEQUENCE_ITEMS]++;
+        if (req->params.allocateIds.equipmentInventory[j].equipId == 0)
+            needed[ID_SEQUENCE_EQUIPMENT]++;
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+    // Usually the current leases have enough IDs left, in which case the request finishes without touching the database
+    for (*i = 0; *i < ID_SEQUENCE_COUNT; (*i)++) {
+        if (leases[*i].end - leases[*i].next < needed[*i]) {
+            req->temp.allocateIds.count = needed[*i] > ID_LEASE_SIZE ? needed[*i] : ID_LEASE_SIZE;
 
-    query = "INSERT INTO Equipment (item) VALUES (?)";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
+            query = "UPDATE IdSequences SET next_id = LAST_INSERT_ID(next_id + ?) WHERE name = ?";
+            DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
 
-    for (*i = 0; *i < req->params.allocateIds.equippedCount; (*i)++) {
-        if (req->params.allocateIds.equippedEquipment[*i].equipId == 0) {
-            INPUT_BINDER_INIT(1);
-            INPUT_BINDER_u64(&req->params.allocateIds.equippedEquipment[*i].id);
+            INPUT_BINDER_INIT(2);
+            INPUT_BINDER_u64(&req->temp.allocateIds.count);
+            INPUT_BINDER_string(ID_SEQUENCE_NAMES[*i]);
             INPUT_BINDER_FINALIZE(req->stmt);
 
             DO_ASYNC_INT(mysql_stmt_execute, req, status);
-            req->params.allocateIds.equippedEquipment[*i].equipId = mysql_stmt_insert_id(req->stmt);
-        }
-    }
 
-    for (*i = 0; *i < req->params.allocateIds.equipCount; (*i)++) {
-        if (req->params.allocateIds.equipmentInventory[*i].equipId == 0) {
-            INPUT_BINDER_INIT(1);
-            INPUT_BINDER_u64(&req->params.allocateIds.equipmentInventory[*i].id);
-            INPUT_BINDER_FINALIZE(req->stmt);
+            if (mysql_stmt_affected_rows(req->stmt) != 1)
+                return -1;
 
-            DO_ASYNC_INT(mysql_stmt_execute, req, status);
-            req->params.allocateIds.equipmentInventory[*i].equipId = mysql_stmt_insert_id(req->stmt);
+            // Whatever was left of the previous lease is skipped
+            leases[*i].end = mysql_stmt_insert_id(req->stmt);
+            leases[*i].next = leases[*i].end - req->temp.allocateIds.count;
+
+            DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
         }
     }
 
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
-
-    query = "INSERT INTO CharacterEquipment (equip, character_id) VALUES (?, ?)";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-
-    for (*i = 0; *i < req->params.allocateIds.equippedCount; (*i)++) {
-        INPUT_BINDER_INIT(2);
-        INPUT_BINDER_u64(&req->params.allocateIds.equippedEquipment[*i].equipId);
-        INPUT_BINDER_u32(&req->params.allocateIds.id);
-        INPUT_BINDER_FINALIZE(req->stmt);
+    for (size_t j = 0; j < req->params.allocateIds.itemCount; j++)
+        req->res.allocateIds.items[j] = leases[ID_SEQUENCE_ITEMS].next++;
 
-        DO_ASYNC_INT(mysql_stmt_execute, req, status);
-        req->res.allocateIds.equippedEquipment[*i] = mysql_stmt_insert_id(req->stmt);
+    for (size_t j = 0; j < req->params.allocateIds.equippedCount; j++) {
+        if (req->params.allocateIds.equippedEquipment[j].id == 0)
+            req->params.allocateIds.equippedEquipment[j].id = leases[ID_SEQUENCE_ITEMS].next++;
+        if (req->params.allocateIds.equippedEquipment[j].equipId == 0)
+            req->params.allocateIds.equippedEquipment[j].equipId = leases[ID_SEQUENCE_EQUIPMENT].next++;
+        req->res.allocateIds.equippedEquipment[j] = leases[ID_SEQUENCE_CHARACTER_EQUIPMENT].next++;
     }
 
-    for (*i = 0; *i < req->params.allocateIds.equipCount; (*i)++) {
-        INPUT_BINDER_INIT(2);
-        INPUT_BINDER_u64(&req->params.allocateIds.equipmentInventory[*i].equipId);
-        INPUT_BINDER_u32(&req->params.allocateIds.id);
-        INPUT_BINDER_FINALIZE(req->stmt);
-
-        DO_ASYNC_INT(mysql_stmt_execute, req, status);
-        req->res.allocateIds.equipmentInventory[*i] = mysql_stmt_insert_id(req->stmt);
+    for (size_t j = 0; j < req->params.allocateIds.equipCount; j++) {
+        if (req->params.allocateIds.equipmentInventory[j].id == 0)
+            req->params.allocateIds.equipmentInventory[j].id = leases[ID_SEQUENCE_ITEMS].next++;
+        if (req->params.allocateIds.equipmentInventory[j].equipId == 0)
+            req->params.allocateIds.equipmentInventory[j].equipId = leases[ID_SEQUENCE_EQUIPMENT].next++;
+        req->res.allocateIds.equipmentInventory[j] = leases[ID_SEQUENCE_CHARACTER_EQUIPMENT].next++;
     }
 
     END_ASYNC();
@@ -1884,6 +1854,11 @@ static int do_update_character(struct DatabaseRequest *req, int status)
     INPUT_BINDER_u64(&req->params.updateCharacter.storage.id);
     INPUT_BINDER_FINALIZE(req->stmt);
 
+    // Also bumps the version of every character that shares the storage, see StoragesBumpVersion
+    DO_ASYNC_INT(mysql_stmt_execute, req, status);
+
+    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+
     query = "UPDATE Items JOIN InventoryItems ON Items.id = item SET deleted = 1 WHERE character_id = ?";
     DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
     INPUT_BINDER_INIT(1);
@@ -2235,11 +2210,7 @@ static int do_update_character(struct DatabaseRequest *req, int status)
         DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
     }
 
-    query = "DELETE FROM Items WHERE deleted = 1";
-    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
-    DO_ASYNC_INT(mysql_stmt_execute, req, status);
-
-    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+    // Rows that are still marked as deleted are reclaimed later by DATABASE_REQUEST_TYPE_COMPACT_ITEMS
 
     // TODO: Maybe use a soft-delete
     query = "DELETE FROM InProgressQuests WHERE character_id = ?";
@@ -2448,8 +2419,53 @@ static int do_update_character(struct DatabaseRequest *req, int status)
         mysql_stmt_attr_set(req->stmt, STMT_ATTR_ARRAY_SIZE, (unsigned int[]) { req->params.updateCharacter.keyMapEntryCount });
 
         DO_ASYNC_INT(mysql_stmt_execute, req, status);
+
+        mysql_stmt_attr_set(req->stmt, STMT_ATTR_ROW_SIZE, (size_t[]) { 0 });
+        mysql_stmt_attr_set(req->stmt, STMT_ATTR_ARRAY_SIZE, (unsigned int[]) { 0 });
+
+        DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+    }
+
+    query = "SELECT version FROM Characters WHERE id = ?";
+    DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, strlen(query));
+    INPUT_BINDER_INIT(1);
+    INPUT_BINDER_u32(&req->params.updateCharacter.id);
+    INPUT_BINDER_FINALIZE(req->stmt);
+
+    DO_ASYNC_INT(mysql_stmt_execute, req, status);
+
+    OUTPUT_BINDER_INIT(1);
+    OUTPUT_BINDER_u64(&req->res.updateCharacter.version);
+    OUTPUT_BINDER_FINALIZE(req->stmt);
+
+    req->res.updateCharacter.version = 0;
+    DO_ASYNC_FETCH(req, status);
+
+    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+
+    END_ASYNC();
+
+    return 0;
+}
+
+static int do_compact_items(struct DatabaseRequest *req, int status)
+{
+    BEGIN_ASYNC(req)
+    {
+        // Dependent rows in Equipment and the link tables are removed by ON DELETE CASCADE
+        char query[64];
+        int len = sprintf(query,
+                          "DELETE FROM Items WHERE deleted = 1 LIMIT %" PRIu32,
+                          req->params.compactItems.batchSize);
+        DO_ASYNC_INT(mysql_stmt_prepare, req, status, query, len);
     }
 
+    DO_ASYNC_INT(mysql_stmt_execute, req, status);
+
+    req->res.compactItems.deleted = mysql_stmt_affected_rows(req->stmt);
+
+    DO_ASYNC_BOOL(mysql_stmt_reset, req, status);
+
     END_ASYNC();
 
     return 0;
@@ -2860,4 +2876,3 @@ static int poll_to_mariadb(int status)
 
     return ret;
 }
-
@@ -12,6 +12,9 @@
 
 #define ACCOUNT_HASH_LEN 16
 
+// Passed as the known version of a character when no copy of it is cached
+#define DATABASE_CHARACTER_VERSION_NONE UINT64_MAX
+
 struct DatabaseConnection;
 
 enum DatabaseRequestType {
@@ -28,7 +31,8 @@ enum DatabaseRequestType {
     DATABASE_REQUEST_TYPE_GET_REACTOR_DROPS,
     DATABASE_REQUEST_TYPE_GET_SHOPS,
     DATABASE_REQUEST_TYPE_ALLOCATE_IDS,
-    DATABASE_REQUEST_TYPE_UPDATE_CHARACTER
+    DATABASE_REQUEST_TYPE_UPDATE_CHARACTER,
+    DATABASE_REQUEST_TYPE_COMPACT_ITEMS
 };
 
 struct DatabaseItem {
@@ -160,6 +164,8 @@ struct RequestParams {
         } getCharactersForAccount;
         struct {
             uint32_t id;
+            // If the character's version still equals this only its first result set is returned
+            uint64_t knownVersion;
         } getCharacter;
         struct {
             uint32_t id;
@@ -265,6 +271,10 @@ struct RequestParams {
             size_t keyMapEntryCount;
             struct DatabaseKeyMapEntry *keyMap;
         } updateCharacter;
+        struct {
+            // Maximum number of rows to delete in one go
+            uint32_t batchSize;
+        } compactItems;
     };
 };
 
@@ -472,6 +482,9 @@ union DatabaseResult {
         struct DatabaseMonsterBookEntry *monsterBook;
         size_t keyMapEntryCount;
         struct DatabaseKeyMapEntry *keyMap;
+        uint64_t version;
+        // Set if `version` matched the known version, in which case only the fields up to `etcSlots` are filled in
+        bool unchanged;
     } getCharacter;
     struct {
         size_t count;
@@ -490,8 +503,21 @@ union DatabaseResult {
         uint64_t equippedEquipment[252];
         uint64_t equipmentInventory[252];
     } allocateIds;
+    struct {
+        // The version of the character after the update was committed
+        uint64_t version;
+    } updateCharacter;
+    struct {
+        uint64_t deleted;
+    } compactItems;
 };
 
+/**
+ * Initializes the client library. Must be called before connections are created from more than one thread at a time.
+ */
+int database_init(void);
+void database_terminate(void);
+
 void database_connection_set_credentials(char *host, char *user, char *password, char *db, uint16_t port, char *socket);
 
 struct DatabaseConnection *database_connection_create(const char *host, const char *user, const char *password, const char *db, uint16_t port, const char *socket);
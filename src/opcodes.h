@@ -1,6 +1,7 @@
 #ifndef OPCODES_H
 #define OPCODES_H
 
+#define RECEIVE_OPCODE_PONG 0x0018
 #define RECEIVE_OPCODE_PORTAL 0x0026
 #define RECEIVE_OPCODE_MOVE 0x0029
 #define RECEIVE_OPCODE_SIT 0x002A
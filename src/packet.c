@@ -398,6 +398,14 @@ void set_gender_packet(bool gender, uint8_t *packet)
     writer_bool(&writer, gender);
 }
 
+void ping_packet(uint8_t *packet)
+{
+    struct Writer writer;
+    writer_init(&writer, PING_PACKET_LENGTH, packet);
+
+    writer_u16(&writer, 0x0011);
+}
+
 void change_map_packet(struct Character *chr, uint32_t to, uint8_t portal, uint8_t *packet)
 {
     struct Writer writer;
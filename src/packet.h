@@ -90,6 +90,9 @@ size_t set_field_packet(struct Character *chr, uint8_t *packet);
 #define SET_GENDER_PACKET_LENGTH 3
 void set_gender_packet(bool gender, uint8_t *packet);
 
+#define PING_PACKET_LENGTH 2
+void ping_packet(uint8_t *packet);
+
 #define CHANGE_MAP_PACKET_LENGTH 27
 void change_map_packet(struct Character *chr, uint32_t to, uint8_t portal, uint8_t *packet);
 
@@ -3,8 +3,15 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <threads.h>
+#include <time.h>
 
 #include <fcntl.h>
 #include <sys/mman.h> // mmap
@@ -21,33 +28,66 @@
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 
-struct Rectangle {
-    struct Point sw;
-    struct Point ne;
-};
+#define FOOTHOLD_TREE_FANOUT 8
+#define FOOTHOLD_TREE_MAX_DEPTH 16
+// Lookups per map done by wz_benchmark_footholds()
+#define FOOTHOLD_BENCHMARK_QUERIES 10000
 
-struct RTreeNode {
-    struct RTreeNode *parent;
-    struct Rectangle bound;
-    bool isLeaf;
-    uint8_t count;
+struct FootholdTreeNode {
+    // The children's bounding boxes, or the footholds' end points in a leaf,
+    // kept as struct-of-arrays so that a whole node is tested at once. Slots past count are unused
     union {
-        struct RTreeNode *children[3];
-        struct Foothold footholds[3];
+        struct {
+            int16_t minX[FOOTHOLD_TREE_FANOUT];
+            int16_t minY[FOOTHOLD_TREE_FANOUT];
+            int16_t maxX[FOOTHOLD_TREE_FANOUT];
+            int16_t maxY[FOOTHOLD_TREE_FANOUT];
+        };
+        struct {
+            int16_t x1[FOOTHOLD_TREE_FANOUT];
+            int16_t y1[FOOTHOLD_TREE_FANOUT];
+            int16_t x2[FOOTHOLD_TREE_FANOUT];
+            int16_t y2[FOOTHOLD_TREE_FANOUT];
+        };
     };
+    // Index of the first child in the tree's nodes, or of the first foothold in the tree's footholds for a leaf
+    uint32_t first;
+    uint8_t count;
+    bool isLeaf;
 };
 
+// A bulk-loaded R-tree stored as a flat array; nodes[0] is the root and the children of each node are contiguous
 struct FootholdRTree {
-    struct RTreeNode *root;
+    uint32_t nodeCount;
+    struct FootholdTreeNode *nodes;
+    uint32_t footholdCount;
+    struct Foothold *footholds;
 };
 
-static void insert_foothold(struct FootholdRTree *tree, struct Foothold *fh);
+struct FootholdTreeEntry {
+    int16_t minX;
+    int16_t minY;
+    int16_t maxX;
+    int16_t maxY;
+    uint32_t index;
+};
 
-bool WRITER;
+static int foothold_tree_build(struct FootholdRTree *tree, const struct Foothold *footholds, size_t count);
+static struct FootholdTreeEntry node_bounds(const struct FootholdTreeNode *node);
+static const struct Foothold *footholds_scan_below(const struct FootholdRTree *tree, const struct Point *p);
+static int16_t get_distance_below(const struct Foothold *fh, const struct Point *p);
 
 cmph_t *MAP_INFO_MPH;
 static size_t MAP_INFO_COUNT;
 static struct MapInfo *MAP_INFOS;
+// When maps are loaded lazily MAP_INFOS only holds their IDs until they are first looked up
+static bool LAZY_MAPS;
+static char **MAP_PATHS;
+// The IDs of the lazily loaded maps by index. Unlike MAP_INFOS[i].id these are never written after startup,
+// so map_index() can read them while another thread parses the map
+static uint32_t *MAP_IDS;
+static atomic_bool *MAP_LOADED;
+static mtx_t MAP_LOAD_MTX;
 
 cmph_t *MOB_INFO_MPH;
 static size_t MOB_INFO_COUNT;
@@ -56,6 +96,12 @@ static struct MobInfo *MOB_INFOS;
 cmph_t *QUEST_INFO_MPH;
 static size_t QUEST_INFO_COUNT;
 static struct QuestInfo *QUEST_INFOS;
+// Parallel to QUEST_INFOS, compiled after every load as they point into it
+static struct QuestProgram *QUEST_PROGRAMS;
+// Sorted, QUEST_MONSTER_TARGETS[i] counts the kills of QUEST_MONSTER_IDS[i]
+static size_t QUEST_MONSTER_COUNT;
+static uint32_t *QUEST_MONSTER_IDS;
+static struct QuestMonsterTarget *QUEST_MONSTER_TARGETS;
 
 cmph_t *ITEM_INFO_MPH;
 static size_t ITEM_INFO_COUNT;
@@ -81,6 +127,101 @@ cmph_t *MOB_SKILL_INFO_MPH;
 static size_t MOB_SKILL_INFO_COUNT;
 static struct SkillInfo *MOB_SKILL_INFOS;
 
+// A snapshot of everything that wz_init() parses, written by `channel wz compile`.
+// Pointers inside the snapshot are stored as offsets from its start and are relocated after it is mapped.
+#define WZ_SNAPSHOT_PATH "wz/wz.snapshot"
+#define WZ_SNAPSHOT_MAGIC 0x544f4853504e535aull // "ZSNPSHOT"
+// Bump this whenever the meaning of a parsed field changes without changing the structs' layout
+#define WZ_SNAPSHOT_VERSION 3
+
+enum WzTable {
+    WZ_TABLE_SKILLS,
+    WZ_TABLE_MOB_SKILLS,
+    WZ_TABLE_REACTORS,
+    WZ_TABLE_EQUIPS,
+    WZ_TABLE_QUESTS,
+    WZ_TABLE_MOBS,
+    WZ_TABLE_MAPS,
+    WZ_TABLE_ITEMS,
+    WZ_TABLE_CONSUMABLES,
+    WZ_TABLE_COUNT
+};
+
+struct SnapshotTable {
+    uint64_t count;
+    uint64_t offset;
+    uint64_t mphOffset;
+    uint64_t mphSize;
+};
+
+struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t layout;
+    uint64_t fingerprint;
+    uint64_t size;
+    struct SnapshotTable tables[WZ_TABLE_COUNT];
+};
+
+// The XML files that the snapshot is compiled from
+static const char *WZ_SOURCES[] = {
+    "wz/Skill.wz",
+    "wz/Reactor.wz",
+    "wz/Character.wz",
+    "wz/Quest.wz",
+    "wz/Mob.wz",
+    "wz/Map.wz/Map",
+    "wz/Item.wz"
+};
+
+// Channel processes on the same host share a single copy of the snapshot in a POSIX shared memory segment.
+// It is mapped at the same address in every process so the pointers that its creator relocated are valid in all of them.
+// The address is far below where the kernel places shared libraries and mmap()s, but anything else that claims it
+// (e.g. AddressSanitizer's shadow memory) makes that process fall back to a private copy, which is logged
+#define WZ_SHARED_NAME "/syrup-wz"
+#define WZ_SHARED_BASE ((void *)0x100000000000)
+// How long to wait for another process to create the segment before assuming that it died
+#define WZ_SHARED_TIMEOUT_SEC 300
+
+// The mapped snapshot (private or shared), or NULL if the data was parsed from XML
+static void *SNAPSHOT;
+static size_t SNAPSHOT_SIZE;
+
+static int wz_parse_xml(bool lazy_maps);
+static int load_tables(void);
+static int compile_requirements(size_t count, const struct QuestRequirement *reqs, struct QuestRequirementProgram *program);
+static int compile_quests(void);
+static void free_quest_programs(void);
+static int load_snapshot(const char *path, uint64_t fingerprint);
+static int load_shared(uint64_t fingerprint);
+static bool snapshot_valid(const void *base, size_t size, uint64_t fingerprint);
+static int attach_snapshot(void *base, size_t size, bool relocate);
+static void *build_snapshot(uint64_t fingerprint, size_t *size);
+static int write_snapshot(const char *path, uint64_t fingerprint);
+static uint64_t wz_fingerprint(void);
+static int run_loaders(void);
+static int load_skills(void);
+static int load_mob_skills(void);
+static int load_reactors(void);
+static int load_equipment(void);
+static int load_quests(void);
+static int load_mobs(void);
+static int load_maps(void);
+static int load_items(void);
+static int load_consumables(void);
+static char **list_files(const char *path, const char *exclude, size_t *count);
+static void free_files(char **paths, size_t count);
+static char *read_file(const char *path, size_t *len);
+static int parse_files_parallel(char **paths, size_t count, void (*parse)(XML_Parser parser, size_t index, const char *data, size_t len));
+static void parse_map(XML_Parser parser, size_t index, const char *data, size_t len);
+static void parse_equip(XML_Parser parser, size_t index, const char *data, size_t len);
+static uint32_t map_id_from_path(const char *path);
+#define MAP_INDEX_NONE SIZE_MAX
+static size_t map_index(uint32_t id);
+static void build_portal_hash(struct MapInfo *map);
+static const struct PortalInfo *find_portal(const struct MapInfo *map, const char *name);
+static void link_portals(void);
+
 enum MapItemType {
     MAP_ITEM_TYPE_TOP_LEVEL,
     MAP_ITEM_TYPE_INFO,
@@ -108,6 +249,10 @@ struct MapParserContext {
     uint32_t skip;
     uint8_t footholdLevel;
     struct Foothold currentFoothold;
+    // Collected while parsing and bulk loaded into the map's tree at the end
+    size_t footholdCount;
+    size_t footholdCapacity;
+    struct Foothold *footholds;
 };
 
 enum MobItemType {
@@ -328,682 +473,1384 @@ static void on_mob_skill_end(void *user_data, const XML_Char *name);
 
 int wz_init(void)
 {
-    //int shm;
-    //sem_t *sem;
-    //while (true) {
-    //    if ((sem = sem_open("/syrup-wz", O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 0)) == SEM_FAILED) {
-    //        if (errno == EEXIST) {
-    //            if ((sem = sem_open("/syrup-wz", O_RDWR)) == SEM_FAILED) {
-    //                if (errno != ENONET) {
-    //                    return -1;
-    //                }
-    //            } else {
-    //                sem_wait(sem);
-    //                sem_post(sem);
-    //                shm = shm_open("/syrup-wz", O_RDONLY, 0);
-    //                break;
-    //            }
-    //        } else {
-    //            return -1;
-    //        }
-    //    } else {
-    //        shm = shm_open("/syrup-wz", O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-    //        WRITER = true;
-    //        break;
-    //    }
-    //}
-
-    WRITER = true;
-    if (WRITER) {
-        XML_Parser parser = XML_ParserCreate(NULL);
+    if (load_tables() == -1)
+        return -1;
 
-        {
-            struct SkillParserContext ctx = {
-                .head = NULL,
-                .skillCapacity = 1,
-            };
-            DIR *skill_dir = opendir("wz/Skill.wz");
+    if (compile_quests() == -1) {
+        wz_terminate();
+        return -1;
+    }
 
-            SKILL_INFOS = malloc(sizeof(struct SkillInfo));
+    return 0;
+}
 
-            struct dirent *entry;
-            while ((entry = readdir(skill_dir)) != NULL) {
-                if (entry->d_name[0] == '.' || !isdigit(entry->d_name[0]) || entry->d_type != DT_REG)
-                    continue;
+static int load_tables(void)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t fingerprint = wz_fingerprint();
+    if (load_shared(fingerprint) == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stderr, "Attached shared WZ data in %ld ms\n", (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+        return 0;
+    }
 
-                int fd = openat(dirfd(skill_dir), entry->d_name, O_RDONLY);
-                off_t len = lseek(fd, 0, SEEK_END);
-                lseek(fd, 0, SEEK_SET);
-                char *data = malloc(len);
-                read(fd, data, len);
-                close(fd);
+    fprintf(stderr, "Couldn't share WZ data with other channels, loading a private copy\n");
+    if (load_snapshot(WZ_SNAPSHOT_PATH, fingerprint) == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stderr, "Loaded WZ snapshot in %ld ms\n", (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+        return 0;
+    }
 
-                XML_SetElementHandler(parser, on_skill_start, on_skill_end);
-                XML_SetUserData(parser, &ctx);
-                XML_Parse(parser, data, len, true);
-                free(data);
-                XML_ParserReset(parser, NULL);
-            }
-            closedir(skill_dir);
-
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(SKILL_INFOS, sizeof(struct SkillInfo), offsetof(struct SkillInfo, id), sizeof(uint32_t), SKILL_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            SKILL_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < SKILL_INFO_COUNT) {
-                uint32_t j = cmph_search(SKILL_INFO_MPH, (void *)&SKILL_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct SkillInfo temp = SKILL_INFOS[j];
-                    SKILL_INFOS[j] = SKILL_INFOS[i];
-                    SKILL_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+    fprintf(stderr, "WZ snapshot is missing or stale, parsing XML (run `channel wz compile` to speed up the next start)\n");
+    // Nothing else needs the maps that this channel never visits
+    return wz_parse_xml(true);
+}
 
-            fprintf(stderr, "Loaded skills\n");
-        }
+int wz_compile(void)
+{
+    // Taken before parsing so that files changed in the meantime make the snapshot stale
+    uint64_t fingerprint = wz_fingerprint();
+    if (wz_parse_xml(false) != 0)
+        return -1;
 
-        {
-            struct SkillParserContext ctx = {
-                .head = NULL,
-                .skillCapacity = 1,
-            };
+    int ret = write_snapshot(WZ_SNAPSHOT_PATH, fingerprint);
+    if (ret == 0)
+        fprintf(stderr, "Wrote %s\n", WZ_SNAPSHOT_PATH);
 
-            MOB_SKILL_INFOS = malloc(sizeof(struct SkillInfo));
+    wz_terminate();
+    return ret;
+}
 
-            int fd = open("wz/Skill.wz/MobSkill.img.xml", O_RDONLY);
-            off_t len = lseek(fd, 0, SEEK_END);
-            lseek(fd, 0, SEEK_SET);
-            char *data = malloc(len);
-            read(fd, data, len);
-            close(fd);
+int wz_benchmark_footholds(void)
+{
+    if (wz_init() != 0)
+        return -1;
+
+    // Query points spread uniformly over each map's footholds, generated beforehand so only the lookups are timed
+    struct Point *points = malloc(FOOTHOLD_BENCHMARK_QUERIES * sizeof(struct Point));
+    if (points == NULL) {
+        wz_terminate();
+        return -1;
+    }
 
-            XML_SetElementHandler(parser, on_mob_skill_start, on_mob_skill_end);
-            XML_SetUserData(parser, &ctx);
-            XML_Parse(parser, data, len, true);
-            free(data);
-            XML_ParserReset(parser, NULL);
+    uint32_t seed = 1;
+    size_t maps = 0;
+    size_t footholds = 0;
+    size_t tree_hits = 0;
+    size_t scan_hits = 0;
+    size_t mismatches = 0;
+    uint64_t tree_ns = 0;
+    uint64_t scan_ns = 0;
+    for (size_t i = 0; i < MAP_INFO_COUNT; i++) {
+        size_t index = map_index(MAP_LOADED != NULL ? MAP_IDS[i] : MAP_INFOS[i].id);
+        if (index == MAP_INDEX_NONE)
+            continue;
+
+        const struct FootholdRTree *tree = MAP_INFOS[index].footholdTree;
+        if (tree->nodeCount == 0)
+            continue;
+
+        struct FootholdTreeEntry bounds = node_bounds(&tree->nodes[0]);
+        int32_t width = bounds.maxX - bounds.minX + 1;
+        int32_t height = bounds.maxY - bounds.minY + 1;
+        for (size_t j = 0; j < FOOTHOLD_BENCHMARK_QUERIES; j++) {
+            seed = seed * 1103515245 + 12345;
+            points[j].x = bounds.minX + (int32_t)((seed >> 8) % width);
+            seed = seed * 1103515245 + 12345;
+            points[j].y = bounds.minY + (int32_t)((seed >> 8) % height);
+        }
 
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(MOB_SKILL_INFOS, sizeof(struct SkillInfo), offsetof(struct SkillInfo, id), sizeof(uint32_t), MOB_SKILL_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            MOB_SKILL_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < MOB_SKILL_INFO_COUNT) {
-                uint32_t j = cmph_search(MOB_SKILL_INFO_MPH, (void *)&MOB_SKILL_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct SkillInfo temp = MOB_SKILL_INFOS[j];
-                    MOB_SKILL_INFOS[j] = MOB_SKILL_INFOS[i];
-                    MOB_SKILL_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t j = 0; j < FOOTHOLD_BENCHMARK_QUERIES; j++) {
+            if (foothold_tree_find_below(tree, &points[j]) != NULL)
+                tree_hits++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        tree_ns += (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
 
-            fprintf(stderr, "Loaded mob skills\n");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t j = 0; j < FOOTHOLD_BENCHMARK_QUERIES; j++) {
+            if (footholds_scan_below(tree, &points[j]) != NULL)
+                scan_hits++;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        scan_ns += (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
+
+        // Outside of the timed loops; ties between footholds at the same distance may be broken differently
+        for (size_t j = 0; j < FOOTHOLD_BENCHMARK_QUERIES; j++) {
+            const struct Foothold *expected = footholds_scan_below(tree, &points[j]);
+            const struct Foothold *actual = foothold_tree_find_below(tree, &points[j]);
+            if ((expected == NULL) != (actual == NULL) ||
+                    (expected != NULL && get_distance_below(expected, &points[j]) != get_distance_below(actual, &points[j])))
+                mismatches++;
         }
 
-        {
-            struct ReactorParserContext ctx = {
-                .parser = parser,
-                .head = NULL,
-            };
-            DIR *reactor_dir = opendir("wz/Reactor.wz");
-            struct dirent *entry;
-            size_t count = 0;
-            while ((entry = readdir(reactor_dir)) != NULL) {
-                if (entry->d_name[0] != '.' && entry->d_type == DT_REG)
-                    count++;
-            }
+        footholds += tree->footholdCount;
+        maps++;
+    }
 
-            REACTOR_INFOS = malloc(count * sizeof(struct ReactorInfo));
-            rewinddir(reactor_dir);
+    size_t queries = maps * FOOTHOLD_BENCHMARK_QUERIES;
+    printf("%zu queries on %zu maps (%zu footholds)\n", queries, maps, footholds);
+    printf("R-tree: %" PRIu64 " ns/query\n", queries > 0 ? tree_ns / queries : 0);
+    printf("Linear scan: %" PRIu64 " ns/query\n", queries > 0 ? scan_ns / queries : 0);
+    printf("Found a foothold: %zu with the R-tree, %zu with the linear scan; %zu results disagreed\n", tree_hits, scan_hits, mismatches);
 
-            // First pass - unlinked reactors
-            while ((entry = readdir(reactor_dir)) != NULL) {
-                if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
-                    continue;
-                int fd = openat(dirfd(reactor_dir), entry->d_name, O_RDONLY);
-                off_t len = lseek(fd, 0, SEEK_END);
-                lseek(fd, 0, SEEK_SET);
-                char *data = malloc(len);
-                read(fd, data, len);
-                close(fd);
+    free(points);
+    wz_terminate();
+    return 0;
+}
 
-                XML_SetElementHandler(parser, on_reactor_start, on_reactor_end);
-                XML_SetUserData(parser, &ctx);
-                XML_Parse(parser, data, len, true);
-                free(data);
-                XML_ParserReset(parser, NULL);
-            }
-            //closedir(reactor_dir);
-
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(REACTOR_INFOS, sizeof(struct ReactorInfo), offsetof(struct ReactorInfo, id), sizeof(uint32_t), REACTOR_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            REACTOR_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < REACTOR_INFO_COUNT) {
-                uint32_t j = cmph_search(REACTOR_INFO_MPH, (void *)&REACTOR_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct ReactorInfo temp = REACTOR_INFOS[j];
-                    REACTOR_INFOS[j] = REACTOR_INFOS[i];
-                    REACTOR_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+int wz_self_test(void)
+{
+    int ret = 0;
 
-            rewinddir(reactor_dir);
+    // Repeated required items keep the largest count instead of adding up
+    {
+        const struct QuestRequirement reqs[] = {
+            { .type = QUEST_REQUIREMENT_TYPE_ITEM, .item = { 4000001, 5 } },
+            { .type = QUEST_REQUIREMENT_TYPE_ITEM, .item = { 4000000, 1 } },
+            { .type = QUEST_REQUIREMENT_TYPE_ITEM, .item = { 4000001, 3 } },
+        };
 
-            // Second pass - linked reactors
-            while ((entry = readdir(reactor_dir)) != NULL) {
-                if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
-                    continue;
-                int fd = openat(dirfd(reactor_dir), entry->d_name, O_RDONLY);
-                off_t len = lseek(fd, 0, SEEK_END);
-                lseek(fd, 0, SEEK_SET);
-                char *data = malloc(len);
-                read(fd, data, len);
-                close(fd);
+        struct QuestRequirementProgram program;
+        if (compile_requirements(sizeof(reqs) / sizeof(reqs[0]), reqs, &program) == -1)
+            return -1;
 
-                XML_SetElementHandler(parser, on_reactor_second_pass_start, on_reactor_second_pass_end);
-                XML_SetUserData(parser, &ctx);
-                XML_Parse(parser, data, len, true);
-                free(data);
-                if (REACTOR_INFO_COUNT == count) {
-                    XML_ParserReset(parser, NULL);
-                    break;
-                }
-                XML_ParserReset(parser, NULL);
-            }
-            closedir(reactor_dir);
-            cmph_destroy(REACTOR_INFO_MPH);
-
-            adapter = cmph_io_struct_vector_adapter(REACTOR_INFOS, sizeof(struct ReactorInfo), offsetof(struct ReactorInfo, id), sizeof(uint32_t), REACTOR_INFO_COUNT);
-            config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            REACTOR_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            i = 0;
-            while (i < REACTOR_INFO_COUNT) {
-                uint32_t j = cmph_search(REACTOR_INFO_MPH, (void *)&REACTOR_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct ReactorInfo temp = REACTOR_INFOS[j];
-                    REACTOR_INFOS[j] = REACTOR_INFOS[i];
-                    REACTOR_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+        bool passed = program.itemCount == 2 && program.absentItemCount == 0 &&
+            program.items[0].id == 4000000 && program.items[0].count == 1 &&
+            program.items[1].id == 4000001 && program.items[1].count == 5;
+        printf("Repeated required items: %s\n", passed ? "passed" : "FAILED");
+        if (!passed)
+            ret = -1;
 
-            fprintf(stderr, "Loaded reactors\n");
-        }
-
-        {
-            struct EquipParserContext ctx = {
-                .parser = parser,
-                .head = NULL,
-                .currentEquip = 0,
-            };
-            DIR *equip_dir = opendir("wz/Character.wz");
-            struct dirent *entry;
-            while ((entry = readdir(equip_dir)) != NULL) {
-                if (entry->d_type == DT_DIR && entry->d_name[0] != '.' && strcmp(entry->d_name, "Afterimage")) {
-                    int fd = openat(dirfd(equip_dir), entry->d_name, O_RDONLY | O_DIRECTORY);
-                    DIR *dir = fdopendir(fd);
-                    while ((entry = readdir(dir)) != NULL) {
-                        if (entry->d_name[0] != '.')
-                            EQUIP_INFO_COUNT++;
-                    }
-                    closedir(dir);
-                }
-            }
+        free(program.others);
+        free(program.items);
+        free(program.quests);
+    }
 
-            EQUIP_INFOS = malloc(EQUIP_INFO_COUNT * sizeof(struct EquipInfo));
-            rewinddir(equip_dir);
-
-            while ((entry = readdir(equip_dir)) != NULL) {
-                if (entry->d_type == DT_DIR && entry->d_name[0] != '.' && strcmp(entry->d_name, "Afterimage")) {
-                    int fd = openat(dirfd(equip_dir), entry->d_name, O_RDONLY | O_DIRECTORY);
-                    DIR *dir = fdopendir(fd);
-                    while ((entry = readdir(dir)) != NULL) {
-                        if (entry->d_name[0] == '.')
-                            continue;
-                        fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
-                        off_t len = lseek(fd, 0, SEEK_END);
-                        lseek(fd, 0, SEEK_SET);
-                        char *data = malloc(len);
-                        read(fd, data, len);
-                        close(fd);
-
-                        XML_SetElementHandler(parser, on_equip_start, on_equip_end);
-                        XML_SetUserData(parser, &ctx);
-                        XML_Parse(parser, data, len, true);
-                        free(data);
-                        XML_ParserReset(parser, NULL);
-                        ctx.currentEquip++;
-                    }
-                    closedir(dir);
-                }
-            }
-            closedir(equip_dir);
-
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(EQUIP_INFOS, sizeof(struct EquipInfo), offsetof(struct EquipInfo, id), sizeof(uint32_t), EQUIP_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            EQUIP_INFO_MPH = cmph_new(config);
-            assert(EQUIP_INFO_MPH != NULL);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < EQUIP_INFO_COUNT) {
-                uint32_t j = cmph_search(EQUIP_INFO_MPH, (void *)&EQUIP_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct EquipInfo temp = EQUIP_INFOS[j];
-                    EQUIP_INFOS[j] = EQUIP_INFOS[i];
-                    EQUIP_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+    // An item that mustn't be held isn't folded into a required count of the same item
+    {
+        const struct QuestRequirement reqs[] = {
+            { .type = QUEST_REQUIREMENT_TYPE_ITEM, .item = { 4031000, 0 } },
+            { .type = QUEST_REQUIREMENT_TYPE_ITEM, .item = { 4031000, 2 } },
+            { .type = QUEST_REQUIREMENT_TYPE_ITEM, .item = { 4031001, 0 } },
+            { .type = QUEST_REQUIREMENT_TYPE_ITEM, .item = { 4031001, 0 } },
+        };
 
-            fprintf(stderr, "Loaded equipment\n");
-        }
+        struct QuestRequirementProgram program;
+        if (compile_requirements(sizeof(reqs) / sizeof(reqs[0]), reqs, &program) == -1)
+            return -1;
+
+        bool passed = program.itemCount == 1 && program.absentItemCount == 2 &&
+            program.items[0].id == 4031000 && program.items[0].count == 2 &&
+            program.items[1].id == 4031000 && program.items[1].count == 0 &&
+            program.items[2].id == 4031001 && program.items[2].count == 0;
+        printf("Items that mustn't be held: %s\n", passed ? "passed" : "FAILED");
+        if (!passed)
+            ret = -1;
+
+        free(program.others);
+        free(program.items);
+        free(program.quests);
+    }
 
-        {
-            struct QuestCheckParserContext ctx = {
-                .questCapacity = 1,
-            };
+    return ret;
+}
 
-            QUEST_INFOS = malloc(sizeof(struct QuestInfo));
+static int wz_parse_xml(bool lazy_maps)
+{
+    LAZY_MAPS = lazy_maps;
+    return run_loaders();
+}
 
-            XML_SetElementHandler(parser, on_quest_check_start, on_quest_check_end);
-            XML_SetUserData(parser, &ctx);
-            int fd = open("wz/Quest.wz/Check.img.xml", O_RDONLY);
-            off_t len = lseek(fd, 0, SEEK_END);
-            lseek(fd, 0, SEEK_SET);
-            char *data = malloc(len);
-            read(fd, data, len);
-            close(fd);
-            XML_Parse(parser, data, len, true);
-            free(data);
-            XML_ParserReset(parser, NULL);
+struct WzTask {
+    int (*run)(void *ctx);
+    void *ctx;
+    // The caller's count of unfinished tasks, decremented once this one returns
+    size_t *pending;
+};
 
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(QUEST_INFOS, sizeof(struct QuestInfo), offsetof(struct QuestInfo, id), sizeof(uint16_t), QUEST_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            QUEST_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < QUEST_INFO_COUNT) {
-                uint32_t j = cmph_search(QUEST_INFO_MPH, (void *)&QUEST_INFOS[i].id, sizeof(uint16_t));
-                if (i != j) {
-                    struct QuestInfo temp = QUEST_INFOS[j];
-                    QUEST_INFOS[j] = QUEST_INFOS[i];
-                    QUEST_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
-        }
+// The threads that parse the XML files, shared by the table loaders and the per-file jobs that they start.
+// A thread that waits for its tasks runs queued ones in the meantime, so a loader waiting for its files never idles a core
+struct WzPool {
+    mtx_t mtx;
+    cnd_t cnd;
+    size_t head;
+    size_t taskCount;
+    size_t taskCapacity;
+    struct WzTask *tasks;
+    bool stop;
+    size_t threadCount;
+    thrd_t *threads;
+};
 
-        {
-            struct QuestActParserContext ctx = {
-                .questCapacity = QUEST_INFO_COUNT,
-            };
+// Only set while run_loaders() is running
+static struct WzPool *POOL;
 
-            XML_SetElementHandler(parser, on_quest_act_start, on_quest_act_end);
-            XML_SetUserData(parser, &ctx);
-            int fd = open("wz/Quest.wz/Act.img.xml", O_RDONLY);
-            off_t len = lseek(fd, 0, SEEK_END);
-            lseek(fd, 0, SEEK_SET);
-            char *data = malloc(len);
-            read(fd, data, len);
-            close(fd);
-            XML_Parse(parser, data, len, true);
-            free(data);
-            XML_ParserReset(parser, NULL);
+// Must be called with the pool's mutex held, which is released while the task runs
+static bool pool_run_one(struct WzPool *pool)
+{
+    if (pool->head == pool->taskCount)
+        return false;
 
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(QUEST_INFOS, sizeof(struct QuestInfo), offsetof(struct QuestInfo, id), sizeof(uint16_t), QUEST_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            cmph_destroy(QUEST_INFO_MPH);
-            QUEST_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < QUEST_INFO_COUNT) {
-                uint32_t j = cmph_search(QUEST_INFO_MPH, (void *)&QUEST_INFOS[i].id, sizeof(uint16_t));
-                if (i != j) {
-                    struct QuestInfo temp = QUEST_INFOS[j];
-                    QUEST_INFOS[j] = QUEST_INFOS[i];
-                    QUEST_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+    struct WzTask task = pool->tasks[pool->head++];
+    if (pool->head == pool->taskCount) {
+        pool->head = 0;
+        pool->taskCount = 0;
+    }
+
+    mtx_unlock(&pool->mtx);
+    task.run(task.ctx);
+    mtx_lock(&pool->mtx);
+    (*task.pending)--;
+    cnd_broadcast(&pool->cnd);
+    return true;
+}
+
+static int pool_thread(void *ctx)
+{
+    struct WzPool *pool = ctx;
+    mtx_lock(&pool->mtx);
+    while (!pool->stop) {
+        if (!pool_run_one(pool))
+            cnd_wait(&pool->cnd, &pool->mtx);
+    }
+    mtx_unlock(&pool->mtx);
+    return 0;
+}
+
+static int pool_start(struct WzPool *pool, size_t thread_count)
+{
+    pool->head = 0;
+    pool->taskCount = 0;
+    pool->taskCapacity = 0;
+    pool->tasks = NULL;
+    pool->stop = false;
+    pool->threadCount = 0;
+    pool->threads = malloc((thread_count != 0 ? thread_count : 1) * sizeof(thrd_t));
+    if (pool->threads == NULL)
+        return -1;
+
+    if (mtx_init(&pool->mtx, mtx_plain) != thrd_success) {
+        free(pool->threads);
+        return -1;
+    }
+
+    if (cnd_init(&pool->cnd) != thrd_success) {
+        mtx_destroy(&pool->mtx);
+        free(pool->threads);
+        return -1;
+    }
+
+    // Fewer threads only make the waiting callers do more of the work
+    while (pool->threadCount < thread_count && thrd_create(&pool->threads[pool->threadCount], pool_thread, pool) == thrd_success)
+        pool->threadCount++;
+
+    return 0;
+}
+
+static void pool_stop(struct WzPool *pool)
+{
+    mtx_lock(&pool->mtx);
+    pool->stop = true;
+    cnd_broadcast(&pool->cnd);
+    mtx_unlock(&pool->mtx);
+
+    for (size_t i = 0; i < pool->threadCount; i++)
+        thrd_join(pool->threads[i], NULL);
+
+    cnd_destroy(&pool->cnd);
+    mtx_destroy(&pool->mtx);
+    free(pool->tasks);
+    free(pool->threads);
+}
 
-            fprintf(stderr, "Loaded quests\n");
+// Returns -1 if the task couldn't be queued, in which case the caller should run it itself
+static int pool_submit(struct WzPool *pool, int (*run)(void *ctx), void *ctx, size_t *pending)
+{
+    mtx_lock(&pool->mtx);
+    if (pool->taskCount == pool->taskCapacity) {
+        size_t capacity = pool->taskCapacity != 0 ? pool->taskCapacity * 2 : 16;
+        void *temp = realloc(pool->tasks, capacity * sizeof(struct WzTask));
+        if (temp == NULL) {
+            mtx_unlock(&pool->mtx);
+            return -1;
         }
 
-        {
-            struct MobParserContext ctx = {
-                .parser = parser,
-                .head = NULL,
-            };
-            DIR *mobs_dir = opendir("wz/Mob.wz");
-            struct dirent *entry;
-            size_t count = 0;
-            while ((entry = readdir(mobs_dir)) != NULL) {
-                if (entry->d_name[0] != '.' && entry->d_type == DT_REG)
-                    count++;
-            }
+        pool->tasks = temp;
+        pool->taskCapacity = capacity;
+    }
 
-            MOB_INFOS = malloc(count * sizeof(struct MobInfo));
-            rewinddir(mobs_dir);
+    pool->tasks[pool->taskCount++] = (struct WzTask) { run, ctx, pending };
+    (*pending)++;
+    // Waiters share the condition with the idle threads, so waking just one could wake a caller that is done
+    cnd_broadcast(&pool->cnd);
+    mtx_unlock(&pool->mtx);
+    return 0;
+}
 
-            while ((entry = readdir(mobs_dir)) != NULL) {
-                if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
-                    continue;
-                int fd = openat(dirfd(mobs_dir), entry->d_name, O_RDONLY);
-                off_t len = lseek(fd, 0, SEEK_END);
-                lseek(fd, 0, SEEK_SET);
-                char *data = malloc(len);
-                read(fd, data, len);
-                close(fd);
+static void pool_wait(struct WzPool *pool, size_t *pending)
+{
+    mtx_lock(&pool->mtx);
+    while (*pending > 0) {
+        if (!pool_run_one(pool))
+            cnd_wait(&pool->cnd, &pool->mtx);
+    }
+    mtx_unlock(&pool->mtx);
+}
 
-                //ctx.currentSkill = 1;
-                //MOB_INFOS[ctx.currentMob].lifeCount = 0;
-                //MOB_INFOS[ctx.currentMob].lives = malloc(sizeof(struct LifeInfo));
+struct WzLoader {
+    const char *name;
+    int (*load)(void);
+    int ret;
+};
 
-                XML_SetElementHandler(parser, on_mob_start, on_mob_end);
-                XML_SetUserData(parser, &ctx);
-                XML_Parse(parser, data, len, true);
-                free(data);
-                XML_ParserReset(parser, NULL);
-                MOB_INFO_COUNT++;
-            }
-            closedir(mobs_dir);
-
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(MOB_INFOS, sizeof(struct MobInfo), offsetof(struct MobInfo, id), sizeof(uint32_t), MOB_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            MOB_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < MOB_INFO_COUNT) {
-                uint32_t j = cmph_search(MOB_INFO_MPH, (void *)&MOB_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct MobInfo temp = MOB_INFOS[j];
-                    MOB_INFOS[j] = MOB_INFOS[i];
-                    MOB_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+static int loader_thread(void *ctx)
+{
+    struct WzLoader *loader = ctx;
+    loader->ret = loader->load();
+    return 0;
+}
 
-            fprintf(stderr, "Loaded mobs\n");
-        }
-
-        {
-            struct MapParserContext ctx = {
-                .head = NULL,
-            };
-            DIR *maps_dir = opendir("wz/Map.wz/Map");
-            struct dirent *entry;
-            while ((entry = readdir(maps_dir)) != NULL) {
-                if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
-                    int fd = openat(dirfd(maps_dir), entry->d_name, O_RDONLY | O_DIRECTORY);
-                    DIR *dir = fdopendir(fd);
-                    while ((entry = readdir(dir)) != NULL) {
-                        if (entry->d_name[0] != '.')
-                            MAP_INFO_COUNT++;
-                    }
-                    closedir(dir);
-                }
-            }
+// Each table only depends on itself so all of them are parsed concurrently
+static int run_loaders(void)
+{
+    struct WzLoader loaders[] = {
+        { "skills", load_skills },
+        { "mob skills", load_mob_skills },
+        { "reactors", load_reactors },
+        { "equipment", load_equipment },
+        { "quests", load_quests },
+        { "mobs", load_mobs },
+        { "maps", load_maps },
+        { "items", load_items },
+        { "consumables", load_consumables },
+    };
+    size_t count = sizeof(loaders) / sizeof(loaders[0]);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // This thread makes up the last core as it runs tasks while waiting for them
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    struct WzPool pool;
+    if (pool_start(&pool, nproc > 1 ? nproc - 1 : 0) == 0)
+        POOL = &pool;
+
+    size_t pending = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Fall back to loading it on this thread
+        if (POOL == NULL || pool_submit(POOL, loader_thread, &loaders[i], &pending) == -1)
+            loader_thread(&loaders[i]);
+    }
 
-            MAP_INFOS = malloc(MAP_INFO_COUNT * sizeof(struct MapInfo));
-            for (size_t i = 0; i < MAP_INFO_COUNT; i++) {
-                MAP_INFOS[i].footholdTree = malloc(sizeof(struct FootholdRTree));
-                MAP_INFOS[i].footholdTree->root = NULL;
-            }
-            rewinddir(maps_dir);
-
-            while ((entry = readdir(maps_dir)) != NULL) {
-                if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
-                    int fd = openat(dirfd(maps_dir), entry->d_name, O_RDONLY | O_DIRECTORY);
-                    DIR *dir = fdopendir(fd);
-                    while ((entry = readdir(dir)) != NULL) {
-                        if (entry->d_name[0] == '.')
-                            continue;
-                        fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
-                        off_t len = lseek(fd, 0, SEEK_END);
-                        lseek(fd, 0, SEEK_SET);
-                        char *data = malloc(len);
-                        read(fd, data, len);
-                        close(fd);
-
-                        MAP_INFOS[ctx.currentMap].forcedReturn = -1;
-                        MAP_INFOS[ctx.currentMap].seats = 0;
-                        MAP_INFOS[ctx.currentMap].onUserEnter[0] = '\0';
-                        MAP_INFOS[ctx.currentMap].onFirstUserEnter[0] = '\0';
-
-                        ctx.currentLife = 1;
-                        MAP_INFOS[ctx.currentMap].lifeCount = 0;
-                        MAP_INFOS[ctx.currentMap].lives = malloc(sizeof(struct LifeInfo));
-
-                        ctx.currentPortal = 1;
-                        MAP_INFOS[ctx.currentMap].portalCount = 0;
-                        MAP_INFOS[ctx.currentMap].portals = malloc(sizeof(struct PortalInfo));
-
-                        ctx.reactorCapacity = 1;
-                        MAP_INFOS[ctx.currentMap].reactorCount = 0;
-                        MAP_INFOS[ctx.currentMap].reactors = malloc(sizeof(struct MapReactorInfo));
-
-                        XML_SetElementHandler(parser, on_map_start, on_map_end);
-                        XML_SetUserData(parser, &ctx);
-                        XML_Parse(parser, data, len, true);
-                        free(data);
-                        XML_ParserReset(parser, NULL);
-                        ctx.currentMap++;
-                    }
-                    closedir(dir);
-                }
-            }
-            closedir(maps_dir);
-
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(MAP_INFOS, sizeof(struct MapInfo), offsetof(struct MapInfo, id), sizeof(uint32_t), MAP_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            MAP_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < MAP_INFO_COUNT) {
-                uint32_t j = cmph_search(MAP_INFO_MPH, (void *)&MAP_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct MapInfo temp = MAP_INFOS[j];
-                    MAP_INFOS[j] = MAP_INFOS[i];
-                    MAP_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+    if (POOL != NULL) {
+        pool_wait(POOL, &pending);
+        POOL = NULL;
+        pool_stop(&pool);
+    }
 
-            fprintf(stderr, "Loaded maps\n");
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (loaders[i].ret == -1) {
+            fprintf(stderr, "Failed to load %s\n", loaders[i].name);
+            ret = -1;
         }
+    }
 
-        {
-            struct ItemParserContext ctx = {
-                .parser = parser,
-                .head = NULL,
-                .itemCapacity = 1,
-            };
-            DIR *item_dir = opendir("wz/Item.wz");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "Parsed WZ XML in %ld ms\n", (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
 
-            ITEM_INFOS = malloc(sizeof(struct ItemInfo));
+    return ret;
+}
 
-            struct dirent *entry;
-            while ((entry = readdir(item_dir)) != NULL) {
-                // Skip Pet and Special for now
-                if (!strcmp(entry->d_name, "Pet"))
-                    continue;
-                if (!strcmp(entry->d_name, "Special"))
-                    continue;
-                if (entry->d_name[0] != '.' && entry->d_type == DT_DIR) {
-                    DIR *dir = fdopendir(openat(dirfd(item_dir), entry->d_name, O_RDONLY));
-                    while ((entry = readdir(dir)) != NULL) {
-                        if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
-                            continue;
-                        int fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
-                        off_t len = lseek(fd, 0, SEEK_END);
-                        lseek(fd, 0, SEEK_SET);
-                        char *data = malloc(len);
-                        read(fd, data, len);
-                        close(fd);
-
-                        XML_SetElementHandler(parser, on_item_start, on_item_end);
-                        XML_SetUserData(parser, &ctx);
-                        XML_Parse(parser, data, len, true);
-                        free(data);
-                        XML_ParserReset(parser, NULL);
-                    }
-                    closedir(dir);
-                }
-            }
-            closedir(item_dir);
-
-            ctx.head2 = NULL;
-            ctx.skip = 0;
-
-            DIR *equip_dir = opendir("wz/Character.wz");
-
-            while ((entry = readdir(equip_dir)) != NULL) {
-                if (entry->d_type == DT_DIR && entry->d_name[0] != '.' && strcmp(entry->d_name, "Afterimage")) {
-                    int fd = openat(dirfd(equip_dir), entry->d_name, O_RDONLY | O_DIRECTORY);
-                    DIR *dir = fdopendir(fd);
-                    while ((entry = readdir(dir)) != NULL) {
-                        if (entry->d_name[0] == '.')
-                            continue;
-                        fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
-                        off_t len = lseek(fd, 0, SEEK_END);
-                        lseek(fd, 0, SEEK_SET);
-                        char *data = malloc(len);
-                        read(fd, data, len);
-                        close(fd);
-
-                        XML_SetElementHandler(parser, on_equip_item_start, on_equip_item_end);
-                        XML_SetUserData(parser, &ctx);
-                        XML_Parse(parser, data, len, true);
-                        free(data);
-                        XML_ParserReset(parser, NULL);
-                    }
-                    closedir(dir);
-                }
-            }
-            closedir(equip_dir);
-
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(ITEM_INFOS, sizeof(struct ItemInfo), offsetof(struct ItemInfo, id), sizeof(uint32_t), ITEM_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            ITEM_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < ITEM_INFO_COUNT) {
-                uint32_t j = cmph_search(ITEM_INFO_MPH, (void *)&ITEM_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct ItemInfo temp = ITEM_INFOS[j];
-                    ITEM_INFOS[j] = ITEM_INFOS[i];
-                    ITEM_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
-            }
+// Lists the files in the subdirectories of path, skipping the subdirectory named exclude
+static char **list_files(const char *path, const char *exclude, size_t *count)
+{
+    DIR *root = opendir(path);
+    if (root == NULL)
+        return NULL;
 
-            fprintf(stderr, "Loaded items\n");
-        }
+    size_t capacity = 1;
+    char **paths = malloc(sizeof(char *));
+    if (paths == NULL) {
+        closedir(root);
+        return NULL;
+    }
 
-        {
-            struct ConsumableParserContext ctx = {
-                .head = NULL,
-                .itemCapacity = 1,
-            };
-            DIR *dir = opendir("wz/Item.wz/Consume");
+    *count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(root)) != NULL) {
+        if (entry->d_type != DT_DIR || entry->d_name[0] == '.' || (exclude != NULL && !strcmp(entry->d_name, exclude)))
+            continue;
 
-            CONSUMABLE_INFOS = malloc(sizeof(struct ConsumableInfo));
+        char sub[256];
+        snprintf(sub, sizeof(sub), "%s/%s", path, entry->d_name);
+        DIR *dir = opendir(sub);
+        if (dir == NULL)
+            continue;
 
-            struct dirent *entry;
-            while ((entry = readdir(dir)) != NULL) {
-                if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
-                    continue;
-                int fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
-                off_t len = lseek(fd, 0, SEEK_END);
-                lseek(fd, 0, SEEK_SET);
-                char *data = malloc(len);
-                read(fd, data, len);
-                close(fd);
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.')
+                continue;
 
-                XML_SetElementHandler(parser, on_consumable_start, on_consumable_end);
-                XML_SetUserData(parser, &ctx);
-                XML_Parse(parser, data, len, true);
-                free(data);
-                XML_ParserReset(parser, NULL);
+            if (*count == capacity) {
+                void *temp = realloc(paths, (capacity * 2) * sizeof(char *));
+                if (temp == NULL) {
+                    closedir(dir);
+                    closedir(root);
+                    free_files(paths, *count);
+                    return NULL;
+                }
+
+                paths = temp;
+                capacity *= 2;
             }
-            closedir(dir);
 
-            cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(CONSUMABLE_INFOS, sizeof(struct ConsumableInfo), offsetof(struct ConsumableInfo, id), sizeof(uint32_t), CONSUMABLE_INFO_COUNT);
-            cmph_config_t *config = cmph_config_new(adapter);
-            cmph_config_set_algo(config, CMPH_BDZ);
-            CONSUMABLE_INFO_MPH = cmph_new(config);
-            cmph_config_destroy(config);
-            cmph_io_struct_vector_adapter_destroy(adapter);
-            size_t i = 0;
-            while (i < CONSUMABLE_INFO_COUNT) {
-                uint32_t j = cmph_search(CONSUMABLE_INFO_MPH, (void *)&CONSUMABLE_INFOS[i].id, sizeof(uint32_t));
-                if (i != j) {
-                    struct ConsumableInfo temp = CONSUMABLE_INFOS[j];
-                    CONSUMABLE_INFOS[j] = CONSUMABLE_INFOS[i];
-                    CONSUMABLE_INFOS[i] = temp;
-                } else {
-                    i++;
-                }
+            size_t len = strlen(sub) + 1 + strlen(entry->d_name) + 1;
+            paths[*count] = malloc(len);
+            if (paths[*count] == NULL) {
+                closedir(dir);
+                closedir(root);
+                free_files(paths, *count);
+                return NULL;
             }
 
-            fprintf(stderr, "Loaded consumables\n");
+            snprintf(paths[*count], len, "%s/%s", sub, entry->d_name);
+            (*count)++;
         }
-
-        XML_ParserFree(parser);
-        //sem_post(sem);
+        closedir(dir);
     }
+    closedir(root);
 
-    //sem_close(sem);
+    return paths;
+}
 
-    return 0;
+static void free_files(char **paths, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
 }
 
-int wz_init_equipment(void)
+// Reads all of a file, which must not be empty as an empty document isn't valid XML
+static char *read_file(const char *path, size_t *len)
 {
-    XML_Parser parser = XML_ParserCreate(NULL);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
 
-    {
-        struct EquipParserContext ctx = {
-            .parser = parser,
-            .head = NULL,
-        };
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        fprintf(stderr, "Couldn't seek in %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    if (size == 0) {
+        fprintf(stderr, "%s is empty\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    char *data = malloc(size);
+    if (data == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t done = 0;
+    while (done < (size_t)size) {
+        ssize_t ret = read(fd, data + done, size - done);
+        if (ret == -1 && errno == EINTR)
+            continue;
+
+        if (ret <= 0) {
+            if (ret == -1)
+                fprintf(stderr, "Couldn't read %s: %s\n", path, strerror(errno));
+            else
+                fprintf(stderr, "%s was truncated while it was read\n", path);
+            free(data);
+            close(fd);
+            return NULL;
+        }
+
+        done += ret;
+    }
+
+    close(fd);
+    *len = size;
+    return data;
+}
+
+struct ParallelParse {
+    char **paths;
+    size_t count;
+    atomic_size_t next;
+    void (*parse)(XML_Parser parser, size_t index, const char *data, size_t len);
+    atomic_bool failed;
+};
+
+// Workers claim the next unparsed file until there are none left,
+// so a few large files don't leave the other workers idle
+static int parse_worker(void *ctx)
+{
+    struct ParallelParse *job = ctx;
+    XML_Parser parser = XML_ParserCreate(NULL);
+    if (parser == NULL) {
+        job->failed = true;
+        return 0;
+    }
+
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        size_t len;
+        char *data = read_file(job->paths[i], &len);
+        if (data == NULL) {
+            job->failed = true;
+            continue;
+        }
+
+        job->parse(parser, i, data, len);
+        free(data);
+        XML_ParserReset(parser, NULL);
+    }
+
+    XML_ParserFree(parser);
+    return 0;
+}
+
+// Calls parse for each file from the loaders' pool, each worker with its own parser.
+// parse gets the file's index in paths which it can use as its slot in the preallocated table
+static int parse_files_parallel(char **paths, size_t count, void (*parse)(XML_Parser parser, size_t index, const char *data, size_t len))
+{
+    struct ParallelParse job = {
+        .paths = paths,
+        .count = count,
+        .parse = parse,
+    };
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, false);
+
+    // One worker per pool thread at most, any that start after the files ran out return right away
+    size_t pending = 0;
+    size_t worker_count = POOL != NULL ? MIN(POOL->threadCount, count) : 0;
+    for (size_t i = 0; i < worker_count; i++) {
+        if (pool_submit(POOL, parse_worker, &job, &pending) == -1)
+            break;
+    }
+
+    // Whatever the workers didn't get to (or all of it if there are none) is parsed here
+    parse_worker(&job);
+
+    if (POOL != NULL)
+        pool_wait(POOL, &pending);
+
+    return job.failed ? -1 : 0;
+}
+
+static void parse_map(XML_Parser parser, size_t index, const char *data, size_t len)
+{
+    struct MapParserContext ctx = {
+        .head = NULL,
+        .currentMap = index,
+        .currentLife = 1,
+        .currentPortal = 1,
+        .reactorCapacity = 1,
+        .footholdCount = 0,
+        .footholdCapacity = 0,
+        .footholds = NULL,
+    };
+
+    MAP_INFOS[index].forcedReturn = -1;
+    MAP_INFOS[index].seats = 0;
+    MAP_INFOS[index].onUserEnter[0] = '\0';
+    MAP_INFOS[index].onFirstUserEnter[0] = '\0';
+
+    MAP_INFOS[index].lifeCount = 0;
+    MAP_INFOS[index].lives = malloc(sizeof(struct LifeInfo));
+
+    MAP_INFOS[index].portalCount = 0;
+    MAP_INFOS[index].portals = malloc(sizeof(struct PortalInfo));
+
+    MAP_INFOS[index].reactorCount = 0;
+    MAP_INFOS[index].reactors = malloc(sizeof(struct MapReactorInfo));
+
+    XML_SetElementHandler(parser, on_map_start, on_map_end);
+    XML_SetUserData(parser, &ctx);
+    XML_Parse(parser, data, len, true);
+
+    foothold_tree_build(MAP_INFOS[index].footholdTree, ctx.footholds, ctx.footholdCount);
+    free(ctx.footholds);
+    build_portal_hash(&MAP_INFOS[index]);
+}
+
+static void parse_equip(XML_Parser parser, size_t index, const char *data, size_t len)
+{
+    struct EquipParserContext ctx = {
+        .parser = parser,
+        .head = NULL,
+        .currentEquip = index,
+    };
+
+    XML_SetElementHandler(parser, on_equip_start, on_equip_end);
+    XML_SetUserData(parser, &ctx);
+    XML_Parse(parser, data, len, true);
+}
+
+static int load_skills(void)
+{
+    XML_Parser parser = XML_ParserCreate(NULL);
+
+    struct SkillParserContext ctx = {
+        .head = NULL,
+        .skillCapacity = 1,
+    };
+    DIR *skill_dir = opendir("wz/Skill.wz");
+
+    SKILL_INFOS = malloc(sizeof(struct SkillInfo));
+
+    struct dirent *entry;
+    while ((entry = readdir(skill_dir)) != NULL) {
+        if (entry->d_name[0] == '.' || !isdigit(entry->d_name[0]) || entry->d_type != DT_REG)
+            continue;
+
+        int fd = openat(dirfd(skill_dir), entry->d_name, O_RDONLY);
+        off_t len = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        char *data = malloc(len);
+        read(fd, data, len);
+        close(fd);
+
+        XML_SetElementHandler(parser, on_skill_start, on_skill_end);
+        XML_SetUserData(parser, &ctx);
+        XML_Parse(parser, data, len, true);
+        free(data);
+        XML_ParserReset(parser, NULL);
+    }
+    closedir(skill_dir);
+
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(SKILL_INFOS, sizeof(struct SkillInfo), offsetof(struct SkillInfo, id), sizeof(uint32_t), SKILL_INFO_COUNT);
+    cmph_config_t *config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    SKILL_INFO_MPH = cmph_new(config);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    size_t i = 0;
+    while (i < SKILL_INFO_COUNT) {
+        uint32_t j = cmph_search(SKILL_INFO_MPH, (void *)&SKILL_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct SkillInfo temp = SKILL_INFOS[j];
+            SKILL_INFOS[j] = SKILL_INFOS[i];
+            SKILL_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    fprintf(stderr, "Loaded skills\n");
+    XML_ParserFree(parser);
+    return 0;
+}
+
+static int load_mob_skills(void)
+{
+    XML_Parser parser = XML_ParserCreate(NULL);
+
+    struct SkillParserContext ctx = {
+        .head = NULL,
+        .skillCapacity = 1,
+    };
+
+    MOB_SKILL_INFOS = malloc(sizeof(struct SkillInfo));
+
+    int fd = open("wz/Skill.wz/MobSkill.img.xml", O_RDONLY);
+    off_t len = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    char *data = malloc(len);
+    read(fd, data, len);
+    close(fd);
+
+    XML_SetElementHandler(parser, on_mob_skill_start, on_mob_skill_end);
+    XML_SetUserData(parser, &ctx);
+    XML_Parse(parser, data, len, true);
+    free(data);
+    XML_ParserReset(parser, NULL);
+
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(MOB_SKILL_INFOS, sizeof(struct SkillInfo), offsetof(struct SkillInfo, id), sizeof(uint32_t), MOB_SKILL_INFO_COUNT);
+    cmph_config_t *config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    MOB_SKILL_INFO_MPH = cmph_new(config);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    size_t i = 0;
+    while (i < MOB_SKILL_INFO_COUNT) {
+        uint32_t j = cmph_search(MOB_SKILL_INFO_MPH, (void *)&MOB_SKILL_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct SkillInfo temp = MOB_SKILL_INFOS[j];
+            MOB_SKILL_INFOS[j] = MOB_SKILL_INFOS[i];
+            MOB_SKILL_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    fprintf(stderr, "Loaded mob skills\n");
+    XML_ParserFree(parser);
+    return 0;
+}
+
+static int load_reactors(void)
+{
+    XML_Parser parser = XML_ParserCreate(NULL);
+
+    struct ReactorParserContext ctx = {
+        .parser = parser,
+        .head = NULL,
+    };
+    DIR *reactor_dir = opendir("wz/Reactor.wz");
+    struct dirent *entry;
+    size_t count = 0;
+    while ((entry = readdir(reactor_dir)) != NULL) {
+        if (entry->d_name[0] != '.' && entry->d_type == DT_REG)
+            count++;
+    }
+
+    REACTOR_INFOS = malloc(count * sizeof(struct ReactorInfo));
+    rewinddir(reactor_dir);
+
+    // First pass - unlinked reactors
+    while ((entry = readdir(reactor_dir)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
+            continue;
+        int fd = openat(dirfd(reactor_dir), entry->d_name, O_RDONLY);
+        off_t len = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        char *data = malloc(len);
+        read(fd, data, len);
+        close(fd);
+
+        XML_SetElementHandler(parser, on_reactor_start, on_reactor_end);
+        XML_SetUserData(parser, &ctx);
+        XML_Parse(parser, data, len, true);
+        free(data);
+        XML_ParserReset(parser, NULL);
+    }
+    //closedir(reactor_dir);
+
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(REACTOR_INFOS, sizeof(struct ReactorInfo), offsetof(struct ReactorInfo, id), sizeof(uint32_t), REACTOR_INFO_COUNT);
+    cmph_config_t *config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    REACTOR_INFO_MPH = cmph_new(config);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    size_t i = 0;
+    while (i < REACTOR_INFO_COUNT) {
+        uint32_t j = cmph_search(REACTOR_INFO_MPH, (void *)&REACTOR_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct ReactorInfo temp = REACTOR_INFOS[j];
+            REACTOR_INFOS[j] = REACTOR_INFOS[i];
+            REACTOR_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    rewinddir(reactor_dir);
+
+    // Second pass - linked reactors
+    while ((entry = readdir(reactor_dir)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
+            continue;
+        int fd = openat(dirfd(reactor_dir), entry->d_name, O_RDONLY);
+        off_t len = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        char *data = malloc(len);
+        read(fd, data, len);
+        close(fd);
+
+        XML_SetElementHandler(parser, on_reactor_second_pass_start, on_reactor_second_pass_end);
+        XML_SetUserData(parser, &ctx);
+        XML_Parse(parser, data, len, true);
+        free(data);
+        if (REACTOR_INFO_COUNT == count) {
+            XML_ParserReset(parser, NULL);
+            break;
+        }
+        XML_ParserReset(parser, NULL);
+    }
+    closedir(reactor_dir);
+    cmph_destroy(REACTOR_INFO_MPH);
+
+    adapter = cmph_io_struct_vector_adapter(REACTOR_INFOS, sizeof(struct ReactorInfo), offsetof(struct ReactorInfo, id), sizeof(uint32_t), REACTOR_INFO_COUNT);
+    config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    REACTOR_INFO_MPH = cmph_new(config);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    i = 0;
+    while (i < REACTOR_INFO_COUNT) {
+        uint32_t j = cmph_search(REACTOR_INFO_MPH, (void *)&REACTOR_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct ReactorInfo temp = REACTOR_INFOS[j];
+            REACTOR_INFOS[j] = REACTOR_INFOS[i];
+            REACTOR_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    fprintf(stderr, "Loaded reactors\n");
+    XML_ParserFree(parser);
+    return 0;
+}
+
+static int load_equipment(void)
+{
+    size_t count;
+    char **paths = list_files("wz/Character.wz", "Afterimage", &count);
+    if (paths == NULL)
+        return -1;
+
+    EQUIP_INFO_COUNT = count;
+    EQUIP_INFOS = malloc(EQUIP_INFO_COUNT * sizeof(struct EquipInfo));
+    if (EQUIP_INFOS == NULL) {
+        free_files(paths, count);
+        return -1;
+    }
+
+    int ret = parse_files_parallel(paths, count, parse_equip);
+    free_files(paths, count);
+    if (ret == -1)
+        return -1;
+
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(EQUIP_INFOS, sizeof(struct EquipInfo), offsetof(struct EquipInfo, id), sizeof(uint32_t), EQUIP_INFO_COUNT);
+    cmph_config_t *config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    EQUIP_INFO_MPH = cmph_new(config);
+    assert(EQUIP_INFO_MPH != NULL);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    size_t i = 0;
+    while (i < EQUIP_INFO_COUNT) {
+        uint32_t j = cmph_search(EQUIP_INFO_MPH, (void *)&EQUIP_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct EquipInfo temp = EQUIP_INFOS[j];
+            EQUIP_INFOS[j] = EQUIP_INFOS[i];
+            EQUIP_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    fprintf(stderr, "Loaded equipment\n");
+    return 0;
+}
+
+static int load_quests(void)
+{
+    XML_Parser parser = XML_ParserCreate(NULL);
+
+    {
+        struct QuestCheckParserContext ctx = {
+            .questCapacity = 1,
+        };
+
+        QUEST_INFOS = malloc(sizeof(struct QuestInfo));
+
+        XML_SetElementHandler(parser, on_quest_check_start, on_quest_check_end);
+        XML_SetUserData(parser, &ctx);
+        int fd = open("wz/Quest.wz/Check.img.xml", O_RDONLY);
+        off_t len = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        char *data = malloc(len);
+        read(fd, data, len);
+        close(fd);
+        XML_Parse(parser, data, len, true);
+        free(data);
+        XML_ParserReset(parser, NULL);
+
+        cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(QUEST_INFOS, sizeof(struct QuestInfo), offsetof(struct QuestInfo, id), sizeof(uint16_t), QUEST_INFO_COUNT);
+        cmph_config_t *config = cmph_config_new(adapter);
+        cmph_config_set_algo(config, CMPH_BDZ);
+        QUEST_INFO_MPH = cmph_new(config);
+        cmph_config_destroy(config);
+        cmph_io_struct_vector_adapter_destroy(adapter);
+        size_t i = 0;
+        while (i < QUEST_INFO_COUNT) {
+            uint32_t j = cmph_search(QUEST_INFO_MPH, (void *)&QUEST_INFOS[i].id, sizeof(uint16_t));
+            if (i != j) {
+                struct QuestInfo temp = QUEST_INFOS[j];
+                QUEST_INFOS[j] = QUEST_INFOS[i];
+                QUEST_INFOS[i] = temp;
+            } else {
+                i++;
+            }
+        }
+    }
+
+    {
+        struct QuestActParserContext ctx = {
+            .questCapacity = QUEST_INFO_COUNT,
+        };
+
+        XML_SetElementHandler(parser, on_quest_act_start, on_quest_act_end);
+        XML_SetUserData(parser, &ctx);
+        int fd = open("wz/Quest.wz/Act.img.xml", O_RDONLY);
+        off_t len = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        char *data = malloc(len);
+        read(fd, data, len);
+        close(fd);
+        XML_Parse(parser, data, len, true);
+        free(data);
+        XML_ParserReset(parser, NULL);
+
+        cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(QUEST_INFOS, sizeof(struct QuestInfo), offsetof(struct QuestInfo, id), sizeof(uint16_t), QUEST_INFO_COUNT);
+        cmph_config_t *config = cmph_config_new(adapter);
+        cmph_config_set_algo(config, CMPH_BDZ);
+        cmph_destroy(QUEST_INFO_MPH);
+        QUEST_INFO_MPH = cmph_new(config);
+        cmph_config_destroy(config);
+        cmph_io_struct_vector_adapter_destroy(adapter);
+        size_t i = 0;
+        while (i < QUEST_INFO_COUNT) {
+            uint32_t j = cmph_search(QUEST_INFO_MPH, (void *)&QUEST_INFOS[i].id, sizeof(uint16_t));
+            if (i != j) {
+                struct QuestInfo temp = QUEST_INFOS[j];
+                QUEST_INFOS[j] = QUEST_INFOS[i];
+                QUEST_INFOS[i] = temp;
+            } else {
+                i++;
+            }
+        }
+
+        fprintf(stderr, "Loaded quests\n");
+    }
+
+    XML_ParserFree(parser);
+    return 0;
+}
+
+static int load_mobs(void)
+{
+    XML_Parser parser = XML_ParserCreate(NULL);
+
+    struct MobParserContext ctx = {
+        .parser = parser,
+        .head = NULL,
+    };
+    DIR *mobs_dir = opendir("wz/Mob.wz");
+    struct dirent *entry;
+    size_t count = 0;
+    while ((entry = readdir(mobs_dir)) != NULL) {
+        if (entry->d_name[0] != '.' && entry->d_type == DT_REG)
+            count++;
+    }
+
+    MOB_INFOS = malloc(count * sizeof(struct MobInfo));
+    rewinddir(mobs_dir);
+
+    while ((entry = readdir(mobs_dir)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
+            continue;
+        int fd = openat(dirfd(mobs_dir), entry->d_name, O_RDONLY);
+        off_t len = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        char *data = malloc(len);
+        read(fd, data, len);
+        close(fd);
+
+        //ctx.currentSkill = 1;
+        //MOB_INFOS[ctx.currentMob].lifeCount = 0;
+        //MOB_INFOS[ctx.currentMob].lives = malloc(sizeof(struct LifeInfo));
+
+        XML_SetElementHandler(parser, on_mob_start, on_mob_end);
+        XML_SetUserData(parser, &ctx);
+        XML_Parse(parser, data, len, true);
+        free(data);
+        XML_ParserReset(parser, NULL);
+        MOB_INFO_COUNT++;
+    }
+    closedir(mobs_dir);
+
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(MOB_INFOS, sizeof(struct MobInfo), offsetof(struct MobInfo, id), sizeof(uint32_t), MOB_INFO_COUNT);
+    cmph_config_t *config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    MOB_INFO_MPH = cmph_new(config);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    size_t i = 0;
+    while (i < MOB_INFO_COUNT) {
+        uint32_t j = cmph_search(MOB_INFO_MPH, (void *)&MOB_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct MobInfo temp = MOB_INFOS[j];
+            MOB_INFOS[j] = MOB_INFOS[i];
+            MOB_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    fprintf(stderr, "Loaded mobs\n");
+    XML_ParserFree(parser);
+    return 0;
+}
+
+static int load_maps(void)
+{
+    size_t count;
+    char **paths = list_files("wz/Map.wz/Map", NULL, &count);
+    if (paths == NULL)
+        return -1;
+
+    MAP_INFO_COUNT = count;
+    MAP_INFOS = malloc(MAP_INFO_COUNT * sizeof(struct MapInfo));
+    if (MAP_INFOS == NULL) {
+        free_files(paths, count);
+        return -1;
+    }
+
+    if (LAZY_MAPS) {
+        // Only the IDs are needed for the index, and they are in the file names
+        for (size_t i = 0; i < MAP_INFO_COUNT; i++) {
+            MAP_INFOS[i].id = map_id_from_path(paths[i]);
+            MAP_INFOS[i].footholdTree = NULL;
+            MAP_INFOS[i].lifeCount = 0;
+            MAP_INFOS[i].lives = NULL;
+            MAP_INFOS[i].portalCount = 0;
+            MAP_INFOS[i].portals = NULL;
+            MAP_INFOS[i].portalHashMask = 0;
+            MAP_INFOS[i].portalHash = NULL;
+            MAP_INFOS[i].reactorCount = 0;
+            MAP_INFOS[i].reactors = NULL;
+        }
+    } else {
+        for (size_t i = 0; i < MAP_INFO_COUNT; i++)
+            MAP_INFOS[i].footholdTree = malloc(sizeof(struct FootholdRTree));
+
+        int ret = parse_files_parallel(paths, count, parse_map);
+        if (ret == -1) {
+            free_files(paths, count);
+            return -1;
+        }
+    }
+
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(MAP_INFOS, sizeof(struct MapInfo), offsetof(struct MapInfo, id), sizeof(uint32_t), MAP_INFO_COUNT);
+    cmph_config_t *config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    MAP_INFO_MPH = cmph_new(config);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    size_t i = 0;
+    while (i < MAP_INFO_COUNT) {
+        uint32_t j = cmph_search(MAP_INFO_MPH, (void *)&MAP_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct MapInfo temp = MAP_INFOS[j];
+            MAP_INFOS[j] = MAP_INFOS[i];
+            MAP_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    if (!LAZY_MAPS) {
+        free_files(paths, count);
+        link_portals();
+        fprintf(stderr, "Loaded maps\n");
+        return 0;
+    }
+
+    MAP_PATHS = malloc(MAP_INFO_COUNT * sizeof(char *));
+    MAP_IDS = malloc(MAP_INFO_COUNT * sizeof(uint32_t));
+    MAP_LOADED = malloc(MAP_INFO_COUNT * sizeof(atomic_bool));
+    if (MAP_PATHS == NULL || MAP_IDS == NULL || MAP_LOADED == NULL || mtx_init(&MAP_LOAD_MTX, mtx_plain) != thrd_success) {
+        free(MAP_LOADED);
+        free(MAP_IDS);
+        free(MAP_PATHS);
+        MAP_LOADED = NULL;
+        MAP_IDS = NULL;
+        MAP_PATHS = NULL;
+        free_files(paths, count);
+        return -1;
+    }
+
+    // The paths were listed in the order before the reordering above
+    for (size_t k = 0; k < count; k++) {
+        uint32_t id = map_id_from_path(paths[k]);
+        size_t j = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+        MAP_PATHS[j] = paths[k];
+        MAP_IDS[j] = id;
+        atomic_init(&MAP_LOADED[j], false);
+    }
+    free(paths);
+
+    fprintf(stderr, "Indexed maps\n");
+    return 0;
+}
+
+static uint32_t map_id_from_path(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    return strtol(name != NULL ? name + 1 : path, NULL, 10);
+}
+
+static char *read_map_file(const char *path, size_t *len);
+
+// Parses a map that was only indexed at startup. Concurrent callers for the same map wait for the first one.
+// A map that fails to load stays unloaded, so the next lookup tries again
+static int load_map(size_t i)
+{
+    int ret = 0;
+    mtx_lock(&MAP_LOAD_MTX);
+    if (!atomic_load_explicit(&MAP_LOADED[i], memory_order_relaxed)) {
+        ret = -1;
+        size_t len;
+        char *data = read_map_file(MAP_PATHS[i], &len);
+        if (data == NULL) {
+            fprintf(stderr, "Failed to read %s\n", MAP_PATHS[i]);
+            goto unlock;
+        }
+
+        XML_Parser parser = XML_ParserCreate(NULL);
+        if (parser == NULL)
+            goto free_data;
+
+        MAP_INFOS[i].footholdTree = malloc(sizeof(struct FootholdRTree));
+        if (MAP_INFOS[i].footholdTree == NULL)
+            goto free_parser;
+
+        parse_map(parser, i, data, len);
+        ret = 0;
+
+        // Publishes the parsed record to the threads that check MAP_LOADED without taking the lock
+        atomic_store_explicit(&MAP_LOADED[i], true, memory_order_release);
+
+free_parser:
+        XML_ParserFree(parser);
+free_data:
+        free(data);
+    }
+unlock:
+    mtx_unlock(&MAP_LOAD_MTX);
+    return ret;
+}
+
+static char *read_map_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    char *data = malloc(end > 0 ? end : 1);
+    if (data == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t done = 0;
+    while (done < (size_t)end) {
+        ssize_t got = read(fd, data + done, end - done);
+        if (got <= 0) {
+            free(data);
+            close(fd);
+            return NULL;
+        }
+
+        done += got;
+    }
+
+    close(fd);
+    *len = end;
+    return data;
+}
+
+// Looks up a map's index in MAP_INFOS, parsing it first if it hasn't been yet.
+// Returns MAP_INDEX_NONE if there is no such map or it couldn't be loaded
+static size_t map_index(uint32_t id)
+{
+    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+    if (MAP_LOADED == NULL)
+        return MAP_INFOS[i].id == id ? i : MAP_INDEX_NONE;
+
+    if (MAP_IDS[i] != id)
+        return MAP_INDEX_NONE;
+
+    if (!atomic_load_explicit(&MAP_LOADED[i], memory_order_acquire) && load_map(i) == -1)
+        return MAP_INDEX_NONE;
+
+    return i;
+}
+
+static int load_items(void)
+{
+    XML_Parser parser = XML_ParserCreate(NULL);
+
+    struct ItemParserContext ctx = {
+        .parser = parser,
+        .head = NULL,
+        .itemCapacity = 1,
+    };
+    DIR *item_dir = opendir("wz/Item.wz");
+
+    ITEM_INFOS = malloc(sizeof(struct ItemInfo));
+
+    struct dirent *entry;
+    while ((entry = readdir(item_dir)) != NULL) {
+        // Skip Pet and Special for now
+        if (!strcmp(entry->d_name, "Pet"))
+            continue;
+        if (!strcmp(entry->d_name, "Special"))
+            continue;
+        if (entry->d_name[0] != '.' && entry->d_type == DT_DIR) {
+            DIR *dir = fdopendir(openat(dirfd(item_dir), entry->d_name, O_RDONLY));
+            while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
+                    continue;
+                int fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
+                off_t len = lseek(fd, 0, SEEK_END);
+                lseek(fd, 0, SEEK_SET);
+                char *data = malloc(len);
+                read(fd, data, len);
+                close(fd);
+
+                XML_SetElementHandler(parser, on_item_start, on_item_end);
+                XML_SetUserData(parser, &ctx);
+                XML_Parse(parser, data, len, true);
+                free(data);
+                XML_ParserReset(parser, NULL);
+            }
+            closedir(dir);
+        }
+    }
+    closedir(item_dir);
+
+    ctx.head2 = NULL;
+    ctx.skip = 0;
+
+    DIR *equip_dir = opendir("wz/Character.wz");
+
+    while ((entry = readdir(equip_dir)) != NULL) {
+        if (entry->d_type == DT_DIR && entry->d_name[0] != '.' && strcmp(entry->d_name, "Afterimage")) {
+            int fd = openat(dirfd(equip_dir), entry->d_name, O_RDONLY | O_DIRECTORY);
+            DIR *dir = fdopendir(fd);
+            while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.')
+                    continue;
+                fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
+                off_t len = lseek(fd, 0, SEEK_END);
+                lseek(fd, 0, SEEK_SET);
+                char *data = malloc(len);
+                read(fd, data, len);
+                close(fd);
+
+                XML_SetElementHandler(parser, on_equip_item_start, on_equip_item_end);
+                XML_SetUserData(parser, &ctx);
+                XML_Parse(parser, data, len, true);
+                free(data);
+                XML_ParserReset(parser, NULL);
+            }
+            closedir(dir);
+        }
+    }
+    closedir(equip_dir);
+
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(ITEM_INFOS, sizeof(struct ItemInfo), offsetof(struct ItemInfo, id), sizeof(uint32_t), ITEM_INFO_COUNT);
+    cmph_config_t *config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    ITEM_INFO_MPH = cmph_new(config);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    size_t i = 0;
+    while (i < ITEM_INFO_COUNT) {
+        uint32_t j = cmph_search(ITEM_INFO_MPH, (void *)&ITEM_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct ItemInfo temp = ITEM_INFOS[j];
+            ITEM_INFOS[j] = ITEM_INFOS[i];
+            ITEM_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    fprintf(stderr, "Loaded items\n");
+    XML_ParserFree(parser);
+    return 0;
+}
+
+static int load_consumables(void)
+{
+    XML_Parser parser = XML_ParserCreate(NULL);
+
+    struct ConsumableParserContext ctx = {
+        .head = NULL,
+        .itemCapacity = 1,
+    };
+    DIR *dir = opendir("wz/Item.wz/Consume");
+
+    CONSUMABLE_INFOS = malloc(sizeof(struct ConsumableInfo));
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type != DT_REG)
+            continue;
+        int fd = openat(dirfd(dir), entry->d_name, O_RDONLY);
+        off_t len = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        char *data = malloc(len);
+        read(fd, data, len);
+        close(fd);
+
+        XML_SetElementHandler(parser, on_consumable_start, on_consumable_end);
+        XML_SetUserData(parser, &ctx);
+        XML_Parse(parser, data, len, true);
+        free(data);
+        XML_ParserReset(parser, NULL);
+    }
+    closedir(dir);
+
+    cmph_io_adapter_t *adapter = cmph_io_struct_vector_adapter(CONSUMABLE_INFOS, sizeof(struct ConsumableInfo), offsetof(struct ConsumableInfo, id), sizeof(uint32_t), CONSUMABLE_INFO_COUNT);
+    cmph_config_t *config = cmph_config_new(adapter);
+    cmph_config_set_algo(config, CMPH_BDZ);
+    CONSUMABLE_INFO_MPH = cmph_new(config);
+    cmph_config_destroy(config);
+    cmph_io_struct_vector_adapter_destroy(adapter);
+    size_t i = 0;
+    while (i < CONSUMABLE_INFO_COUNT) {
+        uint32_t j = cmph_search(CONSUMABLE_INFO_MPH, (void *)&CONSUMABLE_INFOS[i].id, sizeof(uint32_t));
+        if (i != j) {
+            struct ConsumableInfo temp = CONSUMABLE_INFOS[j];
+            CONSUMABLE_INFOS[j] = CONSUMABLE_INFOS[i];
+            CONSUMABLE_INFOS[i] = temp;
+        } else {
+            i++;
+        }
+    }
+
+    fprintf(stderr, "Loaded consumables\n");
+    XML_ParserFree(parser);
+    return 0;
+}
+
+int wz_init_equipment(void)
+{
+    XML_Parser parser = XML_ParserCreate(NULL);
+
+    {
+        struct EquipParserContext ctx = {
+            .parser = parser,
+            .head = NULL,
+        };
         DIR *equip_dir = opendir("wz/Character.wz");
         struct dirent *entry;
         while ((entry = readdir(equip_dir)) != NULL) {
@@ -1074,24 +1921,309 @@ int wz_init_equipment(void)
     return 0;
 }
 
-static void foothold_tree_free(struct RTreeNode *node)
+static void foothold_tree_free(struct FootholdRTree *tree)
 {
-    if (node == NULL)
-        return;
+    free(tree->nodes);
+    free(tree->footholds);
+}
 
-    if (node->isLeaf) {
-        free(node);
-        return;
+static bool job_bit(uint16_t job, size_t *bit)
+{
+    // Jobs are numbered as branch * 100 + path * 10 + advancement
+    if (job / 100 >= QUEST_JOB_MASK_WORDS * 64 / 16 || job % 100 / 10 >= 4 || job % 10 >= 4)
+        return false;
+
+    *bit = job / 100 * 16 + job % 100 / 10 * 4 + job % 10;
+    return true;
+}
+
+static int cmp_quest_state_requirement(const void *a_, const void *b_)
+{
+    const struct QuestStateRequirement *a = a_;
+    const struct QuestStateRequirement *b = b_;
+    return a->id < b->id ? -1 : a->id > b->id;
+}
+
+static int cmp_quest_item_requirement(const void *a_, const void *b_)
+{
+    const struct QuestItemRequirement *a = a_;
+    const struct QuestItemRequirement *b = b_;
+    return a->id < b->id ? -1 : a->id > b->id;
+}
+
+static bool compile_job_requirement(const struct QuestRequirement *req, struct QuestRequirementProgram *program)
+{
+    uint64_t jobs[QUEST_JOB_MASK_WORDS] = { 0 };
+    for (size_t i = 0; i < req->job.count; i++) {
+        size_t bit;
+        if (!job_bit(req->job.jobs[i], &bit))
+            return false;
+
+        jobs[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+
+    // Each job requirement must hold on its own
+    for (size_t i = 0; i < QUEST_JOB_MASK_WORDS; i++)
+        program->jobs[i] = program->anyJob ? jobs[i] : program->jobs[i] & jobs[i];
+    program->anyJob = false;
+    return true;
+}
+
+static int compile_requirements(size_t count, const struct QuestRequirement *reqs, struct QuestRequirementProgram *program)
+{
+    *program = (struct QuestRequirementProgram) {
+        .maxLevel = UINT8_MAX,
+        .anyJob = true
+    };
+
+    size_t quest_count = 0;
+    size_t item_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (reqs[i].type == QUEST_REQUIREMENT_TYPE_QUEST)
+            quest_count++;
+        else if (reqs[i].type == QUEST_REQUIREMENT_TYPE_ITEM)
+            item_count++;
+    }
+
+    program->quests = malloc(quest_count * sizeof(struct QuestStateRequirement));
+    program->items = malloc(item_count * sizeof(struct QuestItemRequirement));
+    // The remaining requirements can't outnumber all of them
+    program->others = malloc(count * sizeof(const struct QuestRequirement *));
+    if ((program->quests == NULL && quest_count != 0) || (program->items == NULL && item_count != 0) || (program->others == NULL && count != 0)) {
+        free(program->others);
+        free(program->items);
+        free(program->quests);
+        // So that free_quest_programs() doesn't free them again
+        program->others = NULL;
+        program->items = NULL;
+        program->quests = NULL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct QuestRequirement *req = &reqs[i];
+        switch (req->type) {
+        case QUEST_REQUIREMENT_TYPE_NPC:
+            if (program->npc == 0)
+                program->npc = req->npc.id;
+            else
+                program->others[program->otherCount++] = req;
+        break;
+
+        case QUEST_REQUIREMENT_TYPE_QUEST:
+            program->quests[program->questCount].id = req->quest.id;
+            program->quests[program->questCount].state = req->quest.state;
+            program->questCount++;
+        break;
+
+        case QUEST_REQUIREMENT_TYPE_JOB:
+            if (!compile_job_requirement(req, program))
+                program->others[program->otherCount++] = req;
+        break;
+
+        case QUEST_REQUIREMENT_TYPE_COMPLETED_QUEST:
+            if (req->questCompleted.amount > program->completedQuests)
+                program->completedQuests = req->questCompleted.amount;
+        break;
+
+        case QUEST_REQUIREMENT_TYPE_MESO:
+            if (req->meso.amount > program->meso)
+                program->meso = req->meso.amount;
+        break;
+
+        case QUEST_REQUIREMENT_TYPE_MIN_LEVEL:
+            if (req->minLevel.level > program->minLevel)
+                program->minLevel = req->minLevel.level;
+        break;
+
+        case QUEST_REQUIREMENT_TYPE_MAX_LEVEL:
+            if (req->maxLevel.level < program->maxLevel)
+                program->maxLevel = req->maxLevel.level;
+        break;
+
+        case QUEST_REQUIREMENT_TYPE_ITEM:
+            program->items[program->itemCount].id = req->item.id;
+            program->items[program->itemCount].count = req->item.count;
+            program->itemCount++;
+        break;
+
+        // Kill counts are tracked through the quest's progress instead
+        case QUEST_REQUIREMENT_TYPE_MOB:
+        break;
+
+        default:
+            program->others[program->otherCount++] = req;
+        }
+    }
+
+    qsort(program->quests, program->questCount, sizeof(struct QuestStateRequirement), cmp_quest_state_requirement);
+
+    // The items that mustn't be held go after the required ones, so that a required and a forbidden
+    // entry for the same item are still checked separately, which no character can satisfy at once
+    size_t required = 0;
+    for (size_t i = 0; i < program->itemCount; i++) {
+        if (program->items[i].count != 0) {
+            struct QuestItemRequirement item = program->items[i];
+            program->items[i] = program->items[required];
+            program->items[required++] = item;
+        }
+    }
+
+    qsort(program->items, required, sizeof(struct QuestItemRequirement), cmp_quest_item_requirement);
+    qsort(program->items + required, program->itemCount - required, sizeof(struct QuestItemRequirement), cmp_quest_item_requirement);
+
+    // check_quest_items() matches each inventory slot to a single requirement, so repeated items are merged into one.
+    // Each entry has to hold on its own, so the largest count wins
+    size_t merged = 0;
+    for (size_t i = 0; i < required; i++) {
+        if (merged > 0 && program->items[merged - 1].id == program->items[i].id) {
+            if (program->items[i].count > program->items[merged - 1].count)
+                program->items[merged - 1].count = program->items[i].count;
+        } else {
+            program->items[merged++] = program->items[i];
+        }
     }
 
-    for (uint8_t i = 0; i < node->count; i++)
-        foothold_tree_free(node->children[i]);
+    size_t absent = 0;
+    for (size_t i = required; i < program->itemCount; i++) {
+        if (absent == 0 || program->items[merged + absent - 1].id != program->items[i].id) {
+            program->items[merged + absent] = program->items[i];
+            absent++;
+        }
+    }
+
+    program->itemCount = merged;
+    program->absentItemCount = absent;
 
-    free(node);
+    return 0;
+}
+
+struct QuestMonsterEntry {
+    uint32_t monster;
+    struct QuestMonsterTarget target;
+};
+
+static int cmp_quest_monster_entry(const void *a_, const void *b_)
+{
+    const struct QuestMonsterEntry *a = a_;
+    const struct QuestMonsterEntry *b = b_;
+    if (a->monster != b->monster)
+        return a->monster < b->monster ? -1 : 1;
+
+    if (a->target.quest != b->target.quest)
+        return a->target.quest < b->target.quest ? -1 : 1;
+
+    return a->target.index < b->target.index ? -1 : a->target.index > b->target.index;
+}
+
+// Only the first mob requirement of a quest counts kills, see client_kill_monster()
+static const struct QuestRequirement *first_mob_requirement(const struct QuestInfo *info)
+{
+    for (size_t i = 0; i < info->endRequirementCount; i++) {
+        if (info->endRequirements[i].type == QUEST_REQUIREMENT_TYPE_MOB)
+            return &info->endRequirements[i];
+    }
+
+    return NULL;
+}
+
+static int compile_quests(void)
+{
+    QUEST_PROGRAMS = calloc(QUEST_INFO_COUNT != 0 ? QUEST_INFO_COUNT : 1, sizeof(struct QuestProgram));
+    if (QUEST_PROGRAMS == NULL)
+        return -1;
+
+    size_t entry_count = 0;
+    for (size_t i = 0; i < QUEST_INFO_COUNT; i++) {
+        const struct QuestInfo *info = &QUEST_INFOS[i];
+        if (compile_requirements(info->startRequirementCount, info->startRequirements, &QUEST_PROGRAMS[i].start) == -1 ||
+                compile_requirements(info->endRequirementCount, info->endRequirements, &QUEST_PROGRAMS[i].end) == -1) {
+            free_quest_programs();
+            return -1;
+        }
+
+        const struct QuestRequirement *req = first_mob_requirement(info);
+        if (req != NULL)
+            entry_count += req->mob.count;
+    }
+
+    struct QuestMonsterEntry *entries = malloc((entry_count != 0 ? entry_count : 1) * sizeof(struct QuestMonsterEntry));
+    QUEST_MONSTER_IDS = malloc((entry_count != 0 ? entry_count : 1) * sizeof(uint32_t));
+    QUEST_MONSTER_TARGETS = malloc((entry_count != 0 ? entry_count : 1) * sizeof(struct QuestMonsterTarget));
+    if (entries == NULL || QUEST_MONSTER_IDS == NULL || QUEST_MONSTER_TARGETS == NULL) {
+        free(entries);
+        free_quest_programs();
+        return -1;
+    }
+
+    entry_count = 0;
+    for (size_t i = 0; i < QUEST_INFO_COUNT; i++) {
+        const struct QuestRequirement *req = first_mob_requirement(&QUEST_INFOS[i]);
+        if (req == NULL)
+            continue;
+
+        for (size_t j = 0; j < req->mob.count; j++) {
+            entries[entry_count].monster = req->mob.mobs[j].id;
+            entries[entry_count].target.quest = QUEST_INFOS[i].id;
+            entries[entry_count].target.index = j;
+            entries[entry_count].target.count = req->mob.mobs[j].count;
+            entry_count++;
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(struct QuestMonsterEntry), cmp_quest_monster_entry);
+    for (size_t i = 0; i < entry_count; i++) {
+        QUEST_MONSTER_IDS[i] = entries[i].monster;
+        QUEST_MONSTER_TARGETS[i] = entries[i].target;
+    }
+    QUEST_MONSTER_COUNT = entry_count;
+    free(entries);
+
+    return 0;
+}
+
+static void free_quest_programs(void)
+{
+    if (QUEST_PROGRAMS != NULL) {
+        for (size_t i = 0; i < QUEST_INFO_COUNT; i++) {
+            free(QUEST_PROGRAMS[i].start.quests);
+            free(QUEST_PROGRAMS[i].start.items);
+            free(QUEST_PROGRAMS[i].start.others);
+            free(QUEST_PROGRAMS[i].end.quests);
+            free(QUEST_PROGRAMS[i].end.items);
+            free(QUEST_PROGRAMS[i].end.others);
+        }
+    }
+
+    free(QUEST_PROGRAMS);
+    QUEST_PROGRAMS = NULL;
+    free(QUEST_MONSTER_IDS);
+    QUEST_MONSTER_IDS = NULL;
+    free(QUEST_MONSTER_TARGETS);
+    QUEST_MONSTER_TARGETS = NULL;
+    QUEST_MONSTER_COUNT = 0;
 }
 
 void wz_terminate(void)
 {
+    free_quest_programs();
+
+    if (SNAPSHOT != NULL) {
+        cmph_destroy(SKILL_INFO_MPH);
+        cmph_destroy(MOB_SKILL_INFO_MPH);
+        cmph_destroy(REACTOR_INFO_MPH);
+        cmph_destroy(CONSUMABLE_INFO_MPH);
+        cmph_destroy(EQUIP_INFO_MPH);
+        cmph_destroy(ITEM_INFO_MPH);
+        cmph_destroy(QUEST_INFO_MPH);
+        cmph_destroy(MOB_INFO_MPH);
+        cmph_destroy(MAP_INFO_MPH);
+        // Everything else lives in the mapping
+        munmap(SNAPSHOT, SNAPSHOT_SIZE);
+        SNAPSHOT = NULL;
+        return;
+    }
+
     cmph_destroy(REACTOR_INFO_MPH);
     for (size_t i = 0; i < REACTOR_INFO_COUNT; i++) {
         struct ReactorInfo *reactor = &REACTOR_INFOS[i];
@@ -1170,17 +2302,39 @@ void wz_terminate(void)
     cmph_destroy(MAP_INFO_MPH);
 
     for (size_t i = 0; i < MAP_INFO_COUNT; i++) {
-        foothold_tree_free(MAP_INFOS[i].footholdTree->root);
+        // Never looked up
+        if (MAP_INFOS[i].footholdTree == NULL)
+            continue;
+
+        foothold_tree_free(MAP_INFOS[i].footholdTree);
         free(MAP_INFOS[i].footholdTree);
         free(MAP_INFOS[i].lives);
         free(MAP_INFOS[i].portals);
+        free(MAP_INFOS[i].portalHash);
         free(MAP_INFOS[i].reactors);
     }
     free(MAP_INFOS);
-    //if (WRITER) {
-    //    sem_unlink("/syrup-wz");
-    //    shm_unlink("/syrup-wz");
-    //}
+
+    if (MAP_PATHS != NULL) {
+        free_files(MAP_PATHS, MAP_INFO_COUNT);
+        free(MAP_IDS);
+        free(MAP_LOADED);
+        mtx_destroy(&MAP_LOAD_MTX);
+        MAP_PATHS = NULL;
+        MAP_IDS = NULL;
+        MAP_LOADED = NULL;
+    }
+
+    // The loaders count up from these, so they must be reset for the tables to be parsed again
+    SKILL_INFO_COUNT = 0;
+    MOB_SKILL_INFO_COUNT = 0;
+    REACTOR_INFO_COUNT = 0;
+    EQUIP_INFO_COUNT = 0;
+    QUEST_INFO_COUNT = 0;
+    MOB_INFO_COUNT = 0;
+    MAP_INFO_COUNT = 0;
+    ITEM_INFO_COUNT = 0;
+    CONSUMABLE_INFO_COUNT = 0;
 }
 
 void wz_terminate_equipment(void)
@@ -1191,8 +2345,8 @@ void wz_terminate_equipment(void)
 
 const struct MapInfo *wz_get_map(uint32_t id)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
-    if (MAP_INFOS[i].id != id)
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
         return NULL;
 
     return &MAP_INFOS[i];
@@ -1200,63 +2354,146 @@ const struct MapInfo *wz_get_map(uint32_t id)
 
 uint32_t wz_get_map_nearest_town(uint32_t id)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
+        return id;
+
     return MAP_INFOS[i].returnMap;
 }
 
 uint32_t wz_get_map_forced_return(uint32_t id)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
+        return id;
+
     return MAP_INFOS[i].forcedReturn != -1 ? MAP_INFOS[i].forcedReturn : id;
 }
 
 const char *wz_get_map_enter_script(uint32_t id)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
+        return NULL;
+
     return strcmp(MAP_INFOS[i].onUserEnter, "") == 0 ? NULL : MAP_INFOS[i].onUserEnter;
 }
 
 uint16_t wz_get_map_seat_count(uint32_t id)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
+        return 0;
+
     return MAP_INFOS[i].seats;
 }
 
 uint32_t wz_get_target_map(uint32_t id, char *target)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
-    for (size_t j = 0; j < MAP_INFOS[i].portalCount; j++) {
-        if (!strcmp(MAP_INFOS[i].portals[j].name, target)) {
-            return MAP_INFOS[i].portals[j].targetMap;
-        }
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
+        return -1;
+
+    const struct PortalInfo *portal = find_portal(&MAP_INFOS[i], target);
+    return portal != NULL ? portal->targetMap : (uint32_t)-1;
+}
+
+uint8_t wz_get_target_portal(uint32_t id, char *target)
+{
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
+        return -1;
+
+    const struct PortalInfo *portal = find_portal(&MAP_INFOS[i], target);
+    if (portal == NULL)
+        return -1;
+
+    // Lazily loaded maps can't be linked up front as that would load every map they lead to
+    if (MAP_LOADED == NULL)
+        return portal->targetPortal;
+
+    size_t j = map_index(portal->targetMap);
+    if (j == MAP_INDEX_NONE)
+        return -1;
+
+    const struct PortalInfo *target_portal = find_portal(&MAP_INFOS[j], portal->targetName);
+    return target_portal != NULL ? target_portal->id : (uint8_t)-1;
+}
+
+static uint32_t portal_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *c = name; *c != '\0'; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Indexes the map's portals by name. Portals that share a name are found in index order
+static void build_portal_hash(struct MapInfo *map)
+{
+    map->portalHashMask = 0;
+    map->portalHash = NULL;
+    for (size_t i = 0; i < map->portalCount; i++)
+        map->portals[i].targetPortal = -1;
+
+    if (map->portalCount == 0)
+        return;
+
+    // At most half full
+    size_t size = 4;
+    while (size < map->portalCount * 2)
+        size *= 2;
+
+    map->portalHash = calloc(size, sizeof(uint16_t));
+    if (map->portalHash == NULL)
+        return;
+    map->portalHashMask = size - 1;
+
+    for (size_t i = 0; i < map->portalCount; i++) {
+        size_t slot = portal_name_hash(map->portals[i].name) & map->portalHashMask;
+        while (map->portalHash[slot] != 0)
+            slot = (slot + 1) & map->portalHashMask;
+        map->portalHash[slot] = i + 1;
+    }
+}
+
+static const struct PortalInfo *find_portal(const struct MapInfo *map, const char *name)
+{
+    if (map->portalHash == NULL)
+        return NULL;
+
+    size_t slot = portal_name_hash(name) & map->portalHashMask;
+    while (map->portalHash[slot] != 0) {
+        const struct PortalInfo *portal = &map->portals[map->portalHash[slot] - 1];
+        if (!strcmp(portal->name, name))
+            return portal;
+        slot = (slot + 1) & map->portalHashMask;
     }
 
-    return -1;
+    return NULL;
 }
 
-uint8_t wz_get_target_portal(uint32_t id, char *target)
+// Fills in every portal's targetPortal, once all the maps have been parsed
+static void link_portals(void)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
-    uint32_t target_map_id;
-    char *name;
-    for (size_t j = 0; j < MAP_INFOS[i].portalCount; j++) {
-        if (!strcmp(MAP_INFOS[i].portals[j].name, target)) {
-            target_map_id = MAP_INFOS[i].portals[j].targetMap;
-            name = MAP_INFOS[i].portals[j].targetName;
-        }
-    }
+    for (size_t i = 0; i < MAP_INFO_COUNT; i++) {
+        for (size_t j = 0; j < MAP_INFOS[i].portalCount; j++) {
+            struct PortalInfo *portal = &MAP_INFOS[i].portals[j];
+            size_t k = cmph_search(MAP_INFO_MPH, (void *)&portal->targetMap, sizeof(uint32_t));
+            if (MAP_INFOS[k].id != portal->targetMap)
+                continue;
 
-    i = cmph_search(MAP_INFO_MPH, (void *)&target_map_id, sizeof(uint32_t));
-    for (size_t j = 0; j < MAP_INFOS[i].portalCount; j++) {
-        if (!strcmp(MAP_INFOS[i].portals[j].name, name)) {
-            return j;
+            const struct PortalInfo *target = find_portal(&MAP_INFOS[k], portal->targetName);
+            if (target != NULL)
+                portal->targetPortal = target->id;
         }
     }
-
-    return -1;
 }
 
-static int16_t get_distance_below(struct Foothold *fh, struct Point *p)
+static int16_t get_distance_below(const struct Foothold *fh, const struct Point *p)
 {
     if (fh->p1.x == fh->p2.x) {
         return MIN(fh->p1.y, fh->p2.y) - p->y;
@@ -1265,44 +2502,62 @@ static int16_t get_distance_below(struct Foothold *fh, struct Point *p)
     return (fh->p2.y - fh->p1.y) * (p->x - fh->p1.x) / (fh->p2.x - fh->p1.x) + fh->p1.y - p->y;
 }
 
-static struct Foothold *tree_find_below(struct RTreeNode *node, struct Point *p)
+static void tree_find_below(const struct FootholdRTree *tree, uint32_t index, const struct Point *p, const struct Foothold **min, int32_t *min_dist)
 {
-    if (node->bound.sw.x > p->x || node->bound.sw.y < p->y)
-        return NULL;
+    const struct FootholdTreeNode *node = &tree->nodes[index];
+    bool match[FOOTHOLD_TREE_FANOUT];
 
+    // Both loops test every slot without branching so that they can be vectorized,
+    // only the (few) matches are then looked at one by one
     if (node->isLeaf) {
-        struct Foothold *min = NULL;
-        int16_t min_dist = INT16_MAX;
-        for (uint8_t i = 0; i < node->count; i++) {
-            if ((node->footholds[i].p1.x > p->x && node->footholds[i].p2.x > p->x) || (node->footholds[i].p1.x < p->x && node->footholds[i].p2.x < p->x) || (node->footholds[i].p1.y < p->y && node->footholds[i].p2.y < p->y))
-                continue;
-
-            if (node->footholds[i].p1.x == node->footholds[i].p2.x && (p->x != node->footholds[i].p1.x || p->y > node->footholds[i].p1.y || p->y > node->footholds[i].p2.y))
-                continue;
+        for (uint8_t i = 0; i < FOOTHOLD_TREE_FANOUT; i++) {
+            bool outside = ((node->x1[i] > p->x) & (node->x2[i] > p->x)) | ((node->x1[i] < p->x) & (node->x2[i] < p->x)) | ((node->y1[i] < p->y) & (node->y2[i] < p->y));
+            bool wall_missed = (node->x1[i] == node->x2[i]) & ((p->x != node->x1[i]) | (p->y > node->y1[i]) | (p->y > node->y2[i]));
+            match[i] = (i < node->count) & !outside & !wall_missed;
+        }
 
-            int16_t dist = get_distance_below(&node->footholds[i], p);
-            if (dist < 0)
+        for (uint8_t i = 0; i < node->count; i++) {
+            if (!match[i])
                 continue;
 
-            if (dist < min_dist) {
-                min = &node->footholds[i];
-                min_dist = dist;
+            const struct Foothold *fh = &tree->footholds[node->first + i];
+            int16_t dist = get_distance_below(fh, p);
+            if (dist >= 0 && dist < *min_dist) {
+                *min = fh;
+                *min_dist = dist;
             }
         }
 
-        return min;
+        return;
     }
 
-    struct Foothold *min = NULL;
-    int16_t min_dist = INT16_MAX;
+    for (uint8_t i = 0; i < FOOTHOLD_TREE_FANOUT; i++)
+        match[i] = (i < node->count) & (node->minX[i] <= p->x) & (node->maxX[i] >= p->x) & (node->maxY[i] >= p->y);
+
     for (uint8_t i = 0; i < node->count; i++) {
-        struct Foothold *current = tree_find_below(node->children[i], p);
-        if (current != NULL) {
-            int16_t dist = get_distance_below(current, p);
-            if (dist < min_dist) {
-                min = current;
-                min_dist = dist;
-            }
+        // Nothing in the child can be closer than its top edge
+        if (match[i] && node->minY[i] - p->y < *min_dist)
+            tree_find_below(tree, node->first + i, p, min, min_dist);
+    }
+}
+
+// The same search as foothold_tree_find_below() without the tree, used as the baseline by wz_benchmark_footholds()
+static const struct Foothold *footholds_scan_below(const struct FootholdRTree *tree, const struct Point *p)
+{
+    const struct Foothold *min = NULL;
+    int16_t min_dist = INT16_MAX;
+    for (uint32_t i = 0; i < tree->footholdCount; i++) {
+        const struct Foothold *fh = &tree->footholds[i];
+        if ((fh->p1.x > p->x && fh->p2.x > p->x) || (fh->p1.x < p->x && fh->p2.x < p->x) || (fh->p1.y < p->y && fh->p2.y < p->y))
+            continue;
+
+        if (fh->p1.x == fh->p2.x && (p->x != fh->p1.x || p->y > fh->p1.y || p->y > fh->p2.y))
+            continue;
+
+        int16_t dist = get_distance_below(fh, p);
+        if (dist >= 0 && dist < min_dist) {
+            min = fh;
+            min_dist = dist;
         }
     }
 
@@ -1311,18 +2566,33 @@ static struct Foothold *tree_find_below(struct RTreeNode *node, struct Point *p)
 
 const struct Foothold *foothold_tree_find_below(const struct FootholdRTree *tree, struct Point *p)
 {
-    return tree_find_below(tree->root, p);
+    if (tree->nodeCount == 0)
+        return NULL;
+
+    const struct Foothold *min = NULL;
+    int32_t min_dist = INT16_MAX;
+    tree_find_below(tree, 0, p, &min, &min_dist);
+
+    return min;
 }
 
 const struct FootholdRTree *wz_get_foothold_tree_for_map(uint32_t id)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
+        return NULL;
+
     return MAP_INFOS[i].footholdTree;
 }
 
 const struct LifeInfo *wz_get_life_for_map(uint32_t id, size_t *count)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE) {
+        *count = 0;
+        return NULL;
+    }
+
     *count = MAP_INFOS[i].lifeCount;
     return MAP_INFOS[i].lives;
 }
@@ -1333,29 +2603,29 @@ const struct MapReactorInfo *wz_get_reactors_for_map(uint32_t id, size_t *count)
     if (count == NULL)
         count = &count_;
 
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE) {
+        *count = 0;
+        return NULL;
+    }
+
     *count = MAP_INFOS[i].reactorCount;
     return MAP_INFOS[i].reactors;
 }
 
 const struct PortalInfo *wz_get_portal_info_by_name(uint32_t id, const char *name)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
-    if (MAP_INFOS[i].id != id)
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
         return NULL;
 
-    for (size_t j = 0; j < MAP_INFOS[i].portalCount; j++) {
-        if (!strcmp(MAP_INFOS[i].portals[j].name, name))
-            return &MAP_INFOS[i].portals[j];
-    }
-
-    return NULL;
+    return find_portal(&MAP_INFOS[i], name);
 }
 
 const struct PortalInfo *wz_get_portal_info(uint32_t id, uint8_t pid)
 {
-    size_t i = cmph_search(MAP_INFO_MPH, (void *)&id, sizeof(uint32_t));
-    if (MAP_INFOS[i].id != id)
+    size_t i = map_index(id);
+    if (i == MAP_INDEX_NONE)
         return NULL;
 
     if (pid >= MAP_INFOS[i].portalCount)
@@ -1396,6 +2666,46 @@ const struct QuestInfo *wz_get_quest_info(uint16_t id)
     return info;
 }
 
+const struct QuestProgram *wz_get_quest_program(uint16_t id)
+{
+    size_t i = cmph_search(QUEST_INFO_MPH, (void *)&id, sizeof(uint16_t));
+    if (QUEST_INFOS[i].id != id)
+        return NULL;
+    return &QUEST_PROGRAMS[i];
+}
+
+bool wz_quest_program_allows_job(const struct QuestRequirementProgram *program, uint16_t job)
+{
+    if (program->anyJob)
+        return true;
+
+    size_t bit;
+    if (!job_bit(job, &bit))
+        return false;
+
+    return program->jobs[bit / 64] & ((uint64_t)1 << (bit % 64));
+}
+
+const struct QuestMonsterTarget *wz_get_quests_for_monster(uint32_t id, size_t *count)
+{
+    // Lower bound of the monster's run
+    size_t lo = 0, hi = QUEST_MONSTER_COUNT;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (QUEST_MONSTER_IDS[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    size_t end = lo;
+    while (end < QUEST_MONSTER_COUNT && QUEST_MONSTER_IDS[end] == id)
+        end++;
+
+    *count = end - lo;
+    return &QUEST_MONSTER_TARGETS[lo];
+}
+
 const struct ItemInfo *wz_get_item_info(uint32_t id)
 {
     struct ItemInfo *info = &ITEM_INFOS[cmph_search(ITEM_INFO_MPH, (void *)&id, sizeof(uint32_t))];
@@ -1772,8 +3082,19 @@ static void on_map_end(void *user_data, const XML_Char *name)
     }
 
     if (ctx->footholdLevel > 0) {
-        if (ctx->footholdLevel == 3)
-            insert_foothold(MAP_INFOS[ctx->currentMap].footholdTree, &ctx->currentFoothold);
+        if (ctx->footholdLevel == 3) {
+            if (ctx->footholdCount == ctx->footholdCapacity) {
+                size_t capacity = ctx->footholdCapacity == 0 ? 16 : ctx->footholdCapacity * 2;
+                void *temp = realloc(ctx->footholds, capacity * sizeof(struct Foothold));
+                if (temp != NULL) {
+                    ctx->footholds = temp;
+                    ctx->footholdCapacity = capacity;
+                }
+            }
+
+            if (ctx->footholdCount < ctx->footholdCapacity)
+                ctx->footholds[ctx->footholdCount++] = ctx->currentFoothold;
+        }
 
         ctx->footholdLevel--;
         return;
@@ -4110,567 +5431,1114 @@ static void on_mob_skill_start(void *user_data, const XML_Char *name, const XML_
         }
         break;
 
-        case SKILL_ITEM_TYPE_SKILL:
-            if (!strcmp(name, "imgdir")) {
-                if (!strcmp(attrs[1], "level")) {
-                    struct SkillParserStackNode *new = malloc(sizeof(struct SkillParserStackNode));
-                    new->next = ctx->head;
-                    new->type = SKILL_ITEM_TYPE_LEVELS;
-                    ctx->head = new;
+        case SKILL_ITEM_TYPE_SKILL:
+            if (!strcmp(name, "imgdir")) {
+                if (!strcmp(attrs[1], "level")) {
+                    struct SkillParserStackNode *new = malloc(sizeof(struct SkillParserStackNode));
+                    new->next = ctx->head;
+                    new->type = SKILL_ITEM_TYPE_LEVELS;
+                    ctx->head = new;
+
+                    ctx->capacity = 1;
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels = malloc(sizeof(struct SkillLevelInfo));
+                } else {
+                    ctx->skip++;
+                }
+            } else {
+                ctx->skip++;
+            }
+        break;
+
+        case SKILL_ITEM_TYPE_LEVELS: {
+            if (MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount == ctx->capacity) {
+                MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels = realloc(MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels,
+                        (ctx->capacity * 2) * sizeof(struct SkillLevelInfo));
+                ctx->capacity *= 2;
+            }
+
+            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].mpCon = 0;
+            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].interval = 0;
+            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].damage = 0;
+            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].bulletCount = 0;
+            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].count = 1;
+            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].x = 1;
+            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].y = 1;
+            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].hp = 100;
+
+            struct SkillParserStackNode *new = malloc(sizeof(struct SkillParserStackNode));
+            new->next = ctx->head;
+            new->type = SKILL_ITEM_TYPE_LEVEL;
+            ctx->head = new;
+        }
+        break;
+
+
+        case SKILL_ITEM_TYPE_LEVEL:
+            ctx->skip++;
+            if (!strcmp(name, "int")) {
+                const XML_Char *key = NULL;
+                const XML_Char *value = NULL;
+                for (size_t i = 0; attrs[i] != NULL; i += 2) {
+                    if (!strcmp(attrs[i], "name"))
+                        key = attrs[i+1];
+                    else if (!strcmp(attrs[i], "value"))
+                        value = attrs[i+1];
+                }
+
+                assert(key != NULL && value != NULL);
+
+                if (!strcmp(key, "mpCon"))
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].mpCon = strtol(value, NULL, 10);
+                else if (!strcmp(key, "interval"))
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].interval = strtol(value, NULL, 10);
+                else if (!strcmp(key, "damage"))
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].damage = strtol(value, NULL, 10);
+                else if (!strcmp(key, "bulletCount"))
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].bulletCount = strtol(value, NULL, 10);
+                else if (!strcmp(key, "count"))
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].count = strtol(value, NULL, 10);
+                else if (!strcmp(key, "x"))
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].x = strtol(value, NULL, 10);
+                else if (!strcmp(key, "y"))
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].y = strtol(value, NULL, 10);
+                else if (!strcmp(key, "hp"))
+                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].hp = strtol(value, NULL, 10);
+            }
+        break;
+        }
+    }
+}
+
+static void on_mob_skill_end(void *user_data, const XML_Char *name)
+{
+    struct SkillParserContext *ctx = user_data;
+    if (ctx->skip > 0) {
+        ctx->skip--;
+        return;
+    }
+
+    if (ctx->head->type == SKILL_ITEM_TYPE_LEVEL)
+        MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount++;
+    else if (ctx->head->type == SKILL_ITEM_TYPE_SKILL)
+        MOB_SKILL_INFO_COUNT++;
+
+    struct SkillParserStackNode *next = ctx->head->next;
+    free(ctx->head);
+    ctx->head = next;
+}
+
+static struct FootholdTreeEntry node_bounds(const struct FootholdTreeNode *node)
+{
+    struct FootholdTreeEntry bounds = { INT16_MAX, INT16_MAX, INT16_MIN, INT16_MIN, 0 };
+    for (uint8_t i = 0; i < node->count; i++) {
+        if (node->isLeaf) {
+            bounds.minX = MIN(bounds.minX, MIN(node->x1[i], node->x2[i]));
+            bounds.minY = MIN(bounds.minY, MIN(node->y1[i], node->y2[i]));
+            bounds.maxX = MAX(bounds.maxX, MAX(node->x1[i], node->x2[i]));
+            bounds.maxY = MAX(bounds.maxY, MAX(node->y1[i], node->y2[i]));
+        } else {
+            bounds.minX = MIN(bounds.minX, node->minX[i]);
+            bounds.minY = MIN(bounds.minY, node->minY[i]);
+            bounds.maxX = MAX(bounds.maxX, node->maxX[i]);
+            bounds.maxY = MAX(bounds.maxY, node->maxY[i]);
+        }
+    }
+
+    return bounds;
+}
+
+static int compare_entry_x(const void *a, const void *b)
+{
+    const struct FootholdTreeEntry *e1 = a;
+    const struct FootholdTreeEntry *e2 = b;
+    return (e1->minX + e1->maxX) - (e2->minX + e2->maxX);
+}
+
+static int compare_entry_y(const void *a, const void *b)
+{
+    const struct FootholdTreeEntry *e1 = a;
+    const struct FootholdTreeEntry *e2 = b;
+    return (e1->minY + e1->maxY) - (e2->minY + e2->maxY);
+}
+
+// Sort-Tile-Recursive packing of one level: the entries are sorted into vertical slices by their x center
+// and then by their y center inside each slice, and each run of up to FOOTHOLD_TREE_FANOUT entries becomes a node of the next level.
+// Returns the number of nodes, whose first entry and entry count are stored in starts and counts
+static size_t str_pack(struct FootholdTreeEntry *entries, size_t count, uint32_t *starts, uint8_t *counts)
+{
+    size_t nodes = (count + FOOTHOLD_TREE_FANOUT - 1) / FOOTHOLD_TREE_FANOUT;
+    size_t slices = 1;
+    while (slices * slices < nodes)
+        slices++;
+    size_t slice_size = slices * FOOTHOLD_TREE_FANOUT;
+
+    qsort(entries, count, sizeof(struct FootholdTreeEntry), compare_entry_x);
+
+    size_t n = 0;
+    for (size_t start = 0; start < count; start += slice_size) {
+        size_t len = MIN(slice_size, count - start);
+        qsort(entries + start, len, sizeof(struct FootholdTreeEntry), compare_entry_y);
+        for (size_t i = 0; i < len; i += FOOTHOLD_TREE_FANOUT) {
+            starts[n] = start + i;
+            counts[n] = MIN(FOOTHOLD_TREE_FANOUT, len - i);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+// Builds the tree from all of a map's footholds at once, bottom-up, one STR-packed level at a time
+static int foothold_tree_build(struct FootholdRTree *tree, const struct Foothold *footholds, size_t count)
+{
+    tree->nodeCount = 0;
+    tree->nodes = NULL;
+    tree->footholdCount = 0;
+    tree->footholds = NULL;
+    if (count == 0)
+        return 0;
+
+    struct FootholdTreeNode *levels[FOOTHOLD_TREE_MAX_DEPTH];
+    size_t level_counts[FOOTHOLD_TREE_MAX_DEPTH];
+    size_t depth = 0;
+
+    struct FootholdTreeEntry *entries = malloc(count * sizeof(struct FootholdTreeEntry));
+    uint32_t *starts = malloc(count * sizeof(uint32_t));
+    uint8_t *counts = malloc(count);
+    tree->footholds = malloc(count * sizeof(struct Foothold));
+    if (entries == NULL || starts == NULL || counts == NULL || tree->footholds == NULL)
+        goto fail;
+
+    for (size_t i = 0; i < count; i++) {
+        entries[i].minX = MIN(footholds[i].p1.x, footholds[i].p2.x);
+        entries[i].minY = MIN(footholds[i].p1.y, footholds[i].p2.y);
+        entries[i].maxX = MAX(footholds[i].p1.x, footholds[i].p2.x);
+        entries[i].maxY = MAX(footholds[i].p1.y, footholds[i].p2.y);
+        entries[i].index = i;
+    }
+
+    // Leaves - their footholds are stored contiguously in packed order
+    size_t n = str_pack(entries, count, starts, counts);
+    for (size_t i = 0; i < count; i++)
+        tree->footholds[i] = footholds[entries[i].index];
+    tree->footholdCount = count;
+
+    levels[0] = calloc(n, sizeof(struct FootholdTreeNode));
+    if (levels[0] == NULL)
+        goto fail;
+    level_counts[0] = n;
+    depth = 1;
+
+    for (size_t i = 0; i < n; i++) {
+        struct FootholdTreeNode *node = &levels[0][i];
+        node->isLeaf = true;
+        node->first = starts[i];
+        node->count = counts[i];
+        for (uint8_t j = 0; j < node->count; j++) {
+            const struct Foothold *fh = &tree->footholds[starts[i] + j];
+            node->x1[j] = fh->p1.x;
+            node->y1[j] = fh->p1.y;
+            node->x2[j] = fh->p2.x;
+            node->y2[j] = fh->p2.y;
+        }
+    }
+
+    while (level_counts[depth - 1] > 1) {
+        if (depth == FOOTHOLD_TREE_MAX_DEPTH)
+            goto fail;
+
+        size_t below_count = level_counts[depth - 1];
+        for (size_t i = 0; i < below_count; i++) {
+            entries[i] = node_bounds(&levels[depth - 1][i]);
+            entries[i].index = i;
+        }
+
+        n = str_pack(entries, below_count, starts, counts);
+
+        // A node's children must be contiguous so the level below is rearranged in packed order
+        struct FootholdTreeNode *sorted = malloc(below_count * sizeof(struct FootholdTreeNode));
+        if (sorted == NULL)
+            goto fail;
+
+        for (size_t i = 0; i < below_count; i++)
+            sorted[i] = levels[depth - 1][entries[i].index];
+        free(levels[depth - 1]);
+        levels[depth - 1] = sorted;
+
+        levels[depth] = calloc(n, sizeof(struct FootholdTreeNode));
+        if (levels[depth] == NULL)
+            goto fail;
+        level_counts[depth] = n;
+        depth++;
+
+        for (size_t i = 0; i < n; i++) {
+            struct FootholdTreeNode *node = &levels[depth - 1][i];
+            node->isLeaf = false;
+            node->first = starts[i];
+            node->count = counts[i];
+            for (uint8_t j = 0; j < node->count; j++) {
+                const struct FootholdTreeEntry *entry = &entries[starts[i] + j];
+                node->minX[j] = entry->minX;
+                node->minY[j] = entry->minY;
+                node->maxX[j] = entry->maxX;
+                node->maxY[j] = entry->maxY;
+            }
+        }
+    }
+
+    // Flatten the levels root first, so that each level directly follows its parents
+    size_t total = 0;
+    for (size_t i = 0; i < depth; i++)
+        total += level_counts[i];
+
+    tree->nodes = malloc(total * sizeof(struct FootholdTreeNode));
+    if (tree->nodes == NULL)
+        goto fail;
+
+    size_t offset = 0;
+    for (size_t i = depth; i-- > 0; ) {
+        for (size_t j = 0; j < level_counts[i]; j++) {
+            struct FootholdTreeNode *node = &tree->nodes[offset + j];
+            *node = levels[i][j];
+            // Children were indexed within the level below, which is the next one in the array
+            if (!node->isLeaf)
+                node->first += offset + level_counts[i];
+        }
+        offset += level_counts[i];
+        free(levels[i]);
+    }
+    tree->nodeCount = total;
+
+    free(counts);
+    free(starts);
+    free(entries);
+    return 0;
+
+fail:
+    for (size_t i = 0; i < depth; i++)
+        free(levels[i]);
+    free(counts);
+    free(starts);
+    free(entries);
+    free(tree->footholds);
+    tree->footholds = NULL;
+    tree->footholdCount = 0;
+    return -1;
+}
+
+struct SnapshotWriter {
+    char *data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+};
+
+#define SNAPSHOT_ALIGNMENT _Alignof(max_align_t)
+// Offset 0 is always taken by the header so it can stand for NULL
+#define ENCODE(offset) ((void *)(uintptr_t)(offset))
+#define RELOCATE(base, ptr) ((ptr) = (void *)((ptr) == NULL ? NULL : (char *)(base) + (uintptr_t)(ptr)))
+
+static uint64_t snapshot_append(struct SnapshotWriter *w, const void *data, size_t size)
+{
+    size_t offset = (w->size + SNAPSHOT_ALIGNMENT - 1) & ~(SNAPSHOT_ALIGNMENT - 1);
+    if (offset + size > w->capacity) {
+        size_t capacity = w->capacity == 0 ? 1 << 20 : w->capacity;
+        while (offset + size > capacity)
+            capacity *= 2;
+
+        void *temp = realloc(w->data, capacity);
+        if (temp == NULL) {
+            w->failed = true;
+            return 0;
+        }
+
+        w->data = temp;
+        w->capacity = capacity;
+    }
+
+    memset(w->data + w->size, 0, offset - w->size);
+    if (data != NULL)
+        memcpy(w->data + offset, data, size);
+    else
+        memset(w->data + offset, 0, size);
+    w->size = offset + size;
+
+    return offset;
+}
+
+// Returns a pointer to data that was already appended; it is only valid until the next append
+static void *snapshot_at(struct SnapshotWriter *w, uint64_t offset)
+{
+    return w->failed ? NULL : w->data + offset;
+}
+
+static uint64_t snapshot_append_array(struct SnapshotWriter *w, const void *data, size_t count, size_t size)
+{
+    if (count == 0)
+        return 0;
+
+    return snapshot_append(w, data, count * size);
+}
+
+static uint64_t snapshot_append_mph(struct SnapshotWriter *w, cmph_t *mph, uint64_t *size)
+{
+    char *buf;
+    size_t len;
+    FILE *f = open_memstream(&buf, &len);
+    if (f == NULL) {
+        w->failed = true;
+        return 0;
+    }
+
+    cmph_dump(mph, f);
+    fclose(f);
+
+    uint64_t offset = snapshot_append(w, buf, len);
+    free(buf);
+    *size = len;
+
+    return offset;
+}
+
+static uint64_t snapshot_append_requirements(struct SnapshotWriter *w, struct QuestRequirement *reqs, size_t count)
+{
+    uint64_t offset = snapshot_append_array(w, reqs, count, sizeof(struct QuestRequirement));
+    for (size_t i = 0; i < count; i++) {
+        uint64_t array = 0;
+        if (reqs[i].type == QUEST_REQUIREMENT_TYPE_JOB) {
+            array = snapshot_append_array(w, reqs[i].job.jobs, reqs[i].job.count, sizeof(uint16_t));
+        } else if (reqs[i].type == QUEST_REQUIREMENT_TYPE_MOB) {
+            array = snapshot_append_array(w, reqs[i].mob.mobs, reqs[i].mob.count, sizeof(*reqs[i].mob.mobs));
+        } else if (reqs[i].type == QUEST_REQUIREMENT_TYPE_INFO) {
+            char **infos = malloc(reqs[i].info.infoCount * sizeof(char *));
+            if (infos == NULL && reqs[i].info.infoCount > 0) {
+                w->failed = true;
+                return 0;
+            }
+
+            for (size_t j = 0; j < reqs[i].info.infoCount; j++)
+                infos[j] = ENCODE(snapshot_append(w, reqs[i].info.infos[j], strlen(reqs[i].info.infos[j]) + 1));
+
+            array = snapshot_append_array(w, infos, reqs[i].info.infoCount, sizeof(char *));
+            free(infos);
+        } else {
+            continue;
+        }
+
+        struct QuestRequirement *copy = snapshot_at(w, offset);
+        if (copy == NULL)
+            return 0;
+
+        if (reqs[i].type == QUEST_REQUIREMENT_TYPE_JOB)
+            copy[i].job.jobs = ENCODE(array);
+        else if (reqs[i].type == QUEST_REQUIREMENT_TYPE_MOB)
+            copy[i].mob.mobs = ENCODE(array);
+        else
+            copy[i].info.infos = ENCODE(array);
+    }
+
+    return offset;
+}
+
+static uint64_t snapshot_append_acts(struct SnapshotWriter *w, struct QuestAct *acts, size_t count)
+{
+    uint64_t offset = snapshot_append_array(w, acts, count, sizeof(struct QuestAct));
+    for (size_t i = 0; i < count; i++) {
+        uint64_t items = 0;
+        uint64_t skills = 0;
+        if (acts[i].type == QUEST_ACT_TYPE_ITEM) {
+            items = snapshot_append_array(w, acts[i].item.items, acts[i].item.count, sizeof(struct QuestItemAction));
+        } else if (acts[i].type == QUEST_ACT_TYPE_SKILL) {
+            skills = snapshot_append_array(w, acts[i].skill.skills, acts[i].skill.count, sizeof(struct QuestSkillAction));
+            for (size_t j = 0; j < acts[i].skill.count; j++) {
+                uint64_t jobs = snapshot_append_array(w, acts[i].skill.skills[j].jobs, acts[i].skill.skills[j].jobCount, sizeof(uint16_t));
+                struct QuestSkillAction *skill = snapshot_at(w, skills);
+                if (skill == NULL)
+                    return 0;
+
+                skill[j].jobs = ENCODE(jobs);
+            }
+        }
+
+        struct QuestAct *copy = snapshot_at(w, offset);
+        if (copy == NULL)
+            return 0;
+
+        // The other types leave these uninitialized
+        copy[i].item.items = ENCODE(items);
+        copy[i].skill.skills = ENCODE(skills);
+    }
+
+    return offset;
+}
+
+static uint64_t snapshot_append_skills(struct SnapshotWriter *w, struct SkillInfo *skills, size_t count)
+{
+    uint64_t offset = snapshot_append_array(w, skills, count, sizeof(struct SkillInfo));
+    for (size_t i = 0; i < count; i++) {
+        uint64_t levels = snapshot_append_array(w, skills[i].levels, skills[i].levelCount, sizeof(struct SkillLevelInfo));
+        struct SkillInfo *copy = snapshot_at(w, offset);
+        if (copy == NULL)
+            return 0;
+
+        copy[i].levels = ENCODE(levels);
+    }
+
+    return offset;
+}
+
+static uint64_t snapshot_append_reactors(struct SnapshotWriter *w)
+{
+    uint64_t offset = snapshot_append_array(w, REACTOR_INFOS, REACTOR_INFO_COUNT, sizeof(struct ReactorInfo));
+    for (size_t i = 0; i < REACTOR_INFO_COUNT; i++) {
+        struct ReactorInfo *reactor = &REACTOR_INFOS[i];
+        uint64_t states = snapshot_append_array(w, reactor->states, reactor->stateCount, sizeof(struct ReactorStateInfo));
+        for (size_t j = 0; j < reactor->stateCount; j++) {
+            struct ReactorStateInfo *state = &reactor->states[j];
+            uint64_t events = snapshot_append_array(w, state->events, state->eventCount, sizeof(struct ReactorEventInfo));
+            for (size_t k = 0; k < state->eventCount; k++) {
+                if (state->events[k].type != REACTOR_EVENT_TYPE_SKILL)
+                    continue;
 
-                    ctx->capacity = 1;
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels = malloc(sizeof(struct SkillLevelInfo));
-                } else {
-                    ctx->skip++;
-                }
-            } else {
-                ctx->skip++;
-            }
-        break;
+                uint64_t skills = snapshot_append_array(w, state->events[k].skills, state->events[k].skillCount, sizeof(uint32_t));
+                struct ReactorEventInfo *event = snapshot_at(w, events);
+                if (event == NULL)
+                    return 0;
 
-        case SKILL_ITEM_TYPE_LEVELS: {
-            if (MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount == ctx->capacity) {
-                MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels = realloc(MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels,
-                        (ctx->capacity * 2) * sizeof(struct SkillLevelInfo));
-                ctx->capacity *= 2;
+                event[k].skills = ENCODE(skills);
             }
 
-            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].mpCon = 0;
-            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].interval = 0;
-            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].damage = 0;
-            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].bulletCount = 0;
-            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].count = 1;
-            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].x = 1;
-            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].y = 1;
-            MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].hp = 100;
+            struct ReactorStateInfo *copy = snapshot_at(w, states);
+            if (copy == NULL)
+                return 0;
 
-            struct SkillParserStackNode *new = malloc(sizeof(struct SkillParserStackNode));
-            new->next = ctx->head;
-            new->type = SKILL_ITEM_TYPE_LEVEL;
-            ctx->head = new;
+            copy[j].events = ENCODE(events);
         }
-        break;
 
+        struct ReactorInfo *copy = snapshot_at(w, offset);
+        if (copy == NULL)
+            return 0;
 
-        case SKILL_ITEM_TYPE_LEVEL:
-            ctx->skip++;
-            if (!strcmp(name, "int")) {
-                const XML_Char *key = NULL;
-                const XML_Char *value = NULL;
-                for (size_t i = 0; attrs[i] != NULL; i += 2) {
-                    if (!strcmp(attrs[i], "name"))
-                        key = attrs[i+1];
-                    else if (!strcmp(attrs[i], "value"))
-                        value = attrs[i+1];
-                }
+        copy[i].states = ENCODE(states);
+    }
 
-                assert(key != NULL && value != NULL);
+    return offset;
+}
 
-                if (!strcmp(key, "mpCon"))
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].mpCon = strtol(value, NULL, 10);
-                else if (!strcmp(key, "interval"))
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].interval = strtol(value, NULL, 10);
-                else if (!strcmp(key, "damage"))
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].damage = strtol(value, NULL, 10);
-                else if (!strcmp(key, "bulletCount"))
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].bulletCount = strtol(value, NULL, 10);
-                else if (!strcmp(key, "count"))
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].count = strtol(value, NULL, 10);
-                else if (!strcmp(key, "x"))
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].x = strtol(value, NULL, 10);
-                else if (!strcmp(key, "y"))
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].y = strtol(value, NULL, 10);
-                else if (!strcmp(key, "hp"))
-                    MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levels[MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount].hp = strtol(value, NULL, 10);
-            }
-        break;
-        }
+static uint64_t snapshot_append_maps(struct SnapshotWriter *w)
+{
+    uint64_t offset = snapshot_append_array(w, MAP_INFOS, MAP_INFO_COUNT, sizeof(struct MapInfo));
+    for (size_t i = 0; i < MAP_INFO_COUNT; i++) {
+        struct MapInfo *map = &MAP_INFOS[i];
+        uint64_t tree = snapshot_append(w, map->footholdTree, sizeof(struct FootholdRTree));
+        uint64_t nodes = snapshot_append_array(w, map->footholdTree->nodes, map->footholdTree->nodeCount, sizeof(struct FootholdTreeNode));
+        uint64_t footholds = snapshot_append_array(w, map->footholdTree->footholds, map->footholdTree->footholdCount, sizeof(struct Foothold));
+        uint64_t lives = snapshot_append_array(w, map->lives, map->lifeCount, sizeof(struct LifeInfo));
+        uint64_t reactors = snapshot_append_array(w, map->reactors, map->reactorCount, sizeof(struct MapReactorInfo));
+        uint64_t portals = snapshot_append_array(w, map->portals, map->portalCount, sizeof(struct PortalInfo));
+        uint64_t portal_hash = map->portalHash != NULL ? snapshot_append_array(w, map->portalHash, map->portalHashMask + 1, sizeof(uint16_t)) : 0;
+
+        struct FootholdRTree *tree_copy = snapshot_at(w, tree);
+        if (tree_copy == NULL)
+            return 0;
+
+        tree_copy->nodes = ENCODE(nodes);
+        tree_copy->footholds = ENCODE(footholds);
+
+        struct MapInfo *copy = snapshot_at(w, offset);
+        copy[i].footholdTree = ENCODE(tree);
+        copy[i].lives = ENCODE(lives);
+        copy[i].reactors = ENCODE(reactors);
+        copy[i].portals = ENCODE(portals);
+        copy[i].portalHash = ENCODE(portal_hash);
     }
+
+    return offset;
 }
 
-static void on_mob_skill_end(void *user_data, const XML_Char *name)
+static uint64_t snapshot_append_quests(struct SnapshotWriter *w)
 {
-    struct SkillParserContext *ctx = user_data;
-    if (ctx->skip > 0) {
-        ctx->skip--;
-        return;
+    uint64_t offset = snapshot_append_array(w, QUEST_INFOS, QUEST_INFO_COUNT, sizeof(struct QuestInfo));
+    for (size_t i = 0; i < QUEST_INFO_COUNT; i++) {
+        struct QuestInfo *quest = &QUEST_INFOS[i];
+        uint64_t start_reqs = snapshot_append_requirements(w, quest->startRequirements, quest->startRequirementCount);
+        uint64_t end_reqs = snapshot_append_requirements(w, quest->endRequirements, quest->endRequirementCount);
+        uint64_t start_acts = snapshot_append_acts(w, quest->startActs, quest->startActCount);
+        uint64_t end_acts = snapshot_append_acts(w, quest->endActs, quest->endActCount);
+
+        struct QuestInfo *copy = snapshot_at(w, offset);
+        if (copy == NULL)
+            return 0;
+
+        copy[i].startRequirements = ENCODE(start_reqs);
+        copy[i].endRequirements = ENCODE(end_reqs);
+        copy[i].startActs = ENCODE(start_acts);
+        copy[i].endActs = ENCODE(end_acts);
     }
 
-    if (ctx->head->type == SKILL_ITEM_TYPE_LEVEL)
-        MOB_SKILL_INFOS[MOB_SKILL_INFO_COUNT].levelCount++;
-    else if (ctx->head->type == SKILL_ITEM_TYPE_SKILL)
-        MOB_SKILL_INFO_COUNT++;
+    return offset;
+}
 
-    struct SkillParserStackNode *next = ctx->head->next;
-    free(ctx->head);
-    ctx->head = next;
+static uint64_t snapshot_append_mobs(struct SnapshotWriter *w)
+{
+    uint64_t offset = snapshot_append_array(w, MOB_INFOS, MOB_INFO_COUNT, sizeof(struct MobInfo));
+    struct MobInfo *copy = snapshot_at(w, offset);
+    if (copy == NULL)
+        return 0;
+
+    // Mob skills aren't parsed yet
+    for (size_t i = 0; i < MOB_INFO_COUNT; i++) {
+        copy[i].skillCount = 0;
+        copy[i].skills = NULL;
+    }
+
+    return offset;
 }
 
-static struct Rectangle foothold_mbr(struct Foothold *fh)
+static uint32_t snapshot_layout(void)
 {
-    struct Rectangle rect = {
-        {
-            MIN(fh->p1.x, fh->p2.x),
-            MAX(fh->p1.y, fh->p2.y)
-        },
-        {
-            MAX(fh->p1.x, fh->p2.x),
-            MIN(fh->p1.y, fh->p2.y)
-        },
+    // Rejects snapshots that were written by a build with different struct layouts
+    size_t sizes[] = {
+        sizeof(void *),
+        sizeof(struct FootholdTreeNode),
+        sizeof(struct FootholdRTree),
+        sizeof(struct MapInfo),
+        sizeof(struct LifeInfo),
+        sizeof(struct MapReactorInfo),
+        sizeof(struct PortalInfo),
+        sizeof(struct MobInfo),
+        sizeof(struct QuestInfo),
+        sizeof(struct QuestRequirement),
+        sizeof(struct QuestAct),
+        sizeof(struct QuestItemAction),
+        sizeof(struct QuestSkillAction),
+        sizeof(struct ItemInfo),
+        sizeof(struct EquipInfo),
+        sizeof(struct ConsumableInfo),
+        sizeof(struct ReactorInfo),
+        sizeof(struct ReactorStateInfo),
+        sizeof(struct ReactorEventInfo),
+        sizeof(struct SkillInfo),
+        sizeof(struct SkillLevelInfo),
     };
 
-    return rect;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        hash ^= sizes[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
 }
 
-static struct Rectangle rectangle_mbr(struct Rectangle *r1, struct Rectangle *r2)
+// Serializes the parsed tables into a malloc'd image of the snapshot file
+static void *build_snapshot(uint64_t fingerprint, size_t *size)
 {
-    struct Rectangle rect;
-    rect.sw.x = MIN(r1->sw.x, r2->sw.x);
-    rect.sw.y = MAX(r1->sw.y, r2->sw.y);
-    rect.ne.x = MAX(r1->ne.x, r2->ne.x);
-    rect.ne.y = MIN(r1->ne.y, r2->ne.y);
-    return rect;
+    struct SnapshotWriter w = { .data = NULL, .size = 0, .capacity = 0, .failed = false };
+    struct SnapshotHeader header = {
+        .magic = WZ_SNAPSHOT_MAGIC,
+        .version = WZ_SNAPSHOT_VERSION,
+        .layout = snapshot_layout(),
+        .fingerprint = fingerprint,
+    };
+
+    snapshot_append(&w, &header, sizeof(struct SnapshotHeader));
+
+    struct {
+        cmph_t *mph;
+        size_t count;
+    } tables[WZ_TABLE_COUNT] = {
+        [WZ_TABLE_SKILLS] = { SKILL_INFO_MPH, SKILL_INFO_COUNT },
+        [WZ_TABLE_MOB_SKILLS] = { MOB_SKILL_INFO_MPH, MOB_SKILL_INFO_COUNT },
+        [WZ_TABLE_REACTORS] = { REACTOR_INFO_MPH, REACTOR_INFO_COUNT },
+        [WZ_TABLE_EQUIPS] = { EQUIP_INFO_MPH, EQUIP_INFO_COUNT },
+        [WZ_TABLE_QUESTS] = { QUEST_INFO_MPH, QUEST_INFO_COUNT },
+        [WZ_TABLE_MOBS] = { MOB_INFO_MPH, MOB_INFO_COUNT },
+        [WZ_TABLE_MAPS] = { MAP_INFO_MPH, MAP_INFO_COUNT },
+        [WZ_TABLE_ITEMS] = { ITEM_INFO_MPH, ITEM_INFO_COUNT },
+        [WZ_TABLE_CONSUMABLES] = { CONSUMABLE_INFO_MPH, CONSUMABLE_INFO_COUNT },
+    };
+
+    uint64_t offsets[WZ_TABLE_COUNT];
+    offsets[WZ_TABLE_SKILLS] = snapshot_append_skills(&w, SKILL_INFOS, SKILL_INFO_COUNT);
+    offsets[WZ_TABLE_MOB_SKILLS] = snapshot_append_skills(&w, MOB_SKILL_INFOS, MOB_SKILL_INFO_COUNT);
+    offsets[WZ_TABLE_REACTORS] = snapshot_append_reactors(&w);
+    offsets[WZ_TABLE_EQUIPS] = snapshot_append_array(&w, EQUIP_INFOS, EQUIP_INFO_COUNT, sizeof(struct EquipInfo));
+    offsets[WZ_TABLE_QUESTS] = snapshot_append_quests(&w);
+    offsets[WZ_TABLE_MOBS] = snapshot_append_mobs(&w);
+    offsets[WZ_TABLE_MAPS] = snapshot_append_maps(&w);
+    offsets[WZ_TABLE_ITEMS] = snapshot_append_array(&w, ITEM_INFOS, ITEM_INFO_COUNT, sizeof(struct ItemInfo));
+    offsets[WZ_TABLE_CONSUMABLES] = snapshot_append_array(&w, CONSUMABLE_INFOS, CONSUMABLE_INFO_COUNT, sizeof(struct ConsumableInfo));
+
+    for (size_t i = 0; i < WZ_TABLE_COUNT; i++) {
+        header.tables[i].count = tables[i].count;
+        header.tables[i].offset = offsets[i];
+        header.tables[i].mphOffset = snapshot_append_mph(&w, tables[i].mph, &header.tables[i].mphSize);
+    }
+
+    if (w.failed) {
+        free(w.data);
+        return NULL;
+    }
+
+    header.size = w.size;
+    memcpy(w.data, &header, sizeof(struct SnapshotHeader));
+    *size = w.size;
+
+    return w.data;
 }
 
-static struct Rectangle rectangle_intersection(struct Rectangle *r1, struct Rectangle *r2)
+static int write_snapshot(const char *path, uint64_t fingerprint)
 {
-    struct Rectangle rect;
-    rect.sw.x = MAX(r1->sw.x, r2->sw.x);
-    rect.sw.y = MIN(r1->sw.y, r2->sw.y);
-    rect.ne.x = MIN(r1->ne.x, r2->ne.x);
-    rect.ne.y = MAX(r1->ne.y, r2->ne.y);
-    if (rect.sw.x > rect.ne.x || rect.sw.y < rect.ne.y) {
-        rect.sw.x = 0;
-        rect.sw.y = 0;
-        rect.ne.x = 0;
-        rect.ne.y = 0;
+    size_t size;
+    void *data = build_snapshot(fingerprint, &size);
+    if (data == NULL)
+        return -1;
+
+    // Write to a temporary file first so that a running server never maps a partially written snapshot
+    char temp[256];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *f = fopen(temp, "wb");
+    if (f == NULL) {
+        free(data);
+        return -1;
     }
-    return rect;
+
+    if (fwrite(data, 1, size, f) != size) {
+        fclose(f);
+        unlink(temp);
+        free(data);
+        return -1;
+    }
+
+    free(data);
+    if (fclose(f) != 0 || rename(temp, path) == -1) {
+        unlink(temp);
+        return -1;
+    }
+
+    return 0;
 }
 
-static int32_t rectangle_area(struct Rectangle *rect)
+static void relocate_requirements(void *base, struct QuestRequirement *reqs, size_t count)
 {
-    return (rect->ne.x - rect->sw.x) * (rect->sw.y - rect->ne.y);
+    for (size_t i = 0; i < count; i++) {
+        if (reqs[i].type == QUEST_REQUIREMENT_TYPE_JOB) {
+            RELOCATE(base, reqs[i].job.jobs);
+        } else if (reqs[i].type == QUEST_REQUIREMENT_TYPE_MOB) {
+            RELOCATE(base, reqs[i].mob.mobs);
+        } else if (reqs[i].type == QUEST_REQUIREMENT_TYPE_INFO) {
+            RELOCATE(base, reqs[i].info.infos);
+            for (size_t j = 0; j < reqs[i].info.infoCount; j++)
+                RELOCATE(base, reqs[i].info.infos[j]);
+        }
+    }
 }
 
-static int16_t rectangle_length(struct Rectangle *rect)
+static void relocate_acts(void *base, struct QuestAct *acts, size_t count)
 {
-    return (rect->ne.x - rect->sw.x) + (rect->sw.y - rect->ne.y);
+    for (size_t i = 0; i < count; i++) {
+        RELOCATE(base, acts[i].item.items);
+        RELOCATE(base, acts[i].skill.skills);
+        if (acts[i].type == QUEST_ACT_TYPE_SKILL) {
+            for (size_t j = 0; j < acts[i].skill.count; j++)
+                RELOCATE(base, acts[i].skill.skills[j].jobs);
+        }
+    }
 }
 
-static int32_t white_space_area_2(struct Rectangle *r1, struct Rectangle *r2)
+static void relocate_skills(void *base, struct SkillInfo *skills, size_t count)
 {
-    struct Rectangle intersect = rectangle_intersection(r1, r2);
-    int32_t cover_area = rectangle_area(r1) + rectangle_area(r2) - rectangle_area(&intersect);
-    struct Rectangle union_ = rectangle_mbr(r1, r2);
-    return rectangle_area(&union_) - cover_area;
+    for (size_t i = 0; i < count; i++)
+        RELOCATE(base, skills[i].levels);
 }
 
-static int32_t white_space_length_2(struct Rectangle *r1, struct Rectangle *r2)
+static cmph_t *load_mph(void *base, const struct SnapshotTable *table)
 {
-    struct Rectangle intersect = rectangle_intersection(r1, r2);
-    int32_t cover_area = rectangle_length(r1) + rectangle_length(r2) - rectangle_length(&intersect);
-    struct Rectangle union_ = rectangle_mbr(r1, r2);
-    return rectangle_length(&union_) - cover_area;
+    FILE *f = fmemopen((char *)base + table->mphOffset, table->mphSize, "rb");
+    if (f == NULL)
+        return NULL;
+
+    cmph_t *mph = cmph_load(f);
+    fclose(f);
+
+    return mph;
 }
 
-// Find the total free are of the 3 rectangles when put into a bounding one
-static int32_t white_space_area_3(struct Rectangle *r1, struct Rectangle *r2, struct Rectangle *r3)
+// Checks that the snapshot was written by this build from the current XML files
+static bool snapshot_valid(const void *base, size_t size, uint64_t fingerprint)
 {
-    struct Rectangle intersect1 = rectangle_intersection(r1, r2);
-    struct Rectangle intersect2 = rectangle_intersection(r1, r3);
-    struct Rectangle intersect3 = rectangle_intersection(r2, r3);
-    struct Rectangle intersect4 = rectangle_intersection(&intersect1, r3);
-    int32_t cover_area = rectangle_area(r1) + rectangle_area(r2) + rectangle_area(r3)
-        - rectangle_area(&intersect1) - rectangle_area(&intersect2) - rectangle_area(&intersect3)
-        + rectangle_area(&intersect4);
-    struct Rectangle union_ = rectangle_mbr(r1, r2);
-    union_ = rectangle_mbr(&union_, r3);
-    return rectangle_area(&union_) - cover_area;
+    const struct SnapshotHeader *header = base;
+    // Without any of the XML files around there is nothing that the snapshot can be stale against
+    return size >= sizeof(struct SnapshotHeader) && header->magic == WZ_SNAPSHOT_MAGIC &&
+        header->version == WZ_SNAPSHOT_VERSION && header->layout == snapshot_layout() &&
+        header->size == size && (fingerprint == 0 || header->fingerprint == fingerprint);
 }
 
-static int16_t white_space_length_3(struct Rectangle *r1, struct Rectangle *r2, struct Rectangle *r3)
+static void *map_snapshot(const char *path, int prot, size_t *size)
 {
-    struct Rectangle intersect1 = rectangle_intersection(r1, r2);
-    struct Rectangle intersect2 = rectangle_intersection(r1, r3);
-    struct Rectangle intersect3 = rectangle_intersection(r2, r3);
-    struct Rectangle intersect4 = rectangle_intersection(&intersect1, r3);
-    int32_t cover_area = rectangle_length(r1) + rectangle_length(r2) + rectangle_length(r3) - rectangle_length(&intersect1) - rectangle_length(&intersect2) - rectangle_length(&intersect3) + rectangle_length(&intersect4);
-    struct Rectangle union_ = rectangle_mbr(r1, r2);
-    union_ = rectangle_mbr(&union_, r3);
-    return rectangle_length(&union_) - cover_area;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, st.st_size, prot, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    *size = st.st_size;
+    return base;
 }
 
-static void insert_foothold(struct FootholdRTree *tree, struct Foothold *fh)
+static int load_snapshot(const char *path, uint64_t fingerprint)
 {
-    struct Rectangle fh_rect = foothold_mbr(fh);
-    if (tree->root == NULL) {
-        tree->root = malloc(sizeof(struct RTreeNode));
-        tree->root->parent = NULL;
-        tree->root->bound = fh_rect;
-        tree->root->isLeaf = true;
-        tree->root->count = 1;
-        tree->root->footholds[0] = *fh;
-    } else {
-        struct RTreeNode *node = tree->root;
-        // ChooseLeaf
-        // In the standard algorithm, horizontal (and vertical) lines are considered to have area 0
-        // and so if we have 2 footholds { (0,0), (10,0) }, { (100,0) (110,0) } each in a seperate bounding rectangle
-        // and we are trying to insert { (10,0), (20,0) } then it can be added to the second rectangle (as the
-        // 2D area increase it still 0) even though if it was added to the first one it would be much more effiecient.
-        // So our slightly modified algorithm takes this into account and determines that if the 2D area increase is 0
-        // then we pick the rectangle that will have the smaller 1D length increase.
-        while (!node->isLeaf) {
-            struct Rectangle bounding = rectangle_mbr(&node->children[0]->bound, &fh_rect);
-            int32_t min_measure = rectangle_area(&bounding) - rectangle_area(&node->children[0]->bound);
-            bool min_is_length = rectangle_area(&bounding) == 0 && min_measure == 0;
-            if (min_is_length)
-                min_measure = rectangle_length(&bounding) - rectangle_length(&node->children[0]->bound);
-
-            uint8_t min_index = 0;
-            for (uint8_t i = 1; i < node->count; i++) {
-                struct Rectangle bounding = rectangle_mbr(&node->children[i]->bound, &fh_rect);
-                int32_t measure = rectangle_area(&bounding) - rectangle_area(&node->children[i]->bound);
-                bool length = rectangle_area(&bounding) == 0 && measure == 0;
-                if (length)
-                    measure = rectangle_length(&bounding) - rectangle_length(&node->children[i]->bound);
-
-                if (!min_is_length && !length) {
-                    if (measure == min_measure) {
-                        // Pick the smallest rectangle of the two
-                        if (rectangle_area(&node->children[i]->bound) < rectangle_area(&node->children[min_index]->bound)) {
-                            min_index = i;
-                        }
-                    } else if (measure < min_measure) {
-                        min_measure = measure;
-                        min_index = i;
-                    }
-                } else if (min_is_length && length) {
-                    if (measure == min_measure) {
-                        // Pick the smallest rectangle of the two
-                        if (rectangle_length(&node->children[i]->bound) < rectangle_length(&node->children[min_index]->bound)) {
-                            min_index = i;
-                        }
-                    } else if (measure < min_measure) {
-                        min_measure = measure;
-                        min_index = i;
-                    }
-                } else if (length) {
-                    min_measure = measure;
-                    min_index = i;
-                    min_is_length = true;
-                }
-                // Else the current measure represents an area while the minimum represents a length, so we keep the minimum
+    // A private mapping so that relocation only copies the pages that contain pointers
+    size_t size;
+    void *base = map_snapshot(path, PROT_READ | PROT_WRITE, &size);
+    if (base == NULL)
+        return -1;
+
+    if (!snapshot_valid(base, size, fingerprint) || attach_snapshot(base, size, true) == -1) {
+        munmap(base, size);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Turns the offsets stored in the snapshot at base into pointers
+static void relocate_snapshot(void *base)
+{
+    const struct SnapshotHeader *header = base;
+
+    relocate_skills(base, (void *)((char *)base + header->tables[WZ_TABLE_SKILLS].offset), header->tables[WZ_TABLE_SKILLS].count);
+    relocate_skills(base, (void *)((char *)base + header->tables[WZ_TABLE_MOB_SKILLS].offset), header->tables[WZ_TABLE_MOB_SKILLS].count);
+
+    struct ReactorInfo *reactors = (void *)((char *)base + header->tables[WZ_TABLE_REACTORS].offset);
+    for (size_t i = 0; i < header->tables[WZ_TABLE_REACTORS].count; i++) {
+        RELOCATE(base, reactors[i].states);
+        for (size_t j = 0; j < reactors[i].stateCount; j++) {
+            struct ReactorStateInfo *state = &reactors[i].states[j];
+            RELOCATE(base, state->events);
+            for (size_t k = 0; k < state->eventCount; k++) {
+                if (state->events[k].type == REACTOR_EVENT_TYPE_SKILL)
+                    RELOCATE(base, state->events[k].skills);
             }
+        }
+    }
+
+    struct QuestInfo *quests = (void *)((char *)base + header->tables[WZ_TABLE_QUESTS].offset);
+    for (size_t i = 0; i < header->tables[WZ_TABLE_QUESTS].count; i++) {
+        RELOCATE(base, quests[i].startRequirements);
+        relocate_requirements(base, quests[i].startRequirements, quests[i].startRequirementCount);
+        RELOCATE(base, quests[i].endRequirements);
+        relocate_requirements(base, quests[i].endRequirements, quests[i].endRequirementCount);
+        RELOCATE(base, quests[i].startActs);
+        relocate_acts(base, quests[i].startActs, quests[i].startActCount);
+        RELOCATE(base, quests[i].endActs);
+        relocate_acts(base, quests[i].endActs, quests[i].endActCount);
+    }
 
-            node = node->children[min_index];
+    struct MapInfo *maps = (void *)((char *)base + header->tables[WZ_TABLE_MAPS].offset);
+    for (size_t i = 0; i < header->tables[WZ_TABLE_MAPS].count; i++) {
+        RELOCATE(base, maps[i].footholdTree);
+        RELOCATE(base, maps[i].footholdTree->nodes);
+        RELOCATE(base, maps[i].footholdTree->footholds);
+        RELOCATE(base, maps[i].lives);
+        RELOCATE(base, maps[i].reactors);
+        RELOCATE(base, maps[i].portals);
+        RELOCATE(base, maps[i].portalHash);
+    }
+}
+
+// Points the tables into the snapshot at base.
+// If relocate is false the snapshot's pointers must already have been relocated to base
+static int attach_snapshot(void *base, size_t size, bool relocate)
+{
+    const struct SnapshotHeader *header = base;
+    cmph_t *mphs[WZ_TABLE_COUNT];
+    for (size_t i = 0; i < WZ_TABLE_COUNT; i++) {
+        mphs[i] = load_mph(base, &header->tables[i]);
+        if (mphs[i] == NULL) {
+            for (size_t j = 0; j < i; j++)
+                cmph_destroy(mphs[j]);
+            return -1;
         }
+    }
 
-        // SplitNode (brute force to find the smallets split since M=3 is sufficiently small)
-        if (node->count < 3) {
-            node->footholds[node->count] = *fh;
-            node->count++;
-            node->bound = rectangle_mbr(&node->bound, &fh_rect);
-            struct RTreeNode *parent = node->parent;
-            while (parent != NULL) {
-                parent->bound = rectangle_mbr(&parent->bound, &node->bound);
-                node = parent;
-                parent = parent->parent;
-            }
-        } else {
-            // Find how to split the node -- how to organize the 4 footholds into 2 bounding rectangles
-            // such that the total free area/length of the 2 rectangles is the minimum.
-            //
-            // First check all 3-1 splits
-            struct Rectangle fh0_rect = foothold_mbr(&node->footholds[0]);
-            struct Rectangle fh1_rect = foothold_mbr(&node->footholds[1]);
-            struct Rectangle fh2_rect = foothold_mbr(&node->footholds[2]);
-            struct Rectangle child_rects[3] = { fh0_rect, fh1_rect, fh2_rect };
-            int32_t min_area = rectangle_area(&fh0_rect) + white_space_area_3(&fh1_rect, &fh2_rect, &fh_rect);
-            int32_t min_length = rectangle_area(&fh0_rect) == 0 ? rectangle_length(&fh0_rect) : 0;
-            // The predicate checks if the area of the MBR of the 3 rectangles fh1, fh2, fh is 0
-            if (rectangle_area((struct Rectangle[]) { rectangle_mbr((struct Rectangle[]) { rectangle_mbr(&fh1_rect, &fh2_rect) }, &fh_rect) }) == 0)
-                // If the area of the three rectangles is 0 then they must all lie on a horizontal/vertical line
-                min_length += white_space_length_3(&fh1_rect, &fh2_rect, &fh_rect);
-
-            bool min_is_one = true; // The current minimum is a 3-1 split
-            uint8_t which[2] = { 0 };
-            for (uint8_t i = 1; i < 4; i++) {
-                // The rectangle that is left out
-                struct Rectangle *r = i == 1 ? &fh1_rect : (i == 2 ? &fh2_rect : &fh_rect);
-
-                struct Rectangle *r1 = &fh0_rect;
-                struct Rectangle *r2 = i == 1 ? &fh2_rect : &fh1_rect;
-                struct Rectangle *r3 = i == 3 ? &fh2_rect : &fh_rect;
-
-                int32_t area = rectangle_area(r) + white_space_area_3(r1, r2, r3);
-                int32_t length = rectangle_area(r) == 0 ? rectangle_length(r) : 0;
-                if (rectangle_area((struct Rectangle[]) { rectangle_mbr((struct Rectangle[]) { rectangle_mbr(r1, r2) }, r3) }) == 0)
-                    min_length += white_space_length_3(r1, r2, r3);
-
-                if (area < min_area) {
-                    min_area = area;
-                    min_length = length;
-                    which[0] = i;
-                } else if (area == min_area && length < min_length) {
-                    min_length = length;
-                    which[0] = i;
-                }
-            }
+    if (relocate)
+        relocate_snapshot(base);
 
-            // Check all possible 2-2 splits
-            for (uint8_t i = 0; i < 3; i++) {
-                for (uint8_t j = i + 1; j < 4; j++) {
-                    struct Rectangle *r1 = &child_rects[i];
-                    struct Rectangle *r2 = j == 3 ? &fh_rect : &child_rects[i];
-                    struct Rectangle *r3, *r4;
-                    uint8_t k;
-                    for (k = 0; k < 3; k++) {
-                        if (k != i && k != j) {
-                            r3 = &child_rects[k];
-                            break;
-                        }
-                    }
+    SKILL_INFO_MPH = mphs[WZ_TABLE_SKILLS];
+    SKILL_INFO_COUNT = header->tables[WZ_TABLE_SKILLS].count;
+    SKILL_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_SKILLS].offset);
 
-                    for (uint8_t l = k + 1; ; l++) {
-                        if (l != i && l != j) {
-                            r4 = l == 3 ? &fh_rect : &child_rects[l];
-                            break;
-                        }
-                    }
+    MOB_SKILL_INFO_MPH = mphs[WZ_TABLE_MOB_SKILLS];
+    MOB_SKILL_INFO_COUNT = header->tables[WZ_TABLE_MOB_SKILLS].count;
+    MOB_SKILL_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_MOB_SKILLS].offset);
 
-                    // The split is {r1, r2}, {r3, r4}
-
-                    int32_t area1 = white_space_area_2(r1, r2);
-                    int32_t area2 = white_space_area_2(r3, r4);
-
-                    int32_t length1 = 0;
-                    if (area1 == 0 && rectangle_area(r1) == 0)
-                        length1 = white_space_length_2(r1, r2);
-
-                    int32_t length2 = 0;
-                    if (area2 == 0 && rectangle_area(r3) == 0)
-                        length2 = white_space_length_2(r3, r4);
-
-                    if (area1 + area2 < min_area) {
-                        min_area = area1 + area2;
-                        min_length = length1 + length2;
-                        min_is_one = false;
-                        which[0] = i;
-                        which[1] = j;
-                    } else if (area1 + area2 == min_area && length1 + length2 < min_length) {
-                        min_length = length1 + length2;
-                        min_is_one = false;
-                        which[0] = i;
-                        which[1] = j;
-                    }
-                }
-            }
+    REACTOR_INFO_MPH = mphs[WZ_TABLE_REACTORS];
+    REACTOR_INFO_COUNT = header->tables[WZ_TABLE_REACTORS].count;
+    REACTOR_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_REACTORS].offset);
 
-            // Create the new node
-            struct RTreeNode *new = malloc(sizeof(struct RTreeNode));
-            new->isLeaf = true;
+    EQUIP_INFO_MPH = mphs[WZ_TABLE_EQUIPS];
+    EQUIP_INFO_COUNT = header->tables[WZ_TABLE_EQUIPS].count;
+    EQUIP_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_EQUIPS].offset);
 
-            // Insert the picked footholds into the new node
-            if (min_is_one) {
-                new->count = 1;
-                new->footholds[0] = which[0] == 3 ? *fh : node->footholds[which[0]];
+    QUEST_INFO_MPH = mphs[WZ_TABLE_QUESTS];
+    QUEST_INFO_COUNT = header->tables[WZ_TABLE_QUESTS].count;
+    QUEST_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_QUESTS].offset);
 
-                uint8_t j = 0;
-                for (uint32_t i = 0; i < 4; i++) {
-                    if (i != which[0]) {
-                        node->footholds[j] = i == 3 ? *fh : node->footholds[i];
-                        j++;
-                    }
-                }
-            } else {
-                new->count = 2;
-                uint8_t i;
-                for (i = 0; i < 3; i++) {
-                    if (i != which[0] && i != which[1]) {
-                        new->footholds[0] = node->footholds[i];
-                        break;
-                    }
-                }
+    MOB_INFO_MPH = mphs[WZ_TABLE_MOBS];
+    MOB_INFO_COUNT = header->tables[WZ_TABLE_MOBS].count;
+    MOB_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_MOBS].offset);
 
-                for (uint8_t j = i + 1; j < 4; j++) {
-                    if (j != which[0] && j != which[1]) {
-                        new->footholds[1] = j == 3 ? *fh : node->footholds[j];
-                        break;
-                    }
-                }
+    MAP_INFO_MPH = mphs[WZ_TABLE_MAPS];
+    MAP_INFO_COUNT = header->tables[WZ_TABLE_MAPS].count;
+    MAP_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_MAPS].offset);
 
-                node->count = 2;
-                node->footholds[0] = node->footholds[which[0]];
-                node->footholds[1] = which[1] == 3 ? *fh : node->footholds[which[1]];
-            }
+    ITEM_INFO_MPH = mphs[WZ_TABLE_ITEMS];
+    ITEM_INFO_COUNT = header->tables[WZ_TABLE_ITEMS].count;
+    ITEM_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_ITEMS].offset);
 
-            fh0_rect = foothold_mbr(&node->footholds[0]);
-            fh1_rect = foothold_mbr(&node->footholds[1]);
-            fh2_rect = foothold_mbr(&node->footholds[2]);
-            struct Rectangle bound = rectangle_mbr(&fh0_rect, &fh1_rect);
-            node->bound = node->count == 2 ? bound : rectangle_mbr(&bound, &fh2_rect);
-
-            struct Rectangle new_fh0_rect = foothold_mbr(&new->footholds[0]);
-            struct Rectangle new_fh1_rect = foothold_mbr(&new->footholds[1]);
-            new->bound = new->count == 2 ? rectangle_mbr(&new_fh0_rect, &new_fh1_rect) : new_fh0_rect;
-
-            struct RTreeNode *parent = node->parent;
-            while (parent != NULL) {
-                node = parent;
-                if (node->count < 3) {
-                    node->children[node->count] = new;
-                    new->parent = node;
-                    node->count++;
-                    while (node != NULL) {
-                        struct Rectangle bound = node->children[0]->bound;
-                        for (uint8_t i = 1; i < node->count; i++) {
-                            bound = rectangle_mbr(&bound, &node->children[i]->bound);
-                        }
-                        node->bound = bound;
-                        node = node->parent;
-                    }
-                    break;
-                } else {
-                    // Split the parent if it doesn't have room
-                    int32_t min_measure = white_space_area_3(&node->children[1]->bound, &node->children[2]->bound, &new->bound);
-                    bool min_is_length = rectangle_area(&node->children[1]->bound) == 0 && rectangle_area(&node->children[2]->bound) == 0 && min_measure == 0;
-                    if (min_is_length)
-                        min_measure = white_space_length_3(&node->children[1]->bound, &node->children[2]->bound, &new->bound);
-
-                    bool min_is_one = true;
-                    uint8_t which[2] = { 0 };
-                    for (uint8_t i = 1; i < 4; i++) {
-                        struct Rectangle *r1 = &node->children[0]->bound;
-                        struct Rectangle *r2 = i == 1 ? &node->children[2]->bound : &node->children[1]->bound;
-                        struct Rectangle *r3 = i == 3 ? &node->children[2]->bound : &new->bound;
-                        int32_t measure = white_space_area_3(r1, r2, r3);
-                        bool is_length = rectangle_area(r1) == 0 && rectangle_area(r2) == 0 && measure == 0;
-                        if (is_length)
-                            measure = white_space_length_3(r1, r2, r3);
-
-                        if (((!min_is_length && !is_length) || (min_is_length && is_length)) && measure < min_measure) {
-                            min_measure = measure;
-                            which[0] = i;
-                        } else if (is_length) {
-                            min_measure = measure;
-                            which[0] = i;
-                            min_is_length = true;
-                        }
-                    }
+    CONSUMABLE_INFO_MPH = mphs[WZ_TABLE_CONSUMABLES];
+    CONSUMABLE_INFO_COUNT = header->tables[WZ_TABLE_CONSUMABLES].count;
+    CONSUMABLE_INFOS = (void *)((char *)base + header->tables[WZ_TABLE_CONSUMABLES].offset);
 
-                    for (uint8_t i = 0; i < 3; i++) {
-                        for (uint8_t j = i + 1; j < 4; j++) {
-                            struct Rectangle *r1 = &node->children[i]->bound;
-                            struct Rectangle *r2 = j == 3 ? &new->bound : &node->children[j]->bound;
-                            struct Rectangle *r3, *r4;
-                            uint8_t k;
-                            for (k = 0; k < 3; k++) {
-                                if (k != i && k != j) {
-                                    r3 = &node->children[k]->bound;
-                                    break;
-                                }
-                            }
+    SNAPSHOT = base;
+    SNAPSHOT_SIZE = size;
 
-                            for (uint8_t l = k + 1; ; l++) {
-                                if (l != i && l != j) {
-                                    r4 = l == 3 ? &new->bound : &node->children[l]->bound;
-                                    break;
-                                }
-                            }
+    return 0;
+}
 
-                            int32_t measure1 = white_space_area_2(r1, r2);
-                            int32_t measure2 = white_space_area_2(r3, r4);
-                            bool is_length = rectangle_area(r1) == 0 && measure1 == 0 && rectangle_area(r3) == 0 && measure2 == 0;
-                            if (is_length) {
-                                measure1 = white_space_length_2(r1, r2);
-                                measure2 = white_space_length_2(r3, r4);
-                            }
-                            if (((!min_is_length && !is_length) || (min_is_length && is_length)) && measure1 + measure2 < min_measure) {
-                                min_measure = measure1 + measure2;
-                                min_is_one = false;
-                                which[0] = i;
-                                which[1] = j;
-                            } else if (is_length) {
-                                min_measure = measure1 + measure2;
-                                min_is_one = false;
-                                which[0] = i;
-                                which[1] = j;
-                                min_is_length = true;
-                            }
-                        }
-                    }
+static void *map_shared(int fd, size_t size, int prot)
+{
+    void *base = mmap(WZ_SHARED_BASE, size, prot, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Can't map shared WZ data at %p: %s\n", WZ_SHARED_BASE,
+                errno == EEXIST ? "the address range is already in use" : strerror(errno));
+        return NULL;
+    }
 
-                    struct RTreeNode *new_node = malloc(sizeof(struct RTreeNode));
-                    new_node->isLeaf = false;
-
-                    if (min_is_one) {
-                        new_node->count = 1;
-                        new_node->children[0] = which[0] == 3 ? new : node->children[which[0]];
-                        if (which[0] == 3)
-                            new->parent = new_node;
-                        else
-                            node->children[which[0]]->parent = new_node;
-
-                        uint8_t j = 0;
-                        for (uint32_t i = 0; i < 4; i++) {
-                            if (i != which[0]) {
-                                node->children[j] = i == 3 ? new : node->children[i];
-                                if (i == 3)
-                                    new->parent = node;
-                                j++;
-                            }
-                        }
+    // Kernels before 4.17 only treat the address as a hint
+    if (base != WZ_SHARED_BASE) {
+        fprintf(stderr, "Can't map shared WZ data at %p: the kernel doesn't support MAP_FIXED_NOREPLACE\n", WZ_SHARED_BASE);
+        munmap(base, size);
+        return NULL;
+    }
 
-                    } else {
-                        new_node->count = 2;
-                        uint8_t i;
-                        for (i = 0; i < 3; i++) {
-                            if (i != which[0] && i != which[1]) {
-                                new_node->children[0] = node->children[i];
-                                node->children[i]->parent = new_node;
-                                break;
-                            }
-                        }
+    return base;
+}
 
-                        for (uint8_t j = i + 1; j < 4; j++) {
-                            if (j != which[0] && j != which[1]) {
-                                new_node->children[1] = j == 3 ? new : node->children[j];
-                                if (j == 3)
-                                    new->parent = new_node;
-                                else
-                                    node->children[j]->parent = new_node;
-                                break;
-                            }
-                        }
+// Fills a new shared segment from the snapshot file, or from the XML files if the snapshot is stale
+static int create_shared(uint64_t fingerprint)
+{
+    size_t size;
+    void *image = map_snapshot(WZ_SNAPSHOT_PATH, PROT_READ, &size);
+    bool mapped = image != NULL;
+    if (mapped && !snapshot_valid(image, size, fingerprint)) {
+        munmap(image, size);
+        mapped = false;
+    }
 
-                        node->count = 2;
-                        node->children[0] = node->children[which[0]];
-                        node->children[1] = which[1] == 3 ? new : node->children[which[1]];
-                        if (which[1] == 3)
-                            new->parent = node;
-                    }
+    if (!mapped) {
+        fprintf(stderr, "WZ snapshot is missing or stale, parsing XML (run `channel wz compile` to speed up the next start)\n");
+        if (wz_parse_xml(false) == -1)
+            return -1;
 
-                    new = new_node;
-                    struct Rectangle bound = rectangle_mbr(&node->children[0]->bound, &node->children[1]->bound);
-                    node->bound = node->count == 2 ? bound : rectangle_mbr(&bound, &node->children[2]->bound);
-                    new->bound = new->count == 2 ? rectangle_mbr(&new->children[0]->bound, &new->children[1]->bound) : new->children[0]->bound;
-                    parent = node->parent;
-                }
-            }
+        image = build_snapshot(fingerprint, &size);
+        wz_terminate();
+        if (image == NULL)
+            return -1;
+    }
+
+    int fd = shm_open(WZ_SHARED_NAME, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    void *base = NULL;
+    if (fd != -1) {
+        if (ftruncate(fd, size) != -1)
+            base = map_shared(fd, size, PROT_READ | PROT_WRITE);
+        close(fd);
+    }
+
+    if (base != NULL)
+        memcpy(base, image, size);
+
+    if (mapped)
+        munmap(image, size);
+    else
+        free(image);
+
+    if (base == NULL)
+        return -1;
+
+    if (attach_snapshot(base, size, true) == -1) {
+        munmap(base, size);
+        return -1;
+    }
+
+    // Nothing writes to it from here on
+    mprotect(base, size, PROT_READ);
+
+    return 0;
+}
+
+// Returns 1 if the segment is missing or stale
+static int attach_shared(uint64_t fingerprint)
+{
+    int fd = shm_open(WZ_SHARED_NAME, O_RDONLY, 0);
+    if (fd == -1)
+        return errno == ENOENT ? 1 : -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct SnapshotHeader)) {
+        close(fd);
+        return 1;
+    }
+
+    void *base = map_shared(fd, st.st_size, PROT_READ);
+    close(fd);
+    if (base == NULL)
+        return -1;
+
+    if (!snapshot_valid(base, st.st_size, fingerprint)) {
+        munmap(base, st.st_size);
+        return 1;
+    }
+
+    // The creator has already relocated the segment to WZ_SHARED_BASE
+    if (attach_snapshot(base, st.st_size, false) == -1) {
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    return 0;
+}
 
-            if (parent == NULL) {
-                tree->root = malloc(sizeof(struct RTreeNode));
-                tree->root->parent = NULL;
-                tree->root->bound = rectangle_mbr(&node->bound, &new->bound);
-                tree->root->isLeaf = false;
-                tree->root->count = 2;
-                tree->root->children[0] = node;
-                node->parent = tree->root;
-                tree->root->children[1] = new;
-                new->parent = tree->root;
+static int load_shared(uint64_t fingerprint)
+{
+    // The second attempt is for a segment that was left behind by an older build or by a process that died while creating it
+    for (int attempt = 0; attempt < 2; attempt++) {
+        // Whoever manages to create the semaphore creates the segment, everyone else waits for it to be posted
+        sem_t *sem = sem_open(WZ_SHARED_NAME, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 0);
+        if (sem != SEM_FAILED) {
+            int ret = create_shared(fingerprint);
+            if (ret == -1) {
+                shm_unlink(WZ_SHARED_NAME);
+                sem_unlink(WZ_SHARED_NAME);
             }
+
+            // The waiting processes will see that the segment is missing if creating it failed
+            sem_post(sem);
+            sem_close(sem);
+            return ret;
+        }
+
+        if (errno != EEXIST)
+            return -1;
+
+        sem = sem_open(WZ_SHARED_NAME, O_RDWR);
+        if (sem == SEM_FAILED) {
+            // It was unlinked in the meantime
+            if (errno == ENOENT)
+                continue;
+            return -1;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += WZ_SHARED_TIMEOUT_SEC;
+        int ret;
+        while ((ret = sem_timedwait(sem, &deadline)) == -1 && errno == EINTR)
+            ;
+
+        if (ret == 0) {
+            sem_post(sem);
+            sem_close(sem);
+            ret = attach_shared(fingerprint);
+            if (ret != 1)
+                return ret;
+        } else {
+            sem_close(sem);
+            if (errno != ETIMEDOUT)
+                return -1;
+        }
+
+        fprintf(stderr, "Shared WZ data is stale or abandoned, recreating it\n");
+        shm_unlink(WZ_SHARED_NAME);
+        sem_unlink(WZ_SHARED_NAME);
+    }
+
+    return -1;
+}
+
+static void fingerprint_dir(int fd, uint64_t *hash, size_t *count)
+{
+    DIR *dir = fdopendir(fd);
+    if (dir == NULL) {
+        close(fd);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        if (entry->d_type == DT_DIR) {
+            int sub = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY);
+            if (sub != -1)
+                fingerprint_dir(sub, hash, count);
+            continue;
+        }
+
+        struct stat st;
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) == -1)
+            continue;
+
+        // FNV-1a of the entry, combined by addition since readdir() order isn't stable
+        uint64_t h = 14695981039346656037ull;
+        for (const char *c = entry->d_name; *c != '\0'; c++) {
+            h ^= (unsigned char)*c;
+            h *= 1099511628211ull;
         }
+        uint64_t values[] = { st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+        for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+            h ^= values[i];
+            h *= 1099511628211ull;
+        }
+
+        *hash += h;
+        (*count)++;
     }
+
+    closedir(dir);
 }
 
+// Returns 0 if none of the XML files exist
+static uint64_t wz_fingerprint(void)
+{
+    uint64_t hash = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < sizeof(WZ_SOURCES) / sizeof(WZ_SOURCES[0]); i++) {
+        int fd = open(WZ_SOURCES[i], O_RDONLY | O_DIRECTORY);
+        if (fd != -1)
+            fingerprint_dir(fd, &hash, &count);
+    }
+
+    if (count == 0)
+        return 0;
+
+    // Never 0 so that it isn't mistaken for a missing source tree
+    return hash == 0 ? 1 : hash;
+}
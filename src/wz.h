@@ -63,6 +63,8 @@ struct PortalInfo {
     int16_t y;
     uint32_t targetMap;
     char targetName[PORTAL_INFO_NAME_MAX_LENGTH+1];
+    // Index of targetName in targetMap's portals, resolved when the maps are loaded
+    uint8_t targetPortal;
     char script[SCRIPT_NAME_MAX_LENGTH+1];
 
 };
@@ -83,6 +85,9 @@ struct MapInfo {
     struct MapReactorInfo *reactors;
     size_t portalCount;
     struct PortalInfo *portals;
+    // Open-addressed table of portal index + 1 by name, its size is portalHashMask + 1
+    uint16_t portalHashMask;
+    uint16_t *portalHash;
 };
 
 struct MobSkillInfo {
@@ -254,6 +259,56 @@ struct QuestInfo {
     struct QuestAct *endActs;
 };
 
+// Enough for one bit per job up to job 2333
+#define QUEST_JOB_MASK_WORDS 6
+
+struct QuestStateRequirement {
+    uint16_t id;
+    enum QuestState state;
+};
+
+struct QuestItemRequirement {
+    uint32_t id;
+    // 0 means that the character mustn't have the item at all
+    int32_t count;
+};
+
+// A quest's start or end requirements compiled at load time so they can be checked in one go
+struct QuestRequirementProgram {
+    // 0 if the quest isn't bound to an NPC
+    uint32_t npc;
+    uint8_t minLevel;
+    uint8_t maxLevel;
+    int32_t meso;
+    int32_t completedQuests;
+    bool anyJob;
+    uint64_t jobs[QUEST_JOB_MASK_WORDS];
+    // Sorted by ID
+    size_t questCount;
+    struct QuestStateRequirement *quests;
+    // Sorted by unique ID, which also groups them by inventory
+    size_t itemCount;
+    // The items that mustn't be held follow the required ones in `items`, sorted the same way
+    size_t absentItemCount;
+    struct QuestItemRequirement *items;
+    // Requirements that have no compiled form and must be checked one by one
+    size_t otherCount;
+    const struct QuestRequirement **others;
+};
+
+struct QuestProgram {
+    struct QuestRequirementProgram start;
+    struct QuestRequirementProgram end;
+};
+
+// A quest that counts kills of a given monster
+struct QuestMonsterTarget {
+    uint16_t quest;
+    // Index into the quest's progress
+    uint8_t index;
+    int16_t count;
+};
+
 struct ItemInfo {
     uint32_t id;
     int16_t slotMax;
@@ -369,7 +424,24 @@ struct SkillInfo {
     size_t reqLevel;
 };
 
+/**
+ * Loads the WZ tables into a shared memory segment that every channel process on the host maps read-only.
+ * The first process to start fills it from the snapshot (or the XML files). Falls back to a private copy if the segment can't be used.
+ */
 int wz_init(void);
+/**
+ * Parses the XML files and writes them to a binary snapshot that wz_init() maps instead of parsing them again.
+ * The snapshot is ignored once any of the XML files change.
+ */
+int wz_compile(void);
+/**
+ * Times foothold_tree_find_below() over random points on every map and prints the results.
+ */
+int wz_benchmark_footholds(void);
+/**
+ * Checks the quest requirement compiler against hand-written requirement lists and prints the results.
+ */
+int wz_self_test(void);
 int wz_init_equipment(void);
 void wz_terminate(void);
 void wz_terminate_equipment(void);
@@ -389,6 +461,12 @@ const struct EquipInfo *wz_get_equip_info(uint32_t id);
 const struct ConsumableInfo *wz_get_consumable_info(uint32_t id);
 const struct MobInfo *wz_get_monster_stats(uint32_t id);
 const struct QuestInfo *wz_get_quest_info(uint16_t id);
+const struct QuestProgram *wz_get_quest_program(uint16_t id);
+bool wz_quest_program_allows_job(const struct QuestRequirementProgram *program, uint16_t job);
+/**
+ * Gets the quests that count kills of a monster, sorted by quest ID and then by progress index.
+ */
+const struct QuestMonsterTarget *wz_get_quests_for_monster(uint32_t id, size_t *count);
 const struct ItemInfo *wz_get_item_info(uint32_t id);
 const struct ReactorInfo *wz_get_reactor_info(uint32_t id);
 const struct SkillInfo *wz_get_skill_info(uint32_t id);